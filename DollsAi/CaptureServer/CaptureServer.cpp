@@ -1,18 +1,21 @@
 #include "stdafx.h"
 #include "interop.h"
+#include "CommandServer.h"
 #include "SimpleCapture.h"
 #include "winenum.h"
 
 #include <stdio.h>
-#include <unordered_map>
 
 #pragma comment(lib, "windowsapp.lib")
 #pragma comment(lib, "dwmapi.lib")
+// the CMake build links OpenCV itself
+#ifndef DOLLSAI_CMAKE
 #ifdef _DEBUG
 #pragma comment(lib, "opencv_world460d.lib")
 #else
 #pragma comment(lib, "opencv_world460.lib")
 #endif
+#endif
 
 #pragma region bmp
 #pragma pack(push, 2)
@@ -90,13 +93,10 @@ namespace {
     decltype(CreateD3DDevice()) s_d3d_device;
     decltype(s_d3d_device.as<IDXGIDevice>()) s_dxgi_device;
     decltype(CreateDirect3DDevice(s_dxgi_device.get())) s_device;
-
-    decltype(CreateCaptureItemForWindow(nullptr)) s_capture_item = { nullptr };
-    std::unique_ptr<SimpleCapture> s_capture;
 }
 
 namespace cmd {
-    nlohmann::json enum_windows(const nlohmann::json& args)
+    nlohmann::json enum_windows(const nlohmann::json& args, CmdContext& ctx)
     {
         auto windows = EnumerateWindows();
 
@@ -111,117 +111,27 @@ namespace cmd {
 
         return nlohmann::json({ {"result", arrayjson} });
     }
-
-    nlohmann::json capture_start(const nlohmann::json& args)
-    {
-        s_capture_item = decltype(CreateCaptureItemForWindow(nullptr))(nullptr);
-        s_capture.reset();
-
-        uint64_t llhwnd = std::stoull(args["hwnd"].get<std::string>());
-
-        auto item = CreateCaptureItemForWindow(reinterpret_cast<HWND>(llhwnd));
-        auto capture = std::make_unique<SimpleCapture>(s_device, item);
-        // set global after succeeded (take care of error case)
-        s_capture_item = std::move(item);
-        s_capture = std::move(capture);
-
-        return nlohmann::json({ {"result", "OK"} });
-    }
-
-    nlohmann::json capture_stop(const nlohmann::json& args)
-    {
-        s_capture_item = decltype(CreateCaptureItemForWindow(nullptr))(nullptr);
-        s_capture.reset();
-
-        return nlohmann::json({ {"result", "OK"} });
-    }
-
-    nlohmann::json get_frame(const nlohmann::json& args)
-    {
-        if (s_capture == nullptr) {
-            throw std::exception("Capture not started");
-        }
-        do {
-            auto [buf, w, h] = s_capture->TryGetNextFrame();
-            if (buf.empty()) {
-                continue;
-            }
-            cv::Mat m(h, w, CV_8UC3);
-            for (int y = 0; y < m.rows; y++) {
-                auto p = m.ptr<uint8_t>(y);
-                for (int x = 0; x < m.cols; x++) {
-                    p[x * 3 + 0] = buf.at(4 * (y * w + x) + 0);
-                    p[x * 3 + 1] = buf.at(4 * (y * w + x) + 1);
-                    p[x * 3 + 2] = buf.at(4 * (y * w + x) + 2);
-                }
-            }
-            cv::imwrite("test.bmp", m);
-        } while (false);
-
-        return nlohmann::json();
-    }
-}
-
-namespace {
-    using CmdFunc = std::function<nlohmann::json(const nlohmann::json&)>;
-    const std::unordered_map<std::string, CmdFunc> cmd_map = {
-        {"enum_windows", cmd::enum_windows},
-        {"capture_start", cmd::capture_start},
-        {"capture_end", cmd::capture_stop},
-        {"get_frame", cmd::get_frame},
-    };
-
-    nlohmann::json error_json(const char* msg)
-    {
-        auto obj = nlohmann::json::object();
-        obj["message"] = msg;
-
-        return nlohmann::json{ { "error", obj } };
-    }
-
-    nlohmann::json process_cmd(const nlohmann::json& cmdjson)
-    {
-        auto name = cmdjson["cmd"].get<std::string>();
-        auto it = cmd_map.find(name);
-        if (it != cmd_map.end()) {
-            return (it->second)(cmdjson);
-        }
-        else {
-            throw std::exception("Unndefined command");
-        }
-    }
 }
 
 int main(int argc, char *argv[])
 {
-    setlocale(LC_CTYPE, "");
     winrt::init_apartment(winrt::apartment_type::single_threaded);
 
     s_d3d_device = CreateD3DDevice();
+    // every window session maps its frames on the one immediate context, each from its
+    // own capture thread: the context serializes the calls then
+    s_d3d_device.as<ID3D11Multithread>()->SetMultithreadProtected(TRUE);
     s_dxgi_device = s_d3d_device.as<IDXGIDevice>();
     s_device = CreateDirect3DDevice(s_dxgi_device.get());
 
-    while (true) {
-        std::string cmdstr;
-        do {
-            char buf[1024];
-            if (fgets(buf, sizeof(buf), stdin) == nullptr) {
-                // Error or EOF
-                return EXIT_FAILURE;
-            }
-            cmdstr += buf;
-            // wait for "...\n\n"
-        } while (cmdstr.size() < 2 || cmdstr.at(cmdstr.size() - 1) != '\n' || cmdstr.at(cmdstr.size() - 2) != '\n');
-
-        try {
-            auto cmdjson = nlohmann::json::parse(cmdstr);
-            auto respjson = process_cmd(cmdjson);
-            printf("%s\n\n", respjson.dump(2).c_str());
-        }
-        catch (std::exception &e) {
-            fprintf(stderr, "%s\n\n", error_json(e.what()).dump(2).c_str());
-        }
-    }
+    register_command("enum_windows", cmd::enum_windows, CmdConcurrency::Shared);
+    register_source("window", [](const nlohmann::json& args, const CopyOptions& copy) -> std::unique_ptr<FrameSource> {
+        uint64_t llhwnd = std::stoull(args.at("hwnd").get<std::string>());
+        auto item = CreateCaptureItemForWindow(reinterpret_cast<HWND>(llhwnd));
+        auto capture = std::make_unique<SimpleCapture>(s_device, item, copy);
+        capture->StartCapture();
+        return capture;
+    });
 
-    return 0;
+    return run_server(argc, argv);
 }
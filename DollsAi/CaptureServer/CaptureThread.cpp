@@ -0,0 +1,152 @@
+#include "stdafx.h"
+#include "CaptureThread.h"
+#include "LatencyStats.h"
+#include "Recording.h"
+#include "ScreenClassifier.h"
+
+#include <stdexcept>
+
+namespace {
+    // upper bound for noticing a stop request while the source is idle
+    constexpr auto kSourceTimeout = std::chrono::milliseconds(100);
+}
+
+CaptureThread::CaptureThread(std::unique_ptr<FrameSource> source, int tile_size)
+    : m_source(std::move(source)), m_tiles(tile_size), m_lossless(m_source->Lossless())
+{
+    m_thread = std::thread([this]() { Run(); });
+}
+
+CaptureThread::~CaptureThread()
+{
+    Stop();
+}
+
+void CaptureThread::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_source->Interrupt();
+    m_cond.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void CaptureThread::Run()
+{
+    trace_thread_name("capture");
+#ifdef _WIN32
+    // WinRT capture objects are used from this thread
+    winrt::init_apartment(winrt::apartment_type::multi_threaded);
+#endif
+    while (true) {
+        Frame frame;
+        try {
+            frame = m_source->WaitNextFrame(kSourceTimeout);
+        }
+        catch (std::exception& e) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_error = e.what();
+            m_cond.notify_all();
+            break;
+        }
+
+        if (frame && m_lossless) {
+            // before tracking, so the tile state does not run ahead of unread frames
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return !m_latest || m_taken || m_stop; });
+        }
+        if (frame) {
+            {
+                DOLLSAI_TIME_SCOPE("capture.tiles");
+                frame.SetDuplicate(m_tiles.Update(frame));
+            }
+            // a duplicate has the same hash as the frame before
+            if (!frame.Duplicate()) {
+                DOLLSAI_TIME_SCOPE("capture.hash");
+                m_screenHash = dhash(frame.Data(), frame.Stride(), frame.Width(), frame.Height(), frame.Format());
+            }
+            frame.SetScreenHash(m_screenHash);
+        }
+
+        Frame old;
+        std::shared_ptr<Recorder> recorder;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                break;
+            }
+            if (!frame) {
+                continue;
+            }
+            if (m_latest && !m_taken) {
+                m_dropped++;
+            }
+            m_frames++;
+            if (frame.Duplicate()) {
+                m_duplicates++;
+            }
+            // release the replaced frame outside the lock
+            old = std::move(m_latest);
+            m_latest = frame;
+            m_taken = false;
+            recorder = m_recorder;
+        }
+        m_cond.notify_all();
+        if (recorder != nullptr) {
+            recorder->Push(frame);
+        }
+    }
+#ifdef _WIN32
+    winrt::uninit_apartment();
+#endif
+}
+
+Frame CaptureThread::Wait(uint64_t min_id, std::chrono::milliseconds timeout, bool take)
+{
+    Frame frame;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait_for(lock, timeout, [&]() {
+            return (m_latest && m_latest.Id() >= min_id) || !m_error.empty() || m_stop;
+        });
+        if (!m_error.empty()) {
+            throw std::runtime_error("Capture failed: " + m_error);
+        }
+        if (!m_latest || m_latest.Id() < min_id) {
+            return Frame();
+        }
+        frame = m_latest;
+        if (!take) {
+            return frame;
+        }
+        m_taken = true;
+    }
+    if (m_lossless) {
+        // the capture thread may be waiting for this
+        m_cond.notify_all();
+    }
+    return frame;
+}
+
+void CaptureThread::SetRecorder(std::shared_ptr<Recorder> recorder)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_recorder = std::move(recorder);
+}
+
+CaptureThread::Stats CaptureThread::GetStats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stats.frames = m_frames;
+        stats.dropped = m_dropped;
+        stats.duplicates = m_duplicates;
+    }
+    stats.pool = m_source->GetPoolStats();
+    return stats;
+}
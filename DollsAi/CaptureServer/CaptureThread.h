@@ -0,0 +1,75 @@
+#pragma once
+
+#include "FrameSource.h"
+#include "TileTracker.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Recorder;
+
+// Drains a FrameSource on its own thread into a single-slot mailbox that always
+// holds the newest frame. Frames replaced before anybody took them count as dropped.
+// Each frame goes through the TileTracker first, which flags unchanged frames, and
+// gets its screen hash (dhash) before it is published, and goes to the Recorder if one is set.
+class CaptureThread
+{
+public:
+    struct Stats
+    {
+        uint64_t frames;
+        uint64_t dropped;
+        uint64_t duplicates;
+        FramePool::Stats pool;
+    };
+
+    // A Lossless() source never has a frame replaced before it was taken, so none
+    // are dropped and the source waits for the consumer.
+    CaptureThread(std::unique_ptr<FrameSource> source, int tile_size = 32);
+    ~CaptureThread();
+
+    CaptureThread(const CaptureThread&) = delete;
+    CaptureThread& operator=(const CaptureThread&) = delete;
+
+    // Newest frame if its id is >= min_id, waiting up to timeout for one.
+    // Empty frame on timeout or after Stop. Throws if the source failed.
+    Frame WaitFrame(uint64_t min_id, std::chrono::milliseconds timeout) { return Wait(min_id, timeout, true); }
+    // Same, for an observer: the frame is not taken, so it still counts as dropped if
+    // nobody takes it, and a Lossless source does not move on for it.
+    Frame PeekFrame(uint64_t min_id, std::chrono::milliseconds timeout) { return Wait(min_id, timeout, false); }
+
+    // Ends the thread and wakes every wait; the destructor does it too. Not thread safe.
+    void Stop();
+
+    Stats GetStats() const;
+    const TileTracker& Tiles() const { return m_tiles; }
+
+    // Every following frame is pushed to recorder (null to stop).
+    void SetRecorder(std::shared_ptr<Recorder> recorder);
+
+private:
+    void Run();
+    Frame Wait(uint64_t min_id, std::chrono::milliseconds timeout, bool take);
+
+    std::unique_ptr<FrameSource> m_source;
+    TileTracker m_tiles;
+    const bool m_lossless;
+    // capture thread only
+    uint64_t m_screenHash = 0;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    Frame m_latest;
+    bool m_taken = false;
+    bool m_stop = false;
+    std::string m_error;
+    std::shared_ptr<Recorder> m_recorder;
+    uint64_t m_frames = 0;
+    uint64_t m_dropped = 0;
+    uint64_t m_duplicates = 0;
+
+    std::thread m_thread;
+};
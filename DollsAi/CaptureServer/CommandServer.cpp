@@ -0,0 +1,1602 @@
+#include "stdafx.h"
+#include "CommandServer.h"
+#include "CaptureThread.h"
+#include "FramePredicate.h"
+#include "GlyphReader.h"
+#include "LatencyStats.h"
+#include "ObjectDetect.h"
+#include "Trace.h"
+#include "PixelConvert.h"
+#include "PixelProbe.h"
+#include "Recording.h"
+#include "ReplaySource.h"
+#include "ScreenClassifier.h"
+#include "SharedFrameRing.h"
+#include "SocketServer.h"
+#include "SyntheticSource.h"
+#include "TaskPool.h"
+#include "TemplateMatch.h"
+#include "TemplateRegistry.h"
+#include "Watchers.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <locale.h>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+    // One capture_start: a source on its own thread and what is fed by it.
+    // Sessions share nothing but the task pool, so each costs the same.
+    struct CaptureSession
+    {
+        uint32_t id;
+        // null when whole frames are captured
+        std::shared_ptr<const RoiLayout> rois;
+        std::unique_ptr<SharedFrameRing> ring;
+        std::shared_ptr<Recorder> recorder;
+        std::unique_ptr<CaptureThread> capture;
+        // declared last so that it stops first, the capture after it
+        std::unique_ptr<SessionWatchers> watchers;
+    };
+    // changed by Exclusive commands only
+    std::map<uint32_t, std::shared_ptr<CaptureSession>> s_sessions;
+    uint32_t s_next_session_id = 1;
+    // asset pack (templates_reload) plus single templates (template_load)
+    TemplateRegistry s_templates;
+    // probe sets kept by probe_pixels "set"
+    std::unordered_map<std::string, std::shared_ptr<const ProbeSet>> s_probe_sets;
+    std::mutex s_probe_sets_mutex;
+    // reference screens for classify_screen, replaced as a whole by screens_load
+    std::shared_ptr<const ScreenClassifier> s_screens;
+    // glyph atlases for read_number, by glyphs_load "atlas"
+    std::unordered_map<std::string, std::shared_ptr<const GlyphAtlas>> s_glyph_atlases;
+    // cascades for detect_objects, loaded on first use; has its own lock
+    CascadeRegistry s_cascades;
+}
+
+namespace {
+    // scale_factor, min_neighbors, min_size, max_size, downscale: see DetectOptions
+    // parallel: pyramid levels on the task pool (true)
+    DetectOptions parse_detect_options(const nlohmann::json& args)
+    {
+        DetectOptions options;
+        options.scale_factor = args.value("scale_factor", options.scale_factor);
+        options.min_neighbors = args.value("min_neighbors", options.min_neighbors);
+        options.min_size = args.value("min_size", options.min_size);
+        options.max_size = args.value("max_size", options.max_size);
+        options.downscale = args.value("downscale", options.downscale);
+        if (args.value("parallel", true)) {
+            options.pool = &TaskPool::Default();
+        }
+        return options;
+    }
+
+    // [x, y, w, h] clipped to the image, the whole image if r is null
+    cv::Rect clip_roi(const cv::Mat& image, const nlohmann::json& r)
+    {
+        cv::Rect whole(0, 0, image.cols, image.rows);
+        if (r.is_null()) {
+            return whole;
+        }
+        cv::Rect roi = whole & cv::Rect(r.at(0).get<int>(), r.at(1).get<int>(), r.at(2).get<int>(), r.at(3).get<int>());
+        if (roi.empty()) {
+            throw std::runtime_error("ROI outside the frame");
+        }
+        return roi;
+    }
+
+    // [{"name": "hp", "x": 10, "y": 20, "w": 100, "h": 12}, ...]
+    std::shared_ptr<const RoiLayout> parse_rois(const nlohmann::json& rois)
+    {
+        std::vector<Roi> list;
+        for (const auto& roi : rois) {
+            list.push_back({ roi.at("name").get<std::string>(),
+                roi.at("x").get<int>(), roi.at("y").get<int>(), roi.at("w").get<int>(), roi.at("h").get<int>() });
+        }
+        return std::make_shared<const RoiLayout>(std::move(list));
+    }
+
+    // where each ROI is in the returned frame
+    nlohmann::json rois_to_json(const RoiLayout& layout)
+    {
+        auto arrayjson = nlohmann::json::array();
+        const auto& rois = layout.Rois();
+        for (size_t i = 0; i < rois.size(); i++) {
+            arrayjson.push_back({
+                {"name", rois[i].name},
+                {"x", rois[i].x},
+                {"y", rois[i].y},
+                {"w", rois[i].width},
+                {"h", rois[i].height},
+                {"offset_y", layout.OffsetY(i)},
+            });
+        }
+        return arrayjson;
+    }
+
+    // 0xRRGGBB as a number, "#rrggbb" or [r, g, b]
+    uint32_t parse_color(const nlohmann::json& color)
+    {
+        if (color.is_array()) {
+            return color.at(0).get<uint32_t>() << 16 | color.at(1).get<uint32_t>() << 8 | color.at(2).get<uint32_t>();
+        }
+        if (color.is_string()) {
+            auto text = color.get<std::string>();
+            return static_cast<uint32_t>(std::stoul(text.substr(text[0] == '#' ? 1 : 0), nullptr, 16));
+        }
+        return color.get<uint32_t>();
+    }
+
+    // probes: [[x, y, color, tolerance], ...]
+    // predicates: [{"name": "in_battle", "op": "and" | "or", "probes": [0, 3, 4]}, ...]
+    std::shared_ptr<const ProbeSet> parse_probe_set(const nlohmann::json& args)
+    {
+        auto set = std::make_shared<ProbeSet>();
+        for (const auto& probe : args.at("probes")) {
+            set->Add(probe.at(0).get<int>(), probe.at(1).get<int>(), parse_color(probe.at(2)),
+                probe.size() > 3 ? probe.at(3).get<int>() : 0);
+        }
+        for (const auto& predicate : args.value("predicates", nlohmann::json::array())) {
+            auto op = predicate.value("op", std::string("and"));
+            if (op != "and" && op != "or") {
+                throw std::runtime_error("Predicate op must be and/or");
+            }
+            set->AddPredicate({ predicate.at("name").get<std::string>(), op == "or",
+                predicate.at("probes").get<std::vector<uint32_t>>() });
+        }
+        return set;
+    }
+
+    ImageView image_view(const cv::Mat& image)
+    {
+        PixelFormat format = image.channels() == 1 ? PixelFormat::Gray
+            : image.channels() == 4 ? PixelFormat::BGRA : PixelFormat::BGR;
+        return { image.data, image.step, image.cols, image.rows, format };
+    }
+
+    // [x, y, w, h] clipped to the frame
+    ImageView frame_roi(const Frame& frame, const nlohmann::json& r)
+    {
+        cv::Rect roi = cv::Rect(0, 0, frame.Width(), frame.Height())
+            & cv::Rect(r.at(0).get<int>(), r.at(1).get<int>(), r.at(2).get<int>(), r.at(3).get<int>());
+        if (roi.empty()) {
+            throw std::runtime_error("ROI outside the frame");
+        }
+        return { frame.Row(roi.y) + roi.x * bytes_per_pixel(frame.Format()), frame.Stride(),
+            roi.width, roi.height, frame.Format() };
+    }
+
+    // args["session"], or the only session if there is just one
+    std::shared_ptr<CaptureSession> find_session(const nlohmann::json& args)
+    {
+        if (args.contains("session")) {
+            auto it = s_sessions.find(args.at("session").get<uint32_t>());
+            if (it == s_sessions.end()) {
+                throw std::runtime_error("Unknown session");
+            }
+            return it->second;
+        }
+        if (s_sessions.empty()) {
+            throw std::runtime_error("Capture not started");
+        }
+        if (s_sessions.size() > 1) {
+            throw std::runtime_error("session is required with several captures");
+        }
+        return s_sessions.begin()->second;
+    }
+
+    // The batch's snapshot, else the first frame with an id >= min_frame_id that
+    // arrives within timeout_ms (empty if none).
+    Frame wait_frame(const CaptureSession& session, const nlohmann::json& args, const CmdContext& ctx)
+    {
+        if (ctx.snapshot) {
+            return ctx.snapshot;
+        }
+        auto min_frame_id = args.value("min_frame_id", uint64_t(0));
+        auto timeout = std::chrono::milliseconds(args.value("timeout_ms", 0));
+        return session.capture->WaitFrame(min_frame_id, timeout);
+    }
+
+    // [x, y, w, h], or the whole frame (width 0) if json is null or true
+    TileTracker::Rect parse_area(const nlohmann::json& r)
+    {
+        if (r.is_null() || r.is_boolean()) {
+            return {};
+        }
+        return { r.at(0).get<int>(), r.at(1).get<int>(), r.at(2).get<int>(), r.at(3).get<int>() };
+    }
+
+    // {"all": [...]}, {"any": [...]}, {"not": {...}}, or a leaf:
+    //   {"probes": [[x, y, color, tolerance], ...] | "set": name, "predicate": name (all probes if omitted)}
+    //   {"template": id, "roi": [x, y, w, h], "threshold", "levels"}
+    //   {"changed": [x, y, w, h] | true, "since": frame id (the first checked frame if omitted)}
+    //   {"screen": label, "roi": [x, y, w, h], "max_distance": 12}
+    FramePredicate::Ptr parse_condition(const nlohmann::json& json)
+    {
+        if (json.contains("all") || json.contains("any")) {
+            bool any = json.contains("any");
+            std::vector<FramePredicate::Ptr> children;
+            for (const auto& child : json.at(any ? "any" : "all")) {
+                children.push_back(parse_condition(child));
+            }
+            return any ? FramePredicate::Any(std::move(children)) : FramePredicate::All(std::move(children));
+        }
+        if (json.contains("not")) {
+            return FramePredicate::Not(parse_condition(json["not"]));
+        }
+        if (json.contains("probes") || json.contains("set")) {
+            std::shared_ptr<const ProbeSet> set;
+            if (json.contains("probes")) {
+                set = parse_probe_set(json);
+            }
+            else {
+                std::lock_guard<std::mutex> lock(s_probe_sets_mutex);
+                auto it = s_probe_sets.find(json["set"].get<std::string>());
+                if (it == s_probe_sets.end()) {
+                    throw std::runtime_error("Unknown probe set");
+                }
+                set = it->second;
+            }
+            int predicate = -1;
+            if (json.contains("predicate")) {
+                auto name = json["predicate"].get<std::string>();
+                const auto& predicates = set->Predicates();
+                auto it = std::find_if(predicates.begin(), predicates.end(),
+                    [&](const ProbeSet::Predicate& p) { return p.name == name; });
+                if (it == predicates.end()) {
+                    throw std::runtime_error("Unknown probe predicate: " + name);
+                }
+                predicate = static_cast<int>(it - predicates.begin());
+            }
+            return FramePredicate::Probes(std::move(set), predicate);
+        }
+        if (json.contains("template")) {
+            const auto& id = json["template"];
+            auto templ = id.is_number_unsigned() ? s_templates.Find(id.get<size_t>()) : s_templates.Find(id.get<std::string>());
+            if (templ == nullptr) {
+                throw std::runtime_error("Unknown template");
+            }
+            MatchOptions options;
+            options.threshold = json.value("threshold", options.threshold);
+            options.levels = json.value("levels", options.levels);
+            options.pool = &TaskPool::Default();
+            return FramePredicate::TemplateFound(id, std::move(templ), parse_area(json.value("roi", nlohmann::json())), options);
+        }
+        if (json.contains("changed")) {
+            return FramePredicate::Changed(parse_area(json["changed"]), json.value("since", uint64_t(0)));
+        }
+        if (json.contains("screen")) {
+            if (s_screens == nullptr) {
+                throw std::runtime_error("No reference screens loaded");
+            }
+            return FramePredicate::Screen(s_screens, json["screen"].get<std::string>(),
+                parse_area(json.value("roi", nlohmann::json())), json.value("max_distance", 12));
+        }
+        throw std::runtime_error("Unknown condition");
+    }
+
+    nlohmann::json recorder_stats_json(const Recorder& recorder)
+    {
+        auto stats = recorder.GetStats();
+        nlohmann::json json = {
+            {"path", recorder.Path()},
+            {"frames", stats.frames},
+            {"keyframes", stats.keyframes},
+            {"dropped", stats.dropped},
+            {"bytes", stats.bytes},
+        };
+        if (!stats.error.empty()) {
+            json["error"] = stats.error;
+        }
+        return json;
+    }
+
+    uint64_t image_dhash(const cv::Mat& image)
+    {
+        ImageView view = image_view(image);
+        return dhash(view.data, view.stride, view.width, view.height, view.format);
+    }
+
+    // Reference screenshots: <dir>/<label>/*.png (any number per label) or <dir>/<label>.png.
+    // They should be taken with the same capture options (ROIs, scale) as the frames.
+    std::shared_ptr<const ScreenClassifier> load_screens(const std::string& dir)
+    {
+        namespace fs = std::filesystem;
+        auto classifier = std::make_shared<ScreenClassifier>();
+        for (const auto& item : fs::directory_iterator(fs::u8path(dir))) {
+            if (item.is_directory()) {
+                auto label = item.path().filename().u8string();
+                for (const auto& file : fs::directory_iterator(item.path())) {
+                    if (file.is_regular_file()) {
+                        classifier->Add(image_dhash(read_image_file(file.path().u8string())), label);
+                    }
+                }
+            }
+            else if (item.is_regular_file()) {
+                classifier->Add(image_dhash(read_image_file(item.path().u8string())), item.path().stem().u8string());
+            }
+        }
+        return classifier;
+    }
+
+    std::unordered_map<std::string, SourceFactory>& source_factories()
+    {
+        static std::unordered_map<std::string, SourceFactory> factories = {
+            {"synthetic", [](const nlohmann::json& args, const CopyOptions& copy) -> std::unique_ptr<FrameSource> {
+                // test pattern, no window needed
+                return std::make_unique<SyntheticSource>(
+                    args.value("width", 1920), args.value("height", 1080), args.value("fps", 60.0), copy);
+            }},
+            {"replay", [](const nlohmann::json& args, const CopyOptions& copy) -> std::unique_ptr<FrameSource> {
+                // recording or image directory; "speed" 0 hands out every frame as fast as it is taken
+                ReplayOptions replay;
+                replay.speed = args.value("speed", replay.speed);
+                replay.fps = args.value("fps", replay.fps);
+                replay.loop = args.value("loop", replay.loop);
+                replay.start_id = args.value("start_id", replay.start_id);
+                return std::make_unique<ReplaySource>(args.at("path").get<std::string>(), replay, copy);
+            }},
+        };
+        return factories;
+    }
+
+    // Shared or Exclusive as registered; throws on an unknown command
+    CmdConcurrency command_concurrency(const std::string& name);
+    nlohmann::json error_json(const char* msg);
+}
+
+namespace cmd {
+    // Starts a new session next to the running ones; the reply has its id.
+    // shm_name: DollsAiFrames, or DollsAiFrames_<id> if another session has that name
+    nlohmann::json capture_start(const nlohmann::json& args, CmdContext& ctx)
+    {
+        CopyOptions copy;
+        // "bgr" (default), "bgra", "rgb" or "gray": pixel layout of the frames, converted during the copy.
+        // A replayed recording keeps the format it was recorded in, give that one for the ring's size.
+        if (args.contains("format")) {
+            copy.format = parse_pixel_format(args["format"].get<std::string>());
+        }
+        // only these rectangles are copied, packed into one frame
+        if (args.contains("rois")) {
+            copy.rois = parse_rois(args["rois"]);
+        }
+        // "scale": 0.5 (a factor) or [width, height] (a fixed size), area resampled during the copy
+        if (args.contains("scale")) {
+            const auto& scale = args["scale"];
+            if (scale.is_array()) {
+                copy.target_width = scale.at(0).get<int>();
+                copy.target_height = scale.at(1).get<int>();
+            }
+            else {
+                copy.scale = scale.get<double>();
+            }
+        }
+
+        uint32_t id = s_next_session_id;
+        std::string default_shm_name = "DollsAiFrames";
+        for (const auto& entry : s_sessions) {
+            if (entry.second->ring->Name() == default_shm_name) {
+                default_shm_name += "_" + std::to_string(id);
+                break;
+            }
+        }
+        // frames are handed to clients through this shared memory ring
+        auto shm_name = args.value("shm_name", default_shm_name);
+        auto shm_slots = args.value("shm_slots", 4u);
+        auto max_width = args.value("max_width", 3840);
+        auto max_height = args.value("max_height", 2160);
+        size_t max_stride = (static_cast<size_t>(max_width) * bytes_per_pixel(copy.format) + FramePool::kAlign - 1)
+            / FramePool::kAlign * FramePool::kAlign;
+
+        auto source_name = args.value("source", std::string("window"));
+        const auto& sources = source_factories();
+        auto it = sources.find(source_name);
+        if (it == sources.end()) {
+            throw std::runtime_error("Unknown source");
+        }
+        auto source = it->second(args, copy);
+        auto session = std::make_shared<CaptureSession>();
+        session->id = id;
+        session->rois = copy.rois;
+        session->ring = std::make_unique<SharedFrameRing>(shm_name, shm_slots, max_stride * max_height);
+        session->capture = std::make_unique<CaptureThread>(std::move(source), args.value("tile_size", 32));
+        session->watchers = std::make_unique<SessionWatchers>(*session->capture, id);
+        // add after succeeded (take care of error case)
+        s_sessions[id] = std::move(session);
+        s_next_session_id++;
+
+        return nlohmann::json({ {"result", {
+            {"session", id},
+            {"shm_name", shm_name},
+        }} });
+    }
+
+    // session: the session to end, every session if omitted
+    nlohmann::json capture_stop(const nlohmann::json& args, CmdContext& ctx)
+    {
+        std::vector<std::shared_ptr<CaptureSession>> stopped;
+        if (args.contains("session")) {
+            auto it = s_sessions.find(args.at("session").get<uint32_t>());
+            if (it == s_sessions.end()) {
+                throw std::runtime_error("Unknown session");
+            }
+            stopped.push_back(it->second);
+            s_sessions.erase(it);
+        }
+        else {
+            for (const auto& entry : s_sessions) {
+                stopped.push_back(entry.second);
+            }
+            s_sessions.clear();
+        }
+        // a wait_until may still hold the session, its wait ends here
+        for (const auto& session : stopped) {
+            session->watchers.reset();
+            session->capture->Stop();
+        }
+
+        return nlohmann::json({ {"result", "OK"} });
+    }
+
+    // [{"session", "shm_name", "frames"}, ...]
+    nlohmann::json capture_list(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto arrayjson = nlohmann::json::array();
+        for (const auto& entry : s_sessions) {
+            arrayjson.push_back({
+                {"session", entry.first},
+                {"shm_name", entry.second->ring->Name()},
+                {"frames", entry.second->capture->GetStats().frames},
+            });
+        }
+        return nlohmann::json({ {"result", arrayjson} });
+    }
+
+    // session: capture_start's id, may be omitted while one session runs (all frame commands)
+    // min_frame_id: only return a frame with at least this id (last id + 1 for a new one)
+    // timeout_ms: how long to wait for such a frame, 0 = do not wait
+    nlohmann::json get_frame(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        bool inline_pixels = args.value("inline", false);
+        if (inline_pixels && ctx.stream.Mode() == WireMode::Text) {
+            throw std::runtime_error("inline needs a binary protocol");
+        }
+        Frame frame;
+        {
+            DOLLSAI_TIME_SCOPE("get_frame.wait");
+            frame = wait_frame(*session, args, ctx);
+        }
+        if (!frame) {
+            return nlohmann::json();
+        }
+        if (inline_pixels) {
+            const uint8_t* data = frame.Data();
+            size_t size = frame.Stride() * frame.Height();
+            auto result = nlohmann::json({
+                {"frame_id", frame.Id()},
+                {"width", frame.Width()},
+                {"height", frame.Height()},
+                {"stride", frame.Stride()},
+                {"format", pixel_format_name(frame.Format())},
+                {"duplicate", frame.Duplicate()},
+            });
+            if (session->rois) {
+                result["rois"] = rois_to_json(*session->rois);
+            }
+            ctx.attachments.push_back({ data, size, std::move(frame) });
+            return nlohmann::json({ {"result", result} });
+        }
+        // pixels and metadata are in the slot, see SharedFrameRing.h for the layout
+        SharedFrameRing::Published published;
+        {
+            DOLLSAI_TIME_SCOPE("get_frame.publish");
+            published = session->ring->Publish(frame);
+        }
+
+        auto result = nlohmann::json({
+            {"slot", published.slot},
+            {"seq", published.seq},
+            {"frame_id", frame.Id()},
+            {"duplicate", frame.Duplicate()},
+        });
+        if (session->rois) {
+            result["rois"] = rois_to_json(*session->rois);
+        }
+        return nlohmann::json({ {"result", result} });
+    }
+
+    // since: frame id the client has already seen
+    // max_rects: upper bound for the number of rectangles (merged with some slack area)
+    // With ROIs the rects are in packed frame coordinates (see offset_y in get_frame).
+    nlohmann::json get_changes(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        auto since = args.at("since").get<uint64_t>();
+        auto max_rects = args.value("max_rects", size_t(16));
+
+        const auto& tiles = session->capture->Tiles();
+        // read the id first: changes after it may already be included, never missed
+        uint64_t frame_id = tiles.FrameId();
+        bool full = false;
+        auto rects = tiles.ChangedSince(since, max_rects, &full);
+
+        auto arrayjson = nlohmann::json::array();
+        for (const auto& r : rects) {
+            arrayjson.push_back({ r.x, r.y, r.width, r.height });
+        }
+        return nlohmann::json({ {"result", {
+            {"frame_id", frame_id},
+            {"full", full},
+            {"rects", arrayjson},
+        }} });
+    }
+
+    nlohmann::json capture_stats(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        auto stats = session->capture->GetStats();
+
+        nlohmann::json result = {
+            {"frames", stats.frames},
+            {"dropped", stats.dropped},
+            {"duplicates", stats.duplicates},
+            {"pool", {
+                {"hits", stats.pool.hits},
+                {"misses", stats.pool.misses},
+                {"bytes_in_flight", stats.pool.bytes_in_flight},
+                {"bytes_idle", stats.pool.bytes_idle},
+            }},
+        };
+        if (session->recorder != nullptr) {
+            result["recording"] = recorder_stats_json(*session->recorder);
+        }
+        return nlohmann::json({ {"result", result} });
+    }
+
+    // path: recording file, replaced if it exists
+    // queue_frames: frames waiting for the writer before frames are dropped
+    // keyframe_interval: written frames between keyframes (seek granularity)
+    nlohmann::json record_start(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        session->capture->SetRecorder(nullptr);
+        session->recorder.reset();
+
+        RecorderOptions options;
+        options.queue_frames = args.value("queue_frames", options.queue_frames);
+        options.tile_size = args.value("tile_size", options.tile_size);
+        options.keyframe_interval = args.value("keyframe_interval", options.keyframe_interval);
+        auto recorder = std::make_shared<Recorder>(args.at("path").get<std::string>(), options);
+        session->capture->SetRecorder(recorder);
+        session->recorder = std::move(recorder);
+
+        return nlohmann::json({ {"result", "OK"} });
+    }
+
+    nlohmann::json record_stop(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        if (session->recorder == nullptr) {
+            throw std::runtime_error("Not recording");
+        }
+        session->capture->SetRecorder(nullptr);
+        auto recorder = std::move(session->recorder);
+        recorder->Stop();
+
+        return nlohmann::json({ {"result", recorder_stats_json(*recorder)} });
+    }
+
+    // id: name used by find_template, found before pack entries of the same name
+    // path: image file, or the image file bytes as the request attachment (binary modes)
+    nlohmann::json template_load(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto id = args.at("id").get<std::string>();
+        cv::Mat image;
+        if (args.contains("path")) {
+            image = cv::imread(args["path"].get<std::string>(), cv::IMREAD_UNCHANGED);
+        }
+        else {
+            image = cv::imdecode(ctx.request.attachment, cv::IMREAD_UNCHANGED);
+        }
+        if (image.empty()) {
+            throw std::runtime_error("Cannot read template image");
+        }
+        auto templ = std::make_shared<const Template>(Template::FromImage(image));
+        s_templates.Add(id, templ);
+
+        return nlohmann::json({ {"result", {
+            {"width", templ->Width()},
+            {"height", templ->Height()},
+            {"levels", templ->Levels()},
+            {"mask", templ->HasMask()},
+        }} });
+    }
+
+    // dir: directory of template images, path: pack file to write
+    nlohmann::json templates_build(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto count = build_template_pack(args.at("dir").get<std::string>(), args.at("path").get<std::string>());
+
+        return nlohmann::json({ {"result", {
+            {"count", count},
+        }} });
+    }
+
+    // path: pack file, replaces the current pack as a whole
+    nlohmann::json templates_reload(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto count = s_templates.Reload(args.at("path").get<std::string>());
+
+        return nlohmann::json({ {"result", {
+            {"count", count},
+        }} });
+    }
+
+    // id: template name, or index in the loaded pack; ids: several of them
+    // roi: [x, y, w, h] to search in, whole frame if omitted; rois: several of them
+    // threshold, max_results, levels: see MatchOptions
+    // min_frame_id, timeout_ms: as in get_frame
+    // Every template/ROI pair is a task on the task pool. With ids or rois the reply has
+    // "results": [{"id", "roi" (index), "matches"}] in ids-major order, else just "matches".
+    // Positions are in frame pixels (packed/scaled frames when ROIs/scale are set).
+    nlohmann::json find_template(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        bool multi = args.contains("ids") || args.contains("rois");
+        auto ids = args.contains("ids") ? args["ids"] : nlohmann::json::array({ args.at("id") });
+        std::vector<std::shared_ptr<const Template>> templates;
+        for (const auto& id : ids) {
+            auto found = id.is_number_unsigned() ? s_templates.Find(id.get<size_t>()) : s_templates.Find(id.get<std::string>());
+            if (found == nullptr) {
+                throw std::runtime_error("Unknown template");
+            }
+            templates.push_back(std::move(found));
+        }
+        MatchOptions options;
+        options.threshold = args.value("threshold", options.threshold);
+        options.max_results = args.value("max_results", options.max_results);
+        options.levels = args.value("levels", options.levels);
+        options.pool = &TaskPool::Default();
+
+        Frame frame = wait_frame(*session, args, ctx);
+        if (!frame) {
+            return nlohmann::json();
+        }
+
+        cv::Mat image = frame_to_mat(frame);
+        std::vector<cv::Rect> rois;
+        auto roi_list = args.contains("rois") ? args["rois"]
+            : args.contains("roi") ? nlohmann::json::array({ args["roi"] }) : nlohmann::json::array();
+        for (const auto& r : roi_list) {
+            rois.push_back(clip_roi(image, r));
+        }
+        if (rois.empty()) {
+            rois.push_back(clip_roi(image, nullptr));
+        }
+        // every template must fit in every ROI it is searched in
+        for (const auto& templ : templates) {
+            for (const auto& roi : rois) {
+                if (roi.width < templ->Width() || roi.height < templ->Height()) {
+                    throw std::runtime_error("ROI smaller than the template");
+                }
+            }
+        }
+
+        auto results = parallel_map<std::vector<MatchResult>>(*options.pool, templates.size() * rois.size(), [&](size_t i) {
+            return ::find_template(image(rois[i % rois.size()]), *templates[i / rois.size()], options);
+        });
+
+        auto resultsjson = nlohmann::json::array();
+        for (size_t i = 0; i < results.size(); i++) {
+            const cv::Rect& roi = rois[i % rois.size()];
+            const Template& templ = *templates[i / rois.size()];
+            auto matchesjson = nlohmann::json::array();
+            for (const auto& m : results[i]) {
+                matchesjson.push_back({
+                    {"x", roi.x + m.x},
+                    {"y", roi.y + m.y},
+                    {"w", templ.Width()},
+                    {"h", templ.Height()},
+                    {"score", m.score},
+                });
+            }
+            resultsjson.push_back({
+                {"id", ids[i / rois.size()]},
+                {"roi", i % rois.size()},
+                {"matches", matchesjson},
+            });
+        }
+        if (!multi) {
+            return nlohmann::json({ {"result", {
+                {"frame_id", frame.Id()},
+                {"matches", resultsjson[0]["matches"]},
+            }} });
+        }
+        return nlohmann::json({ {"result", {
+            {"frame_id", frame.Id()},
+            {"results", resultsjson},
+        }} });
+    }
+
+    // probes, predicates: see parse_probe_set
+    // set: name to keep the probes under; with only a name, the kept set is evaluated
+    // colors: also return the sampled 0xRRGGBB values
+    // min_frame_id, timeout_ms: as in get_frame
+    nlohmann::json probe_pixels(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        std::shared_ptr<const ProbeSet> set;
+        if (args.contains("probes")) {
+            set = parse_probe_set(args);
+            if (args.contains("set")) {
+                std::lock_guard<std::mutex> lock(s_probe_sets_mutex);
+                s_probe_sets[args["set"].get<std::string>()] = set;
+            }
+        }
+        else {
+            std::lock_guard<std::mutex> lock(s_probe_sets_mutex);
+            auto it = s_probe_sets.find(args.at("set").get<std::string>());
+            if (it == s_probe_sets.end()) {
+                throw std::runtime_error("Unknown probe set");
+            }
+            set = it->second;
+        }
+
+        Frame frame = wait_frame(*session, args, ctx);
+        if (!frame) {
+            return nlohmann::json();
+        }
+
+        bool want_colors = args.value("colors", false);
+        std::vector<uint8_t> hits(set->Size());
+        std::vector<uint32_t> colors(want_colors ? set->Size() : 0);
+        set->Evaluate(frame, want_colors ? colors.data() : nullptr, hits.data());
+
+        auto result = nlohmann::json({
+            {"frame_id", frame.Id()},
+            {"hits", std::vector<bool>(hits.begin(), hits.end())},
+        });
+        if (want_colors) {
+            result["colors"] = colors;
+        }
+        auto values = set->EvaluatePredicates(hits.data());
+        auto predicates = nlohmann::json::object();
+        for (size_t i = 0; i < values.size(); i++) {
+            predicates[set->Predicates()[i].name] = static_cast<bool>(values[i]);
+        }
+        result["predicates"] = predicates;
+        return nlohmann::json({ {"result", result} });
+    }
+
+    // dir: reference screens, see load_screens
+    nlohmann::json screens_load(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto screens = load_screens(args.at("dir").get<std::string>());
+        s_screens = screens;
+
+        return nlohmann::json({ {"result", {
+            {"count", screens->Size()},
+        }} });
+    }
+
+    // roi: [x, y, w, h] to hash instead of the whole frame
+    // max_results: labels to return (3), max_distance: Hamming distance limit (12)
+    // min_frame_id, timeout_ms: as in get_frame
+    nlohmann::json classify_screen(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        if (s_screens == nullptr) {
+            throw std::runtime_error("No reference screens loaded");
+        }
+        Frame frame = wait_frame(*session, args, ctx);
+        if (!frame) {
+            return nlohmann::json();
+        }
+
+        uint64_t hash = frame.ScreenHash();
+        if (args.contains("roi")) {
+            ImageView roi = frame_roi(frame, args["roi"]);
+            hash = dhash(roi.data, roi.stride, roi.width, roi.height, roi.format);
+        }
+        auto matches = s_screens->Nearest(hash, args.value("max_results", size_t(3)), args.value("max_distance", 12));
+
+        auto arrayjson = nlohmann::json::array();
+        for (const auto& m : matches) {
+            arrayjson.push_back({ {"label", m.label}, {"distance", m.distance} });
+        }
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+        return nlohmann::json({ {"result", {
+            {"frame_id", frame.Id()},
+            {"hash", hex},
+            {"matches", arrayjson},
+        }} });
+    }
+
+    // atlas: name for read_number, replaces an atlas of the same name
+    // samples: [{"path": image file, "chars": "0123456789"}, ...], each image showing
+    //   exactly its chars in order
+    // threshold: gray level between text and background, -1 (default) = Otsu per image
+    nlohmann::json glyphs_load(const nlohmann::json& args, CmdContext& ctx)
+    {
+        GlyphOptions options;
+        options.threshold = args.value("threshold", -1);
+        auto atlas = std::make_shared<GlyphAtlas>();
+        for (const auto& sample : args.at("samples")) {
+            cv::Mat image = read_image_file(sample.at("path").get<std::string>());
+            atlas->AddSamples(image_view(image), sample.at("chars").get<std::string>(), options);
+        }
+        s_glyph_atlases[args.at("atlas").get<std::string>()] = atlas;
+
+        return nlohmann::json({ {"result", {
+            {"count", atlas->Size()},
+        }} });
+    }
+
+    // atlas: name given to glyphs_load
+    // roi: [x, y, w, h] holding the number
+    // threshold: as in glyphs_load
+    // min_frame_id, timeout_ms: as in get_frame
+    // "value" is null if the text has no digits; "confidence" is 0..1, from the worst glyph
+    nlohmann::json read_number(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        auto it = s_glyph_atlases.find(args.at("atlas").get<std::string>());
+        if (it == s_glyph_atlases.end()) {
+            throw std::runtime_error("Unknown glyph atlas");
+        }
+        GlyphOptions options;
+        options.threshold = args.value("threshold", -1);
+        Frame frame = wait_frame(*session, args, ctx);
+        if (!frame) {
+            return nlohmann::json();
+        }
+
+        NumberReading reading = ::read_number(frame_roi(frame, args.at("roi")), *it->second, options);
+        return nlohmann::json({ {"result", {
+            {"frame_id", frame.Id()},
+            {"text", reading.text},
+            {"value", reading.has_value ? nlohmann::json(reading.value) : nlohmann::json()},
+            {"confidence", reading.confidence},
+        }} });
+    }
+
+    // cascade: file name without .xml in the cascade dirs (haarcascade_frontalface_default,
+    //   lbpcascade_frontalface, ...) or a path to an .xml; loaded once, then kept
+    // roi: [x, y, w, h] to search in, whole frame if omitted
+    // downscale, scale_factor, min_neighbors, min_size, max_size, parallel: see parse_detect_options
+    // min_frame_id, timeout_ms: as in get_frame
+    // "objects": [{"x", "y", "w", "h" (frame pixels), "level" (pyramid level), "weight"}]
+    nlohmann::json detect_objects(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        auto cascade = s_cascades.Find(args.at("cascade").get<std::string>());
+        auto options = parse_detect_options(args);
+        Frame frame = wait_frame(*session, args, ctx);
+        if (!frame) {
+            return nlohmann::json();
+        }
+
+        cv::Mat image = frame_to_mat(frame);
+        cv::Rect roi = clip_roi(image, args.value("roi", nlohmann::json()));
+        auto detections = cascade->Detect(image(roi), options);
+
+        auto arrayjson = nlohmann::json::array();
+        for (const auto& d : detections) {
+            arrayjson.push_back({
+                {"x", roi.x + d.box.x},
+                {"y", roi.y + d.box.y},
+                {"w", d.box.width},
+                {"h", d.box.height},
+                {"level", d.level},
+                {"weight", d.weight},
+            });
+        }
+        return nlohmann::json({ {"result", {
+            {"frame_id", frame.Id()},
+            {"objects", arrayjson},
+        }} });
+    }
+
+    // Latency histograms of the capture stages, get_frame and every command
+    // (microseconds), plus the frame counters. reset: clear the histograms after reading.
+    nlohmann::json stats(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto latency = nlohmann::json::object();
+        for (const auto& entry : latency_histograms()) {
+            auto summary = entry.second->Summarize();
+            if (summary.count == 0) {
+                continue;
+            }
+            latency[entry.first] = {
+                {"count", summary.count},
+                {"p50_us", summary.p50_ns / 1000.0},
+                {"p90_us", summary.p90_ns / 1000.0},
+                {"p99_us", summary.p99_ns / 1000.0},
+                {"max_us", summary.max_ns / 1000.0},
+                {"mean_us", summary.mean_ns / 1000.0},
+            };
+        }
+        if (args.value("reset", false)) {
+            reset_latency_histograms();
+        }
+
+        auto sessions = nlohmann::json::array();
+        for (const auto& entry : s_sessions) {
+            const CaptureSession& session = *entry.second;
+            auto capture = session.capture->GetStats();
+            nlohmann::json sessionjson = {
+                {"session", session.id},
+                {"frames", {
+                    {"captured", capture.frames},
+                    {"dropped", capture.dropped},
+                    {"duplicates", capture.duplicates},
+                }},
+            };
+            if (session.recorder != nullptr) {
+                sessionjson["recording"] = recorder_stats_json(*session.recorder);
+            }
+            sessions.push_back(std::move(sessionjson));
+        }
+        nlohmann::json result = {
+            {"latency", latency},
+            {"sessions", sessions},
+        };
+        return nlohmann::json({ {"result", result} });
+    }
+
+    // Timeline of every timed stage and command on all threads.
+    // events_per_thread: ring size per thread, the oldest events are overwritten
+    nlohmann::json trace_start(const nlohmann::json& args, CmdContext& ctx)
+    {
+        ::trace_start(args.value("events_per_thread", size_t(65536)));
+        return nlohmann::json({ {"result", nullptr} });
+    }
+
+    // Writes the trace to path as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+    nlohmann::json trace_stop(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto path = args.at("path").get<std::string>();
+        auto result = ::trace_stop(path);
+        return nlohmann::json({ {"result", {
+            {"path", path},
+            {"events", result.events},
+            {"overwritten", result.overwritten},
+        }} });
+    }
+
+    // until: condition tree, see parse_condition
+    // min_frame_id: first frame to check, timeout_ms: give up after this long (null result)
+    // The tree is checked on every new frame of the session, and the reply comes with
+    // the first frame it holds on: {"frame_id", "frames" (checked), "details" (leaves that held)}.
+    // Frames are only looked at, not taken (a Lossless replay does not move on for them).
+    // Exclusive commands do not wait for a running wait_until; capture_end ends it (null result).
+    nlohmann::json wait_until(const nlohmann::json& args, CmdContext& ctx)
+    {
+        if (ctx.snapshot) {
+            throw std::runtime_error("wait_until needs live frames, not a batch");
+        }
+        auto session = find_session(args);
+        auto condition = parse_condition(args.at("until"));
+        auto deadline = FrameClock::now() + std::chrono::milliseconds(args.value("timeout_ms", 0));
+        const auto& tiles = session->capture->Tiles();
+        // the session and the condition are ours now, nothing else of the state is used
+        if (ctx.state_lock != nullptr) {
+            ctx.state_lock->unlock();
+        }
+
+        uint64_t min_frame_id = args.value("min_frame_id", uint64_t(0));
+        uint64_t previous = 0;
+        uint64_t checked = 0;
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - FrameClock::now());
+            Frame frame = session->capture->PeekFrame(min_frame_id, (std::max)(remaining, std::chrono::milliseconds(0)));
+            if (!frame) {
+                return nlohmann::json();
+            }
+            bool holds;
+            {
+                DOLLSAI_TIME_SCOPE("wait_until.evaluate");
+                holds = condition->Evaluate(frame, FrameChanges::Query(tiles, previous));
+            }
+            checked++;
+            if (holds) {
+                auto details = nlohmann::json::array();
+                condition->Describe(frame.Id(), details);
+                return nlohmann::json({ {"result", {
+                    {"frame_id", frame.Id()},
+                    {"frames", checked},
+                    {"details", details},
+                }} });
+            }
+            previous = frame.Id();
+            min_frame_id = frame.Id() + 1;
+        }
+    }
+
+    // name: event name, a subscription of the same name on this stream is replaced
+    // session: as in get_frame
+    // min_interval_ms: at most one event per this long, the ones in between are
+    //   coalesced into the next ("coalesced": how many it replaced)
+    // kind:
+    //   "changed", roi: something in roi (whole frame if omitted) changed
+    //   "template", id, roi, threshold, levels: the template "appeared" / "disappeared"
+    //   "screen", roi, max_distance: the nearest reference screen changed
+    //   "condition", until: the tree (see parse_condition) "holds" / "released"
+    // Events come on this stream between replies: {"event": name, "session",
+    // "frame_id", "kind", ...}. Every new frame goes once through all watchers of
+    // the session. Events wait for a slow reader without holding up the capture, and
+    // pile up into the newest per subscription meanwhile.
+    nlohmann::json subscribe(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        auto name = args.at("name").get<std::string>();
+        auto kind = args.at("kind").get<std::string>();
+        auto roi = parse_area(args.value("roi", nlohmann::json()));
+
+        std::unique_ptr<Watcher> watcher;
+        if (kind == "changed") {
+            watcher = Watcher::Changed(roi);
+        }
+        else if (kind == "template") {
+            nlohmann::json condition = { {"template", args.at("id")} };
+            for (const char* key : { "roi", "threshold", "levels" }) {
+                if (args.contains(key)) {
+                    condition[key] = args[key];
+                }
+            }
+            watcher = Watcher::Condition(parse_condition(condition), "appeared", "disappeared");
+        }
+        else if (kind == "screen") {
+            if (s_screens == nullptr) {
+                throw std::runtime_error("No reference screens loaded");
+            }
+            watcher = Watcher::ScreenChange(s_screens, roi, args.value("max_distance", 12));
+        }
+        else if (kind == "condition") {
+            watcher = Watcher::Condition(parse_condition(args.at("until")), "holds", "released");
+        }
+        else {
+            throw std::runtime_error("Unknown watcher kind");
+        }
+        auto min_interval = std::chrono::milliseconds(args.value("min_interval_ms", 0));
+        session->watchers->Add(EventOutbox::ForStream(ctx.stream), name, std::move(watcher), min_interval);
+
+        return nlohmann::json({ {"result", {
+            {"session", session->id},
+            {"name", name},
+        }} });
+    }
+
+    // name: a subscription of this stream, session: as in get_frame
+    // "result" has the names still subscribed on the session.
+    nlohmann::json unsubscribe(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        auto outbox = EventOutbox::ForStream(ctx.stream);
+        if (!session->watchers->Remove(outbox.get(), args.at("name").get<std::string>())) {
+            throw std::runtime_error("Unknown subscription");
+        }
+
+        return nlohmann::json({ {"result", session->watchers->Names(outbox.get())} });
+    }
+
+    // commands: [{"cmd": ..., ...}, ...], Shared commands only, run in order on one frame
+    // session, min_frame_id, timeout_ms: as in get_frame, for that frame
+    // "results" has each command's reply (or {"error"}) at its index.
+    nlohmann::json batch(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto session = find_session(args);
+        Frame frame = wait_frame(*session, args, ctx);
+        if (!frame) {
+            return nlohmann::json();
+        }
+
+        CmdContext sub = { ctx.stream, ctx.request };
+        sub.snapshot = frame;
+        auto results = nlohmann::json::array();
+        for (auto cmdjson : args.at("commands")) {
+            try {
+                auto name = cmdjson.at("cmd").get<std::string>();
+                if (name == "batch" || command_concurrency(name) != CmdConcurrency::Shared) {
+                    throw std::runtime_error("Command not allowed in batch: " + name);
+                }
+                // the snapshot is a frame of the batch's session
+                if (cmdjson.value("session", session->id) != session->id) {
+                    throw std::runtime_error("Batch commands must use the batch's session");
+                }
+                cmdjson["session"] = session->id;
+                results.push_back(process_cmd(cmdjson, sub));
+            }
+            catch (std::exception& e) {
+                results.push_back(error_json(e.what()));
+            }
+        }
+        ctx.attachments = std::move(sub.attachments);
+
+        return nlohmann::json({ {"result", {
+            {"frame_id", frame.Id()},
+            {"results", results},
+        }} });
+    }
+
+    // mode: text, cbor or msgpack for every message after this reply, which still goes
+    // out in the old mode; pretty: indented text
+    nlohmann::json set_protocol(const nlohmann::json& args, CmdContext& ctx)
+    {
+        auto mode = parse_wire_mode(args.at("mode").get<std::string>());
+        ctx.next_mode = mode;
+        ctx.next_pretty = args.value("pretty", false);
+
+        return nlohmann::json({ {"result", wire_mode_name(mode)} });
+    }
+}
+
+namespace {
+    struct Command
+    {
+        CmdFunc func;
+        CmdConcurrency concurrency;
+        // "cmd.<name>", looked up once
+        LatencyHistogram* latency;
+    };
+
+    Command make_command(const std::string& name, CmdFunc func, CmdConcurrency concurrency)
+    {
+        return { std::move(func), concurrency, &latency_histogram("cmd." + name) };
+    }
+
+    std::unordered_map<std::string, Command>& commands()
+    {
+        static std::unordered_map<std::string, Command> map = [] {
+            constexpr auto shared = CmdConcurrency::Shared;
+            constexpr auto exclusive = CmdConcurrency::Exclusive;
+            const std::tuple<const char*, CmdFunc, CmdConcurrency> builtin[] = {
+                {"capture_start", cmd::capture_start, exclusive},
+                {"capture_end", cmd::capture_stop, exclusive},
+                {"capture_list", cmd::capture_list, shared},
+                {"get_frame", cmd::get_frame, shared},
+                {"get_changes", cmd::get_changes, shared},
+                {"capture_stats", cmd::capture_stats, shared},
+                // TemplateRegistry has its own lock
+                {"template_load", cmd::template_load, shared},
+                {"templates_build", cmd::templates_build, shared},
+                {"templates_reload", cmd::templates_reload, shared},
+                {"find_template", cmd::find_template, shared},
+                {"probe_pixels", cmd::probe_pixels, shared},
+                {"screens_load", cmd::screens_load, exclusive},
+                {"classify_screen", cmd::classify_screen, shared},
+                {"glyphs_load", cmd::glyphs_load, exclusive},
+                {"read_number", cmd::read_number, shared},
+                // CascadeRegistry has its own lock
+                {"detect_objects", cmd::detect_objects, shared},
+                {"record_start", cmd::record_start, exclusive},
+                {"record_stop", cmd::record_stop, exclusive},
+                {"stats", cmd::stats, shared},
+                {"trace_start", cmd::trace_start, shared},
+                {"trace_stop", cmd::trace_stop, shared},
+                {"wait_until", cmd::wait_until, shared},
+                // SessionWatchers has its own lock
+                {"subscribe", cmd::subscribe, shared},
+                {"unsubscribe", cmd::unsubscribe, shared},
+                {"batch", cmd::batch, shared},
+                // the stream must not be in use while the mode changes
+                {"set_protocol", cmd::set_protocol, exclusive},
+            };
+            std::unordered_map<std::string, Command> map;
+            for (const auto& entry : builtin) {
+                map[std::get<0>(entry)] = make_command(std::get<0>(entry), std::get<1>(entry), std::get<2>(entry));
+            }
+            return map;
+        }();
+        return map;
+    }
+
+    CmdConcurrency command_concurrency(const std::string& name)
+    {
+        const auto& map = commands();
+        auto it = map.find(name);
+        if (it == map.end()) {
+            throw std::runtime_error("Unndefined command");
+        }
+        return it->second.concurrency;
+    }
+
+    nlohmann::json error_json(const char* msg)
+    {
+        auto obj = nlohmann::json::object();
+        obj["message"] = msg;
+
+        return nlohmann::json{ { "error", obj } };
+    }
+
+    // Threads for pipelined requests, and one more for Exclusive commands. Tasks start
+    // in the order they are posted, each holding the state lock: shared on a worker,
+    // unique on the exclusive thread. An Exclusive task waits for every task before it
+    // to start, then for their locks; nothing posted after it starts before it ends.
+    // Post never blocks, a reader that must not queue without bound calls WaitForSpace.
+    class CommandWorkers
+    {
+    public:
+        static constexpr size_t kMaxPending = 256;
+
+        explicit CommandWorkers(unsigned threads)
+        {
+            for (unsigned i = 0; i < (std::max)(threads, 1u); i++) {
+                m_threads.emplace_back([this]() { Run(); });
+            }
+            m_threads.emplace_back([this]() { RunExclusive(); });
+        }
+        // runs what is queued, then joins
+        ~CommandWorkers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+            m_exclusiveCond.notify_all();
+            for (auto& thread : m_threads) {
+                thread.join();
+            }
+        }
+
+        using SharedTask = std::function<void(std::shared_lock<std::shared_mutex>&)>;
+
+        // task gets the state lock it runs under
+        void Post(SharedTask task)
+        {
+            Push({ std::move(task), {} });
+        }
+
+        void PostExclusive(std::function<void()> task)
+        {
+            Push({ {}, std::move(task) });
+        }
+
+        // waits until fewer than kMaxPending tasks are queued
+        void WaitForSpace()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_space.wait(lock, [this]() { return m_tasks.size() < kMaxPending; });
+        }
+
+        // for a command run on the reading thread
+        std::shared_lock<std::shared_mutex> LockShared()
+        {
+            return std::shared_lock<std::shared_mutex>(m_state);
+        }
+
+    private:
+        // one of the two is set
+        struct Task
+        {
+            SharedTask shared;
+            std::function<void()> exclusive;
+        };
+
+        void Push(Task task)
+        {
+            bool exclusive = task.exclusive != nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.push_back(std::move(task));
+            }
+            if (exclusive) {
+                m_exclusiveCond.notify_one();
+            }
+            else {
+                m_cond.notify_one();
+            }
+        }
+
+        void Run()
+        {
+            trace_thread_name("command worker");
+#ifdef _WIN32
+            // commands may create WinRT objects (capture_start with a window source)
+            winrt::init_apartment(winrt::apartment_type::multi_threaded);
+#endif
+            while (true) {
+                Task task;
+                std::shared_lock<std::shared_mutex> state;
+                bool next_exclusive;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cond.wait(lock, [this]() {
+                        return (!m_tasks.empty() && m_tasks.front().shared && !m_exclusive) || (m_tasks.empty() && m_stop);
+                    });
+                    if (m_tasks.empty()) {
+                        break;
+                    }
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                    // never waits: only the exclusive thread takes it uniquely, and only while m_exclusive is set
+                    state = std::shared_lock<std::shared_mutex>(m_state);
+                    next_exclusive = m_tasks.empty() || m_tasks.front().exclusive != nullptr;
+                }
+                m_space.notify_all();
+                if (next_exclusive) {
+                    m_exclusiveCond.notify_one();
+                }
+                else {
+                    // the next one may have been posted while every worker was busy
+                    m_cond.notify_one();
+                }
+                task.shared(state);
+            }
+#ifdef _WIN32
+            winrt::uninit_apartment();
+#endif
+        }
+
+        void RunExclusive()
+        {
+            trace_thread_name("command exclusive");
+#ifdef _WIN32
+            // capture_start with a window source activates WinRT capture objects here
+            winrt::init_apartment(winrt::apartment_type::multi_threaded);
+#endif
+            while (true) {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_exclusiveCond.wait(lock, [this]() {
+                        return (!m_tasks.empty() && m_tasks.front().exclusive) || (m_tasks.empty() && m_stop);
+                    });
+                    if (m_tasks.empty()) {
+                        break;
+                    }
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                    m_exclusive = true;
+                }
+                m_space.notify_all();
+                {
+                    // the tasks started before it finish first, or unlock
+                    std::unique_lock<std::shared_mutex> state(m_state);
+                    task.exclusive();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_exclusive = false;
+                }
+                m_cond.notify_all();
+            }
+#ifdef _WIN32
+            winrt::uninit_apartment();
+#endif
+        }
+
+        // held shared by every running command, uniquely by an Exclusive one
+        std::shared_mutex m_state;
+        std::mutex m_mutex;
+        // workers wait on m_cond, the exclusive thread on m_exclusiveCond
+        std::condition_variable m_cond;
+        std::condition_variable m_exclusiveCond;
+        std::condition_variable m_space;
+        std::deque<Task> m_tasks;
+        // an Exclusive task is running or waiting for the state lock
+        bool m_exclusive = false;
+        bool m_stop = false;
+        std::vector<std::thread> m_threads;
+    };
+
+    // Exclusive: alone on the exclusive thread, after everything posted before it.
+    // Async (has an id): on the workers, may overtake other requests.
+    // InOrder: the client's next request waits for its reply.
+    enum class Dispatch {
+        Exclusive,
+        Async,
+        InOrder,
+    };
+
+    Dispatch dispatch_of(const Request& request)
+    {
+        const auto& body = request.body;
+        try {
+            if (command_concurrency(body.at("cmd").get<std::string>()) == CmdConcurrency::Exclusive) {
+                return Dispatch::Exclusive;
+            }
+        }
+        catch (std::exception&) {
+            // answered with the error, in order
+            return Dispatch::InOrder;
+        }
+        return body.contains("id") ? Dispatch::Async : Dispatch::InOrder;
+    }
+
+    // Runs the request and writes its reply, or its error, with the request's id.
+    // state_lock: see CmdContext
+    void answer(CommandStream& stream, const Request& request, std::shared_lock<std::shared_mutex>* state_lock = nullptr)
+    {
+        CmdContext ctx = { stream, request };
+        ctx.state_lock = state_lock;
+        nlohmann::json reply;
+        try {
+            reply = process_cmd(request.body, ctx);
+        }
+        catch (std::exception& e) {
+            reply = error_json(e.what());
+            ctx.attachments.clear();
+            ctx.next_mode.reset();
+        }
+        if (request.body.is_object() && request.body.contains("id")) {
+            if (!reply.is_object()) {
+                // timed out waiting for a frame
+                reply = { {"result", nullptr} };
+            }
+            reply["id"] = request.body["id"];
+        }
+        try {
+            DOLLSAI_TIME_SCOPE("protocol.write");
+            if (ctx.next_mode) {
+                stream.WriteSwitching(std::move(reply), *ctx.next_mode, ctx.next_pretty);
+            }
+            else {
+                stream.Write(std::move(reply), ctx.attachments);
+            }
+        }
+        catch (std::exception& e) {
+            fprintf(stderr, "%s\n\n", error_json(e.what()).dump().c_str());
+        }
+    }
+}
+
+void register_command(const std::string& name, CmdFunc func, CmdConcurrency concurrency)
+{
+    commands()[name] = make_command(name, std::move(func), concurrency);
+}
+
+void register_source(const std::string& name, SourceFactory factory)
+{
+    source_factories()[name] = std::move(factory);
+}
+
+nlohmann::json process_cmd(const nlohmann::json& cmdjson, CmdContext& ctx)
+{
+    auto name = cmdjson.at("cmd").get<std::string>();
+    const auto& map = commands();
+    auto it = map.find(name);
+    if (it != map.end()) {
+#if DOLLSAI_STATS
+        ScopedLatency latency(*it->second.latency);
+#endif
+        return it->second.func(cmdjson, ctx);
+    }
+    else {
+        throw std::runtime_error("Unndefined command");
+    }
+}
+
+int run_server(int argc, char* argv[])
+{
+    setlocale(LC_CTYPE, "");
+
+    unsigned worker_count = 4;
+    std::string listen_address;
+#ifdef DOLLSAI_CASCADE_DIR
+    // the haarcascades/lbpcascades of the OpenCV the build uses
+    s_cascades.AddDir(DOLLSAI_CASCADE_DIR);
+#endif
+    for (int i = 1; i + 1 < argc; i++) {
+        // --screens <dir>: reference screens for classify_screen, loaded once at startup
+        if (strcmp(argv[i], "--screens") == 0) {
+            s_screens = load_screens(argv[i + 1]);
+        }
+        // --cascades <dir>: where detect_objects looks for cascades, may be given several times
+        else if (strcmp(argv[i], "--cascades") == 0) {
+            s_cascades.AddDir(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--workers") == 0) {
+            worker_count = static_cast<unsigned>(atoi(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "--listen") == 0) {
+            listen_address = argv[i + 1];
+        }
+    }
+
+    CommandWorkers workers(worker_count);
+
+    if (!listen_address.empty()) {
+        trace_thread_name("sockets");
+        SocketServer server(listen_address, [&](const std::shared_ptr<SocketClient>& client, Request& request) {
+            if (request.body.is_discarded()) {
+                client->Write(error_json("Malformed request"));
+                return;
+            }
+            // The loop must not wait for commands: Exclusive and in-order ones pause their
+            // client until answered, pipelined ones count against its pending limit.
+            auto dispatch = dispatch_of(request);
+            auto shared = std::make_shared<Request>(std::move(request));
+            if (dispatch == Dispatch::Async) {
+                client->AddPending();
+                workers.Post([client, shared](std::shared_lock<std::shared_mutex>& lock) {
+                    answer(*client, *shared, &lock);
+                    client->RemovePending();
+                });
+                return;
+            }
+            client->Pause();
+            if (dispatch == Dispatch::Exclusive) {
+                workers.PostExclusive([client, shared]() {
+                    answer(*client, *shared);
+                    client->Resume();
+                });
+            }
+            else {
+                workers.Post([client, shared](std::shared_lock<std::shared_mutex>& lock) {
+                    answer(*client, *shared, &lock);
+                    client->Resume();
+                });
+            }
+        });
+        server.Run();
+        return EXIT_SUCCESS;
+    }
+
+    trace_thread_name("commands");
+    // shared for the EventOutbox of subscribe
+    auto stream = std::make_shared<FileCommandStream>(stdin, stdout);
+    while (true) {
+        auto request = std::make_shared<Request>();
+        try {
+            if (!stream->Read(*request)) {
+                // Error or EOF
+                break;
+            }
+        }
+        catch (std::exception& e) {
+            // no id to answer with, the request did not parse
+            try {
+                stream->Write(error_json(e.what()));
+            }
+            catch (std::exception& write_error) {
+                fprintf(stderr, "%s\n\n", error_json(write_error.what()).dump().c_str());
+            }
+            continue;
+        }
+
+        switch (dispatch_of(*request)) {
+        case Dispatch::Exclusive:
+            {
+                // the next request is read after it, like an in-order one
+                std::promise<void> done;
+                workers.PostExclusive([&]() {
+                    answer(*stream, *request);
+                    done.set_value();
+                });
+                done.get_future().wait();
+            }
+            break;
+        case Dispatch::Async:
+            // a client sending faster than commands finish is slowed down instead of growing the queue
+            workers.WaitForSpace();
+            workers.Post([stream, request](std::shared_lock<std::shared_mutex>& lock) {
+                answer(*stream, *request, &lock);
+            });
+            break;
+        case Dispatch::InOrder:
+            {
+                auto lock = workers.LockShared();
+                answer(*stream, *request, &lock);
+            }
+            break;
+        }
+    }
+
+    return EXIT_FAILURE;
+}
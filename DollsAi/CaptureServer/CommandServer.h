@@ -0,0 +1,74 @@
+#pragma once
+
+#include "FrameCopy.h"
+#include "FrameSource.h"
+#include "Protocol.h"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Command loop with every platform independent command and the synthetic and
+// replay sources. A backend (Windows capture, headless) registers its own commands
+// and sources, then calls run_server.
+//
+// A request with an "id" gets it back in its reply, errors included ({"id", "error"}).
+// Such requests may be pipelined: Shared commands among them run on a worker pool
+// and reply as they finish, in any order. Requests without an id, and Exclusive
+// commands, are answered before the client's next request is read; an Exclusive
+// command runs alone, after every command received before it and before any later one
+// (a wait_until received before it only has to have started).
+//
+// With --listen the same commands are served to any number of socket clients
+// instead of stdin/stdout. Each client has its own protocol mode, and all of them
+// share the capture sessions.
+//
+// After subscribe, event messages {"event": name, ...} come on the same stream,
+// between replies. They carry no id.
+
+struct CmdContext
+{
+    CommandStream& stream;
+    const Request& request;
+    // sent after the reply document (binary modes only)
+    std::vector<Attachment> attachments;
+    // inside batch: the frame every command works on
+    Frame snapshot;
+    // the server state lock held shared while the command runs, null if none; a command
+    // that waits long unlocks it once it holds what it needs, so Exclusive ones can run
+    std::shared_lock<std::shared_mutex>* state_lock = nullptr;
+    // set by set_protocol: the wire mode after its own reply (see WriteSwitching)
+    std::optional<WireMode> next_mode;
+    bool next_pretty = false;
+};
+
+enum class CmdConcurrency {
+    // only reads server state (or locks what it changes), may run next to others
+    Shared,
+    // changes server state, runs alone
+    Exclusive,
+};
+
+using CmdFunc = std::function<nlohmann::json(const nlohmann::json&, CmdContext&)>;
+// Source for capture_start {"source": name, ...}; copy holds the parsed rois/scale.
+using SourceFactory = std::function<std::unique_ptr<FrameSource>(const nlohmann::json&, const CopyOptions&)>;
+
+// Replace an entry of the same name. Not thread safe, call before run_server.
+void register_command(const std::string& name, CmdFunc func,
+    CmdConcurrency concurrency = CmdConcurrency::Exclusive);
+void register_source(const std::string& name, SourceFactory factory);
+
+// Runs cmdjson["cmd"]. Throws on an unknown command or a failed one.
+nlohmann::json process_cmd(const nlohmann::json& cmdjson, CmdContext& ctx);
+
+// Answers requests from stdin on stdout until EOF.
+// --screens <dir>: reference screens for classify_screen, loaded once at startup
+// --cascades <dir>: more dirs for detect_objects' cascades, after the build's OpenCV ones
+// --workers <n>: threads for pipelined requests (4)
+// --listen unix:<path> | tcp:<port>: serve socket clients (loopback only) until killed
+//   instead of stdin/stdout
+int run_server(int argc, char* argv[]);
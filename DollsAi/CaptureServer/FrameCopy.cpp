@@ -0,0 +1,116 @@
+#include "stdafx.h"
+#include "FrameCopy.h"
+#include "LatencyStats.h"
+
+#include <algorithm>
+#include <math.h>
+#include <set>
+#include <stdexcept>
+#include <string.h>
+
+RoiLayout::RoiLayout(std::vector<Roi> rois) : m_rois(std::move(rois))
+{
+    if (m_rois.empty()) {
+        throw std::invalid_argument("Empty ROI list");
+    }
+    std::set<std::string> names;
+    for (const auto& roi : m_rois) {
+        if (roi.width <= 0 || roi.height <= 0) {
+            throw std::invalid_argument("Empty ROI: " + roi.name);
+        }
+        if (!names.insert(roi.name).second) {
+            throw std::invalid_argument("Duplicate ROI name: " + roi.name);
+        }
+        m_offsetY.push_back(m_height);
+        m_height += roi.height;
+        m_width = (std::max)(m_width, roi.width);
+    }
+}
+
+SurfaceCopier::SurfaceCopier(CopyOptions options) : m_options(std::move(options))
+{
+    bool sized = m_options.target_width > 0 || m_options.target_height > 0;
+    if (sized && (m_options.target_width <= 0 || m_options.target_height <= 0)) {
+        throw std::invalid_argument("Target size needs both width and height");
+    }
+    if (!(m_options.scale > 0 && m_options.scale <= 1)) {
+        throw std::invalid_argument("Scale must be in (0, 1]");
+    }
+    bool scaled = sized || m_options.scale != 1;
+    if (scaled && m_options.rois) {
+        throw std::invalid_argument("ROIs cannot be combined with scaling");
+    }
+}
+
+Frame SurfaceCopier::Copy(FramePool& pool, const uint8_t* src, size_t src_pitch, int width, int height)
+{
+    DOLLSAI_TIME_SCOPE("capture.copy");
+    if (m_options.rois) {
+        return CopyRois(pool, src, src_pitch, width, height);
+    }
+    if (m_options.target_width > 0 || m_options.scale != 1) {
+        return CopyScaled(pool, src, src_pitch, width, height);
+    }
+    Frame frame = pool.Acquire(width, height, m_options.format);
+    convert_bgra(src, src_pitch, frame.Data(), frame.Stride(), width, height, m_options.format);
+    return frame;
+}
+
+// Rows and columns outside the ROIs are never read. ROI parts outside the surface are zero.
+Frame SurfaceCopier::CopyRois(FramePool& pool, const uint8_t* src, size_t src_pitch, int width, int height)
+{
+    const RoiLayout& layout = *m_options.rois;
+    const PixelFormat format = m_options.format;
+    Frame frame = pool.Acquire(layout.Width(), layout.Height(), format);
+    const size_t bpp = bytes_per_pixel(format);
+    const size_t row_bytes = layout.Width() * bpp;
+    const auto& rois = layout.Rois();
+    for (size_t i = 0; i < rois.size(); i++) {
+        const Roi& roi = rois[i];
+        // visible columns of the ROI, relative to roi.x
+        int x0 = (std::max)(0, -roi.x);
+        int x1 = (std::max)(x0, (std::min)(roi.width, width - roi.x));
+        for (int y = 0; y < roi.height; y++) {
+            uint8_t* dst = frame.Row(layout.OffsetY(i) + y);
+            int sy = roi.y + y;
+            if (sy < 0 || sy >= height || x0 == x1) {
+                memset(dst, 0, row_bytes);
+                continue;
+            }
+            memset(dst, 0, x0 * bpp);
+            convert_bgra_row(src + sy * src_pitch + (static_cast<size_t>(roi.x) + x0) * 4,
+                dst + x0 * bpp, x1 - x0, format);
+            memset(dst + x1 * bpp, 0, row_bytes - x1 * bpp);
+        }
+    }
+    return frame;
+}
+
+Frame SurfaceCopier::CopyScaled(FramePool& pool, const uint8_t* src, size_t src_pitch, int width, int height)
+{
+    int src_w = width;
+    int src_h = height;
+    int dst_w = m_options.target_width;
+    int dst_h = m_options.target_height;
+    if (dst_w <= 0) {
+        double inverse = 1.0 / m_options.scale;
+        int k = static_cast<int>(inverse + 0.5);
+        if (fabs(inverse - k) < 1e-6 && width >= k && height >= k) {
+            dst_w = width / k;
+            dst_h = height / k;
+            src_w = dst_w * k;
+            src_h = dst_h * k;
+        }
+        else {
+            dst_w = (std::max)(1, static_cast<int>(width * m_options.scale + 0.5));
+            dst_h = (std::max)(1, static_cast<int>(height * m_options.scale + 0.5));
+        }
+    }
+    if (!m_resampler || m_resampler->SrcWidth() != src_w || m_resampler->SrcHeight() != src_h
+        || m_resampler->DstWidth() != dst_w || m_resampler->DstHeight() != dst_h) {
+        m_resampler = std::make_unique<AreaResampler>(src_w, src_h, dst_w, dst_h);
+    }
+    Frame frame = pool.Acquire(dst_w, dst_h, m_options.format);
+    m_resampler->Resample(src, src_pitch, frame.Data(), frame.Stride(), m_options.format);
+    return frame;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "FramePool.h"
+#include "Resample.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// A named rectangle of the captured window, in window pixels.
+struct Roi
+{
+    std::string name;
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Packs ROIs into one frame: stacked top to bottom in the given order, left aligned,
+// as wide as the widest ROI. Columns right of a narrower ROI are zero.
+class RoiLayout
+{
+public:
+    // throws std::invalid_argument on an empty list, empty rects or duplicate names
+    explicit RoiLayout(std::vector<Roi> rois);
+
+    const std::vector<Roi>& Rois() const { return m_rois; }
+    // first row of rois[i] in the packed frame
+    int OffsetY(size_t i) const { return m_offsetY[i]; }
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+
+private:
+    std::vector<Roi> m_rois;
+    std::vector<int> m_offsetY;
+    int m_width = 0;
+    int m_height = 0;
+};
+
+// How a captured BGRA surface becomes a frame. rois and scaling are exclusive.
+struct CopyOptions
+{
+    PixelFormat format = PixelFormat::BGR;
+    // copy only these rectangles, packed per RoiLayout
+    std::shared_ptr<const RoiLayout> rois;
+    // area downscale by this factor (0 < scale <= 1). When 1 / scale is an integer k
+    // the output is width / k x height / k and the last width % k columns
+    // (height % k rows) are dropped, so the exact box path applies.
+    double scale = 1.0;
+    // or to a fixed size, if both are set
+    int target_width = 0;
+    int target_height = 0;
+};
+
+// Converts mapped BGRA surfaces into pooled frames as CopyOptions says, reading
+// only the source pixels the output needs. One per FrameSource; not thread safe.
+// Id and timestamp of the returned frame are left to the caller.
+class SurfaceCopier
+{
+public:
+    // throws std::invalid_argument on inconsistent options
+    explicit SurfaceCopier(CopyOptions options);
+
+    const CopyOptions& Options() const { return m_options; }
+
+    Frame Copy(FramePool& pool, const uint8_t* src, size_t src_pitch, int width, int height);
+
+private:
+    Frame CopyRois(FramePool& pool, const uint8_t* src, size_t src_pitch, int width, int height);
+    Frame CopyScaled(FramePool& pool, const uint8_t* src, size_t src_pitch, int width, int height);
+
+    CopyOptions m_options;
+    // rebuilt when the surface size changes
+    std::unique_ptr<AreaResampler> m_resampler;
+};
@@ -0,0 +1,199 @@
+#include "stdafx.h"
+#include "FramePool.h"
+
+#include <new>
+#include <stdexcept>
+
+struct Frame::Buffer
+{
+    std::atomic<int> refs;
+    size_t capacity;
+    size_t sizeClass;
+    uint8_t* data;
+    // Set while in flight only, so idle buffers do not keep the pool alive.
+    std::shared_ptr<FramePool> pool;
+};
+
+namespace {
+    constexpr size_t kMinCapacity = 4096;
+
+    // Size classes are 4 equal steps per power of two: 4K, 5K, 6K, 7K, 8K, 10K, ...
+    size_t size_class(size_t size, size_t* capacity)
+    {
+        if (size < kMinCapacity) {
+            size = kMinCapacity;
+        }
+        int e = 0;
+        for (size_t v = size - 1; v > 1; v >>= 1) {
+            e++;
+        }
+        size_t step = size_t(1) << (e - 2);
+        size_t cap = (size + step - 1) / step * step;
+        *capacity = cap;
+        // cap / step is 4..8, and 8 wraps to the first step of e + 1
+        return e * 4 + (cap / step - 4);
+    }
+}
+
+Frame::Frame(const Frame& other) : m_buffer(other.m_buffer), m_info(other.m_info)
+{
+    if (m_buffer != nullptr) {
+        m_buffer->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Frame::Frame(Frame&& other) noexcept : m_buffer(other.m_buffer), m_info(other.m_info)
+{
+    other.m_buffer = nullptr;
+}
+
+Frame& Frame::operator=(const Frame& other)
+{
+    if (this != &other) {
+        Frame tmp(other);
+        *this = std::move(tmp);
+    }
+    return *this;
+}
+
+Frame& Frame::operator=(Frame&& other) noexcept
+{
+    if (this != &other) {
+        Reset();
+        m_buffer = other.m_buffer;
+        m_info = other.m_info;
+        other.m_buffer = nullptr;
+    }
+    return *this;
+}
+
+void Frame::Reset()
+{
+    if (m_buffer != nullptr) {
+        if (m_buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // keep the pool alive until Recycle has returned
+            auto pool = std::move(m_buffer->pool);
+            pool->Recycle(m_buffer);
+        }
+        m_buffer = nullptr;
+    }
+    m_info = FrameInfo();
+}
+
+uint8_t* Frame::Data()
+{
+    return m_buffer != nullptr ? m_buffer->data : nullptr;
+}
+
+const uint8_t* Frame::Data() const
+{
+    return m_buffer != nullptr ? m_buffer->data : nullptr;
+}
+
+std::shared_ptr<FramePool> FramePool::Create(size_t max_idle)
+{
+    return std::make_shared<FramePool>(max_idle);
+}
+
+FramePool::FramePool(size_t max_idle) : m_maxIdle(max_idle)
+{
+}
+
+FramePool::~FramePool()
+{
+    Trim();
+}
+
+Frame FramePool::Acquire(int width, int height, PixelFormat format)
+{
+    if (width <= 0 || height <= 0) {
+        throw std::invalid_argument("Invalid frame size");
+    }
+    size_t stride = (static_cast<size_t>(width) * bytes_per_pixel(format) + kAlign - 1) / kAlign * kAlign;
+    size_t capacity = 0;
+    size_t sc = size_class(stride * height + kAlign, &capacity);
+
+    Frame::Buffer* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (sc < m_idle.size() && !m_idle[sc].empty()) {
+            buffer = m_idle[sc].back();
+            m_idle[sc].pop_back();
+        }
+    }
+    if (buffer != nullptr) {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        m_bytesIdle.fetch_sub(capacity, std::memory_order_relaxed);
+    }
+    else {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        buffer = new Frame::Buffer();
+        buffer->capacity = capacity;
+        buffer->sizeClass = sc;
+        buffer->data = static_cast<uint8_t*>(::operator new(capacity, std::align_val_t(kAlign)));
+    }
+    m_bytesInFlight.fetch_add(capacity, std::memory_order_relaxed);
+
+    buffer->refs.store(1, std::memory_order_relaxed);
+    buffer->pool = shared_from_this();
+
+    Frame frame;
+    frame.m_buffer = buffer;
+    frame.m_info.width = width;
+    frame.m_info.height = height;
+    frame.m_info.stride = stride;
+    frame.m_info.format = format;
+    return frame;
+}
+
+void FramePool::Recycle(Frame::Buffer* buffer)
+{
+    m_bytesInFlight.fetch_sub(buffer->capacity, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (buffer->sizeClass >= m_idle.size()) {
+            m_idle.resize(buffer->sizeClass + 1);
+        }
+        auto& idle = m_idle[buffer->sizeClass];
+        if (idle.size() < m_maxIdle) {
+            if (idle.capacity() < m_maxIdle) {
+                idle.reserve(m_maxIdle);
+            }
+            idle.push_back(buffer);
+            m_bytesIdle.fetch_add(buffer->capacity, std::memory_order_relaxed);
+            return;
+        }
+    }
+    FreeBuffer(buffer);
+}
+
+void FramePool::FreeBuffer(Frame::Buffer* buffer)
+{
+    ::operator delete(buffer->data, std::align_val_t(kAlign));
+    delete buffer;
+}
+
+FramePool::Stats FramePool::GetStats() const
+{
+    Stats stats;
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+    stats.bytes_in_flight = m_bytesInFlight.load(std::memory_order_relaxed);
+    stats.bytes_idle = m_bytesIdle.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FramePool::Trim()
+{
+    std::vector<std::vector<Frame::Buffer*>> idle;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        idle.swap(m_idle);
+    }
+    for (auto& list : idle) {
+        for (auto* buffer : list) {
+            m_bytesIdle.fetch_sub(buffer->capacity, std::memory_order_relaxed);
+            FreeBuffer(buffer);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "PixelConvert.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using FrameClock = std::chrono::steady_clock;
+
+class FramePool;
+
+struct FrameInfo
+{
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;
+    PixelFormat format = PixelFormat::BGRA;
+    uint64_t id = 0;
+    FrameClock::time_point timestamp;
+    // every tile equals the previous frame (set by TileTracker)
+    bool duplicate = false;
+    // dhash of the whole frame (set by CaptureThread)
+    uint64_t screen_hash = 0;
+};
+
+// Ref-counted image handle. Copies share the pixels; the buffer goes back to its
+// FramePool when the last copy is gone. Neither copy nor release allocates.
+class Frame
+{
+public:
+    Frame() = default;
+    Frame(const Frame& other);
+    Frame(Frame&& other) noexcept;
+    Frame& operator=(const Frame& other);
+    Frame& operator=(Frame&& other) noexcept;
+    ~Frame() { Reset(); }
+
+    void Reset();
+
+    bool Empty() const { return m_buffer == nullptr; }
+    explicit operator bool() const { return !Empty(); }
+
+    const FrameInfo& Info() const { return m_info; }
+    int Width() const { return m_info.width; }
+    int Height() const { return m_info.height; }
+    size_t Stride() const { return m_info.stride; }
+    PixelFormat Format() const { return m_info.format; }
+    uint64_t Id() const { return m_info.id; }
+    FrameClock::time_point Timestamp() const { return m_info.timestamp; }
+    bool Duplicate() const { return m_info.duplicate; }
+    uint64_t ScreenHash() const { return m_info.screen_hash; }
+
+    void SetId(uint64_t id) { m_info.id = id; }
+    void SetTimestamp(FrameClock::time_point timestamp) { m_info.timestamp = timestamp; }
+    void SetDuplicate(bool duplicate) { m_info.duplicate = duplicate; }
+    void SetScreenHash(uint64_t hash) { m_info.screen_hash = hash; }
+
+    uint8_t* Data();
+    const uint8_t* Data() const;
+    uint8_t* Row(int y) { return Data() + y * m_info.stride; }
+    const uint8_t* Row(int y) const { return Data() + y * m_info.stride; }
+
+private:
+    friend class FramePool;
+    struct Buffer;
+
+    Buffer* m_buffer = nullptr;
+    FrameInfo m_info;
+};
+
+// Recycles frame buffers by size class (4 classes per power of two, so at most
+// 25% slack). Once every size in use has been seen, Acquire does not allocate.
+class FramePool : public std::enable_shared_from_this<FramePool>
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        size_t bytes_in_flight;
+        size_t bytes_idle;
+    };
+
+    // Rows are aligned to this and every buffer has this much readable slack
+    // after the last row, so SIMD kernels may over-read the final pixel.
+    static constexpr size_t kAlign = 64;
+
+    // max_idle: buffers kept per size class, the rest is freed on release
+    static std::shared_ptr<FramePool> Create(size_t max_idle = 4);
+
+    explicit FramePool(size_t max_idle);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Pixels are uninitialized. id/timestamp are left for the producer.
+    Frame Acquire(int width, int height, PixelFormat format);
+
+    Stats GetStats() const;
+    // Frees every idle buffer.
+    void Trim();
+
+private:
+    friend class Frame;
+
+    void Recycle(Frame::Buffer* buffer);
+    static void FreeBuffer(Frame::Buffer* buffer);
+
+    const size_t m_maxIdle;
+    mutable std::mutex m_mutex;
+    std::vector<std::vector<Frame::Buffer*>> m_idle;
+
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+    std::atomic<size_t> m_bytesInFlight = 0;
+    std::atomic<size_t> m_bytesIdle = 0;
+};
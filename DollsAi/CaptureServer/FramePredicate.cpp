@@ -0,0 +1,354 @@
+#include "stdafx.h"
+#include "FramePredicate.h"
+
+#include <algorithm>
+
+namespace {
+    // rectangles per ChangedSince query, merged beyond that (a little extra area is fine)
+    constexpr size_t kMaxChangeRects = 32;
+
+    bool intersects(const TileTracker::Rect& a, const TileTracker::Rect& b)
+    {
+        return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+    }
+
+    nlohmann::json rect_json(const TileTracker::Rect& r)
+    {
+        return nlohmann::json::array({ r.x, r.y, r.width, r.height });
+    }
+
+    // roi clipped to the frame, the whole frame for width 0
+    cv::Rect clip(const TileTracker::Rect& roi, const cv::Mat& image)
+    {
+        const cv::Rect whole(0, 0, image.cols, image.rows);
+        return roi.width == 0 ? whole : whole & cv::Rect(roi.x, roi.y, roi.width, roi.height);
+    }
+
+    // Value and details of one frame, reused while nothing in m_area changes.
+    class Leaf : public FramePredicate
+    {
+    public:
+        bool Evaluate(const Frame& frame, const FrameChanges& changes) override
+        {
+            bool fresh = m_frameId != 0 && m_frameId == changes.since && !changes.Touches(m_area);
+            if (!fresh || m_everyFrame) {
+                m_detail = nullptr;
+                m_value = Compute(frame, changes);
+            }
+            m_frameId = frame.Id();
+            return m_value;
+        }
+
+        void Describe(uint64_t frame_id, nlohmann::json& details) const override
+        {
+            if (m_value && m_frameId == frame_id && !m_detail.is_null()) {
+                details.push_back(m_detail);
+            }
+        }
+
+    protected:
+        virtual bool Compute(const Frame& frame, const FrameChanges& changes) = 0;
+
+        // width 0 = the whole frame
+        TileTracker::Rect m_area = {};
+        // cheaper to compute than to check for changes
+        bool m_everyFrame = false;
+        nlohmann::json m_detail;
+
+    private:
+        uint64_t m_frameId = 0;
+        bool m_value = false;
+    };
+
+    class ProbesLeaf : public Leaf
+    {
+    public:
+        ProbesLeaf(std::shared_ptr<const ProbeSet> set, int predicate)
+            : m_set(std::move(set)), m_predicate(predicate), m_hits(m_set->Size())
+        {
+            m_everyFrame = true;
+        }
+
+        int Cost() const override { return 1; }
+
+    protected:
+        bool Compute(const Frame& frame, const FrameChanges& changes) override
+        {
+            m_set->Evaluate(frame, nullptr, m_hits.data());
+            bool value;
+            if (m_predicate < 0) {
+                value = std::all_of(m_hits.begin(), m_hits.end(), [](uint8_t hit) { return hit != 0; });
+            }
+            else {
+                value = m_set->EvaluatePredicates(m_hits.data())[m_predicate];
+            }
+            m_detail = {
+                {"kind", "probes"},
+                {"predicate", m_predicate < 0 ? nlohmann::json() : nlohmann::json(m_set->Predicates()[m_predicate].name)},
+            };
+            return value;
+        }
+
+    private:
+        std::shared_ptr<const ProbeSet> m_set;
+        int m_predicate;
+        std::vector<uint8_t> m_hits;
+    };
+
+    class TemplateLeaf : public Leaf
+    {
+    public:
+        TemplateLeaf(nlohmann::json id, std::shared_ptr<const Template> templ, TileTracker::Rect roi, MatchOptions options)
+            : m_id(std::move(id)), m_templ(std::move(templ)), m_options(options)
+        {
+            m_area = roi;
+            m_options.max_results = 1;
+        }
+
+        int Cost() const override { return 100; }
+
+    protected:
+        bool Compute(const Frame& frame, const FrameChanges& changes) override
+        {
+            cv::Mat image = frame_to_mat(frame);
+            cv::Rect roi = clip(m_area, image);
+            if (roi.width < m_templ->Width() || roi.height < m_templ->Height()) {
+                return false;
+            }
+            auto matches = find_template(image(roi), *m_templ, m_options);
+            if (matches.empty()) {
+                return false;
+            }
+            m_detail = {
+                {"kind", "template"},
+                {"id", m_id},
+                {"x", roi.x + matches[0].x},
+                {"y", roi.y + matches[0].y},
+                {"w", m_templ->Width()},
+                {"h", m_templ->Height()},
+                {"score", matches[0].score},
+            };
+            return true;
+        }
+
+    private:
+        nlohmann::json m_id;
+        std::shared_ptr<const Template> m_templ;
+        MatchOptions m_options;
+    };
+
+    class ScreenLeaf : public Leaf
+    {
+    public:
+        ScreenLeaf(std::shared_ptr<const ScreenClassifier> screens, std::string label, TileTracker::Rect roi, int max_distance)
+            : m_screens(std::move(screens)), m_label(std::move(label)), m_maxDistance(max_distance)
+        {
+            m_area = roi;
+        }
+
+        int Cost() const override { return 3; }
+
+    protected:
+        bool Compute(const Frame& frame, const FrameChanges& changes) override
+        {
+            uint64_t hash = frame.ScreenHash();
+            if (m_area.width != 0) {
+                cv::Mat image = frame_to_mat(frame);
+                cv::Rect roi = clip(m_area, image);
+                if (roi.empty()) {
+                    return false;
+                }
+                hash = dhash(frame.Row(roi.y) + roi.x * bytes_per_pixel(frame.Format()), frame.Stride(),
+                    roi.width, roi.height, frame.Format());
+            }
+            auto nearest = m_screens->Nearest(hash, 1, m_maxDistance);
+            if (nearest.empty() || nearest[0].label != m_label) {
+                return false;
+            }
+            m_detail = {
+                {"kind", "screen"},
+                {"label", m_label},
+                {"distance", nearest[0].distance},
+            };
+            return true;
+        }
+
+    private:
+        std::shared_ptr<const ScreenClassifier> m_screens;
+        std::string m_label;
+        int m_maxDistance;
+    };
+
+    // Sticky: once the area changed after the base frame, it holds.
+    class ChangedLeaf : public FramePredicate
+    {
+    public:
+        ChangedLeaf(TileTracker::Rect area, uint64_t since) : m_area(area), m_base(since)
+        {
+        }
+
+        bool Evaluate(const Frame& frame, const FrameChanges& changes) override
+        {
+            if (m_base == 0) {
+                m_base = frame.Id();
+            }
+            else if (!m_value) {
+                if (m_frameId != 0 && m_frameId == changes.since) {
+                    m_value = changes.Touches(m_area);
+                }
+                else if (changes.tiles != nullptr) {
+                    // skipped frames (short-circuit): ask for the whole span
+                    m_value = FrameChanges::Query(*changes.tiles, m_base).Touches(m_area);
+                }
+                else {
+                    m_value = true;
+                }
+            }
+            if (m_value && m_changedId == 0) {
+                m_changedId = frame.Id();
+            }
+            m_frameId = frame.Id();
+            return m_value;
+        }
+
+        void Describe(uint64_t frame_id, nlohmann::json& details) const override
+        {
+            if (m_value && m_frameId == frame_id) {
+                details.push_back({
+                    {"kind", "changed"},
+                    {"area", m_area.width == 0 ? nlohmann::json() : rect_json(m_area)},
+                    {"since", m_base},
+                    {"frame_id", m_changedId},
+                });
+            }
+        }
+
+        int Cost() const override { return 2; }
+
+    private:
+        TileTracker::Rect m_area;
+        uint64_t m_base;
+        uint64_t m_frameId = 0;
+        uint64_t m_changedId = 0;
+        bool m_value = false;
+    };
+
+    class NotNode : public FramePredicate
+    {
+    public:
+        explicit NotNode(Ptr child) : m_child(std::move(child))
+        {
+        }
+
+        bool Evaluate(const Frame& frame, const FrameChanges& changes) override
+        {
+            return !m_child->Evaluate(frame, changes);
+        }
+
+        // what holds below a not is not why the not holds
+        void Describe(uint64_t frame_id, nlohmann::json& details) const override {}
+
+        int Cost() const override { return m_child->Cost(); }
+
+    private:
+        Ptr m_child;
+    };
+
+    class ListNode : public FramePredicate
+    {
+    public:
+        // any: true if one child is, else true if all are
+        ListNode(std::vector<Ptr> children, bool any) : m_children(std::move(children)), m_any(any)
+        {
+            std::stable_sort(m_children.begin(), m_children.end(), [](const Ptr& a, const Ptr& b) {
+                return a->Cost() < b->Cost();
+            });
+            for (const auto& child : m_children) {
+                m_cost += child->Cost();
+            }
+        }
+
+        bool Evaluate(const Frame& frame, const FrameChanges& changes) override
+        {
+            for (const auto& child : m_children) {
+                if (child->Evaluate(frame, changes) == m_any) {
+                    return m_any;
+                }
+            }
+            return !m_any;
+        }
+
+        void Describe(uint64_t frame_id, nlohmann::json& details) const override
+        {
+            for (const auto& child : m_children) {
+                child->Describe(frame_id, details);
+            }
+        }
+
+        int Cost() const override { return m_cost; }
+
+    private:
+        std::vector<Ptr> m_children;
+        bool m_any;
+        int m_cost = 0;
+    };
+}
+
+FrameChanges FrameChanges::Query(const TileTracker& tiles, uint64_t since)
+{
+    FrameChanges changes;
+    changes.since = since;
+    changes.tiles = &tiles;
+    if (since != 0) {
+        changes.rects = tiles.ChangedSince(since, kMaxChangeRects, &changes.full);
+    }
+    return changes;
+}
+
+bool FrameChanges::Touches(const TileTracker::Rect& area) const
+{
+    if (since == 0 || full) {
+        return true;
+    }
+    if (area.width == 0) {
+        return !rects.empty();
+    }
+    return std::any_of(rects.begin(), rects.end(), [&](const TileTracker::Rect& r) { return intersects(r, area); });
+}
+
+FramePredicate::Ptr FramePredicate::All(std::vector<Ptr> children)
+{
+    return std::make_unique<ListNode>(std::move(children), false);
+}
+
+FramePredicate::Ptr FramePredicate::Any(std::vector<Ptr> children)
+{
+    return std::make_unique<ListNode>(std::move(children), true);
+}
+
+FramePredicate::Ptr FramePredicate::Not(Ptr child)
+{
+    return std::make_unique<NotNode>(std::move(child));
+}
+
+FramePredicate::Ptr FramePredicate::Probes(std::shared_ptr<const ProbeSet> set, int predicate)
+{
+    return std::make_unique<ProbesLeaf>(std::move(set), predicate);
+}
+
+FramePredicate::Ptr FramePredicate::TemplateFound(nlohmann::json id, std::shared_ptr<const Template> templ,
+    TileTracker::Rect roi, MatchOptions options)
+{
+    return std::make_unique<TemplateLeaf>(std::move(id), std::move(templ), roi, options);
+}
+
+FramePredicate::Ptr FramePredicate::Changed(TileTracker::Rect area, uint64_t since)
+{
+    return std::make_unique<ChangedLeaf>(area, since);
+}
+
+FramePredicate::Ptr FramePredicate::Screen(std::shared_ptr<const ScreenClassifier> screens, std::string label,
+    TileTracker::Rect roi, int max_distance)
+{
+    return std::make_unique<ScreenLeaf>(std::move(screens), std::move(label), roi, max_distance);
+}
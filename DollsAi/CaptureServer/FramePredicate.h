@@ -0,0 +1,63 @@
+#pragma once
+
+#include "PixelProbe.h"
+#include "ScreenClassifier.h"
+#include "TemplateMatch.h"
+#include "TileTracker.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Area that changed between the previous evaluated frame and the current one.
+struct FrameChanges
+{
+    // id of the previous frame, 0 if there is none (everything counts as changed)
+    uint64_t since = 0;
+    bool full = true;
+    std::vector<TileTracker::Rect> rects;
+    // for leaves that need changes over a longer span
+    const TileTracker* tiles = nullptr;
+
+    // Changes of tiles after frame `since`, up to tiles' last update.
+    static FrameChanges Query(const TileTracker& tiles, uint64_t since);
+    // true if something in area may have changed; width 0 = the whole frame
+    bool Touches(const TileTracker::Rect& area) const;
+};
+
+// Condition tree over frames: all/any/not over leaves that test pixel probes, a
+// template, a changed area or the screen class. It is evaluated frame after frame:
+// a leaf keeps its value and computes it again only if a tile in its area changed
+// since the frame it was computed on, and all/any stop at the first deciding child,
+// cheapest first. On a mostly static screen a frame costs little more than the probes.
+class FramePredicate
+{
+public:
+    using Ptr = std::unique_ptr<FramePredicate>;
+
+    virtual ~FramePredicate() = default;
+
+    // changes: relative to the previous frame passed to this tree (the same tree must
+    // see the frames of one session in increasing id order)
+    virtual bool Evaluate(const Frame& frame, const FrameChanges& changes) = 0;
+    // Appends a JSON object for every leaf that held on frame_id (the last evaluated frame).
+    virtual void Describe(uint64_t frame_id, nlohmann::json& details) const = 0;
+    // relative cost of one evaluation
+    virtual int Cost() const = 0;
+
+    static Ptr All(std::vector<Ptr> children);
+    static Ptr Any(std::vector<Ptr> children);
+    static Ptr Not(Ptr child);
+    // predicate: index in set.Predicates(), -1 = every probe must hit
+    static Ptr Probes(std::shared_ptr<const ProbeSet> set, int predicate);
+    // a match of templ with at least options.threshold in roi (width 0 = whole frame)
+    static Ptr TemplateFound(nlohmann::json id, std::shared_ptr<const Template> templ,
+        TileTracker::Rect roi, MatchOptions options);
+    // anything in area (width 0 = whole frame) changed after frame `since`
+    // (0 = the first evaluated frame); holds from then on
+    static Ptr Changed(TileTracker::Rect area, uint64_t since);
+    // the nearest reference screen of the frame (or of roi) is label, within max_distance
+    static Ptr Screen(std::shared_ptr<const ScreenClassifier> screens, std::string label,
+        TileTracker::Rect roi, int max_distance);
+};
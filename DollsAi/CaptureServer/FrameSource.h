@@ -0,0 +1,26 @@
+#pragma once
+
+#include "FramePool.h"
+
+#include <chrono>
+
+// Anything that produces frames: a live window capture, a synthetic pattern, ...
+// Driven from a single thread (CaptureThread), so implementations need not be thread safe
+// except for Interrupt().
+class FrameSource
+{
+public:
+    virtual ~FrameSource() = default;
+
+    // Blocks until the next frame or the timeout. Empty frame on timeout.
+    // Frame ids increase by one per produced frame, starting at 1.
+    virtual Frame WaitNextFrame(std::chrono::milliseconds timeout) = 0;
+
+    virtual FramePool::Stats GetPoolStats() const = 0;
+
+    // Makes a blocked WaitNextFrame return early. Called from another thread.
+    virtual void Interrupt() = 0;
+
+    // true if frames should wait for the consumer instead of being dropped (replays)
+    virtual bool Lossless() const { return false; }
+};
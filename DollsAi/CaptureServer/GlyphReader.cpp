@@ -0,0 +1,219 @@
+#include "stdafx.h"
+#include "GlyphReader.h"
+
+#include <algorithm>
+#include <bitset>
+#include <stdexcept>
+#include <stdlib.h>
+
+namespace {
+    constexpr int kCell = GlyphBits::kSize;
+    // distance at which confidence reaches 0
+    constexpr int kMaxConfidentDistance = 64;
+
+    // (b + 2g + r) / 4, same weighting as the screen hash
+    uint8_t brightness(const uint8_t* p, PixelFormat format)
+    {
+        if (format == PixelFormat::Gray) {
+            return p[0];
+        }
+        return static_cast<uint8_t>((p[0] + 2 * p[1] + p[2]) >> 2);
+    }
+
+    int otsu(const std::vector<uint8_t>& gray)
+    {
+        int histogram[256] = {};
+        for (auto v : gray) {
+            histogram[v]++;
+        }
+        const double total = static_cast<double>(gray.size());
+        double sum = 0;
+        for (int i = 0; i < 256; i++) {
+            sum += static_cast<double>(i) * histogram[i];
+        }
+        double sum_below = 0;
+        double count_below = 0;
+        double best = -1;
+        int threshold = 128;
+        for (int t = 0; t < 256; t++) {
+            count_below += histogram[t];
+            if (count_below == 0) {
+                continue;
+            }
+            double count_above = total - count_below;
+            if (count_above == 0) {
+                break;
+            }
+            sum_below += static_cast<double>(t) * histogram[t];
+            double mean_below = sum_below / count_below;
+            double mean_above = (sum - sum_below) / count_above;
+            double between = count_below * count_above * (mean_below - mean_above) * (mean_below - mean_above);
+            if (between > best) {
+                best = between;
+                threshold = t;
+            }
+        }
+        return threshold;
+    }
+
+    GlyphBits normalize(const std::vector<uint8_t>& mask, int stride, int x0, int y0, int w, int h)
+    {
+        GlyphBits bits = {};
+        // fit the longer side to the cell, center the shorter one
+        int side = (std::max)(w, h);
+        int off_x = (side - w) / 2;
+        int off_y = (side - h) / 2;
+        for (int cy = 0; cy < kCell; cy++) {
+            int sy = (2 * cy + 1) * side / (2 * kCell) - off_y;
+            if (sy < 0 || sy >= h) {
+                continue;
+            }
+            for (int cx = 0; cx < kCell; cx++) {
+                int sx = (2 * cx + 1) * side / (2 * kCell) - off_x;
+                if (sx < 0 || sx >= w) {
+                    continue;
+                }
+                if (mask[(y0 + sy) * stride + x0 + sx]) {
+                    int bit = cy * kCell + cx;
+                    bits.words[bit / 64] |= uint64_t(1) << (bit % 64);
+                }
+            }
+        }
+        return bits;
+    }
+
+    int distance(const GlyphBits& a, const GlyphBits& b)
+    {
+        int d = 0;
+        for (int i = 0; i < 4; i++) {
+            d += static_cast<int>(std::bitset<64>(a.words[i] ^ b.words[i]).count());
+        }
+        return d;
+    }
+}
+
+std::vector<GlyphBits> segment_glyphs(const ImageView& image, const GlyphOptions& options)
+{
+    const int w = image.width;
+    const int h = image.height;
+    if (w <= 0 || h <= 0) {
+        return {};
+    }
+    const int bpp = bytes_per_pixel(image.format);
+    std::vector<uint8_t> gray(static_cast<size_t>(w) * h);
+    for (int y = 0; y < h; y++) {
+        const uint8_t* row = image.data + y * image.stride;
+        for (int x = 0; x < w; x++) {
+            gray[static_cast<size_t>(y) * w + x] = brightness(row + static_cast<size_t>(x) * bpp, image.format);
+        }
+    }
+    int threshold = options.threshold >= 0 ? options.threshold : otsu(gray);
+    size_t above = std::count_if(gray.begin(), gray.end(), [threshold](uint8_t v) { return v > threshold; });
+    // text is the minority side
+    bool light_text = above * 2 < gray.size();
+    std::vector<uint8_t> mask(gray.size());
+    for (size_t i = 0; i < gray.size(); i++) {
+        mask[i] = (gray[i] > threshold) == light_text ? 1 : 0;
+    }
+
+    std::vector<int> column(w, 0);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            column[x] += mask[static_cast<size_t>(y) * w + x];
+        }
+    }
+
+    std::vector<GlyphBits> glyphs;
+    for (int x = 0; x < w; ) {
+        if (column[x] == 0) {
+            x++;
+            continue;
+        }
+        int x0 = x;
+        while (x < w && column[x] != 0) {
+            x++;
+        }
+        int x1 = x;
+        int y0 = h;
+        int y1 = 0;
+        for (int y = 0; y < h; y++) {
+            for (int cx = x0; cx < x1; cx++) {
+                if (mask[static_cast<size_t>(y) * w + cx]) {
+                    y0 = (std::min)(y0, y);
+                    y1 = (std::max)(y1, y + 1);
+                    break;
+                }
+            }
+        }
+        if (x1 - x0 < options.min_glyph_pixels && y1 - y0 < options.min_glyph_pixels) {
+            continue;
+        }
+        glyphs.push_back(normalize(mask, w, x0, y0, x1 - x0, y1 - y0));
+    }
+    return glyphs;
+}
+
+void GlyphAtlas::AddSamples(const ImageView& image, const std::string& chars, const GlyphOptions& options)
+{
+    auto glyphs = segment_glyphs(image, options);
+    if (glyphs.size() != chars.size()) {
+        throw std::invalid_argument("Glyph sample has " + std::to_string(glyphs.size())
+            + " glyphs for " + std::to_string(chars.size()) + " characters");
+    }
+    for (size_t i = 0; i < glyphs.size(); i++) {
+        Add(chars[i], glyphs[i]);
+    }
+}
+
+void GlyphAtlas::Add(char symbol, const GlyphBits& bits)
+{
+    m_symbols.push_back(symbol);
+    m_bits.push_back(bits);
+}
+
+char GlyphAtlas::Classify(const GlyphBits& bits, int* best_distance) const
+{
+    size_t best = 0;
+    int best_d = INT32_MAX;
+    for (size_t i = 0; i < m_bits.size(); i++) {
+        int d = distance(bits, m_bits[i]);
+        if (d < best_d) {
+            best_d = d;
+            best = i;
+        }
+    }
+    if (best_distance != nullptr) {
+        *best_distance = best_d;
+    }
+    return m_symbols[best];
+}
+
+NumberReading read_number(const ImageView& image, const GlyphAtlas& atlas, const GlyphOptions& options)
+{
+    if (atlas.Size() == 0) {
+        throw std::invalid_argument("Empty glyph atlas");
+    }
+    NumberReading reading = { "", false, 0.0, 0.0 };
+    int worst = 0;
+    for (const auto& glyph : segment_glyphs(image, options)) {
+        int d = 0;
+        reading.text.push_back(atlas.Classify(glyph, &d));
+        worst = (std::max)(worst, d);
+    }
+    if (reading.text.empty()) {
+        return reading;
+    }
+    reading.confidence = 1.0 - (std::min)(worst, kMaxConfidentDistance) / static_cast<double>(kMaxConfidentDistance);
+
+    std::string number;
+    for (char c : reading.text) {
+        if ((c >= '0' && c <= '9') || c == '.' || (c == '-' && number.empty())) {
+            number.push_back(c);
+        }
+    }
+    if (std::any_of(number.begin(), number.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        reading.has_value = true;
+        reading.value = strtod(number.c_str(), nullptr);
+    }
+    return reading;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "PixelConvert.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Pixels of some image region, e.g. an ROI of a Frame or a decoded atlas image.
+struct ImageView
+{
+    const uint8_t* data;
+    size_t stride;
+    int width;
+    int height;
+    PixelFormat format;
+};
+
+// A glyph normalized to a 16x16 bit cell: the glyph's bounding box scaled to fit,
+// aspect kept, centered. 256 bits in 4 words, row major.
+struct GlyphBits
+{
+    static constexpr int kSize = 16;
+    uint64_t words[4];
+};
+
+struct GlyphOptions
+{
+    // gray level between text and background, -1 = Otsu per ROI
+    int threshold = -1;
+    // glyphs narrower and lower than this many pixels are noise
+    int min_glyph_pixels = 2;
+};
+
+// Binarizes the image (text is whichever side of the threshold covers less area),
+// splits it into glyphs at empty columns and normalizes each glyph, left to right.
+std::vector<GlyphBits> segment_glyphs(const ImageView& image, const GlyphOptions& options);
+
+// Reference glyphs with their characters; any number of samples per character.
+class GlyphAtlas
+{
+public:
+    // Segments a sample image showing exactly the characters of `chars`, in order.
+    // Throws std::invalid_argument if the glyph count does not match.
+    void AddSamples(const ImageView& image, const std::string& chars, const GlyphOptions& options);
+    void Add(char symbol, const GlyphBits& bits);
+
+    size_t Size() const { return m_symbols.size(); }
+
+    // Closest sample by XOR/popcount distance (0..256). Size() must not be 0.
+    char Classify(const GlyphBits& bits, int* distance) const;
+
+private:
+    std::vector<char> m_symbols;
+    std::vector<GlyphBits> m_bits;
+};
+
+struct NumberReading
+{
+    // recognized characters, left to right
+    std::string text;
+    // digits of text read as a number ('-' and '.' kept, ',' and others dropped); false if none
+    bool has_value;
+    double value;
+    // 0..1, from the worst glyph distance
+    double confidence;
+};
+
+NumberReading read_number(const ImageView& image, const GlyphAtlas& atlas, const GlyphOptions& options);
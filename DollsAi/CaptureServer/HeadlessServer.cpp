@@ -0,0 +1,9 @@
+#include "stdafx.h"
+#include "CommandServer.h"
+
+// The command server without a capture backend: frames come from the "synthetic"
+// and "replay" sources, so it runs on any platform.
+int main(int argc, char *argv[])
+{
+    return run_server(argc, argv);
+}
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "LatencyStats.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+    // v != 0
+    int highest_bit(uint64_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanReverse64(&bit, v);
+        return static_cast<int>(bit);
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+    };
+
+    Registry& registry()
+    {
+        // never destroyed: histograms may be recorded into while threads shut down
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+}
+
+int LatencyHistogram::BucketOf(uint64_t ns)
+{
+    if (ns < kSub) {
+        return static_cast<int>(ns);
+    }
+    int e = highest_bit(ns);
+    int sub = static_cast<int>((ns >> (e - kSubBits)) & (kSub - 1));
+    return (e - kSubBits + 1) * kSub + sub;
+}
+
+uint64_t LatencyHistogram::ValueOf(int bucket)
+{
+    if (bucket < kSub) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int e = bucket / kSub + kSubBits - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % kSub);
+    uint64_t low = (kSub + sub) << (e - kSubBits);
+    uint64_t width = uint64_t(1) << (e - kSubBits);
+    return low + width / 2;
+}
+
+void LatencyHistogram::Record(uint64_t ns)
+{
+    m_buckets[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Summary LatencyHistogram::Summarize() const
+{
+    uint64_t counts[kBuckets];
+    uint64_t total = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    Summary summary = {};
+    summary.count = total;
+    summary.max_ns = m_max.load(std::memory_order_relaxed);
+    if (total == 0) {
+        return summary;
+    }
+    summary.mean_ns = static_cast<double>(m_sum.load(std::memory_order_relaxed)) / total;
+
+    auto percentile = [&](double p) {
+        // rank of the sample, 1 based
+        uint64_t rank = (std::max)(uint64_t(1), static_cast<uint64_t>(p * total + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return (std::min)(ValueOf(i), summary.max_ns);
+            }
+        }
+        return summary.max_ns;
+    };
+    summary.p50_ns = percentile(0.5);
+    summary.p90_ns = percentile(0.9);
+    summary.p99_ns = percentile(0.99);
+    return summary;
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram& latency_histogram(const std::string& name)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto& histogram = r.histograms[name];
+    if (histogram == nullptr) {
+        histogram = std::make_unique<LatencyHistogram>(name);
+    }
+    return *histogram;
+}
+
+std::vector<std::pair<std::string, const LatencyHistogram*>> latency_histograms()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::vector<std::pair<std::string, const LatencyHistogram*>> list;
+    for (const auto& entry : r.histograms) {
+        list.emplace_back(entry.first, entry.second.get());
+    }
+    return list;
+}
+
+void reset_latency_histograms()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (auto& entry : r.histograms) {
+        entry.second->Reset();
+    }
+}
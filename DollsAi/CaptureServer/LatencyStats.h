@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Build with DOLLSAI_STATS=0 to compile every DOLLSAI_TIME_SCOPE (and its trace events) out.
+#ifndef DOLLSAI_STATS
+#define DOLLSAI_STATS 1
+#endif
+
+// Latency histogram in nanoseconds with HDR-style log-linear buckets: 32 linear
+// sub-buckets per power of two, so any reported value is within ~3% of the real one.
+// Record is lock free (relaxed atomics) and may be called from any thread.
+class LatencyHistogram
+{
+public:
+    struct Summary
+    {
+        uint64_t count;
+        uint64_t p50_ns;
+        uint64_t p90_ns;
+        uint64_t p99_ns;
+        uint64_t max_ns;
+        double mean_ns;
+    };
+
+    explicit LatencyHistogram(std::string name) : m_name(std::move(name)) {}
+
+    const std::string& Name() const { return m_name; }
+    void Record(uint64_t ns);
+    // Buckets are read one by one, so a summary taken while recording is approximate.
+    Summary Summarize() const;
+    void Reset();
+
+private:
+    static constexpr int kSubBits = 5;
+    static constexpr int kSub = 1 << kSubBits;
+    static constexpr int kBuckets = (64 - kSubBits + 1) * kSub;
+
+    static int BucketOf(uint64_t ns);
+    // middle of the bucket's value range
+    static uint64_t ValueOf(int bucket);
+
+    const std::string m_name;
+    std::atomic<uint64_t> m_buckets[kBuckets] = {};
+    std::atomic<uint64_t> m_sum = 0;
+    std::atomic<uint64_t> m_max = 0;
+};
+
+// Process wide histogram by name, created on first use. The reference stays valid
+// for the life of the process; the lookup takes a lock, so callers keep it.
+LatencyHistogram& latency_histogram(const std::string& name);
+// every histogram created so far, sorted by name
+std::vector<std::pair<std::string, const LatencyHistogram*>> latency_histograms();
+void reset_latency_histograms();
+
+// Records the time from construction to destruction (steady clock), and while a
+// trace runs also as a trace event named after the histogram.
+class ScopedLatency
+{
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram)
+        : m_histogram(histogram), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency()
+    {
+        auto end = std::chrono::steady_clock::now();
+        m_histogram.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            end - m_start).count()));
+        trace_complete(m_histogram.Name().c_str(), m_start, end);
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    LatencyHistogram& m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define DOLLSAI_CONCAT_(a, b) a##b
+#define DOLLSAI_CONCAT(a, b) DOLLSAI_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope into latency_histogram(name); name must be
+// a constant, it is looked up once per call site.
+#if DOLLSAI_STATS
+#define DOLLSAI_TIME_SCOPE(name) \
+    static LatencyHistogram& DOLLSAI_CONCAT(dollsai_histogram_, __LINE__) = latency_histogram(name); \
+    ScopedLatency DOLLSAI_CONCAT(dollsai_latency_, __LINE__)(DOLLSAI_CONCAT(dollsai_histogram_, __LINE__))
+#else
+#define DOLLSAI_TIME_SCOPE(name) ((void)0)
+#endif
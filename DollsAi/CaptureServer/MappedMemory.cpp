@@ -0,0 +1,273 @@
+#include "stdafx.h"
+#include "MappedMemory.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+    std::wstring mapping_name(const std::string& name)
+    {
+        return L"Local\\" + utf8_to_wide(name);
+    }
+#else
+    std::string mapping_name(const std::string& name)
+    {
+        return "/" + name;
+    }
+#endif
+
+    [[noreturn]] void throw_os_error(const char* what, const std::string& name)
+    {
+#ifdef _WIN32
+        unsigned long code = GetLastError();
+#else
+        int code = errno;
+#endif
+        throw std::runtime_error(std::string(what) + " failed: " + name + " (" + std::to_string(code) + ")");
+    }
+}
+
+SharedMemory SharedMemory::Create(const std::string& name, size_t size)
+{
+    SharedMemory shm;
+    shm.m_name = name;
+    shm.m_size = size;
+#ifdef _WIN32
+    HANDLE handle = CreateFileMappingW(
+        INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size),
+        mapping_name(name).c_str());
+    if (handle == nullptr) {
+        throw_os_error("CreateFileMapping", name);
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        // another server owns it (Windows cannot replace a live mapping)
+        CloseHandle(handle);
+        throw std::runtime_error("Shared memory already exists: " + name);
+    }
+    shm.m_handle = handle;
+    shm.m_data = static_cast<uint8_t*>(MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (shm.m_data == nullptr) {
+        throw_os_error("MapViewOfFile", name);
+    }
+#else
+    std::string path = mapping_name(name);
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            // another server owns it, or a crashed one left it (the caller decides, see Remove)
+            throw std::runtime_error("Shared memory already exists: " + name);
+        }
+        throw_os_error("shm_open", name);
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        shm_unlink(path.c_str());
+        throw_os_error("ftruncate", name);
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(path.c_str());
+        throw_os_error("mmap", name);
+    }
+    shm.m_data = static_cast<uint8_t*>(p);
+#endif
+    // only now the name is ours to unlink
+    shm.m_owner = true;
+    return shm;
+}
+
+void SharedMemory::Remove(const std::string& name)
+{
+#ifndef _WIN32
+    shm_unlink(mapping_name(name).c_str());
+#endif
+}
+
+SharedMemory SharedMemory::Open(const std::string& name)
+{
+    SharedMemory shm;
+    shm.m_name = name;
+#ifdef _WIN32
+    HANDLE handle = OpenFileMappingW(FILE_MAP_READ, FALSE, mapping_name(name).c_str());
+    if (handle == nullptr) {
+        throw_os_error("OpenFileMapping", name);
+    }
+    shm.m_handle = handle;
+    shm.m_data = static_cast<uint8_t*>(MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0));
+    if (shm.m_data == nullptr) {
+        throw_os_error("MapViewOfFile", name);
+    }
+    MEMORY_BASIC_INFORMATION info = {};
+    VirtualQuery(shm.m_data, &info, sizeof(info));
+    shm.m_size = info.RegionSize;
+#else
+    int fd = shm_open(mapping_name(name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw_os_error("shm_open", name);
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw_os_error("fstat", name);
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        throw_os_error("mmap", name);
+    }
+    shm.m_data = static_cast<uint8_t*>(p);
+    shm.m_size = static_cast<size_t>(st.st_size);
+#endif
+    return shm;
+}
+
+SharedMemory::SharedMemory(SharedMemory&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+SharedMemory& SharedMemory::operator=(SharedMemory&& other) noexcept
+{
+    if (this != &other) {
+        Close();
+        m_name = std::move(other.m_name);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_owner = std::exchange(other.m_owner, false);
+#ifdef _WIN32
+        m_handle = std::exchange(other.m_handle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+void SharedMemory::Close()
+{
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_handle != nullptr) {
+        CloseHandle(m_handle);
+        m_handle = nullptr;
+    }
+#else
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+    if (m_owner) {
+        shm_unlink(mapping_name(m_name).c_str());
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_owner = false;
+}
+
+MappedFile MappedFile::Open(const std::string& path)
+{
+    MappedFile file;
+    file.m_path = path;
+#ifdef _WIN32
+    HANDLE fh = CreateFileW(utf8_to_wide(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fh == INVALID_HANDLE_VALUE) {
+        throw_os_error("CreateFile", path);
+    }
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(fh, &size)) {
+        CloseHandle(fh);
+        throw_os_error("GetFileSizeEx", path);
+    }
+    file.m_size = static_cast<size_t>(size.QuadPart);
+    if (file.m_size == 0) {
+        // an empty file cannot be mapped
+        CloseHandle(fh);
+        return file;
+    }
+    HANDLE handle = CreateFileMappingW(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    // the mapping keeps the file open
+    CloseHandle(fh);
+    if (handle == nullptr) {
+        throw_os_error("CreateFileMapping", path);
+    }
+    file.m_handle = handle;
+    file.m_data = static_cast<const uint8_t*>(MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0));
+    if (file.m_data == nullptr) {
+        throw_os_error("MapViewOfFile", path);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw_os_error("open", path);
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw_os_error("fstat", path);
+    }
+    file.m_size = static_cast<size_t>(st.st_size);
+    if (file.m_size == 0) {
+        close(fd);
+        return file;
+    }
+    void* p = mmap(nullptr, file.m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        throw_os_error("mmap", path);
+    }
+    file.m_data = static_cast<const uint8_t*>(p);
+#endif
+    return file;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        Close();
+        m_path = std::move(other.m_path);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+#ifdef _WIN32
+        m_handle = std::exchange(other.m_handle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_handle != nullptr) {
+        CloseHandle(m_handle);
+        m_handle = nullptr;
+    }
+#else
+    if (m_data != nullptr) {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Named shared memory: a pagefile-backed file mapping on Windows ("Local\<name>"),
+// POSIX shm_open + mmap elsewhere ("/<name>").
+class SharedMemory
+{
+public:
+    // Creates the named region, zero filled. Throws std::runtime_error if the name is
+    // taken, also by a region a crashed process left behind on POSIX (see Remove).
+    // The creator unlinks the name on destruction.
+    static SharedMemory Create(const std::string& name, size_t size);
+    // Maps an existing region read-only.
+    static SharedMemory Open(const std::string& name);
+    // Unlinks the name of a region nobody owns anymore; mappings of it stay valid.
+    // No-op on Windows, where a region goes away with its last handle.
+    static void Remove(const std::string& name);
+
+    SharedMemory() = default;
+    SharedMemory(SharedMemory&& other) noexcept;
+    SharedMemory& operator=(SharedMemory&& other) noexcept;
+    ~SharedMemory() { Close(); }
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    void Close();
+
+    uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+    const std::string& Name() const { return m_name; }
+
+private:
+    std::string m_name;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_owner = false;
+#ifdef _WIN32
+    void* m_handle = nullptr;
+#endif
+};
+
+// A whole file mapped read-only (CreateFileMapping / mmap).
+// Pages are loaded on first touch, so opening costs nothing per byte.
+class MappedFile
+{
+public:
+    // path is UTF-8. Throws std::runtime_error if the file cannot be opened or mapped.
+    static MappedFile Open(const std::string& path);
+
+    MappedFile() = default;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void Close();
+
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+    const std::string& Path() const { return m_path; }
+
+private:
+    std::string m_path;
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_handle = nullptr;
+#endif
+};
@@ -0,0 +1,248 @@
+#include "stdafx.h"
+#include "ObjectDetect.h"
+#include "LatencyStats.h"
+#include "TaskPool.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+    // cv::CascadeClassifier::detectMultiScale groups with this too
+    constexpr double kGroupEps = 0.2;
+
+    cv::Mat to_gray(const cv::Mat& image)
+    {
+        if (image.channels() == 1) {
+            return image;
+        }
+        if (image.channels() != 3 && image.channels() != 4) {
+            throw std::invalid_argument("Unsupported channel count");
+        }
+        cv::Mat gray;
+        cv::cvtColor(image, gray, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        return gray;
+    }
+
+    // 0 = no limit
+    cv::Size side_size(int side)
+    {
+        return cv::Size(side, side);
+    }
+
+    struct Level
+    {
+        int index;
+        double factor;
+    };
+
+    // Levels whose window fits in size and in [min_size, max_size] (pixels of that image).
+    std::vector<Level> pyramid(cv::Size window, cv::Size size, double scale_factor, double min_size, double max_size)
+    {
+        std::vector<Level> levels;
+        double factor = 1;
+        for (int index = 0; ; index++, factor *= scale_factor) {
+            cv::Size scaled(cvRound(window.width * factor), cvRound(window.height * factor));
+            if (scaled.width > size.width || scaled.height > size.height) {
+                break;
+            }
+            if (max_size > 0 && (scaled.width > max_size || scaled.height > max_size)) {
+                break;
+            }
+            if (scaled.width < min_size || scaled.height < min_size) {
+                continue;
+            }
+            levels.push_back({ index, factor });
+        }
+        return levels;
+    }
+}
+
+std::shared_ptr<Cascade> Cascade::Load(const std::string& path)
+{
+    std::ifstream file(std::filesystem::u8path(path), std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open cascade file: " + path);
+    }
+    std::string xml((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return std::shared_ptr<Cascade>(new Cascade(std::move(xml)));
+}
+
+Cascade::Cascade(std::string xml) : m_xml(std::move(xml))
+{
+    auto classifier = Parse();
+    m_windowSize = classifier->getOriginalWindowSize();
+    m_free.push_back(std::move(classifier));
+}
+
+Cascade::Classifier Cascade::Parse() const
+{
+    cv::FileStorage storage(m_xml, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    auto classifier = std::make_unique<cv::CascadeClassifier>();
+    if (!storage.isOpened() || !classifier->read(storage.getFirstTopLevelNode())) {
+        throw std::runtime_error("Not a cascade file");
+    }
+    return classifier;
+}
+
+Cascade::Classifier Cascade::Acquire() const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_free.empty()) {
+            auto classifier = std::move(m_free.back());
+            m_free.pop_back();
+            return classifier;
+        }
+    }
+    DOLLSAI_TIME_SCOPE("detect.parse");
+    return Parse();
+}
+
+void Cascade::Release(Classifier classifier) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(std::move(classifier));
+}
+
+std::vector<Detection> Cascade::Detect(const cv::Mat& image, const DetectOptions& options) const
+{
+    if (!(options.scale_factor > 1)) {
+        throw std::invalid_argument("scale_factor must be greater than 1");
+    }
+    if (!(options.downscale > 0 && options.downscale <= 1)) {
+        throw std::invalid_argument("downscale must be in (0, 1]");
+    }
+
+    cv::Mat gray = to_gray(image);
+    if (options.downscale < 1) {
+        DOLLSAI_TIME_SCOPE("detect.downscale");
+        cv::Mat small;
+        cv::resize(gray, small, cv::Size(), options.downscale, options.downscale, cv::INTER_AREA);
+        gray = small;
+    }
+    auto levels = pyramid(m_windowSize, gray.size(), options.scale_factor,
+        options.min_size * options.downscale, options.max_size * options.downscale);
+
+    struct Hits
+    {
+        std::vector<cv::Rect> rects;
+        std::vector<int> stages;
+        std::vector<double> weights;
+    };
+    // Each level is its own single scale detectMultiScale (min size = max size = window).
+    // A classifier that throws is not put back, the next Acquire parses a fresh one.
+    auto run_level = [&](size_t i) {
+        const double factor = levels[i].factor;
+        cv::Mat scaled = gray;
+        if (levels[i].index != 0) {
+            cv::resize(gray, scaled, cv::Size(cvRound(gray.cols / factor), cvRound(gray.rows / factor)),
+                0, 0, cv::INTER_LINEAR);
+        }
+        Hits hits;
+        auto classifier = Acquire();
+        classifier->detectMultiScale(scaled, hits.rects, hits.stages, hits.weights,
+            options.scale_factor, 0, 0, m_windowSize, m_windowSize, true);
+        Release(std::move(classifier));
+        // back to pixels of image
+        const double to_image = factor / options.downscale;
+        for (auto& r : hits.rects) {
+            r = cv::Rect(cvRound(r.x * to_image), cvRound(r.y * to_image),
+                cvRound(r.width * to_image), cvRound(r.height * to_image));
+        }
+        return hits;
+    };
+    std::vector<Hits> per_level;
+    {
+        DOLLSAI_TIME_SCOPE("detect.levels");
+        if (options.pool != nullptr) {
+            per_level = parallel_map<Hits>(*options.pool, levels.size(), run_level);
+        }
+        else {
+            for (size_t i = 0; i < levels.size(); i++) {
+                per_level.push_back(run_level(i));
+            }
+        }
+    }
+
+    // in level order, whichever thread ran what, so the grouping is the same every time
+    Hits all;
+    for (auto& hits : per_level) {
+        all.rects.insert(all.rects.end(), hits.rects.begin(), hits.rects.end());
+        all.stages.insert(all.stages.end(), hits.stages.begin(), hits.stages.end());
+        all.weights.insert(all.weights.end(), hits.weights.begin(), hits.weights.end());
+    }
+    cv::groupRectangles(all.rects, all.stages, all.weights, options.min_neighbors, kGroupEps);
+
+    std::vector<Detection> detections;
+    const double window = m_windowSize.width / options.downscale;
+    for (size_t i = 0; i < all.rects.size(); i++) {
+        const auto& r = all.rects[i];
+        int level = cvRound(std::log(r.width / window) / std::log(options.scale_factor));
+        detections.push_back({ r, (std::max)(level, 0), i < all.weights.size() ? all.weights[i] : 0.0 });
+    }
+    return detections;
+}
+
+std::vector<cv::Rect> Cascade::DetectNaive(const cv::Mat& image, const DetectOptions& options) const
+{
+    std::vector<cv::Rect> rects;
+    auto classifier = Acquire();
+    classifier->detectMultiScale(image, rects, options.scale_factor, options.min_neighbors, 0,
+        side_size(options.min_size), side_size(options.max_size));
+    Release(std::move(classifier));
+    return rects;
+}
+
+void CascadeRegistry::AddDir(const std::string& dir)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_dirs.push_back(dir);
+}
+
+std::shared_ptr<const Cascade> CascadeRegistry::Find(const std::string& name)
+{
+    namespace fs = std::filesystem;
+    // loaded under the lock, so a cascade asked for by several requests is read once
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_cascades.find(name);
+    if (it != m_cascades.end()) {
+        return it->second;
+    }
+
+    fs::path found;
+    if (fs::u8path(name).extension() == ".xml" && fs::is_regular_file(fs::u8path(name))) {
+        found = fs::u8path(name);
+    }
+    for (const auto& dir : m_dirs) {
+        for (const char* sub : { "", "haarcascades", "lbpcascades" }) {
+            if (found.empty()) {
+                auto path = fs::u8path(dir) / sub / fs::u8path(name + ".xml");
+                if (fs::is_regular_file(path)) {
+                    found = path;
+                }
+            }
+        }
+    }
+    if (found.empty()) {
+        throw std::runtime_error("Unknown cascade: " + name);
+    }
+    std::shared_ptr<const Cascade> cascade = Cascade::Load(found.u8string());
+    m_cascades[name] = cascade;
+    return cascade;
+}
+
+std::vector<std::string> CascadeRegistry::Names() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> names;
+    for (const auto& entry : m_cascades) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/objdetect.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TaskPool;
+
+struct DetectOptions
+{
+    // size ratio of neighbouring pyramid levels
+    double scale_factor = 1.1;
+    // overlapping raw hits needed for a detection
+    int min_neighbors = 3;
+    // object size limits in pixels of the given image, 0 = the window size / no limit
+    int min_size = 0;
+    int max_size = 0;
+    // the image is resized by this (0 < downscale <= 1) before the pyramid is built;
+    // boxes are still in pixels of the given image
+    double downscale = 1.0;
+    // runs the pyramid levels as tasks, if set
+    TaskPool* pool = nullptr;
+};
+
+struct Detection
+{
+    cv::Rect box;
+    // pyramid level the box's size belongs to, 0 = the window size
+    int level;
+    // sum of the last stage, higher is surer
+    double weight;
+};
+
+// A Haar or LBP cascade file, read once. cv::CascadeClassifier keeps scratch buffers
+// and may not be used by two threads at a time, so the parsed classifiers are kept in
+// a free list: a detection takes one per running pyramid level and puts it back.
+// More are parsed from the kept XML only when more levels run at the same time.
+class Cascade
+{
+public:
+    // throws std::runtime_error if the file is missing or not a cascade
+    static std::shared_ptr<Cascade> Load(const std::string& path);
+
+    cv::Size WindowSize() const { return m_windowSize; }
+
+    // image: 8 bit gray, BGR or BGRA. Every pyramid level is searched at the window
+    // size on its own resized image, then the raw hits of all levels are grouped.
+    std::vector<Detection> Detect(const cv::Mat& image, const DetectOptions& options) const;
+    // What Detect is measured against: one cv::CascadeClassifier::detectMultiScale call
+    // with the same scale_factor, min_neighbors and sizes, ignoring downscale and pool.
+    std::vector<cv::Rect> DetectNaive(const cv::Mat& image, const DetectOptions& options) const;
+
+private:
+    using Classifier = std::unique_ptr<cv::CascadeClassifier>;
+
+    explicit Cascade(std::string xml);
+    Classifier Acquire() const;
+    void Release(Classifier classifier) const;
+    Classifier Parse() const;
+
+    std::string m_xml;
+    cv::Size m_windowSize;
+    mutable std::mutex m_mutex;
+    mutable std::vector<Classifier> m_free;
+};
+
+// Cascades by name, each loaded on first use and kept.
+class CascadeRegistry
+{
+public:
+    // Names are looked up as <dir>/<name>.xml and <dir>/{haarcascades,lbpcascades}/<name>.xml.
+    void AddDir(const std::string& dir);
+
+    // name: as above, or a path to an .xml file. Throws std::runtime_error if not found.
+    std::shared_ptr<const Cascade> Find(const std::string& name);
+    // names loaded so far
+    std::vector<std::string> Names() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<std::string> m_dirs;
+    std::unordered_map<std::string, std::shared_ptr<const Cascade>> m_cascades;
+};
@@ -0,0 +1,248 @@
+#include "stdafx.h"
+#include "PixelConvert.h"
+
+#include <stdexcept>
+#include <string.h>
+
+namespace {
+    // cv::cvtColor BGR2GRAY weights (0.114, 0.587, 0.299) in 14 bit fixed point; they sum to 1 << 14.
+    constexpr int kGrayB = 1868;
+    constexpr int kGrayG = 9617;
+    constexpr int kGrayR = 4899;
+    constexpr int kGrayShift = 14;
+
+    using RowFunc = void (*)(const uint8_t* src, uint8_t* dst, int width);
+
+    void copy_row(const uint8_t* src, uint8_t* dst, int width)
+    {
+        memcpy(dst, src, 4 * static_cast<size_t>(width));
+    }
+
+    void bgr_scalar(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++) {
+            dst[3 * x + 0] = src[4 * x + 0];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x + 2];
+        }
+    }
+
+    void rgb_scalar(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++) {
+            dst[3 * x + 0] = src[4 * x + 2];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x + 0];
+        }
+    }
+
+    void gray_scalar(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++) {
+            int v = src[4 * x + 0] * kGrayB + src[4 * x + 1] * kGrayG + src[4 * x + 2] * kGrayR;
+            dst[x] = static_cast<uint8_t>((v + (1 << (kGrayShift - 1))) >> kGrayShift);
+        }
+    }
+
+#ifdef DOLLSAI_SIMD_X86
+    // 16 pixels per iteration: each BGRA quad is packed to 12 bytes, then the four
+    // 12 byte pieces are stitched into three 16 byte stores.
+    DOLLSAI_TARGET("ssse3")
+    void pack3_ssse3(const uint8_t* src, uint8_t* dst, int width, __m128i mask, RowFunc tail)
+    {
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const __m128i* s = reinterpret_cast<const __m128i*>(src + 4 * x);
+            __m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128(s + 0), mask);
+            __m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128(s + 1), mask);
+            __m128i s2 = _mm_shuffle_epi8(_mm_loadu_si128(s + 2), mask);
+            __m128i s3 = _mm_shuffle_epi8(_mm_loadu_si128(s + 3), mask);
+
+            __m128i* d = reinterpret_cast<__m128i*>(dst + 3 * x);
+            _mm_storeu_si128(d + 0, _mm_or_si128(s0, _mm_slli_si128(s1, 12)));
+            _mm_storeu_si128(d + 1, _mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8)));
+            _mm_storeu_si128(d + 2, _mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4)));
+        }
+        tail(src + 4 * x, dst + 3 * x, width - x);
+    }
+
+    DOLLSAI_TARGET("ssse3")
+    void bgr_ssse3(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        pack3_ssse3(src, dst, width, mask, bgr_scalar);
+    }
+
+    DOLLSAI_TARGET("ssse3")
+    void rgb_ssse3(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i mask = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        pack3_ssse3(src, dst, width, mask, rgb_scalar);
+    }
+
+    DOLLSAI_TARGET("ssse3")
+    void gray_ssse3(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i coef = _mm_setr_epi16(kGrayB, kGrayG, kGrayR, 0, kGrayB, kGrayG, kGrayR, 0);
+        const __m128i round = _mm_set1_epi32(1 << (kGrayShift - 1));
+        const __m128i zero = _mm_setzero_si128();
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i sum[4];
+            for (int i = 0; i < 4; i++) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x) + i);
+                // (B*kB + G*kG, R*kR + A*0) per pixel, then horizontal add of the pairs
+                __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), coef);
+                __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), coef);
+                sum[i] = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), round), kGrayShift);
+            }
+            __m128i w0 = _mm_packs_epi32(sum[0], sum[1]);
+            __m128i w1 = _mm_packs_epi32(sum[2], sum[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(w0, w1));
+        }
+        gray_scalar(src + 4 * x, dst + x, width - x);
+    }
+
+    // 8 pixels per iteration: in-lane shuffle leaves 12 bytes in each 128 bit lane,
+    // permute makes them contiguous and the 24 bytes are stored as 16 + 8.
+    DOLLSAI_TARGET("avx2")
+    void pack3_avx2(const uint8_t* src, uint8_t* dst, int width, __m256i mask, RowFunc tail)
+    {
+        const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+            v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), compact);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x), _mm256_castsi256_si128(v));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 3 * x + 16), _mm256_extracti128_si256(v, 1));
+        }
+        tail(src + 4 * x, dst + 3 * x, width - x);
+    }
+
+    DOLLSAI_TARGET("avx2")
+    void bgr_avx2(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m256i mask = _mm256_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        pack3_avx2(src, dst, width, mask, bgr_scalar);
+    }
+
+    DOLLSAI_TARGET("avx2")
+    void rgb_avx2(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m256i mask = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        pack3_avx2(src, dst, width, mask, rgb_scalar);
+    }
+
+    DOLLSAI_TARGET("avx2")
+    void gray_avx2(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m256i coef = _mm256_setr_epi16(
+            kGrayB, kGrayG, kGrayR, 0, kGrayB, kGrayG, kGrayR, 0,
+            kGrayB, kGrayG, kGrayR, 0, kGrayB, kGrayG, kGrayR, 0);
+        const __m256i round = _mm256_set1_epi32(1 << (kGrayShift - 1));
+        const __m256i zero = _mm256_setzero_si256();
+        // packs/packus interleave the two lanes, this restores pixel order
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        int x = 0;
+        for (; x + 32 <= width; x += 32) {
+            __m256i sum[4];
+            for (int i = 0; i < 4; i++) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x) + i);
+                __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(v, zero), coef);
+                __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(v, zero), coef);
+                sum[i] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), round), kGrayShift);
+            }
+            __m256i w0 = _mm256_packs_epi32(sum[0], sum[1]);
+            __m256i w1 = _mm256_packs_epi32(sum[2], sum[3]);
+            __m256i b = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(w0, w1), order);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), b);
+        }
+        gray_ssse3(src + 4 * x, dst + x, width - x);
+    }
+#endif
+
+    RowFunc select_kernel(PixelFormat format, SimdLevel level)
+    {
+        if (level > simd_level()) {
+            level = simd_level();
+        }
+        switch (format) {
+        case PixelFormat::BGRA:
+            return copy_row;
+#ifdef DOLLSAI_SIMD_X86
+        case PixelFormat::BGR:
+            return level == SimdLevel::AVX2 ? bgr_avx2 : level == SimdLevel::SSSE3 ? bgr_ssse3 : bgr_scalar;
+        case PixelFormat::RGB:
+            return level == SimdLevel::AVX2 ? rgb_avx2 : level == SimdLevel::SSSE3 ? rgb_ssse3 : rgb_scalar;
+        case PixelFormat::Gray:
+            return level == SimdLevel::AVX2 ? gray_avx2 : level == SimdLevel::SSSE3 ? gray_ssse3 : gray_scalar;
+#else
+        case PixelFormat::BGR:
+            return bgr_scalar;
+        case PixelFormat::RGB:
+            return rgb_scalar;
+        case PixelFormat::Gray:
+            return gray_scalar;
+#endif
+        default:
+            throw std::invalid_argument("Unknown pixel format");
+        }
+    }
+}
+
+const char* pixel_format_name(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::BGRA:
+        return "bgra";
+    case PixelFormat::BGR:
+        return "bgr";
+    case PixelFormat::RGB:
+        return "rgb";
+    case PixelFormat::Gray:
+        return "gray";
+    default:
+        return "unknown";
+    }
+}
+
+PixelFormat parse_pixel_format(const std::string& name)
+{
+    for (auto format : { PixelFormat::BGRA, PixelFormat::BGR, PixelFormat::RGB, PixelFormat::Gray }) {
+        if (name == pixel_format_name(format)) {
+            return format;
+        }
+    }
+    throw std::runtime_error("Unknown pixel format: " + name);
+}
+
+void convert_bgra_row(const uint8_t* src, uint8_t* dst, int width, PixelFormat dst_format)
+{
+    select_kernel(dst_format, simd_level())(src, dst, width);
+}
+
+void convert_bgra(
+    const uint8_t* src, size_t src_pitch,
+    uint8_t* dst, size_t dst_pitch,
+    int width, int height, PixelFormat dst_format)
+{
+    convert_bgra(src, src_pitch, dst, dst_pitch, width, height, dst_format, simd_level());
+}
+
+void convert_bgra(
+    const uint8_t* src, size_t src_pitch,
+    uint8_t* dst, size_t dst_pitch,
+    int width, int height, PixelFormat dst_format, SimdLevel level)
+{
+    RowFunc kernel = select_kernel(dst_format, level);
+    for (int y = 0; y < height; y++) {
+        kernel(src + y * src_pitch, dst + y * dst_pitch, width);
+    }
+}
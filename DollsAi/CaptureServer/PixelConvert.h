@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+enum class PixelFormat : uint8_t {
+    BGRA,
+    BGR,
+    RGB,
+    Gray,
+};
+
+constexpr int bytes_per_pixel(PixelFormat format)
+{
+    return format == PixelFormat::BGRA ? 4 : format == PixelFormat::Gray ? 1 : 3;
+}
+
+const char* pixel_format_name(PixelFormat format);
+// throws std::runtime_error on unknown name
+PixelFormat parse_pixel_format(const std::string& name);
+
+// BGRA (capture texture layout) to any PixelFormat.
+// Gray uses the same fixed point weights as cv::cvtColor(BGR2GRAY).
+void convert_bgra_row(const uint8_t* src, uint8_t* dst, int width, PixelFormat dst_format);
+
+// src_pitch/dst_pitch are bytes per row, e.g. D3D11_MAPPED_SUBRESOURCE::RowPitch and cv::Mat::step.
+void convert_bgra(
+    const uint8_t* src, size_t src_pitch,
+    uint8_t* dst, size_t dst_pitch,
+    int width, int height, PixelFormat dst_format);
+
+// Same as above with an explicit kernel set, for comparing SIMD paths with the scalar one.
+// level must not exceed simd_level().
+void convert_bgra(
+    const uint8_t* src, size_t src_pitch,
+    uint8_t* dst, size_t dst_pitch,
+    int width, int height, PixelFormat dst_format, SimdLevel level);
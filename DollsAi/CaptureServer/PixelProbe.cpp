@@ -0,0 +1,193 @@
+#include "stdafx.h"
+#include "PixelProbe.h"
+
+#include <limits>
+#include <stdexcept>
+#include <string.h>
+
+namespace {
+    constexpr size_t kLanes = 8;
+
+    // 0xRRGGBB from the pixel at p
+    uint32_t load_rgb(const uint8_t* p, PixelFormat format)
+    {
+        switch (format) {
+        case PixelFormat::RGB:
+            return static_cast<uint32_t>(p[0]) << 16 | p[1] << 8 | p[2];
+        case PixelFormat::Gray:
+            return p[0] * 0x010101u;
+        default:
+            // B, G, R in memory is 0xRRGGBB little endian
+            return static_cast<uint32_t>(p[2]) << 16 | p[1] << 8 | p[0];
+        }
+    }
+
+    bool within(uint32_t a, uint32_t b, uint32_t tolerance)
+    {
+        for (int shift = 0; shift < 24; shift += 8) {
+            int d = static_cast<int>((a >> shift) & 0xff) - static_cast<int>((b >> shift) & 0xff);
+            if ((d < 0 ? -d : d) > static_cast<int>((tolerance >> shift) & 0xff)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef DOLLSAI_SIMD_X86
+    // Gathers 32 bits per probe, 1 to 3 bytes past the pixel for BGR/RGB/gray; the
+    // pool's readable slack after the last row covers that.
+    DOLLSAI_TARGET("avx2")
+    void probe_avx2(const Frame& frame, const int32_t* xs, const int32_t* ys, const uint32_t* rgbs,
+        const uint32_t* tolerances, size_t count, uint32_t* colors, uint8_t* hits)
+    {
+        const int bpp = bytes_per_pixel(frame.Format());
+        const __m256i width = _mm256_set1_epi32(frame.Width());
+        const __m256i height = _mm256_set1_epi32(frame.Height());
+        const __m256i stride = _mm256_set1_epi32(static_cast<int>(frame.Stride()));
+        const __m256i pixel = _mm256_set1_epi32(bpp);
+        const __m256i minus_one = _mm256_set1_epi32(-1);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i to_rgb;
+        switch (frame.Format()) {
+        case PixelFormat::RGB:
+            to_rgb = _mm256_setr_epi8(
+                2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+                2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+            break;
+        case PixelFormat::Gray:
+            to_rgb = _mm256_setr_epi8(
+                0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1,
+                0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+            break;
+        default:
+            to_rgb = _mm256_setr_epi8(
+                0, 1, 2, -1, 4, 5, 6, -1, 8, 9, 10, -1, 12, 13, 14, -1,
+                0, 1, 2, -1, 4, 5, 6, -1, 8, 9, 10, -1, 12, 13, 14, -1);
+            break;
+        }
+        const int* base = reinterpret_cast<const int*>(frame.Data());
+
+        for (size_t i = 0; i < count; i += kLanes) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i));
+            __m256i valid = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi32(x, minus_one), _mm256_cmpgt_epi32(width, x)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(y, minus_one), _mm256_cmpgt_epi32(height, y)));
+            __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(y, stride), _mm256_mullo_epi32(x, pixel));
+            __m256i raw = _mm256_mask_i32gather_epi32(zero, base, offset, valid, 1);
+            __m256i rgb = _mm256_shuffle_epi8(raw, to_rgb);
+
+            __m256i expected = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgbs + i));
+            __m256i tolerance = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tolerances + i));
+            __m256i diff = _mm256_max_epu8(_mm256_subs_epu8(rgb, expected), _mm256_subs_epu8(expected, rgb));
+            __m256i ok = _mm256_cmpeq_epi8(_mm256_min_epu8(diff, tolerance), diff);
+            __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(ok, minus_one), valid);
+
+            if (colors != nullptr) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(colors + i), rgb);
+            }
+            if (hits != nullptr) {
+                int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+                for (size_t lane = 0; lane < kLanes; lane++) {
+                    hits[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+                }
+            }
+        }
+    }
+#endif
+}
+
+size_t ProbeSet::Add(int x, int y, uint32_t rgb, int tolerance)
+{
+    if (tolerance < 0 || tolerance > 255) {
+        throw std::invalid_argument("Probe tolerance must be 0..255");
+    }
+    size_t index = m_count++;
+    if (index == m_x.size()) {
+        // a whole block of padding probes, never inside a frame
+        m_x.resize(index + kLanes, -1);
+        m_y.resize(index + kLanes, -1);
+        m_rgb.resize(index + kLanes, 0);
+        m_tolerance.resize(index + kLanes, 0);
+    }
+    m_x[index] = x;
+    m_y[index] = y;
+    m_rgb[index] = rgb & 0xffffff;
+    m_tolerance[index] = static_cast<uint32_t>(tolerance) * 0x010101u;
+    return index;
+}
+
+void ProbeSet::AddPredicate(Predicate predicate)
+{
+    for (auto index : predicate.probes) {
+        if (index >= m_count) {
+            throw std::out_of_range("Predicate " + predicate.name + " uses unknown probe " + std::to_string(index));
+        }
+    }
+    m_predicates.push_back(std::move(predicate));
+}
+
+void ProbeSet::Evaluate(const Frame& frame, uint32_t* colors, uint8_t* hits) const
+{
+    Evaluate(frame, colors, hits, simd_level());
+}
+
+void ProbeSet::Evaluate(const Frame& frame, uint32_t* colors, uint8_t* hits, SimdLevel level) const
+{
+#ifdef DOLLSAI_SIMD_X86
+    // 32 bit gather offsets
+    bool small = frame.Stride() * frame.Height() <= static_cast<size_t>((std::numeric_limits<int32_t>::max)());
+    if (level >= SimdLevel::AVX2 && small && m_count > 0) {
+        // the kernel writes whole blocks, the caller's arrays only have m_count entries
+        size_t blocks = m_count / kLanes * kLanes;
+        if (blocks > 0) {
+            probe_avx2(frame, m_x.data(), m_y.data(), m_rgb.data(), m_tolerance.data(), blocks, colors, hits);
+        }
+        if (blocks < m_count) {
+            uint32_t tail_colors[kLanes];
+            uint8_t tail_hits[kLanes];
+            probe_avx2(frame, m_x.data() + blocks, m_y.data() + blocks, m_rgb.data() + blocks,
+                m_tolerance.data() + blocks, kLanes, tail_colors, tail_hits);
+            for (size_t i = blocks; i < m_count; i++) {
+                if (colors != nullptr) {
+                    colors[i] = tail_colors[i - blocks];
+                }
+                if (hits != nullptr) {
+                    hits[i] = tail_hits[i - blocks];
+                }
+            }
+        }
+        return;
+    }
+#endif
+    const int bpp = bytes_per_pixel(frame.Format());
+    for (size_t i = 0; i < m_count; i++) {
+        int x = m_x[i];
+        int y = m_y[i];
+        bool inside = x >= 0 && x < frame.Width() && y >= 0 && y < frame.Height();
+        uint32_t rgb = inside ? load_rgb(frame.Row(y) + static_cast<size_t>(x) * bpp, frame.Format()) : 0;
+        if (colors != nullptr) {
+            colors[i] = rgb;
+        }
+        if (hits != nullptr) {
+            hits[i] = inside && within(rgb, m_rgb[i], m_tolerance[i]) ? 1 : 0;
+        }
+    }
+}
+
+std::vector<bool> ProbeSet::EvaluatePredicates(const uint8_t* hits) const
+{
+    std::vector<bool> result;
+    result.reserve(m_predicates.size());
+    for (const auto& predicate : m_predicates) {
+        bool value = !predicate.any;
+        for (auto index : predicate.probes) {
+            if ((hits[index] != 0) == predicate.any) {
+                value = predicate.any;
+                break;
+            }
+        }
+        result.push_back(value);
+    }
+    return result;
+}
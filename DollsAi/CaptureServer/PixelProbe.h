@@ -0,0 +1,48 @@
+#pragma once
+
+#include "FramePool.h"
+
+#include <string>
+#include <vector>
+
+// A batch of "is pixel (x, y) close to this color" checks, kept in SoA form so the
+// AVX2 path gathers and compares 8 probes at a time straight from the frame buffer.
+// Colors are 0xRRGGBB whatever the frame format (gray reads as r = g = b).
+// A probe hits if every channel differs by at most its tolerance.
+class ProbeSet
+{
+public:
+    // A named AND (all) or OR (any) over probe indices.
+    struct Predicate
+    {
+        std::string name;
+        bool any;
+        std::vector<uint32_t> probes;
+    };
+
+    size_t Add(int x, int y, uint32_t rgb, int tolerance);
+    // throws std::out_of_range on a probe index that does not exist
+    void AddPredicate(Predicate predicate);
+
+    size_t Size() const { return m_count; }
+    const std::vector<Predicate>& Predicates() const { return m_predicates; }
+
+    // colors[i] = sampled 0xRRGGBB (0 for probes outside the frame, which never hit),
+    // hits[i] = 1 if within tolerance. Either may be null. Reads nothing but the probed pixels.
+    void Evaluate(const Frame& frame, uint32_t* colors, uint8_t* hits) const;
+    // Same with an explicit kernel set; level must not exceed simd_level().
+    void Evaluate(const Frame& frame, uint32_t* colors, uint8_t* hits, SimdLevel level) const;
+
+    // predicate results in Predicates() order, from the hits of Evaluate
+    std::vector<bool> EvaluatePredicates(const uint8_t* hits) const;
+
+private:
+    // padded to a multiple of 8 with probes outside any frame, m_count are real
+    std::vector<int32_t> m_x;
+    std::vector<int32_t> m_y;
+    std::vector<uint32_t> m_rgb;
+    // tolerance in each color byte
+    std::vector<uint32_t> m_tolerance;
+    size_t m_count = 0;
+    std::vector<Predicate> m_predicates;
+};
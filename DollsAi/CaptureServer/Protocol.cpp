@@ -0,0 +1,244 @@
+#include "stdafx.h"
+#include "Protocol.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace {
+    // anything larger means the stream is out of sync
+    constexpr uint32_t kMaxDocSize = 64 * 1024 * 1024;
+    constexpr uint32_t kMaxAttachmentSize = 512 * 1024 * 1024;
+
+    bool read_exact(FILE* fp, void* dst, size_t size)
+    {
+        return fread(dst, 1, size, fp) == size;
+    }
+
+    uint32_t load_le32(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    void store_le32(uint8_t* p, uint32_t v)
+    {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+        p[2] = static_cast<uint8_t>(v >> 16);
+        p[3] = static_cast<uint8_t>(v >> 24);
+    }
+}
+
+const char* wire_mode_name(WireMode mode)
+{
+    switch (mode) {
+    case WireMode::Cbor:
+        return "cbor";
+    case WireMode::MsgPack:
+        return "msgpack";
+    default:
+        return "text";
+    }
+}
+
+WireMode parse_wire_mode(const std::string& name)
+{
+    for (auto mode : { WireMode::Text, WireMode::Cbor, WireMode::MsgPack }) {
+        if (name == wire_mode_name(mode)) {
+            return mode;
+        }
+    }
+    throw std::runtime_error("Unknown protocol mode: " + name);
+}
+
+void CommandStream::Write(nlohmann::json body, const std::vector<Attachment>& attachments)
+{
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    WriteMessage(std::move(body), attachments);
+}
+
+void CommandStream::Push(nlohmann::json body)
+{
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    WriteMessage(std::move(body), {});
+}
+
+void CommandStream::WriteSwitching(nlohmann::json body, WireMode mode, bool pretty)
+{
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    WriteMessage(std::move(body), {});
+    if (mode != m_mode) {
+        ModeChanged(mode);
+    }
+    m_mode = mode;
+    m_pretty = pretty;
+}
+
+void CommandStream::WriteMessage(nlohmann::json body, const std::vector<Attachment>& attachments)
+{
+    std::vector<uint8_t> head;
+    if (m_mode == WireMode::Text) {
+        if (!attachments.empty()) {
+            throw std::logic_error("Attachments need a binary protocol");
+        }
+        auto str = m_pretty ? body.dump(2) : body.dump();
+        head.reserve(str.size() + 2);
+        head.assign(str.begin(), str.end());
+        head.push_back('\n');
+        head.push_back('\n');
+    }
+    else {
+        size_t attachment_size = 0;
+        if (!attachments.empty()) {
+            auto sizes = nlohmann::json::array();
+            for (const auto& a : attachments) {
+                sizes.push_back(a.size);
+                attachment_size += a.size;
+            }
+            body["attachments"] = std::move(sizes);
+        }
+
+        // header first, the document is appended behind it
+        head.resize(8);
+        if (m_mode == WireMode::Cbor) {
+            nlohmann::json::to_cbor(body, head);
+        }
+        else {
+            nlohmann::json::to_msgpack(body, head);
+        }
+        store_le32(head.data(), static_cast<uint32_t>(head.size() - 8));
+        store_le32(head.data() + 4, static_cast<uint32_t>(attachment_size));
+    }
+    Send(std::move(head), attachments);
+}
+
+size_t CommandStream::Decode(const uint8_t* data, size_t size, Request& request)
+{
+    request.attachment.clear();
+    if (m_mode == WireMode::Text) {
+        // a message arriving in many reads is searched once, not once per read
+        for (size_t i = (std::max)(size_t(1), m_scanned <= size ? m_scanned : 0); i < size; i++) {
+            if (data[i] == '\n' && data[i - 1] == '\n') {
+                m_scanned = 0;
+                request.body = nlohmann::json::parse(data, data + i + 1, nullptr, false);
+                return i + 1;
+            }
+        }
+        if (size > kMaxDocSize) {
+            m_scanned = 0;
+            throw std::runtime_error("Request too large");
+        }
+        m_scanned = size;
+        return 0;
+    }
+
+    if (size < 8) {
+        return 0;
+    }
+    uint32_t doc_size = load_le32(data);
+    uint32_t attachment_size = load_le32(data + 4);
+    if (doc_size > kMaxDocSize || attachment_size > kMaxAttachmentSize) {
+        throw std::runtime_error("Broken message header");
+    }
+    size_t total = 8 + static_cast<size_t>(doc_size) + attachment_size;
+    if (size < total) {
+        return 0;
+    }
+    const uint8_t* doc = data + 8;
+    if (m_mode == WireMode::Cbor) {
+        request.body = nlohmann::json::from_cbor(doc, doc + doc_size, true, false);
+    }
+    else {
+        request.body = nlohmann::json::from_msgpack(doc, doc + doc_size, true, false);
+    }
+    request.attachment.assign(doc + doc_size, data + total);
+    return total;
+}
+
+FileCommandStream::FileCommandStream(FILE* in, FILE* out) : m_in(in), m_out(out)
+{
+}
+
+bool FileCommandStream::Read(Request& request)
+{
+    request.attachment.clear();
+    return Mode() == WireMode::Text ? ReadText(request) : ReadBinary(request);
+}
+
+bool FileCommandStream::ReadText(Request& request)
+{
+    m_text.clear();
+    bool too_large = false;
+    do {
+        char buf[4096];
+        if (fgets(buf, sizeof(buf), m_in) == nullptr) {
+            // Error or EOF
+            return false;
+        }
+        if (m_text.size() > kMaxDocSize) {
+            // skip to the end of the message, only the last byte matters for the terminator
+            m_text.erase(0, m_text.size() - 1);
+            too_large = true;
+        }
+        m_text += buf;
+        // wait for "...\n\n"
+    } while (m_text.size() < 2 || m_text[m_text.size() - 1] != '\n' || m_text[m_text.size() - 2] != '\n');
+
+    if (too_large) {
+        throw std::runtime_error("Request too large");
+    }
+    request.body = nlohmann::json::parse(m_text);
+    return true;
+}
+
+bool FileCommandStream::ReadBinary(Request& request)
+{
+    uint8_t header[8];
+    if (!read_exact(m_in, header, sizeof(header))) {
+        return false;
+    }
+    uint32_t doc_size = load_le32(header);
+    uint32_t attachment_size = load_le32(header + 4);
+    if (doc_size > kMaxDocSize || attachment_size > kMaxAttachmentSize) {
+        fprintf(stderr, "Broken message header (%u, %u)\n", doc_size, attachment_size);
+        return false;
+    }
+
+    m_doc.resize(doc_size);
+    request.attachment.resize(attachment_size);
+    if (!read_exact(m_in, m_doc.data(), doc_size) ||
+        !read_exact(m_in, request.attachment.data(), attachment_size)) {
+        return false;
+    }
+
+    if (Mode() == WireMode::Cbor) {
+        request.body = nlohmann::json::from_cbor(m_doc);
+    }
+    else {
+        request.body = nlohmann::json::from_msgpack(m_doc);
+    }
+    return true;
+}
+
+void FileCommandStream::Send(std::vector<uint8_t> head, const std::vector<Attachment>& attachments)
+{
+    fwrite(head.data(), 1, head.size(), m_out);
+    for (const auto& a : attachments) {
+        fwrite(a.data, 1, a.size, m_out);
+    }
+    fflush(m_out);
+}
+
+void FileCommandStream::ModeChanged(WireMode mode)
+{
+#ifdef _WIN32
+    // no CRLF translation on binary streams
+    int flag = mode == WireMode::Text ? _O_TEXT : _O_BINARY;
+    _setmode(_fileno(m_in), flag);
+    _setmode(_fileno(m_out), flag);
+#endif
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "FramePool.h"
+
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Text mode (default): a JSON document terminated by an empty line ("...\n\n")
+// in both directions.
+//
+// Binary modes (after set_protocol): every message is
+//   uint32 LE  document size
+//   uint32 LE  attachment size (sum of all attachments)
+//   document   CBOR or MessagePack
+//   attachments, raw and back to back
+// A message with attachments lists their sizes in the document as
+// "attachments": [size, ...].
+// A client must wait for the reply to set_protocol before sending in the new mode.
+enum class WireMode {
+    Text,
+    Cbor,
+    MsgPack,
+};
+
+const char* wire_mode_name(WireMode mode);
+// throws std::runtime_error on unknown name
+WireMode parse_wire_mode(const std::string& name);
+
+// Raw reply payload. `owner` keeps frame pixels alive until they are written,
+// so they go out without being copied into the document.
+struct Attachment
+{
+    const uint8_t* data;
+    size_t size;
+    Frame owner;
+};
+
+struct Request
+{
+    nlohmann::json body;
+    // attachment bytes sent with the request (binary modes only)
+    std::vector<uint8_t> attachment;
+};
+
+// Message framing of one connection in the current WireMode. Subclasses move the
+// bytes: FileCommandStream (stdin/stdout) or a SocketClient.
+// Write and Push may be called from several threads.
+class CommandStream : public std::enable_shared_from_this<CommandStream>
+{
+public:
+    virtual ~CommandStream() = default;
+
+    // a reply
+    void Write(nlohmann::json body, const std::vector<Attachment>& attachments = {});
+    // an event, not in answer to a request
+    void Push(nlohmann::json body);
+
+    // The reply to set_protocol: it still goes out in the current mode, every message
+    // written after it in mode. Replies to other requests may be written meanwhile.
+    void WriteSwitching(nlohmann::json body, WireMode mode, bool pretty);
+
+    WireMode Mode() const { return m_mode; }
+
+    // the peer is gone, nothing written arrives anymore
+    virtual bool Closed() const { return false; }
+    // written messages are piling up unsent, better hold back what can wait
+    virtual bool Congested() const { return false; }
+
+protected:
+    // One encoded message: head is the text, or the header and the document, and
+    // the attachments follow it. Called with the write lock held.
+    virtual void Send(std::vector<uint8_t> head, const std::vector<Attachment>& attachments) = 0;
+    virtual void ModeChanged(WireMode mode) {}
+
+    // Size of the complete message at the front of data, 0 if more bytes are needed.
+    // request.body is discarded (is_discarded()) if the message does not parse.
+    // Throws if the binary header is broken or a text message grows past the size
+    // limit, the stream is out of sync then.
+    // Text is searched only from where the previous call stopped: until a message is
+    // returned, data must start with the same bytes (more may be appended).
+    size_t Decode(const uint8_t* data, size_t size, Request& request);
+
+private:
+    // with the write lock held
+    void WriteMessage(nlohmann::json body, const std::vector<Attachment>& attachments);
+
+    WireMode m_mode = WireMode::Text;
+    bool m_pretty = false;
+    // reading side: bytes of the pending text message already searched for "\n\n"
+    size_t m_scanned = 0;
+
+    std::mutex m_writeMutex;
+};
+
+// Blocking stream on a pair of FILEs. Read is called from one thread.
+class FileCommandStream : public CommandStream
+{
+public:
+    FileCommandStream(FILE* in, FILE* out);
+
+    // Blocks for the next request. Returns false on EOF or an unrecoverable stream
+    // error. Throws if the message was read completely but does not parse.
+    bool Read(Request& request);
+
+protected:
+    void Send(std::vector<uint8_t> head, const std::vector<Attachment>& attachments) override;
+    void ModeChanged(WireMode mode) override;
+
+private:
+    bool ReadText(Request& request);
+    bool ReadBinary(Request& request);
+
+    FILE* m_in;
+    FILE* m_out;
+
+    // reused between messages
+    std::string m_text;
+    std::vector<uint8_t> m_doc;
+};
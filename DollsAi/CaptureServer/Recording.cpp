@@ -0,0 +1,523 @@
+#include "stdafx.h"
+#include "Recording.h"
+#include "LatencyStats.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <string.h>
+
+namespace recording {
+    void ZeroRunEncoder::Append(const uint8_t* data, size_t size)
+    {
+        size_t i = 0;
+        while (i < size) {
+            if (data[i] == 0) {
+                size_t j = i + 1;
+                for (; j + 8 <= size; j += 8) {
+                    uint64_t word;
+                    memcpy(&word, data + j, 8);
+                    if (word != 0) {
+                        break;
+                    }
+                }
+                while (j < size && data[j] == 0) {
+                    j++;
+                }
+                m_zeros += j - i;
+                i = j;
+                continue;
+            }
+            if (m_zeros > 0) {
+                if (m_zeros >= kMinZeroRun) {
+                    FlushLiteral();
+                    PutToken(m_zeros, true);
+                }
+                else {
+                    m_literal.insert(m_literal.end(), m_zeros, 0);
+                }
+                m_zeros = 0;
+            }
+            size_t j = i + 1;
+            while (j < size && data[j] != 0) {
+                j++;
+            }
+            m_literal.insert(m_literal.end(), data + i, data + j);
+            i = j;
+        }
+    }
+
+    void ZeroRunEncoder::Finish()
+    {
+        FlushLiteral();
+        if (m_zeros > 0) {
+            PutToken(m_zeros, true);
+            m_zeros = 0;
+        }
+    }
+
+    void ZeroRunEncoder::FlushLiteral()
+    {
+        if (m_literal.empty()) {
+            return;
+        }
+        PutToken(m_literal.size(), false);
+        m_out.insert(m_out.end(), m_literal.begin(), m_literal.end());
+        m_literal.clear();
+    }
+
+    void ZeroRunEncoder::PutToken(size_t length, bool zero)
+    {
+        uint64_t v = (static_cast<uint64_t>(length) << 1) | (zero ? 1 : 0);
+        while (v >= 0x80) {
+            m_out.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        m_out.push_back(static_cast<uint8_t>(v));
+    }
+
+    bool zero_run_decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size, size_t* consumed)
+    {
+        size_t in = 0;
+        size_t out = 0;
+        while (out < dst_size) {
+            uint64_t v = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                if (in >= src_size || shift > 63) {
+                    return false;
+                }
+                byte = src[in++];
+                v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+
+            uint64_t length = v >> 1;
+            if (length > dst_size - out) {
+                return false;
+            }
+            if (v & 1) {
+                memset(dst + out, 0, length);
+            }
+            else {
+                if (length > src_size - in) {
+                    return false;
+                }
+                memcpy(dst + out, src + in, length);
+                in += length;
+            }
+            out += length;
+        }
+        if (consumed != nullptr) {
+            *consumed = in;
+        }
+        return true;
+    }
+}
+
+Recorder::Recorder(const std::string& path, const RecorderOptions& options)
+    : m_path(path), m_options(options), m_start(FrameClock::now()),
+    m_queue((std::max)(options.queue_frames, size_t(1)))
+{
+    if (options.tile_size < 4 || options.tile_size > 0xffff) {
+        throw std::invalid_argument("Tile size out of range");
+    }
+    m_file.open(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        throw std::runtime_error("Cannot create recording: " + path);
+    }
+    recording::FileHeader header = {};
+    memcpy(header.magic, recording::kMagic, sizeof(header.magic));
+    header.version = recording::kVersion;
+    header.start_unix_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_offset = sizeof(header);
+
+    m_thread = std::thread([this]() { Run(); });
+}
+
+void Recorder::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool Recorder::Push(const Frame& frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop || !m_error.empty() || m_queued == m_queue.size()) {
+            m_dropped++;
+            return false;
+        }
+        m_queue[(m_head + m_queued) % m_queue.size()] = frame;
+        m_queued++;
+    }
+    m_cond.notify_one();
+    return true;
+}
+
+Recorder::Stats Recorder::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return { m_frames, m_keyframes, m_dropped, m_bytes, m_error };
+}
+
+void Recorder::Run()
+{
+    trace_thread_name("recorder");
+    while (true) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            // drain the queue before stopping
+            m_cond.wait(lock, [this]() { return m_queued > 0 || m_stop; });
+            if (m_queued == 0) {
+                break;
+            }
+            frame = std::move(m_queue[m_head]);
+            m_head = (m_head + 1) % m_queue.size();
+            m_queued--;
+            if (!m_error.empty()) {
+                m_dropped++;
+                continue;
+            }
+        }
+        try {
+            Write(frame);
+        }
+        catch (std::exception& e) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_error = e.what();
+        }
+    }
+    try {
+        Close();
+    }
+    catch (std::exception& e) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = e.what();
+    }
+}
+
+void Recorder::Write(const Frame& frame)
+{
+    DOLLSAI_TIME_SCOPE("record.write");
+    const int w = frame.Width();
+    const int h = frame.Height();
+    const int bpp = bytes_per_pixel(frame.Format());
+    const int tile = m_options.tile_size;
+    const int cols = (w + tile - 1) / tile;
+    const int rows = (h + tile - 1) / tile;
+    const size_t bitmap_size = (static_cast<size_t>(cols) * rows + 7) / 8;
+
+    bool keyframe = !m_previous || m_previous.Width() != w || m_previous.Height() != h
+        || m_previous.Format() != frame.Format() || m_sinceKeyframe >= m_options.keyframe_interval;
+
+    recording::FrameHeader header = {};
+    header.id = frame.Id();
+    header.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.Timestamp() - m_start).count();
+    header.width = w;
+    header.height = h;
+    header.format = static_cast<uint8_t>(frame.Format());
+    header.tile_size = static_cast<uint16_t>(tile);
+    header.flags = keyframe ? recording::kKeyframe : 0;
+
+    m_chunk.assign(sizeof(header), 0);
+    // the duplicate flag refers to the frame captured before, which must be the one written before
+    bool repeat = !keyframe && frame.Duplicate() && frame.Id() == m_previous.Id() + 1;
+    if (!repeat) {
+        m_chunk.resize(sizeof(header) + bitmap_size, 0);
+        recording::ZeroRunEncoder encoder(m_chunk);
+        m_residual.resize(static_cast<size_t>(tile) * bpp);
+        for (int ty = 0; ty < rows; ty++) {
+            const int y0 = ty * tile;
+            const int y1 = (std::min)(h, y0 + tile);
+            for (int tx = 0; tx < cols; tx++) {
+                const size_t x_offset = static_cast<size_t>(tx) * tile * bpp;
+                const size_t row_bytes = static_cast<size_t>((std::min)(w - tx * tile, tile)) * bpp;
+                if (!keyframe) {
+                    bool same = true;
+                    for (int y = y0; y < y1 && same; y++) {
+                        same = memcmp(frame.Row(y) + x_offset, m_previous.Row(y) + x_offset, row_bytes) == 0;
+                    }
+                    if (same) {
+                        continue;
+                    }
+                }
+                const size_t index = static_cast<size_t>(ty) * cols + tx;
+                m_chunk[sizeof(header) + index / 8] |= static_cast<uint8_t>(1 << (index % 8));
+                header.stored_tiles++;
+
+                uint8_t* r = m_residual.data();
+                for (int y = y0; y < y1; y++) {
+                    const uint8_t* p = frame.Row(y) + x_offset;
+                    if (keyframe) {
+                        memcpy(r, p, bpp);
+                        for (size_t i = bpp; i < row_bytes; i++) {
+                            r[i] = static_cast<uint8_t>(p[i] - p[i - bpp]);
+                        }
+                    }
+                    else {
+                        const uint8_t* q = m_previous.Row(y) + x_offset;
+                        for (size_t i = 0; i < row_bytes; i++) {
+                            r[i] = p[i] ^ q[i];
+                        }
+                    }
+                    encoder.Append(r, row_bytes);
+                }
+            }
+        }
+        encoder.Finish();
+        repeat = header.stored_tiles == 0;
+    }
+    if (repeat) {
+        m_chunk.resize(sizeof(header));
+        header.flags = recording::kRepeat;
+    }
+    memcpy(m_chunk.data(), &header, sizeof(header));
+
+    recording::IndexEntry entry = {};
+    entry.id = header.id;
+    entry.timestamp_ns = header.timestamp_ns;
+    entry.offset = m_offset;
+    entry.flags = header.flags;
+    WriteChunk(recording::kFrameChunk, m_chunk);
+    m_index.push_back(entry);
+
+    m_sinceKeyframe = keyframe ? 1 : m_sinceKeyframe + 1;
+    m_previous = frame;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frames++;
+    if (keyframe) {
+        m_keyframes++;
+    }
+    m_bytes = m_offset;
+}
+
+void Recorder::WriteChunk(const char* type, const std::vector<uint8_t>& payload)
+{
+    recording::ChunkHeader chunk = {};
+    memcpy(chunk.type, type, sizeof(chunk.type));
+    chunk.size = payload.size();
+    m_file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+    m_file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+    if (!m_file) {
+        throw std::runtime_error("Cannot write recording: " + m_path);
+    }
+    m_offset += sizeof(chunk) + payload.size();
+}
+
+void Recorder::Close()
+{
+    m_previous.Reset();
+    if (m_file && m_error.empty()) {
+        recording::Trailer trailer = {};
+        trailer.index_offset = m_offset;
+        trailer.count = static_cast<uint32_t>(m_index.size());
+        memcpy(trailer.magic, recording::kIndexMagic, sizeof(trailer.magic));
+
+        const auto* begin = reinterpret_cast<const uint8_t*>(m_index.data());
+        WriteChunk(recording::kIndexChunk, std::vector<uint8_t>(begin, begin + m_index.size() * sizeof(recording::IndexEntry)));
+        m_file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        m_offset += sizeof(trailer);
+    }
+    m_file.close();
+    if (!m_file) {
+        throw std::runtime_error("Cannot write recording: " + m_path);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bytes = m_offset;
+}
+
+RecordingReader::RecordingReader(const std::string& path)
+    : m_file(MappedFile::Open(path))
+{
+    const uint8_t* data = m_file.Data();
+    const uint64_t size = m_file.Size();
+    recording::FileHeader header = {};
+    if (size < sizeof(header)) {
+        throw std::runtime_error("Not a recording: " + path);
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, recording::kMagic, sizeof(header.magic)) != 0 || header.version != recording::kVersion) {
+        throw std::runtime_error("Not a recording (or another version): " + path);
+    }
+    m_startUnixUs = header.start_unix_us;
+
+    recording::Trailer trailer = {};
+    recording::ChunkHeader chunk = {};
+    if (size >= sizeof(header) + sizeof(chunk) + sizeof(trailer)) {
+        memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+    }
+    uint64_t index_bytes = static_cast<uint64_t>(trailer.count) * sizeof(recording::IndexEntry);
+    if (memcmp(trailer.magic, recording::kIndexMagic, sizeof(trailer.magic)) == 0
+        && trailer.index_offset >= sizeof(header)
+        && trailer.index_offset + sizeof(chunk) + index_bytes + sizeof(trailer) == size) {
+        m_index.resize(trailer.count);
+        memcpy(m_index.data(), data + trailer.index_offset + sizeof(chunk), index_bytes);
+    }
+    else {
+        // no index (the writer did not finish), walk the chunks up to the first incomplete one
+        uint64_t offset = sizeof(header);
+        while (size - offset >= sizeof(chunk)) {
+            memcpy(&chunk, data + offset, sizeof(chunk));
+            if (chunk.size > size - offset - sizeof(chunk)) {
+                break;
+            }
+            if (memcmp(chunk.type, recording::kFrameChunk, sizeof(chunk.type)) == 0
+                && chunk.size >= sizeof(recording::FrameHeader)) {
+                recording::FrameHeader frame = {};
+                memcpy(&frame, data + offset + sizeof(chunk), sizeof(frame));
+                recording::IndexEntry entry = {};
+                entry.id = frame.id;
+                entry.timestamp_ns = frame.timestamp_ns;
+                entry.offset = offset;
+                entry.flags = frame.flags;
+                m_index.push_back(entry);
+            }
+            offset += sizeof(chunk) + chunk.size;
+        }
+    }
+    // decoding starts at a keyframe
+    while (!m_index.empty() && !(m_index.front().flags & recording::kKeyframe)) {
+        m_index.erase(m_index.begin());
+    }
+}
+
+size_t RecordingReader::Find(uint64_t id) const
+{
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), id,
+        [](const recording::IndexEntry& e, uint64_t id) { return e.id < id; });
+    return it - m_index.begin();
+}
+
+Frame RecordingReader::Read(size_t i, FramePool& pool)
+{
+    if (i >= m_index.size()) {
+        throw std::out_of_range("Recording frame out of range");
+    }
+    if (m_next != i + 1) {
+        size_t keyframe = i;
+        while (!(m_index[keyframe].flags & recording::kKeyframe)) {
+            keyframe--;
+        }
+        size_t start = m_next > keyframe && m_next <= i ? m_next : keyframe;
+        // invalid until the canvas is consistent again
+        m_next = 0;
+        for (size_t j = start; j <= i; j++) {
+            Apply(j);
+        }
+        m_next = i + 1;
+    }
+
+    Frame frame = pool.Acquire(m_width, m_height, m_format);
+    const size_t row_bytes = static_cast<size_t>(m_width) * bytes_per_pixel(m_format);
+    for (int y = 0; y < m_height; y++) {
+        memcpy(frame.Row(y), m_canvas.data() + y * row_bytes, row_bytes);
+    }
+    frame.SetId(m_index[i].id);
+    return frame;
+}
+
+void RecordingReader::Apply(size_t i)
+{
+    const uint8_t* data = m_file.Data();
+    const uint64_t size = m_file.Size();
+    const uint64_t offset = m_index[i].offset;
+    recording::ChunkHeader chunk = {};
+    recording::FrameHeader header = {};
+    if (offset > size || size - offset < sizeof(chunk)) {
+        throw std::runtime_error("Corrupt recording: " + m_file.Path());
+    }
+    memcpy(&chunk, data + offset, sizeof(chunk));
+    if (chunk.size > size - offset - sizeof(chunk) || chunk.size < sizeof(header)) {
+        throw std::runtime_error("Corrupt recording: " + m_file.Path());
+    }
+    const uint8_t* payload = data + offset + sizeof(chunk);
+    memcpy(&header, payload, sizeof(header));
+    if (header.flags & recording::kRepeat) {
+        return;
+    }
+    const bool keyframe = (header.flags & recording::kKeyframe) != 0;
+    if (keyframe) {
+        if (header.width == 0 || header.height == 0 || header.width > 0x8000 || header.height > 0x8000
+            || header.format > static_cast<uint8_t>(PixelFormat::Gray)) {
+            throw std::runtime_error("Corrupt recording: " + m_file.Path());
+        }
+        m_width = header.width;
+        m_height = header.height;
+        m_format = static_cast<PixelFormat>(header.format);
+        m_canvas.resize(static_cast<size_t>(m_width) * m_height * bytes_per_pixel(m_format));
+    }
+    if (static_cast<int>(header.width) != m_width || static_cast<int>(header.height) != m_height
+        || header.format != static_cast<uint8_t>(m_format) || header.tile_size < 4) {
+        throw std::runtime_error("Corrupt recording: " + m_file.Path());
+    }
+
+    const int bpp = bytes_per_pixel(m_format);
+    const int tile = header.tile_size;
+    const int cols = (m_width + tile - 1) / tile;
+    const int rows = (m_height + tile - 1) / tile;
+    const size_t bitmap_size = (static_cast<size_t>(cols) * rows + 7) / 8;
+    if (chunk.size < sizeof(header) + bitmap_size) {
+        throw std::runtime_error("Corrupt recording: " + m_file.Path());
+    }
+    const uint8_t* bitmap = payload + sizeof(header);
+    auto stored = [&](int tx, int ty) {
+        size_t index = static_cast<size_t>(ty) * cols + tx;
+        return (bitmap[index / 8] >> (index % 8)) & 1;
+    };
+
+    size_t residual_size = 0;
+    for (int ty = 0; ty < rows; ty++) {
+        for (int tx = 0; tx < cols; tx++) {
+            if (stored(tx, ty)) {
+                residual_size += static_cast<size_t>((std::min)(tile, m_width - tx * tile)) * bpp
+                    * (std::min)(tile, m_height - ty * tile);
+            }
+        }
+    }
+    m_residual.resize(residual_size);
+    if (!recording::zero_run_decode(bitmap + bitmap_size, chunk.size - sizeof(header) - bitmap_size,
+        m_residual.data(), residual_size, nullptr)) {
+        throw std::runtime_error("Corrupt recording: " + m_file.Path());
+    }
+
+    const size_t stride = static_cast<size_t>(m_width) * bpp;
+    const uint8_t* r = m_residual.data();
+    for (int ty = 0; ty < rows; ty++) {
+        const int y0 = ty * tile;
+        const int y1 = (std::min)(m_height, y0 + tile);
+        for (int tx = 0; tx < cols; tx++) {
+            if (!stored(tx, ty)) {
+                continue;
+            }
+            const size_t x_offset = static_cast<size_t>(tx) * tile * bpp;
+            const size_t row_bytes = static_cast<size_t>((std::min)(tile, m_width - tx * tile)) * bpp;
+            for (int y = y0; y < y1; y++, r += row_bytes) {
+                uint8_t* p = m_canvas.data() + y * stride + x_offset;
+                if (keyframe) {
+                    memcpy(p, r, bpp);
+                    for (size_t k = bpp; k < row_bytes; k++) {
+                        p[k] = static_cast<uint8_t>(r[k] + p[k - bpp]);
+                    }
+                }
+                else {
+                    for (size_t k = 0; k < row_bytes; k++) {
+                        p[k] ^= r[k];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "FramePool.h"
+#include "MappedMemory.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Session recording: a chunked file of delta compressed frames with a seek index.
+//
+// Layout (native endian):
+//   FileHeader (64 bytes)
+//   chunks, each a ChunkHeader followed by `size` bytes:
+//     "FRAM"  FrameHeader, then (unless kRepeat) a bitmap of the frame's tiles
+//             (bit i = tile i in raster order is stored) and the zero-run coded
+//             residuals of the stored tiles, tile by tile, row by row
+//     "INDX"  IndexEntry per frame, written when the recording is closed
+//   Trailer (16 bytes) after the index chunk
+//
+// A keyframe stores every tile with a left-neighbour byte delta (PNG "Sub").
+// Other frames store only tiles that differ from the previous frame in the file,
+// XORed with it. A file without a trailer (writer killed) can still be read by
+// walking the chunks.
+namespace recording {
+    constexpr char kMagic[4] = { 'D', 'A', 'S', 'R' };
+    constexpr char kIndexMagic[4] = { 'D', 'A', 'I', 'X' };
+    constexpr char kFrameChunk[4] = { 'F', 'R', 'A', 'M' };
+    constexpr char kIndexChunk[4] = { 'I', 'N', 'D', 'X' };
+    constexpr uint32_t kVersion = 1;
+
+    enum FrameFlags : uint8_t {
+        kKeyframe = 1,
+        // same pixels as the previous frame, no payload
+        kRepeat = 2,
+    };
+
+    struct FileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        // wall clock at timestamp 0, microseconds since the Unix epoch
+        int64_t start_unix_us;
+        uint8_t pad[48];
+    };
+    static_assert(sizeof(FileHeader) == 64, "recording header is 64 bytes");
+
+    struct ChunkHeader
+    {
+        char type[4];
+        uint32_t reserved;
+        uint64_t size;
+    };
+
+    struct FrameHeader
+    {
+        uint64_t id;
+        // capture time relative to the start of the recording
+        int64_t timestamp_ns;
+        uint32_t width;
+        uint32_t height;
+        uint8_t format;
+        uint8_t flags;
+        uint16_t tile_size;
+        uint32_t stored_tiles;
+    };
+
+    struct IndexEntry
+    {
+        uint64_t id;
+        int64_t timestamp_ns;
+        // of the chunk header
+        uint64_t offset;
+        uint8_t flags;
+        uint8_t reserved[7];
+    };
+
+    struct Trailer
+    {
+        // of the index chunk header
+        uint64_t index_offset;
+        uint32_t count;
+        char magic[4];
+    };
+
+    // Zero runs of at least this many bytes get their own token.
+    constexpr size_t kMinZeroRun = 8;
+
+    // Byte stream as tokens varint((length << 1) | zero), followed by `length`
+    // literal bytes unless zero. Input may be appended in pieces.
+    class ZeroRunEncoder
+    {
+    public:
+        explicit ZeroRunEncoder(std::vector<uint8_t>& out) : m_out(out) {}
+
+        void Append(const uint8_t* data, size_t size);
+        // Flushes the pending run. Must be called once after the last Append.
+        void Finish();
+
+    private:
+        void FlushLiteral();
+        void PutToken(size_t length, bool zero);
+
+        std::vector<uint8_t>& m_out;
+        std::vector<uint8_t> m_literal;
+        size_t m_zeros = 0;
+    };
+
+    // Decodes exactly dst_size bytes. false if the input is malformed or too short.
+    bool zero_run_decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size, size_t* consumed);
+}
+
+struct RecorderOptions
+{
+    // frames waiting for the writer; further frames are dropped
+    size_t queue_frames = 8;
+    int tile_size = 32;
+    // a keyframe at least every this many written frames, bounds the cost of a seek
+    uint32_t keyframe_interval = 300;
+};
+
+// Writes frames to a recording on its own thread. Push never blocks and never
+// copies pixels (it keeps a reference to the pooled frame); when the queue is
+// full the frame is dropped and counted.
+class Recorder
+{
+public:
+    struct Stats
+    {
+        uint64_t frames;
+        uint64_t keyframes;
+        uint64_t dropped;
+        uint64_t bytes;
+        // write error, the recording stopped there
+        std::string error;
+    };
+
+    // path is UTF-8. Throws std::runtime_error if the file cannot be created.
+    Recorder(const std::string& path, const RecorderOptions& options);
+    ~Recorder() { Stop(); }
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    // false if the frame was dropped
+    bool Push(const Frame& frame);
+    // Writes the queued frames and the index and closes the file. Later pushes are dropped.
+    void Stop();
+
+    const std::string& Path() const { return m_path; }
+    Stats GetStats() const;
+
+private:
+    void Run();
+    void Write(const Frame& frame);
+    void WriteChunk(const char* type, const std::vector<uint8_t>& payload);
+    void Close();
+
+    const std::string m_path;
+    const RecorderOptions m_options;
+    const FrameClock::time_point m_start;
+    std::ofstream m_file;
+
+    // writer thread only
+    Frame m_previous;
+    uint32_t m_sinceKeyframe = 0;
+    uint64_t m_offset = 0;
+    std::vector<recording::IndexEntry> m_index;
+    std::vector<uint8_t> m_chunk;
+    std::vector<uint8_t> m_residual;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    // ring of queue_frames slots
+    std::vector<Frame> m_queue;
+    size_t m_head = 0;
+    size_t m_queued = 0;
+    bool m_stop = false;
+    uint64_t m_frames = 0;
+    uint64_t m_keyframes = 0;
+    uint64_t m_dropped = 0;
+    uint64_t m_bytes = 0;
+    std::string m_error;
+
+    std::thread m_thread;
+};
+
+// Random access to the frames of a recording. Reading the frames in order costs
+// one delta each; any other read decodes forward from the preceding keyframe.
+class RecordingReader
+{
+public:
+    // path is UTF-8. Throws std::runtime_error if it is not a recording.
+    explicit RecordingReader(const std::string& path);
+
+    size_t Size() const { return m_index.size(); }
+    const recording::IndexEntry& Entry(size_t i) const { return m_index[i]; }
+    int64_t StartUnixUs() const { return m_startUnixUs; }
+    // position of the first frame with an id >= id (Size() if none)
+    size_t Find(uint64_t id) const;
+
+    // Frame i with its recorded id; timestamp is left to the caller.
+    // Throws std::runtime_error if the frame data is corrupt.
+    Frame Read(size_t i, FramePool& pool);
+
+private:
+    void Apply(size_t i);
+
+    MappedFile m_file;
+    int64_t m_startUnixUs = 0;
+    std::vector<recording::IndexEntry> m_index;
+
+    // decoded frame m_next - 1, rows packed
+    std::vector<uint8_t> m_canvas;
+    int m_width = 0;
+    int m_height = 0;
+    PixelFormat m_format = PixelFormat::BGRA;
+    size_t m_next = 0;
+    std::vector<uint8_t> m_residual;
+};
@@ -0,0 +1,115 @@
+#include "stdafx.h"
+#include "ReplaySource.h"
+#include "LatencyStats.h"
+#include "TemplateRegistry.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+ReplaySource::ReplaySource(const std::string& path, const ReplayOptions& options, CopyOptions copy)
+    : m_options(options), m_copier(std::move(copy))
+{
+    if (options.speed < 0 || options.fps <= 0) {
+        throw std::invalid_argument("Invalid replay parameters");
+    }
+    if (fs::is_directory(fs::u8path(path))) {
+        for (const auto& item : fs::directory_iterator(fs::u8path(path))) {
+            if (item.is_regular_file() && is_image_file(item.path().u8string())) {
+                m_images.push_back(item.path().u8string());
+            }
+        }
+        std::sort(m_images.begin(), m_images.end());
+        m_count = m_images.size();
+    }
+    else {
+        m_recording = std::make_unique<RecordingReader>(path);
+        m_count = m_recording->Size();
+        m_first = m_recording->Find(options.start_id);
+    }
+    if (m_first >= m_count) {
+        throw std::runtime_error("Nothing to replay: " + path);
+    }
+    m_position = m_first;
+    m_origin = FrameClock::now();
+}
+
+FrameClock::duration ReplaySource::Offset(size_t i) const
+{
+    if (m_recording != nullptr) {
+        return std::chrono::duration_cast<FrameClock::duration>(std::chrono::nanoseconds(
+            m_recording->Entry(i).timestamp_ns - m_recording->Entry(m_first).timestamp_ns));
+    }
+    return std::chrono::duration_cast<FrameClock::duration>(
+        std::chrono::duration<double>(static_cast<double>(i - m_first) / m_options.fps));
+}
+
+Frame ReplaySource::ReadFrame(size_t i)
+{
+    DOLLSAI_TIME_SCOPE("replay.read");
+    if (m_recording != nullptr) {
+        return m_recording->Read(i, *m_pool);
+    }
+    cv::Mat image = read_image_file(m_images[i]);
+    if (image.depth() != CV_8U) {
+        image.convertTo(image, CV_8U, 1.0 / 256);
+    }
+    cv::Mat bgra;
+    if (image.channels() == 4) {
+        bgra = image;
+    }
+    else {
+        cv::cvtColor(image, bgra, image.channels() == 1 ? cv::COLOR_GRAY2BGRA : cv::COLOR_BGR2BGRA);
+    }
+    return m_copier.Copy(*m_pool, bgra.data, bgra.step, bgra.cols, bgra.rows);
+}
+
+bool ReplaySource::SleepUntil(FrameClock::time_point time)
+{
+    std::unique_lock<std::mutex> lock(m_interruptMutex);
+    return !m_interruptCond.wait_until(lock, time, [this]() { return m_interrupted; });
+}
+
+void ReplaySource::Interrupt()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_interruptMutex);
+        m_interrupted = true;
+    }
+    m_interruptCond.notify_all();
+}
+
+Frame ReplaySource::WaitNextFrame(std::chrono::milliseconds timeout)
+{
+    if (m_position == m_count) {
+        if (!m_options.loop) {
+            SleepUntil(FrameClock::now() + timeout);
+            return Frame();
+        }
+        m_position = m_first;
+        m_origin = FrameClock::now();
+    }
+    if (m_options.speed > 0) {
+        auto due = m_origin + std::chrono::duration_cast<FrameClock::duration>(Offset(m_position) / m_options.speed);
+        auto now = FrameClock::now();
+        if (due - now > timeout) {
+            SleepUntil(now + timeout);
+            return Frame();
+        }
+        if (!SleepUntil(due)) {
+            return Frame();
+        }
+        // keep the recorded gaps, but do not try to catch up after a stall
+        now = FrameClock::now();
+        if (now > due) {
+            m_origin += now - due;
+        }
+    }
+
+    Frame frame = ReadFrame(m_position++);
+    frame.SetId(m_nextFrameId++);
+    frame.SetTimestamp(FrameClock::now());
+    return frame;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "FrameCopy.h"
+#include "FrameSource.h"
+#include "Recording.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ReplayOptions
+{
+    // 1 = recorded pace, 2 = twice as fast, 0 = as fast as frames are taken
+    double speed = 0;
+    // pace of an image directory at speed 1 (images have no timestamps)
+    double fps = 30;
+    bool loop = false;
+    // recordings: start at the first frame with at least this recorded id
+    uint64_t start_id = 0;
+};
+
+// Plays back a recording (see Recorder) or a directory of images (png, bmp, jpg,
+// in name order) as if it was captured live. Frames get fresh ids from 1; without
+// loop the source idles after the last frame.
+// Images go through the CopyOptions like a captured surface. A recording plays in
+// the format, ROIs and scale it was recorded with.
+class ReplaySource : public FrameSource
+{
+public:
+    // path is UTF-8. Throws std::runtime_error if it is neither a recording nor a directory with images.
+    ReplaySource(const std::string& path, const ReplayOptions& options, CopyOptions copy = {});
+
+    Frame WaitNextFrame(std::chrono::milliseconds timeout) override;
+    FramePool::Stats GetPoolStats() const override { return m_pool->GetStats(); }
+    void Interrupt() override;
+    // speed 0 is "every frame, as fast as they are taken"
+    bool Lossless() const override { return m_options.speed == 0; }
+
+private:
+    // time of frame i after frame m_first, at speed 1
+    FrameClock::duration Offset(size_t i) const;
+    Frame ReadFrame(size_t i);
+    // false if interrupted before time
+    bool SleepUntil(FrameClock::time_point time);
+
+    ReplayOptions m_options;
+    SurfaceCopier m_copier;
+    std::unique_ptr<RecordingReader> m_recording;
+    std::vector<std::string> m_images;
+    size_t m_first = 0;
+    size_t m_count = 0;
+    size_t m_position = 0;
+    // when frame m_first is due
+    FrameClock::time_point m_origin;
+
+    std::shared_ptr<FramePool> m_pool = FramePool::Create();
+    uint64_t m_nextFrameId = 1;
+
+    // wakes a waiting WaitNextFrame, the pace and the idle end alike
+    std::mutex m_interruptMutex;
+    std::condition_variable m_interruptCond;
+    bool m_interrupted = false;
+};
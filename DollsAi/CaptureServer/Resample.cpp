@@ -0,0 +1,255 @@
+#include "stdafx.h"
+#include "Resample.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+#include <string.h>
+
+namespace {
+    // Up to 16 x 16 bytes of 255 fit in the uint16 sums.
+    constexpr int kMaxBoxFactor = 16;
+
+    // sum[x] += horizontal sum of `factor` source pixels, per channel
+    void box_add(const uint8_t* src, uint16_t* sum, int dst_width, int factor)
+    {
+        for (int x = 0; x < dst_width; x++) {
+            const uint8_t* p = src + 4 * static_cast<size_t>(x) * factor;
+            for (int i = 0; i < factor; i++) {
+                sum[4 * x + 0] += p[4 * i + 0];
+                sum[4 * x + 1] += p[4 * i + 1];
+                sum[4 * x + 2] += p[4 * i + 2];
+                sum[4 * x + 3] += p[4 * i + 3];
+            }
+        }
+    }
+
+    // Rounded mean of 2x2 / 4x4 blocks of the given rows into one BGRA row, scalar tail.
+    void box2_scalar(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, int x, int dst_width)
+    {
+        for (; x < dst_width; x++) {
+            for (int c = 0; c < 4; c++) {
+                int sum = r0[8 * x + c] + r0[8 * x + 4 + c] + r1[8 * x + c] + r1[8 * x + 4 + c];
+                dst[4 * x + c] = static_cast<uint8_t>((sum + 2) >> 2);
+            }
+        }
+    }
+
+    void box4_scalar(const uint8_t* const* rows, uint8_t* dst, int x, int dst_width)
+    {
+        for (; x < dst_width; x++) {
+            for (int c = 0; c < 4; c++) {
+                int sum = 0;
+                for (int i = 0; i < 4; i++) {
+                    for (int j = 0; j < 4; j++) {
+                        sum += rows[i][16 * x + 4 * j + c];
+                    }
+                }
+                dst[4 * x + c] = static_cast<uint8_t>((sum + 8) >> 4);
+            }
+        }
+    }
+
+#ifdef DOLLSAI_SIMD_X86
+    // SSE2 is the x86 baseline, so these need no dispatch.
+
+    // two pixels of 16 bit channels in each of lo/hi -> their pair sums, lo's in the low half
+    inline __m128i pair_sums(__m128i lo, __m128i hi)
+    {
+        return _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)), _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+    }
+
+    void box2_sse2(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, int dst_width)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(2);
+        int x = 0;
+        // 8 source pixels per row -> 4 output pixels
+        for (; x + 4 <= dst_width; x += 4) {
+            __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 8 * x));
+            __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 8 * x + 16));
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 8 * x));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 8 * x + 16));
+            __m128i s0 = pair_sums(
+                _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero)),
+                _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero)));
+            __m128i s1 = pair_sums(
+                _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero)),
+                _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero)));
+            s0 = _mm_srli_epi16(_mm_add_epi16(s0, round), 2);
+            s1 = _mm_srli_epi16(_mm_add_epi16(s1, round), 2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_packus_epi16(s0, s1));
+        }
+        box2_scalar(r0, r1, dst, x, dst_width);
+    }
+
+    void box4_sse2(const uint8_t* const* rows, uint8_t* dst, int dst_width)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(8);
+        int x = 0;
+        // 16 source pixels per row -> 4 output pixels
+        for (; x + 4 <= dst_width; x += 4) {
+            __m128i sum[4] = {};
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[i] + 16 * x + 16 * j));
+                    sum[j] = _mm_add_epi16(sum[j], _mm_add_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)));
+                }
+            }
+            // sum[j] holds two half sums of output pixel x + j
+            __m128i s0 = pair_sums(sum[0], sum[1]);
+            __m128i s1 = pair_sums(sum[2], sum[3]);
+            s0 = _mm_srli_epi16(_mm_add_epi16(s0, round), 4);
+            s1 = _mm_srli_epi16(_mm_add_epi16(s1, round), 4);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_packus_epi16(s0, s1));
+        }
+        box4_scalar(rows, dst, x, dst_width);
+    }
+#endif
+
+    void box2(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, int dst_width)
+    {
+#ifdef DOLLSAI_SIMD_X86
+        box2_sse2(r0, r1, dst, dst_width);
+#else
+        box2_scalar(r0, r1, dst, 0, dst_width);
+#endif
+    }
+
+    void box4(const uint8_t* const* rows, uint8_t* dst, int dst_width)
+    {
+#ifdef DOLLSAI_SIMD_X86
+        box4_sse2(rows, dst, dst_width);
+#else
+        box4_scalar(rows, dst, 0, dst_width);
+#endif
+    }
+
+    uint8_t saturate(float v)
+    {
+        return static_cast<uint8_t>((std::min)(255.0f, (std::max)(0.0f, v + 0.5f)));
+    }
+}
+
+AreaResampler::AreaResampler(int src_width, int src_height, int dst_width, int dst_height)
+    : m_srcWidth(src_width), m_srcHeight(src_height), m_dstWidth(dst_width), m_dstHeight(dst_height)
+{
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) {
+        throw std::invalid_argument("Invalid resample size");
+    }
+    if (src_width % dst_width == 0 && src_height % dst_height == 0
+        && src_width / dst_width == src_height / dst_height && src_width / dst_width <= kMaxBoxFactor) {
+        m_factor = src_width / dst_width;
+        m_boxSum.resize(4 * static_cast<size_t>(dst_width));
+    }
+    else {
+        MakeTaps(src_width, dst_width, m_xStarts, m_xTaps);
+        MakeTaps(src_height, dst_height, m_yStarts, m_yTaps);
+        m_rowSum.resize(4 * static_cast<size_t>(dst_width));
+        m_colSum.resize(4 * static_cast<size_t>(dst_width));
+    }
+    m_bgra.resize(4 * static_cast<size_t>(dst_width));
+}
+
+// Output pixel i covers source [i * scale, (i + 1) * scale); each source pixel is
+// weighted by its overlap, normalized so the weights of one output pixel sum to 1.
+// When upscaling, a single source pixel covers the whole range.
+void AreaResampler::MakeTaps(int src_size, int dst_size, std::vector<int>& starts, std::vector<Tap>& taps)
+{
+    const double scale = static_cast<double>(src_size) / dst_size;
+    starts.clear();
+    taps.clear();
+    for (int i = 0; i < dst_size; i++) {
+        starts.push_back(static_cast<int>(taps.size()));
+        double begin = i * scale;
+        double end = (std::min)((i + 1) * scale, static_cast<double>(src_size));
+        int first = static_cast<int>(floor(begin));
+        int last = (std::min)(static_cast<int>(ceil(end)), src_size);
+        double total = end - begin;
+        for (int s = first; s < last; s++) {
+            double overlap = (std::min)(end, s + 1.0) - (std::max)(begin, static_cast<double>(s));
+            if (overlap > 1e-9) {
+                taps.push_back({ s, static_cast<float>(overlap / total) });
+            }
+        }
+    }
+    starts.push_back(static_cast<int>(taps.size()));
+}
+
+void AreaResampler::Resample(const uint8_t* src, size_t src_pitch, uint8_t* dst, size_t dst_pitch, PixelFormat dst_format)
+{
+    if (m_factor != 0) {
+        ResampleBox(src, src_pitch, dst, dst_pitch, dst_format);
+    }
+    else {
+        ResampleArea(src, src_pitch, dst, dst_pitch, dst_format);
+    }
+}
+
+void AreaResampler::ResampleBox(const uint8_t* src, size_t src_pitch, uint8_t* dst, size_t dst_pitch, PixelFormat dst_format)
+{
+    const int k = m_factor;
+    const unsigned count = k * k;
+    for (int y = 0; y < m_dstHeight; y++) {
+        const uint8_t* rows[kMaxBoxFactor];
+        for (int i = 0; i < k; i++) {
+            rows[i] = src + (static_cast<size_t>(y) * k + i) * src_pitch;
+        }
+        if (k == 2) {
+            box2(rows[0], rows[1], m_bgra.data(), m_dstWidth);
+        }
+        else if (k == 4) {
+            box4(rows, m_bgra.data(), m_dstWidth);
+        }
+        else {
+            std::fill(m_boxSum.begin(), m_boxSum.end(), 0);
+            for (int i = 0; i < k; i++) {
+                box_add(rows[i], m_boxSum.data(), m_dstWidth, k);
+            }
+            for (size_t i = 0; i < m_boxSum.size(); i++) {
+                m_bgra[i] = static_cast<uint8_t>((m_boxSum[i] + (count >> 1)) / count);
+            }
+        }
+        convert_bgra_row(m_bgra.data(), dst + y * dst_pitch, m_dstWidth, dst_format);
+    }
+}
+
+void AreaResampler::ResampleArea(const uint8_t* src, size_t src_pitch, uint8_t* dst, size_t dst_pitch, PixelFormat dst_format)
+{
+    const size_t n = m_rowSum.size();
+    // the row shared by two output rows is reduced once and kept in m_rowSum
+    int reduced_row = -1;
+    for (int y = 0; y < m_dstHeight; y++) {
+        std::fill(m_colSum.begin(), m_colSum.end(), 0.0f);
+        for (int t = m_yStarts[y]; t < m_yStarts[y + 1]; t++) {
+            const Tap& ty = m_yTaps[t];
+            if (ty.index != reduced_row) {
+                const uint8_t* row = src + ty.index * src_pitch;
+                for (int x = 0; x < m_dstWidth; x++) {
+                    float b = 0, g = 0, r = 0, a = 0;
+                    for (int u = m_xStarts[x]; u < m_xStarts[x + 1]; u++) {
+                        const uint8_t* p = row + 4 * static_cast<size_t>(m_xTaps[u].index);
+                        float w = m_xTaps[u].weight;
+                        b += p[0] * w;
+                        g += p[1] * w;
+                        r += p[2] * w;
+                        a += p[3] * w;
+                    }
+                    m_rowSum[4 * x + 0] = b;
+                    m_rowSum[4 * x + 1] = g;
+                    m_rowSum[4 * x + 2] = r;
+                    m_rowSum[4 * x + 3] = a;
+                }
+                reduced_row = ty.index;
+            }
+            for (size_t i = 0; i < n; i++) {
+                m_colSum[i] += m_rowSum[i] * ty.weight;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            m_bgra[i] = saturate(m_colSum[i]);
+        }
+        convert_bgra_row(m_bgra.data(), dst + y * dst_pitch, m_dstWidth, dst_format);
+    }
+}
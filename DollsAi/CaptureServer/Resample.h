@@ -0,0 +1,53 @@
+#pragma once
+
+#include "PixelConvert.h"
+
+#include <vector>
+
+// Area (box) downscaling of a BGRA surface straight into the destination format.
+// Every source row is read once and nothing full-size is written; the only scratch
+// is a few output-width rows, kept between calls.
+// Integer factors (the same k for both axes) use an exact integer mean with SSE2
+// kernels for k = 2 and 4; any other ratio uses float weights like cv::INTER_AREA.
+class AreaResampler
+{
+public:
+    AreaResampler(int src_width, int src_height, int dst_width, int dst_height);
+
+    int SrcWidth() const { return m_srcWidth; }
+    int SrcHeight() const { return m_srcHeight; }
+    int DstWidth() const { return m_dstWidth; }
+    int DstHeight() const { return m_dstHeight; }
+
+    // src must be SrcWidth() x SrcHeight() BGRA, dst DstWidth() x DstHeight() of dst_format.
+    void Resample(const uint8_t* src, size_t src_pitch, uint8_t* dst, size_t dst_pitch, PixelFormat dst_format);
+
+private:
+    struct Tap
+    {
+        int index;
+        float weight;
+    };
+
+    void ResampleBox(const uint8_t* src, size_t src_pitch, uint8_t* dst, size_t dst_pitch, PixelFormat dst_format);
+    void ResampleArea(const uint8_t* src, size_t src_pitch, uint8_t* dst, size_t dst_pitch, PixelFormat dst_format);
+    static void MakeTaps(int src_size, int dst_size, std::vector<int>& starts, std::vector<Tap>& taps);
+
+    int m_srcWidth;
+    int m_srcHeight;
+    int m_dstWidth;
+    int m_dstHeight;
+    // box factor, 0 for the float path
+    int m_factor = 0;
+
+    // float path: taps of output column/row i are taps[starts[i]] .. taps[starts[i + 1] - 1]
+    std::vector<int> m_xStarts;
+    std::vector<Tap> m_xTaps;
+    std::vector<int> m_yStarts;
+    std::vector<Tap> m_yTaps;
+
+    std::vector<uint16_t> m_boxSum;
+    std::vector<float> m_rowSum;
+    std::vector<float> m_colSum;
+    std::vector<uint8_t> m_bgra;
+};
@@ -0,0 +1,140 @@
+#include "stdafx.h"
+#include "ScreenClassifier.h"
+
+#include <algorithm>
+#include <bitset>
+
+namespace {
+    constexpr int kCellsX = 9;
+    constexpr int kCellsY = 8;
+    constexpr int kSamplesPerCell = 16;
+
+    // (b + 2g + r) / 4, gray as is
+    int brightness(const uint8_t* p, PixelFormat format)
+    {
+        if (format == PixelFormat::Gray) {
+            return p[0];
+        }
+        return (p[0] + 2 * p[1] + p[2]) >> 2;
+    }
+}
+
+uint64_t dhash(const uint8_t* data, size_t stride, int width, int height, PixelFormat format)
+{
+    const int bpp = bytes_per_pixel(format);
+    int means[kCellsY][kCellsX];
+    for (int cy = 0; cy < kCellsY; cy++) {
+        int y0 = height * cy / kCellsY;
+        int y1 = (std::max)(y0 + 1, height * (cy + 1) / kCellsY);
+        int step_y = (std::max)(1, (y1 - y0) / kSamplesPerCell);
+        for (int cx = 0; cx < kCellsX; cx++) {
+            int x0 = width * cx / kCellsX;
+            int x1 = (std::max)(x0 + 1, width * (cx + 1) / kCellsX);
+            int step_x = (std::max)(1, (x1 - x0) / kSamplesPerCell);
+            int sum = 0;
+            int count = 0;
+            for (int y = y0; y < y1 && y < height; y += step_y) {
+                const uint8_t* row = data + y * stride;
+                for (int x = x0; x < x1 && x < width; x += step_x) {
+                    sum += brightness(row + static_cast<size_t>(x) * bpp, format);
+                    count++;
+                }
+            }
+            means[cy][cx] = count > 0 ? sum / count : 0;
+        }
+    }
+    uint64_t hash = 0;
+    for (int y = 0; y < kCellsY; y++) {
+        for (int x = 0; x < kCellsX - 1; x++) {
+            if (means[y][x] < means[y][x + 1]) {
+                hash |= uint64_t(1) << (y * 8 + x);
+            }
+        }
+    }
+    return hash;
+}
+
+int hamming_distance(uint64_t a, uint64_t b)
+{
+    return static_cast<int>(std::bitset<64>(a ^ b).count());
+}
+
+void ScreenClassifier::Add(uint64_t hash, const std::string& label)
+{
+    auto inserted = m_labelIds.emplace(label, static_cast<uint32_t>(m_labels.size()));
+    if (inserted.second) {
+        m_labels.push_back(label);
+    }
+    uint32_t label_index = inserted.first->second;
+
+    uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    if (m_nodes.empty()) {
+        m_nodes.push_back({ hash, label_index, {} });
+        return;
+    }
+    uint32_t node = 0;
+    for (;;) {
+        int d = hamming_distance(hash, m_nodes[node].hash);
+        auto& children = m_nodes[node].children;
+        auto child = std::find_if(children.begin(), children.end(), [d](const auto& c) { return c.first == d; });
+        if (child == children.end()) {
+            children.emplace_back(d, index);
+            break;
+        }
+        node = child->second;
+    }
+    m_nodes.push_back({ hash, label_index, {} });
+}
+
+std::vector<ScreenClassifier::Match> ScreenClassifier::Nearest(uint64_t hash, size_t max_results, int max_distance) const
+{
+    // best distance per label
+    std::unordered_map<uint32_t, int> best;
+    // the radius shrinks to the worst kept distance once max_results labels are known
+    int radius = max_distance;
+    auto worst_kept = [&]() {
+        std::vector<int> distances;
+        for (const auto& b : best) {
+            distances.push_back(b.second);
+        }
+        std::nth_element(distances.begin(), distances.begin() + (max_results - 1), distances.end());
+        return distances[max_results - 1];
+    };
+
+    std::vector<uint32_t> stack;
+    if (!m_nodes.empty() && max_results > 0) {
+        stack.push_back(0);
+    }
+    while (!stack.empty()) {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        int d = hamming_distance(hash, node.hash);
+        if (d <= radius) {
+            auto it = best.find(node.label);
+            if (it == best.end() || d < it->second) {
+                best[node.label] = d;
+                if (best.size() >= max_results) {
+                    radius = (std::min)(radius, worst_kept());
+                }
+            }
+        }
+        // triangle inequality: a child at edge distance e can only be within radius if |e - d| <= radius
+        for (const auto& child : node.children) {
+            if (child.first >= d - radius && child.first <= d + radius) {
+                stack.push_back(child.second);
+            }
+        }
+    }
+
+    std::vector<Match> result;
+    for (const auto& b : best) {
+        result.push_back({ m_labels[b.first], b.second });
+    }
+    std::sort(result.begin(), result.end(), [](const Match& a, const Match& b) {
+        return a.distance != b.distance ? a.distance < b.distance : a.label < b.label;
+    });
+    if (result.size() > max_results) {
+        result.resize(max_results);
+    }
+    return result;
+}
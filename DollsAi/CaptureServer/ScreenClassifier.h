@@ -0,0 +1,49 @@
+#pragma once
+
+#include "PixelConvert.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 64 bit difference hash: the image is reduced to 9x8 cells of mean brightness and
+// bit (y * 8 + x) is set if cell (x, y) is darker than cell (x + 1, y).
+// Cell means come from a sparse sample grid (at most 16x16 points per cell), so hashing
+// costs the same for any frame size.
+uint64_t dhash(const uint8_t* data, size_t stride, int width, int height, PixelFormat format);
+
+int hamming_distance(uint64_t a, uint64_t b);
+
+// Labeled reference hashes in a BK-tree (edges keyed by Hamming distance), so a
+// lookup only visits subtrees that can hold something within the search radius.
+// A label may have any number of reference hashes.
+class ScreenClassifier
+{
+public:
+    struct Match
+    {
+        std::string label;
+        int distance;
+    };
+
+    void Add(uint64_t hash, const std::string& label);
+    size_t Size() const { return m_nodes.size(); }
+
+    // Up to max_results labels within max_distance, nearest first; each label once,
+    // with its best distance.
+    std::vector<Match> Nearest(uint64_t hash, size_t max_results, int max_distance) const;
+
+private:
+    struct Node
+    {
+        uint64_t hash;
+        uint32_t label;
+        // (distance to child, child index)
+        std::vector<std::pair<int, uint32_t>> children;
+    };
+
+    std::vector<Node> m_nodes;
+    std::vector<std::string> m_labels;
+    std::unordered_map<std::string, uint32_t> m_labelIds;
+};
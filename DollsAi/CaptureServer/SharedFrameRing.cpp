@@ -0,0 +1,200 @@
+#include "stdafx.h"
+#include "SharedFrameRing.h"
+
+#include <new>
+#include <stdexcept>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr size_t kPageSize = 4096;
+
+    uint32_t current_pid()
+    {
+#ifdef _WIN32
+        return GetCurrentProcessId();
+#else
+        return static_cast<uint32_t>(getpid());
+#endif
+    }
+
+    // POSIX names outlive their creator. True if the region called name was made by
+    // a server that is not running anymore; a region still being set up (no pid yet)
+    // or of unknown layout is never stale.
+    bool is_stale_ring(const std::string& name)
+    {
+#ifdef _WIN32
+        // the mapping is gone with the last process that had it open
+        return false;
+#else
+        SharedMemory shm;
+        try {
+            shm = SharedMemory::Open(name);
+        }
+        catch (std::exception&) {
+            return false;
+        }
+        if (shm.Size() < shm_ring::kHeaderSize) {
+            return false;
+        }
+        auto header = reinterpret_cast<const SharedRingHeader*>(shm.Data());
+        pid_t pid = static_cast<pid_t>(header->owner_pid);
+        return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+#endif
+    }
+
+    const SharedSlotHeader* slot_at(const SharedRingHeader* header, uint32_t index)
+    {
+        auto base = reinterpret_cast<const uint8_t*>(header);
+        return reinterpret_cast<const SharedSlotHeader*>(
+            base + shm_ring::kHeaderSize + index * header->slot_stride);
+    }
+}
+
+SharedFrameRing::SharedFrameRing(const std::string& name, uint32_t slot_count, size_t slot_capacity)
+{
+    if (slot_count == 0) {
+        throw std::invalid_argument("slot_count must be > 0");
+    }
+    size_t slot_stride = (shm_ring::kSlotHeaderSize + slot_capacity + kPageSize - 1) / kPageSize * kPageSize;
+    const size_t size = shm_ring::kHeaderSize + slot_count * slot_stride;
+    if (is_stale_ring(name)) {
+        SharedMemory::Remove(name);
+    }
+    m_shm = SharedMemory::Create(name, size);
+    m_header = new (m_shm.Data()) SharedRingHeader();
+    m_header->owner_pid = current_pid();
+
+    for (uint32_t i = 0; i < slot_count; i++) {
+        auto slot = new (m_shm.Data() + shm_ring::kHeaderSize + i * slot_stride) SharedSlotHeader();
+        slot->seq.store(0, std::memory_order_relaxed);
+    }
+    m_header->version = shm_ring::kVersion;
+    m_header->slot_count = slot_count;
+    m_header->slot_stride = slot_stride;
+    m_header->slot_capacity = slot_capacity;
+    m_header->write_seq.store(0, std::memory_order_relaxed);
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = shm_ring::kMagic;
+}
+
+SharedSlotHeader* SharedFrameRing::Slot(uint32_t index) const
+{
+    return const_cast<SharedSlotHeader*>(slot_at(m_header, index));
+}
+
+SharedFrameRing::Published SharedFrameRing::Publish(const Frame& frame)
+{
+    size_t size = frame.Stride() * frame.Height();
+    if (size > m_header->slot_capacity) {
+        throw std::runtime_error("Frame does not fit in shared memory slot");
+    }
+
+    std::lock_guard<std::mutex> lock(m_publishMutex);
+    uint64_t seq = m_header->write_seq.load(std::memory_order_relaxed) + 1;
+    uint32_t index = static_cast<uint32_t>((seq - 1) % m_header->slot_count);
+    SharedSlotHeader* slot = Slot(index);
+
+    slot->seq.store(2 * seq - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frame_id = frame.Id();
+    slot->timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        frame.Timestamp().time_since_epoch()).count();
+    slot->width = frame.Width();
+    slot->height = frame.Height();
+    slot->stride = static_cast<uint32_t>(frame.Stride());
+    slot->format = static_cast<uint32_t>(frame.Format());
+    slot->size = size;
+    memcpy(reinterpret_cast<uint8_t*>(slot) + shm_ring::kSlotHeaderSize, frame.Data(), size);
+
+    slot->seq.store(2 * seq, std::memory_order_release);
+    m_header->write_seq.store(seq, std::memory_order_release);
+
+    return { index, seq };
+}
+
+SharedFrameReader::SharedFrameReader(const std::string& name)
+    : m_shm(SharedMemory::Open(name))
+{
+    if (m_shm.Size() < shm_ring::kHeaderSize) {
+        throw std::runtime_error("Shared memory too small: " + name);
+    }
+    m_header = reinterpret_cast<const SharedRingHeader*>(m_shm.Data());
+    if (m_header->magic != shm_ring::kMagic || m_header->version != shm_ring::kVersion) {
+        throw std::runtime_error("Not a frame ring: " + name);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+bool SharedFrameReader::TryReadLatest(View& view)
+{
+    uint64_t latest = m_header->write_seq.load(std::memory_order_acquire);
+    while (latest > m_cursor) {
+        if (ReadSeq(latest, view)) {
+            m_skipped += latest - m_cursor - 1;
+            m_cursor = latest;
+            return true;
+        }
+        // overwritten while reading the header, try the newer one
+        latest = m_header->write_seq.load(std::memory_order_acquire);
+    }
+    return false;
+}
+
+bool SharedFrameReader::TryReadNext(View& view)
+{
+    while (true) {
+        uint64_t latest = m_header->write_seq.load(std::memory_order_acquire);
+        if (latest <= m_cursor) {
+            return false;
+        }
+        uint64_t next = m_cursor + 1;
+        uint64_t oldest = latest > m_header->slot_count ? latest - m_header->slot_count + 1 : 1;
+        if (next < oldest) {
+            m_skipped += oldest - next;
+            next = oldest;
+        }
+        if (ReadSeq(next, view)) {
+            m_cursor = next;
+            return true;
+        }
+        // lapped between the two loads, recompute oldest
+        m_skipped++;
+        m_cursor = next;
+    }
+}
+
+bool SharedFrameReader::ReadSeq(uint64_t seq, View& view)
+{
+    uint32_t index = static_cast<uint32_t>((seq - 1) % m_header->slot_count);
+    const SharedSlotHeader* slot = slot_at(m_header, index);
+
+    if (slot->seq.load(std::memory_order_acquire) != 2 * seq) {
+        return false;
+    }
+    view.seq = seq;
+    view.slot = index;
+    view.frame_id = slot->frame_id;
+    view.timestamp_us = slot->timestamp_us;
+    view.width = static_cast<int>(slot->width);
+    view.height = static_cast<int>(slot->height);
+    view.stride = slot->stride;
+    view.format = static_cast<PixelFormat>(slot->format);
+    view.data = reinterpret_cast<const uint8_t*>(slot) + shm_ring::kSlotHeaderSize;
+    return Validate(view);
+}
+
+bool SharedFrameReader::Validate(const View& view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot_at(m_header, view.slot)->seq.load(std::memory_order_relaxed) == 2 * view.seq;
+}
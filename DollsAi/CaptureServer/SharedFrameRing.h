@@ -0,0 +1,127 @@
+#pragma once
+
+#include "FramePool.h"
+#include "MappedMemory.h"
+
+#include <atomic>
+#include <mutex>
+
+// Frame ring in named shared memory: one producer (the server), any number of
+// reader processes. The producer never waits; a reader that is too slow notices
+// through the per-slot sequence numbers and skips ahead.
+//
+// Layout (native endian, offsets from the start of the region):
+//   0                                 SharedRingHeader (64 bytes)
+//   64 + i * slot_stride              SharedSlotHeader of slot i (64 bytes)
+//   64 + i * slot_stride + 64         pixels of slot i, `stride` bytes per row
+//
+// Publish number n (1, 2, ...) goes to slot (n - 1) % slot_count. While it is
+// written the slot's seq is 2n - 1 (odd), afterwards 2n. A read of publish n is
+// valid only if seq was 2n both before and after copying the pixels.
+namespace shm_ring {
+    constexpr uint32_t kMagic = 0x52464144; // "DAFR"
+    constexpr uint32_t kVersion = 1;
+    constexpr size_t kHeaderSize = 64;
+    constexpr size_t kSlotHeaderSize = 64;
+}
+
+struct SharedRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    // process id of the server, written before anything else; a new server
+    // only takes over the name when this process is gone
+    uint32_t owner_pid;
+    uint64_t slot_stride;
+    uint64_t slot_capacity;
+    // last completed publish number, 0 = nothing yet
+    std::atomic<uint64_t> write_seq;
+};
+
+struct SharedSlotHeader
+{
+    std::atomic<uint64_t> seq;
+    uint64_t frame_id;
+    int64_t timestamp_us;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint64_t size;
+};
+
+static_assert(sizeof(SharedRingHeader) <= shm_ring::kHeaderSize, "ring header too large");
+static_assert(sizeof(SharedSlotHeader) <= shm_ring::kSlotHeaderSize, "slot header too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock free");
+
+class SharedFrameRing
+{
+public:
+    struct Published
+    {
+        uint32_t slot;
+        uint64_t seq;
+    };
+
+    // slot_capacity: max pixel bytes of one frame (stride * height)
+    // Throws std::runtime_error if a live server has a ring of that name. A ring left
+    // by a crashed server (owner_pid no longer running) is replaced.
+    SharedFrameRing(const std::string& name, uint32_t slot_count, size_t slot_capacity);
+
+    const std::string& Name() const { return m_shm.Name(); }
+    uint32_t SlotCount() const { return m_header->slot_count; }
+    size_t SlotCapacity() const { return static_cast<size_t>(m_header->slot_capacity); }
+
+    // Copies the frame into the next slot. Throws if it does not fit.
+    // Concurrent calls are serialized.
+    Published Publish(const Frame& frame);
+
+private:
+    SharedSlotHeader* Slot(uint32_t index) const;
+
+    SharedMemory m_shm;
+    SharedRingHeader* m_header = nullptr;
+    std::mutex m_publishMutex;
+};
+
+// Read side, for in-process consumers and as the reference for client implementations.
+// Each reader keeps its own cursor; readers never write to the region.
+class SharedFrameReader
+{
+public:
+    struct View
+    {
+        uint64_t seq;
+        uint32_t slot;
+        uint64_t frame_id;
+        int64_t timestamp_us;
+        int width;
+        int height;
+        size_t stride;
+        PixelFormat format;
+        // points into shared memory, only trustworthy if Validate() says so afterwards
+        const uint8_t* data;
+    };
+
+    explicit SharedFrameReader(const std::string& name);
+
+    // Newest published frame after the cursor; false if there is none.
+    bool TryReadLatest(View& view);
+    // Next frame in order after the cursor. If the producer lapped the reader,
+    // jumps to the oldest frame still in the ring and counts the skipped ones.
+    bool TryReadNext(View& view);
+    // True if the slot still holds view.seq, i.e. the pixels read so far are not torn.
+    bool Validate(const View& view) const;
+
+    uint64_t Cursor() const { return m_cursor; }
+    uint64_t Skipped() const { return m_skipped; }
+
+private:
+    bool ReadSeq(uint64_t seq, View& view);
+
+    SharedMemory m_shm;
+    const SharedRingHeader* m_header = nullptr;
+    uint64_t m_cursor = 0;
+    uint64_t m_skipped = 0;
+};
@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "Simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+    SimdLevel detect_cpu()
+    {
+#if defined(DOLLSAI_SIMD_X86) && defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+
+        __cpuid(info, 1);
+        bool ssse3 = (info[2] & (1 << 9)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        // OS must save YMM registers on context switch
+        bool ymm = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+
+        bool avx2 = false;
+        if (max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = ymm && (info[1] & (1 << 5)) != 0;
+        }
+        if (avx2) {
+            return SimdLevel::AVX2;
+        }
+        if (ssse3) {
+            return SimdLevel::SSSE3;
+        }
+        return SimdLevel::Scalar;
+#elif defined(DOLLSAI_SIMD_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SimdLevel::AVX2;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return SimdLevel::SSSE3;
+        }
+        return SimdLevel::Scalar;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }
+
+    SimdLevel detect()
+    {
+        SimdLevel level = detect_cpu();
+
+        const char* env = getenv("DOLLSAI_SIMD");
+        if (env != nullptr) {
+            SimdLevel request = level;
+            if (strcmp(env, "scalar") == 0) {
+                request = SimdLevel::Scalar;
+            }
+            else if (strcmp(env, "ssse3") == 0) {
+                request = SimdLevel::SSSE3;
+            }
+            if (request < level) {
+                level = request;
+            }
+        }
+        return level;
+    }
+}
+
+SimdLevel simd_level()
+{
+    static const SimdLevel level = detect();
+    return level;
+}
+
+const char* simd_level_name(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::SSSE3:
+        return "ssse3";
+    case SimdLevel::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
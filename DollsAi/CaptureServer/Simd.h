@@ -0,0 +1,25 @@
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DOLLSAI_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// MSVC allows any intrinsic everywhere, gcc/clang need the ISA enabled per function.
+#if defined(DOLLSAI_SIMD_X86) && !defined(_MSC_VER)
+#define DOLLSAI_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DOLLSAI_TARGET(isa)
+#endif
+
+enum class SimdLevel {
+    Scalar,
+    SSSE3,
+    AVX2,
+};
+
+// Best kernel set usable on this CPU, detected once.
+// Environment variable DOLLSAI_SIMD=scalar|ssse3|avx2 can lower it (never raise it).
+SimdLevel simd_level();
+
+const char* simd_level_name(SimdLevel level);
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "SimpleCapture.h"
 #include "interop.h"
+#include "LatencyStats.h"
 #include <winrt/windows.graphics.directx.direct3d11.h>
 
 using namespace winrt;
@@ -17,7 +18,9 @@ using namespace Windows::UI::Composition;
 
 SimpleCapture::SimpleCapture(
     IDirect3DDevice const& device,
-    GraphicsCaptureItem const& item)
+    GraphicsCaptureItem const& item,
+    CopyOptions options)
+    : m_copier(std::move(options))
 {
     m_item = item;
     m_device = device;
@@ -36,7 +39,8 @@ SimpleCapture::SimpleCapture(
         2);
 
     // Create framepool, define pixel format (DXGI_FORMAT_B8G8R8A8_UNORM), and frame size. 
-    m_framePool = Direct3D11CaptureFramePool::Create(
+    // Free threaded: frames are read on the capture thread, which has no dispatcher queue.
+    m_framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(
         m_device,
         DirectXPixelFormat::B8G8R8A8UIntNormalized,
         2,
@@ -44,6 +48,13 @@ SimpleCapture::SimpleCapture(
     m_session = m_framePool.CreateCaptureSession(m_item);
     m_lastSize = size;
     //m_frameArrived = m_framePool.FrameArrived(auto_revoke, { this, &SimpleCapture::OnFrameArrived });
+    m_frameArrived = m_framePool.FrameArrived(auto_revoke, [this](auto&&, auto&&) {
+        {
+            std::lock_guard<std::mutex> lock(m_arrivedMutex);
+            m_arrived = true;
+        }
+        m_arrivedCond.notify_one();
+    });
 }
 
 // Start sending capture frames
@@ -71,25 +82,25 @@ void SimpleCapture::Close()
         m_session.Close();
 
         m_swapChain = nullptr;
+        m_stagingTexture = nullptr;
         m_framePool = nullptr;
         m_session = nullptr;
         m_item = nullptr;
     }
 }
 
-#include <stdio.h>
-std::tuple<std::vector<uint8_t>, int, int> SimpleCapture::TryGetNextFrame()
+template <typename Func>
+bool SimpleCapture::MapNextFrame(Func&& func)
 {
-    std::vector<uint8_t> buf;
-    int width = 0;
-    int height = 0;
-
     bool newSize = false;
     {
-        auto frame = m_framePool.TryGetNextFrame();
+        Direct3D11CaptureFrame frame{ nullptr };
+        {
+            DOLLSAI_TIME_SCOPE("capture.acquire");
+            frame = m_framePool.TryGetNextFrame();
+        }
         if (!frame) {
-            putwchar(L'.');
-            return { buf, 0, 0 };
+            return false;
         }
         auto frameContentSize = frame.ContentSize();
         if (frameContentSize.Width != m_lastSize.Width ||
@@ -97,12 +108,15 @@ std::tuple<std::vector<uint8_t>, int, int> SimpleCapture::TryGetNextFrame()
             m_lastSize = frameContentSize;
             newSize = true;
         }
-        wprintf(L"\nCaptured %dx%d\n", frameContentSize.Width, frameContentSize.Height);
-
         auto frameSurface = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame.Surface());
         D3D11_MAPPED_SUBRESOURCE mapInfo = {};
-        HRESULT hr = m_d3dContext->Map(frameSurface.get(), 0, D3D11_MAP_READ, 0, &mapInfo);
+        HRESULT hr;
+        {
+            DOLLSAI_TIME_SCOPE("capture.map");
+            hr = m_d3dContext->Map(frameSurface.get(), 0, D3D11_MAP_READ, 0, &mapInfo);
+        }
         if (hr == E_INVALIDARG) {
+            DOLLSAI_TIME_SCOPE("capture.staging_copy");
             // copy the texture and try map again
             D3D11_TEXTURE2D_DESC desc;
             frameSurface->GetDesc(&desc);
@@ -111,33 +125,43 @@ std::tuple<std::vector<uint8_t>, int, int> SimpleCapture::TryGetNextFrame()
             desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
             desc.MiscFlags = 0;
 
-            auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(m_device);
-            winrt::com_ptr<ID3D11Texture2D> stagingTexture;
-            check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, stagingTexture.put()));
+            // reuse the staging texture while the size stays the same
+            D3D11_TEXTURE2D_DESC stagingDesc = {};
+            if (m_stagingTexture) {
+                m_stagingTexture->GetDesc(&stagingDesc);
+            }
+            if (!m_stagingTexture || stagingDesc.Width != desc.Width || stagingDesc.Height != desc.Height) {
+                auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(m_device);
+                m_stagingTexture = nullptr;
+                check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_stagingTexture.put()));
+            }
+            auto stagingTexture = m_stagingTexture;
 
             // copy the texture to a staging resource
             m_d3dContext->CopyResource(stagingTexture.get(), frameSurface.get());
 
             // now, map the staging resource
-            HRESULT hr = m_d3dContext->Map(stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapInfo);
+            check_hresult(m_d3dContext->Map(stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapInfo));
             frameSurface = std::move(stagingTexture);
         }
         else {
             // throw
             check_hresult(hr);
         }
-        // copy
-        const int depth = 4;
-        buf.resize(depth * frameContentSize.Width * frameContentSize.Height);
-        for (int y = 0; y < frameContentSize.Height; y++) {
-            size_t srcoffset = y * mapInfo.RowPitch;
-            size_t dstoffset = y * depth * frameContentSize.Width;
-            const uint8_t* src = static_cast<uint8_t*>(mapInfo.pData) + srcoffset;
-            uint8_t* dst = buf.data() + dstoffset;
-            memcpy_s(dst, buf.data() + buf.size() - dst, src, depth * frameContentSize.Width);
+        // content may be larger than the pool texture until the pool is recreated
+        D3D11_TEXTURE2D_DESC surfaceDesc;
+        frameSurface->GetDesc(&surfaceDesc);
+        int width = (std::min)(frameContentSize.Width, static_cast<int>(surfaceDesc.Width));
+        int height = (std::min)(frameContentSize.Height, static_cast<int>(surfaceDesc.Height));
+
+        // read rows in place (RowPitch may be larger than 4 * width)
+        try {
+            func(static_cast<const uint8_t*>(mapInfo.pData), mapInfo.RowPitch, width, height);
+        }
+        catch (...) {
+            m_d3dContext->Unmap(frameSurface.get(), 0);
+            throw;
         }
-        width = frameContentSize.Width;
-        height = frameContentSize.Height;
         m_d3dContext->Unmap(frameSurface.get(), 0);
     }
 
@@ -149,7 +173,50 @@ std::tuple<std::vector<uint8_t>, int, int> SimpleCapture::TryGetNextFrame()
             m_lastSize);
     }
 
-    return { buf, width, height };
+    return true;
+}
+
+bool SimpleCapture::TryGetNextFrame(const MappedFrameFunc& func)
+{
+    return MapNextFrame(func);
+}
+
+Frame SimpleCapture::TryGetNextFrame()
+{
+    Frame result;
+    // template call, so the per-frame path does not go through std::function
+    MapNextFrame([&](const uint8_t* data, size_t pitch, int w, int h) {
+        result = m_copier.Copy(*m_pool, data, pitch, w, h);
+    });
+    if (result) {
+        result.SetId(m_nextFrameId++);
+        result.SetTimestamp(FrameClock::now());
+    }
+    return result;
+}
+
+Frame SimpleCapture::WaitNextFrame(std::chrono::milliseconds timeout)
+{
+    Frame frame = TryGetNextFrame();
+    if (!frame) {
+        {
+            DOLLSAI_TIME_SCOPE("capture.wait");
+            std::unique_lock<std::mutex> lock(m_arrivedMutex);
+            m_arrivedCond.wait_for(lock, timeout, [this]() { return m_arrived; });
+            m_arrived = false;
+        }
+        frame = TryGetNextFrame();
+    }
+    return frame;
+}
+
+void SimpleCapture::Interrupt()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_arrivedMutex);
+        m_arrived = true;
+    }
+    m_arrivedCond.notify_one();
 }
 
 /*
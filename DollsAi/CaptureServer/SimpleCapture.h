@@ -1,22 +1,42 @@
 #pragma once
 
-class SimpleCapture
+#include "FrameCopy.h"
+#include "FrameSource.h"
+
+#include <condition_variable>
+#include <mutex>
+
+class SimpleCapture : public FrameSource
 {
 public:
     SimpleCapture(
         winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
-        winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item);
+        winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item,
+        CopyOptions options = {});
     ~SimpleCapture() { Close(); }
 
     void StartCapture();
     winrt::Windows::UI::Composition::ICompositionSurface CreateSurface(
         winrt::Windows::UI::Composition::Compositor const& compositor);
 
-    std::tuple<std::vector<uint8_t>, int, int> TryGetNextFrame();
+    // Called while the frame texture is mapped: BGRA pixels, row pitch in bytes, width, height.
+    using MappedFrameFunc = std::function<void(const uint8_t*, size_t, int, int)>;
+    // Returns false if no frame is ready. Pixels are only valid during the callback.
+    bool TryGetNextFrame(const MappedFrameFunc& func);
+    // Copies the next frame into a pooled buffer as the CopyOptions say. Empty frame if none is ready.
+    Frame TryGetNextFrame();
+
+    // FrameSource: waits for FrameArrived, then TryGetNextFrame()
+    Frame WaitNextFrame(std::chrono::milliseconds timeout) override;
+    FramePool::Stats GetPoolStats() const override { return m_pool->GetStats(); }
+    void Interrupt() override;
 
     void Close();
 
 private:
+    template <typename Func>
+    bool MapNextFrame(Func&& func);
+
     //void OnFrameArrived(
     //    winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const& sender,
     //    winrt::Windows::Foundation::IInspectable const& args);
@@ -38,6 +58,15 @@ private:
     winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
     winrt::com_ptr<IDXGISwapChain1> m_swapChain{ nullptr };
     winrt::com_ptr<ID3D11DeviceContext> m_d3dContext{ nullptr };
+    winrt::com_ptr<ID3D11Texture2D> m_stagingTexture{ nullptr };
+
+    SurfaceCopier m_copier;
+    std::shared_ptr<FramePool> m_pool = FramePool::Create();
+    uint64_t m_nextFrameId = 1;
+
+    std::mutex m_arrivedMutex;
+    std::condition_variable m_arrivedCond;
+    bool m_arrived = false;
 
     std::atomic<bool> m_closed = false;
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::FrameArrived_revoker m_frameArrived;
@@ -0,0 +1,409 @@
+#include "stdafx.h"
+#include "SocketServer.h"
+
+#include <stdexcept>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifndef DOLLSAI_CMAKE
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+    using socket_t = SOCKET;
+    using pollfd_t = WSAPOLLFD;
+    constexpr socket_t kNoSocket = INVALID_SOCKET;
+
+    int last_socket_error() { return WSAGetLastError(); }
+    bool would_block(int error) { return error == WSAEWOULDBLOCK; }
+    void close_socket(socket_t s) { closesocket(s); }
+    int poll_sockets(pollfd_t* fds, size_t count) { return WSAPoll(fds, static_cast<ULONG>(count), -1); }
+    void set_nonblocking(socket_t s)
+    {
+        u_long on = 1;
+        ioctlsocket(s, FIONBIO, &on);
+    }
+
+    struct WinsockInit
+    {
+        WinsockInit()
+        {
+            WSADATA data;
+            if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+                throw std::runtime_error("WSAStartup failed");
+            }
+        }
+        ~WinsockInit() { WSACleanup(); }
+    };
+#else
+    using socket_t = int;
+    using pollfd_t = pollfd;
+    constexpr socket_t kNoSocket = -1;
+
+    int last_socket_error() { return errno; }
+    bool would_block(int error) { return error == EAGAIN || error == EWOULDBLOCK || error == EINTR; }
+    void close_socket(socket_t s) { close(s); }
+    int poll_sockets(pollfd_t* fds, size_t count) { return poll(fds, static_cast<nfds_t>(count), -1); }
+    void set_nonblocking(socket_t s)
+    {
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    }
+#endif
+
+#ifdef MSG_NOSIGNAL
+    // a closed peer is noticed by the return value, not by SIGPIPE
+    constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+    constexpr int kSendFlags = 0;
+#endif
+
+    // per recv, and recvs per client and poll round
+    constexpr size_t kReadSize = 64 * 1024;
+    constexpr size_t kReadsPerRound = 16;
+
+    socket_t to_socket(intptr_t fd) { return static_cast<socket_t>(fd); }
+
+    [[noreturn]] void throw_socket_error(const char* what)
+    {
+        throw std::runtime_error(std::string(what) + " failed (" + std::to_string(last_socket_error()) + ")");
+    }
+
+    socket_t listen_tcp(int port)
+    {
+        socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s == kNoSocket) {
+            throw_socket_error("socket");
+        }
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        // local clients only
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, SOMAXCONN) != 0) {
+            close_socket(s);
+            throw_socket_error("bind/listen");
+        }
+        return s;
+    }
+
+    socket_t listen_unix(const std::string& path)
+    {
+#ifdef _WIN32
+        throw std::runtime_error("unix: listeners need a POSIX system, use tcp:<port>");
+#else
+        socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == kNoSocket) {
+            throw_socket_error("socket");
+        }
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            close_socket(s);
+            throw std::runtime_error("Socket path too long");
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        // left behind by a server that did not exit cleanly
+        unlink(path.c_str());
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, SOMAXCONN) != 0) {
+            close_socket(s);
+            throw_socket_error("bind/listen");
+        }
+        return s;
+#endif
+    }
+
+    socket_t wake_socket()
+    {
+        socket_t s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s == kNoSocket) {
+            throw_socket_error("socket");
+        }
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            getsockname(s, reinterpret_cast<sockaddr*>(&addr), &len) != 0 ||
+            connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close_socket(s);
+            throw_socket_error("wake socket");
+        }
+        set_nonblocking(s);
+        return s;
+    }
+}
+
+SocketClient::SocketClient(SocketServer& server, intptr_t fd) : m_server(server), m_fd(fd)
+{
+}
+
+void SocketClient::Resume()
+{
+    m_paused = false;
+    m_server.Wake();
+}
+
+void SocketClient::RemovePending()
+{
+    if (m_pending-- == kMaxPending) {
+        m_server.Wake();
+    }
+}
+
+bool SocketClient::Congested() const
+{
+    std::lock_guard<std::mutex> lock(m_outMutex);
+    return m_outBytes > kCongestedBytes;
+}
+
+void SocketClient::Send(std::vector<uint8_t> head, const std::vector<Attachment>& attachments)
+{
+    if (m_closed) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_outMutex);
+        m_outBytes += head.size();
+        m_output.push_back({ std::move(head), {} });
+        for (const auto& a : attachments) {
+            m_outBytes += a.size;
+            m_output.push_back({ {}, a });
+        }
+        if (m_outBytes > kMaxQueuedBytes) {
+            // not reading its replies, dropped before it holds on to every frame
+            m_closed = true;
+        }
+    }
+    m_server.Wake();
+}
+
+SocketServer::SocketServer(const std::string& address, Handler handler) : m_handler(std::move(handler))
+{
+#ifdef _WIN32
+    static WinsockInit winsock;
+#endif
+    if (address.compare(0, 5, "unix:") == 0) {
+        m_unixPath = address.substr(5);
+        m_listen = listen_unix(m_unixPath);
+    }
+    else if (address.compare(0, 4, "tcp:") == 0) {
+        m_listen = listen_tcp(std::stoi(address.substr(4)));
+    }
+    else {
+        throw std::runtime_error("Listen address must be unix:<path> or tcp:<port>");
+    }
+    set_nonblocking(to_socket(m_listen));
+    try {
+        m_wake = wake_socket();
+    }
+    catch (...) {
+        close_socket(to_socket(m_listen));
+        throw;
+    }
+}
+
+SocketServer::~SocketServer()
+{
+    for (const auto& client : m_clients) {
+        Close(*client);
+    }
+    close_socket(to_socket(m_wake));
+    close_socket(to_socket(m_listen));
+#ifndef _WIN32
+    if (!m_unixPath.empty()) {
+        unlink(m_unixPath.c_str());
+    }
+#endif
+}
+
+void SocketServer::Stop()
+{
+    m_stop = true;
+    Wake();
+}
+
+void SocketServer::Wake()
+{
+    char byte = 0;
+    send(to_socket(m_wake), &byte, 1, 0);
+}
+
+void SocketServer::Run()
+{
+    std::vector<pollfd_t> fds;
+    while (!m_stop) {
+        fds.clear();
+        fds.push_back({ to_socket(m_listen), POLLIN, 0 });
+        fds.push_back({ to_socket(m_wake), POLLIN, 0 });
+        for (const auto& client : m_clients) {
+            short events = client->Reading() ? POLLIN : 0;
+            {
+                std::lock_guard<std::mutex> lock(client->m_outMutex);
+                if (!client->m_output.empty()) {
+                    events |= POLLOUT;
+                }
+            }
+            fds.push_back({ to_socket(client->m_fd), events, 0 });
+        }
+        if (poll_sockets(fds.data(), fds.size()) < 0) {
+            if (would_block(last_socket_error())) {
+                continue;
+            }
+            throw_socket_error("poll");
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char buf[256];
+            while (recv(to_socket(m_wake), buf, sizeof(buf), 0) > 0) {
+            }
+        }
+        // m_clients may grow below, fds only covers the ones polled
+        size_t polled = fds.size() - 2;
+        for (size_t i = 0; i < polled; i++) {
+            auto client = m_clients[i];
+            short revents = fds[i + 2].revents;
+            bool alive = !client->m_closed;
+            if (alive && (revents & POLLIN)) {
+                alive = ReadFrom(*client);
+            }
+            if (alive && (revents & POLLOUT)) {
+                alive = WriteTo(*client);
+            }
+            if (alive && (revents & (POLLERR | POLLNVAL | POLLHUP)) && !(revents & POLLIN)) {
+                // hung up while paused, or failed
+                alive = false;
+            }
+            if (alive) {
+                // also after a Resume, the requests may already be buffered
+                DecodeRequests(client);
+            }
+            if (!alive || client->m_closed) {
+                Close(*client);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            Accept();
+        }
+
+        size_t kept = 0;
+        for (auto& client : m_clients) {
+            if (client->m_fd != -1) {
+                m_clients[kept++] = std::move(client);
+            }
+        }
+        m_clients.resize(kept);
+        m_clientCount = kept;
+    }
+}
+
+void SocketServer::Accept()
+{
+    while (true) {
+        socket_t s = accept(to_socket(m_listen), nullptr, nullptr);
+        if (s == kNoSocket) {
+            return;
+        }
+        set_nonblocking(s);
+        if (m_unixPath.empty()) {
+            // replies are small and latency bound
+            int on = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+        }
+        m_clients.push_back(std::make_shared<SocketClient>(*this, static_cast<intptr_t>(s)));
+    }
+}
+
+bool SocketServer::ReadFrom(SocketClient& client)
+{
+    auto& input = client.m_input;
+    // decoded before the next round, so the input holds at most one message plus this
+    for (size_t round = 0; round < kReadsPerRound; round++) {
+        size_t used = input.size();
+        input.resize(used + kReadSize);
+        auto got = recv(to_socket(client.m_fd), reinterpret_cast<char*>(input.data() + used), static_cast<int>(kReadSize), 0);
+        input.resize(used + (got > 0 ? static_cast<size_t>(got) : 0));
+        if (got == 0) {
+            // EOF
+            return false;
+        }
+        if (got < 0) {
+            return would_block(last_socket_error());
+        }
+    }
+    // more is waiting, poll reports it again
+    return true;
+}
+
+bool SocketServer::WriteTo(SocketClient& client)
+{
+    std::lock_guard<std::mutex> lock(client.m_outMutex);
+    while (!client.m_output.empty()) {
+        const auto& chunk = client.m_output.front();
+        const uint8_t* data = chunk.bytes.empty() ? chunk.attachment.data : chunk.bytes.data();
+        size_t size = chunk.bytes.empty() ? chunk.attachment.size : chunk.bytes.size();
+        size_t left = size - client.m_outOffset;
+        auto sent = send(to_socket(client.m_fd), reinterpret_cast<const char*>(data + client.m_outOffset),
+            static_cast<int>((std::min)(left, size_t(1) << 30)), kSendFlags);
+        if (sent < 0) {
+            return would_block(last_socket_error());
+        }
+        client.m_outOffset += static_cast<size_t>(sent);
+        client.m_outBytes -= static_cast<size_t>(sent);
+        if (client.m_outOffset == size) {
+            client.m_output.pop_front();
+            client.m_outOffset = 0;
+        }
+    }
+    return true;
+}
+
+void SocketServer::DecodeRequests(const std::shared_ptr<SocketClient>& client)
+{
+    auto& input = client->m_input;
+    size_t consumed = 0;
+    Request request;
+    try {
+        while (client->Reading() && !client->m_closed) {
+            size_t size = client->Decode(input.data() + consumed, input.size() - consumed, request);
+            if (size == 0) {
+                break;
+            }
+            consumed += size;
+            m_handler(client, request);
+        }
+    }
+    catch (std::exception&) {
+        // out of sync, nothing after this can be read
+        client->m_closed = true;
+    }
+    input.erase(input.begin(), input.begin() + consumed);
+}
+
+void SocketServer::Close(SocketClient& client)
+{
+    if (client.m_fd == -1) {
+        return;
+    }
+    client.m_closed = true;
+    close_socket(to_socket(client.m_fd));
+    client.m_fd = -1;
+    std::lock_guard<std::mutex> lock(client.m_outMutex);
+    client.m_output.clear();
+    client.m_outBytes = 0;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Protocol.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class SocketServer;
+
+// One accepted connection. Write only queues the message; the server's loop sends
+// it, so a slow client never blocks the thread that answers it. Attachments are
+// queued by reference (their Frame keeps the pixels alive), so one frame sent to
+// many clients is never copied per client.
+class SocketClient : public CommandStream
+{
+public:
+    // queued bytes beyond this close the connection
+    static constexpr size_t kMaxQueuedBytes = 256 * 1024 * 1024;
+    // queued bytes beyond this make the client Congested
+    static constexpr size_t kCongestedBytes = 1024 * 1024;
+    // requests handed off and not answered yet; at this many the client is not read from
+    static constexpr size_t kMaxPending = 64;
+
+    SocketClient(SocketServer& server, intptr_t fd);
+
+    // While paused, no further requests are decoded (the client waits for a reply).
+    void Pause() { m_paused = true; }
+    void Resume();
+    // Around a request answered in the background: the client is read again once
+    // fewer than kMaxPending are.
+    void AddPending() { m_pending++; }
+    void RemovePending();
+    // requests are read and decoded
+    bool Reading() const { return !m_paused && m_pending < kMaxPending; }
+    bool Closed() const override { return m_closed; }
+    bool Congested() const override;
+
+protected:
+    void Send(std::vector<uint8_t> head, const std::vector<Attachment>& attachments) override;
+
+private:
+    friend class SocketServer;
+
+    struct Chunk
+    {
+        std::vector<uint8_t> bytes;
+        Attachment attachment;
+    };
+
+    SocketServer& m_server;
+    intptr_t m_fd;
+    std::atomic<bool> m_paused = false;
+    std::atomic<size_t> m_pending = 0;
+    std::atomic<bool> m_closed = false;
+
+    // loop thread only
+    std::vector<uint8_t> m_input;
+
+    mutable std::mutex m_outMutex;
+    std::deque<Chunk> m_output;
+    // sent bytes of m_output.front()
+    size_t m_outOffset = 0;
+    size_t m_outBytes = 0;
+};
+
+// Event-driven listener: one thread polls the listening socket and every client,
+// reads requests and sends queued replies. Requests are handed to the handler on
+// that thread, which should not block for long (post them to workers). A client
+// that is not Reading is not polled for input, so its socket buffer fills and the
+// sender waits; the server never holds more than one round of reads per client
+// beyond the message being decoded.
+//
+// address: "unix:<path>" (POSIX only) or "tcp:<port>" on 127.0.0.1
+class SocketServer
+{
+public:
+    using Handler = std::function<void(const std::shared_ptr<SocketClient>&, Request&)>;
+
+    SocketServer(const std::string& address, Handler handler);
+    ~SocketServer();
+
+    SocketServer(const SocketServer&) = delete;
+    SocketServer& operator=(const SocketServer&) = delete;
+
+    // Serves until Stop is called.
+    void Run();
+    // Thread safe.
+    void Stop();
+    // Makes the loop poll again (output queued, client resumed). Thread safe.
+    void Wake();
+
+    size_t ClientCount() const { return m_clientCount; }
+
+private:
+    void Accept();
+    // false if the connection is done
+    bool ReadFrom(SocketClient& client);
+    bool WriteTo(SocketClient& client);
+    void DecodeRequests(const std::shared_ptr<SocketClient>& client);
+    void Close(SocketClient& client);
+
+    Handler m_handler;
+    std::string m_unixPath;
+    intptr_t m_listen = -1;
+    // loopback UDP socket connected to itself, written by Wake
+    intptr_t m_wake = -1;
+    std::atomic<bool> m_stop = false;
+    std::atomic<size_t> m_clientCount = 0;
+    std::vector<std::shared_ptr<SocketClient>> m_clients;
+};
@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#include "SyntheticSource.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <thread>
+
+namespace {
+    constexpr int kBoxSize = 64;
+}
+
+SyntheticSource::SyntheticSource(int width, int height, double fps, CopyOptions options)
+    : m_width(width), m_height(height), m_copier(std::move(options))
+{
+    if (width <= 0 || height <= 0 || fps <= 0) {
+        throw std::invalid_argument("Invalid synthetic source parameters");
+    }
+    m_interval = std::chrono::duration_cast<FrameClock::duration>(std::chrono::duration<double>(1.0 / fps));
+    m_next = FrameClock::now();
+
+    m_background.resize(4 * static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+        uint8_t* p = m_background.data() + 4 * static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; x++) {
+            p[4 * x + 0] = static_cast<uint8_t>(x);
+            p[4 * x + 1] = static_cast<uint8_t>(y);
+            p[4 * x + 2] = static_cast<uint8_t>(x + y);
+            p[4 * x + 3] = 255;
+        }
+    }
+    m_surface = m_background;
+}
+
+Frame SyntheticSource::WaitNextFrame(std::chrono::milliseconds timeout)
+{
+    auto now = FrameClock::now();
+    if (m_next - now > timeout) {
+        std::this_thread::sleep_for(timeout);
+        return Frame();
+    }
+    std::this_thread::sleep_until(m_next);
+    if (m_interrupted) {
+        return Frame();
+    }
+    // keep the rate, but do not try to catch up after a stall
+    m_next = (std::max)(m_next + m_interval, FrameClock::now());
+
+    uint64_t id = m_nextFrameId++;
+    const size_t pitch = 4 * static_cast<size_t>(m_width);
+    int box_w = (std::min)(kBoxSize, m_width);
+    int box_h = (std::min)(kBoxSize, m_height);
+    int span = m_width - box_w + 1;
+    int box_x = static_cast<int>(id * 4 % span);
+    // restore the rows under the previous square, then draw the new one
+    memcpy(m_surface.data(), m_background.data(), pitch * box_h);
+    for (int y = 0; y < box_h; y++) {
+        memset(m_surface.data() + y * pitch + box_x * 4, static_cast<int>(id & 0xff), static_cast<size_t>(box_w) * 4);
+    }
+
+    Frame frame = m_copier.Copy(*m_pool, m_surface.data(), pitch, m_width, m_height);
+    frame.SetId(id);
+    frame.SetTimestamp(FrameClock::now());
+    return frame;
+}
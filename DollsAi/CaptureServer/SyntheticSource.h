@@ -0,0 +1,33 @@
+#pragma once
+
+#include "FrameCopy.h"
+#include "FrameSource.h"
+
+#include <atomic>
+#include <vector>
+
+// Test pattern at a fixed rate: a static gradient with a 64x64 square moving
+// along the top rows, so only a small part of each frame changes.
+// Needs no window and no GPU.
+class SyntheticSource : public FrameSource
+{
+public:
+    SyntheticSource(int width, int height, double fps, CopyOptions options = {});
+
+    Frame WaitNextFrame(std::chrono::milliseconds timeout) override;
+    FramePool::Stats GetPoolStats() const override { return m_pool->GetStats(); }
+    void Interrupt() override { m_interrupted = true; }
+
+private:
+    int m_width;
+    int m_height;
+    SurfaceCopier m_copier;
+    FrameClock::duration m_interval;
+    FrameClock::time_point m_next;
+
+    std::vector<uint8_t> m_background; // BGRA
+    std::vector<uint8_t> m_surface; // background plus the square, stands in for the mapped texture
+    std::shared_ptr<FramePool> m_pool = FramePool::Create();
+    uint64_t m_nextFrameId = 1;
+    std::atomic<bool> m_interrupted = false;
+};
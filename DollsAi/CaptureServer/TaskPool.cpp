@@ -0,0 +1,172 @@
+#include "stdafx.h"
+#include "TaskPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+namespace {
+    // tasks per thread and ParallelFor: enough to even out uneven items
+    constexpr size_t kTasksPerThread = 4;
+
+    // queue of the current thread if it is a worker of that pool
+    thread_local const void* t_pool = nullptr;
+    thread_local size_t t_queue = 0;
+}
+
+struct TaskPool::Job
+{
+    const std::function<void(size_t)>* body;
+    std::atomic<size_t> remaining;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    size_t error_index = SIZE_MAX;
+};
+
+TaskPool::TaskPool(unsigned threads)
+{
+    if (threads == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        threads = hardware > 1 ? hardware - 1 : 0;
+    }
+    // one queue per worker, the last one for callers from outside
+    for (unsigned i = 0; i <= threads; i++) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        m_threads.emplace_back([this, i]() { Worker(i); });
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+TaskPool& TaskPool::Default()
+{
+    static TaskPool pool;
+    return pool;
+}
+
+void TaskPool::ParallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+    if (count == 0) {
+        return;
+    }
+    if (count == 1 || m_threads.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    const size_t tasks = (std::min)(count, Concurrency() * kTasksPerThread);
+    Job job;
+    job.body = &body;
+    job.remaining = tasks;
+
+    // counted before they are pushed, so m_queued never goes below the real count
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued += tasks;
+    }
+    // spread the tasks over all queues, starting with our own
+    const size_t home = t_pool == this ? t_queue : m_queues.size() - 1;
+    for (size_t t = 0; t < tasks; t++) {
+        Queue& queue = *m_queues[(home + t) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ &job, count * t / tasks, count * (t + 1) / tasks });
+    }
+    m_cond.notify_all();
+
+    // help until our job is done, running whatever task comes first (maybe another job's)
+    while (job.remaining.load() != 0) {
+        if (TryRun(home)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]() { return job.remaining.load() == 0 || m_queued.load() != 0; });
+    }
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+void TaskPool::Worker(size_t index)
+{
+    t_pool = this;
+    t_queue = index;
+    trace_thread_name("pool");
+    for (;;) {
+        if (TryRun(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_stop || m_queued.load() != 0; });
+        if (m_stop) {
+            return;
+        }
+    }
+}
+
+// own queue newest first, then steal the oldest task of the others
+bool TaskPool::TryRun(size_t home)
+{
+    Task task = {};
+    bool found = false;
+    {
+        Queue& own = *m_queues[home];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (size_t i = 1; !found && i < m_queues.size(); i++) {
+        Queue& victim = *m_queues[(home + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    m_queued--;
+    Run(task);
+    return true;
+}
+
+void TaskPool::Run(const Task& task)
+{
+    Job& job = *task.job;
+    for (size_t i = task.begin; i < task.end; i++) {
+        try {
+            (*job.body)(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(job.error_mutex);
+            if (i < job.error_index) {
+                job.error_index = i;
+                job.error = std::current_exception();
+            }
+            break;
+        }
+    }
+    if (--job.remaining == 0) {
+        // the waiting caller checks remaining under m_mutex
+        { std::lock_guard<std::mutex> lock(m_mutex); }
+        m_cond.notify_all();
+    }
+}
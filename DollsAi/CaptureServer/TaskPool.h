@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool for splitting one request into independent tasks.
+// Each worker has its own deque: it pops its newest task, idle workers steal the
+// oldest task of another worker. The thread calling ParallelFor runs tasks too
+// while it waits, so ParallelFor may be nested inside a task.
+class TaskPool
+{
+public:
+    // threads: worker count, 0 = one per hardware thread minus the caller
+    explicit TaskPool(unsigned threads = 0);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    // threads that run tasks of one ParallelFor, including the caller
+    unsigned Concurrency() const { return static_cast<unsigned>(m_threads.size()) + 1; }
+
+    // Calls body(i) for every i in [0, count) and returns when all are done.
+    // If calls throw, the exception of the lowest index is rethrown.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    // process wide pool, created on first use
+    static TaskPool& Default();
+
+private:
+    struct Job;
+    struct Task
+    {
+        Job* job;
+        size_t begin;
+        size_t end;
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Worker(size_t index);
+    bool TryRun(size_t home);
+    void Run(const Task& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::atomic<size_t> m_queued = 0;
+    bool m_stop = false;
+};
+
+// results[i] = func(i), computed on the pool, in index order regardless of scheduling.
+template <typename T, typename Func>
+std::vector<T> parallel_map(TaskPool& pool, size_t count, Func&& func)
+{
+    std::vector<T> results(count);
+    pool.ParallelFor(count, [&](size_t i) {
+        results[i] = func(i);
+    });
+    return results;
+}
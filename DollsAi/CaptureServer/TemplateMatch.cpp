@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "TemplateMatch.h"
+#include "TaskPool.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    // Coarse levels stop before the template gets smaller than this.
+    constexpr int kMinTemplateSide = 12;
+    // Scores drop at reduced resolution; candidates this far below the threshold are still refined.
+    constexpr double kCoarseSlack = 0.2;
+    // search window margin around the upscaled candidate, in pixels of the finer level
+    constexpr int kRefineMargin = 3;
+    // fewer result rows per stripe are not worth a task
+    constexpr int kMinStripeRows = 32;
+
+    cv::Mat to_channels(const cv::Mat& image, int channels)
+    {
+        if (image.channels() == channels) {
+            return image;
+        }
+        if (image.channels() > 4 || channels > 4) {
+            throw std::invalid_argument("Unsupported channel count");
+        }
+        static const int codes[5][5] = {
+            // to:   -, gray, -, BGR, BGRA
+            { -1, -1, -1, -1, -1 },
+            { -1, -1, -1, cv::COLOR_GRAY2BGR, cv::COLOR_GRAY2BGRA },
+            { -1, -1, -1, -1, -1 },
+            { -1, cv::COLOR_BGR2GRAY, -1, -1, cv::COLOR_BGR2BGRA },
+            { -1, cv::COLOR_BGRA2GRAY, -1, cv::COLOR_BGRA2BGR, -1 },
+        };
+        int code = codes[image.channels()][channels];
+        if (code < 0) {
+            throw std::invalid_argument("Unsupported channel count");
+        }
+        cv::Mat converted;
+        cv::cvtColor(image, converted, code);
+        return converted;
+    }
+
+    cv::Mat half(const cv::Mat& image)
+    {
+        cv::Mat result;
+        cv::resize(image, result, cv::Size((std::max)(1, image.cols / 2), (std::max)(1, image.rows / 2)), 0, 0, cv::INTER_AREA);
+        return result;
+    }
+
+    cv::Mat half_mask(const cv::Mat& mask)
+    {
+        cv::Mat result;
+        cv::resize(mask, result, cv::Size((std::max)(1, mask.cols / 2), (std::max)(1, mask.rows / 2)), 0, 0, cv::INTER_NEAREST);
+        return result;
+    }
+
+    void match(const cv::Mat& image, const Template& templ, int level, cv::Mat& scores)
+    {
+        if (templ.HasMask()) {
+            cv::matchTemplate(image, templ.Level(level), scores, cv::TM_CCOEFF_NORMED, templ.Mask(level));
+            // masked normalization divides by zero on flat areas
+            cv::patchNaNs(scores, -1.0);
+            cv::threshold(scores, scores, 1.0, 1.0, cv::THRESH_TRUNC);
+        }
+        else {
+            cv::matchTemplate(image, templ.Level(level), scores, cv::TM_CCOEFF_NORMED);
+        }
+    }
+
+    // Same as match, in horizontal stripes of the score map run on the pool.
+    // matchTemplate writes into each stripe in place since its size already fits.
+    void match_striped(const cv::Mat& image, const Template& templ, int level, cv::Mat& scores, TaskPool* pool)
+    {
+        const cv::Mat& t = templ.Level(level);
+        int rows = image.rows - t.rows + 1;
+        int stripes = pool == nullptr ? 1 : (std::min)(static_cast<int>(pool->Concurrency()) * 2, rows / kMinStripeRows);
+        if (stripes <= 1) {
+            match(image, templ, level, scores);
+            return;
+        }
+        scores.create(rows, image.cols - t.cols + 1, CV_32F);
+        pool->ParallelFor(stripes, [&](size_t i) {
+            int r0 = static_cast<int>(rows * i / stripes);
+            int r1 = static_cast<int>(rows * (i + 1) / stripes);
+            cv::Mat part = scores.rowRange(r0, r1);
+            match(image.rowRange(r0, r1 + t.rows - 1), templ, level, part);
+        });
+    }
+
+    // Local maxima of a score map above min_score, best first: takes the maximum and
+    // blanks the area a template overlapping it would cover, until max_count are found.
+    std::vector<MatchResult> peaks(cv::Mat& scores, double min_score, size_t max_count, cv::Size templ_size)
+    {
+        std::vector<MatchResult> result;
+        while (result.size() < max_count) {
+            double score;
+            cv::Point loc;
+            cv::minMaxLoc(scores, nullptr, &score, nullptr, &loc);
+            if (score < min_score) {
+                break;
+            }
+            result.push_back({ loc.x, loc.y, score });
+            cv::Rect blank(loc.x - templ_size.width / 2, loc.y - templ_size.height / 2, templ_size.width, templ_size.height);
+            scores(blank & cv::Rect(0, 0, scores.cols, scores.rows)).setTo(-1.0f);
+        }
+        return result;
+    }
+
+    double overlap(const MatchResult& a, const MatchResult& b, cv::Size size)
+    {
+        cv::Rect ra(a.x, a.y, size.width, size.height);
+        cv::Rect rb(b.x, b.y, size.width, size.height);
+        return static_cast<double>((ra & rb).area()) / ra.area();
+    }
+}
+
+cv::Mat frame_to_mat(const Frame& frame)
+{
+    return cv::Mat(frame.Height(), frame.Width(), CV_8UC(bytes_per_pixel(frame.Format())),
+        const_cast<uint8_t*>(frame.Data()), frame.Stride());
+}
+
+Template::Template(cv::Mat image, cv::Mat mask)
+{
+    if (image.empty() || image.depth() != CV_8U) {
+        throw std::invalid_argument("Template must be a non-empty 8 bit image");
+    }
+    if (!mask.empty() && (mask.type() != CV_8UC1 || mask.size() != image.size())) {
+        throw std::invalid_argument("Template mask must be 8 bit, one channel, image sized");
+    }
+    m_levels.push_back(image);
+    if (!mask.empty()) {
+        m_masks.push_back(mask);
+    }
+    while (static_cast<int>(m_levels.size()) < kMaxLevels) {
+        const cv::Mat& last = m_levels.back();
+        if ((std::min)(last.cols, last.rows) / 2 < kMinTemplateSide) {
+            break;
+        }
+        m_levels.push_back(half(last));
+        if (!m_masks.empty()) {
+            m_masks.push_back(half_mask(m_masks.back()));
+        }
+    }
+}
+
+Template::Template(std::vector<cv::Mat> levels, std::vector<cv::Mat> masks, std::shared_ptr<const void> owner)
+    : m_levels(std::move(levels)), m_masks(std::move(masks)), m_owner(std::move(owner))
+{
+    if (m_levels.empty() || (!m_masks.empty() && m_masks.size() != m_levels.size())) {
+        throw std::invalid_argument("Invalid template levels");
+    }
+}
+
+Template Template::FromImage(const cv::Mat& decoded)
+{
+    if (decoded.empty()) {
+        throw std::invalid_argument("Empty template image");
+    }
+    cv::Mat mask;
+    if (decoded.channels() == 4) {
+        cv::Mat alpha;
+        cv::extractChannel(decoded, alpha, 3);
+        double min_alpha;
+        cv::minMaxLoc(alpha, &min_alpha);
+        if (min_alpha < 255) {
+            mask = alpha > 0;
+        }
+    }
+    return Template(to_channels(decoded, 3), mask);
+}
+
+std::vector<MatchResult> find_template(const cv::Mat& image, const Template& templ, const MatchOptions& options)
+{
+    if (image.cols < templ.Width() || image.rows < templ.Height() || options.max_results == 0) {
+        return {};
+    }
+    cv::Mat source = to_channels(image, templ.Level(0).channels());
+
+    int levels = options.levels < 0 ? templ.Levels() : (std::min)(options.levels, templ.Levels());
+    levels = (std::max)(levels, 1);
+    std::vector<cv::Mat> pyramid = { source };
+    for (int i = 1; i < levels; i++) {
+        cv::Mat next = half(pyramid.back());
+        if (next.cols < templ.Level(i).cols || next.rows < templ.Level(i).rows) {
+            levels = i;
+            break;
+        }
+        pyramid.push_back(next);
+    }
+
+    // whole image at the coarsest level
+    int top = levels - 1;
+    cv::Mat scores;
+    match_striped(pyramid[top], templ, top, scores, options.pool);
+    double coarse_threshold = top == 0 ? options.threshold : options.threshold - kCoarseSlack;
+    // extra candidates, some fail to reach the threshold at full resolution
+    size_t max_candidates = top == 0 ? options.max_results : options.max_results * 4;
+    auto candidates = peaks(scores, coarse_threshold, max_candidates, templ.Level(top).size());
+
+    // refine each candidate down to full resolution
+    auto refine = [&](size_t i) {
+        MatchResult& c = candidates[i];
+        for (int level = top - 1; level >= 0; level--) {
+            const cv::Mat& img = pyramid[level];
+            const cv::Mat& t = templ.Level(level);
+            cv::Rect window(2 * c.x - kRefineMargin, 2 * c.y - kRefineMargin,
+                t.cols + 2 * kRefineMargin, t.rows + 2 * kRefineMargin);
+            window &= cv::Rect(0, 0, img.cols, img.rows);
+            if (window.width < t.cols || window.height < t.rows) {
+                c.score = -1;
+                return;
+            }
+            cv::Mat local;
+            match(img(window), templ, level, local);
+            double score;
+            cv::Point loc;
+            cv::minMaxLoc(local, nullptr, &score, nullptr, &loc);
+            c = { window.x + loc.x, window.y + loc.y, score };
+        }
+    };
+    if (options.pool != nullptr && top > 0) {
+        options.pool->ParallelFor(candidates.size(), refine);
+    }
+    else {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            refine(i);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const MatchResult& a, const MatchResult& b) {
+        return a.score > b.score;
+    });
+    std::vector<MatchResult> result;
+    for (const auto& c : candidates) {
+        if (c.score < options.threshold || result.size() >= options.max_results) {
+            break;
+        }
+        bool suppressed = std::any_of(result.begin(), result.end(), [&](const MatchResult& r) {
+            return overlap(r, c, templ.Level(0).size()) > 0.5;
+        });
+        if (!suppressed) {
+            result.push_back(c);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "FramePool.h"
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+#include <vector>
+
+class TaskPool;
+
+// Wraps frame pixels without copying; valid while the frame is alive.
+cv::Mat frame_to_mat(const Frame& frame);
+
+// A template image with its pyramid, built once when the template is loaded.
+// Level 0 is the full size, each further level is half the previous one.
+// An optional mask (8 bit, non-zero = compared) has a matching pyramid.
+class Template
+{
+public:
+    static constexpr int kMaxLevels = 4;
+
+    // 8 bit gray, BGR or BGRA
+    explicit Template(cv::Mat image, cv::Mat mask = cv::Mat());
+    // Prebuilt levels, e.g. views into a mapped asset pack kept alive by owner.
+    // masks is empty or has one entry per level.
+    Template(std::vector<cv::Mat> levels, std::vector<cv::Mat> masks, std::shared_ptr<const void> owner);
+
+    // Decoded file contents (cv::IMREAD_UNCHANGED) to a BGR template, like the frames.
+    // Alpha becomes the mask unless the image is fully opaque.
+    static Template FromImage(const cv::Mat& decoded);
+
+    int Width() const { return m_levels[0].cols; }
+    int Height() const { return m_levels[0].rows; }
+    int Levels() const { return static_cast<int>(m_levels.size()); }
+    const cv::Mat& Level(int level) const { return m_levels[level]; }
+    bool HasMask() const { return !m_masks.empty(); }
+    // empty Mat if HasMask() is false
+    const cv::Mat& Mask(int level) const { return HasMask() ? m_masks[level] : m_noMask; }
+
+private:
+    std::vector<cv::Mat> m_levels;
+    std::vector<cv::Mat> m_masks;
+    cv::Mat m_noMask;
+    std::shared_ptr<const void> m_owner;
+};
+
+struct MatchOptions
+{
+    // minimum TM_CCOEFF_NORMED score at full resolution
+    double threshold = 0.9;
+    size_t max_results = 8;
+    // pyramid levels to use, 1 = full resolution only, -1 = as many as the template size allows
+    int levels = -1;
+    // splits the coarse search into stripes and refines candidates in parallel, if set
+    TaskPool* pool = nullptr;
+};
+
+struct MatchResult
+{
+    // top left corner of the match, in image pixels
+    int x;
+    int y;
+    double score;
+};
+
+// Coarse-to-fine search: matches the whole image at the coarsest pyramid level with a
+// lowered threshold, then refines every candidate in a small window per finer level.
+// Overlapping matches are suppressed, best first. The image is converted to the
+// template's channel count if they differ.
+std::vector<MatchResult> find_template(const cv::Mat& image, const Template& templ, const MatchOptions& options);
@@ -0,0 +1,241 @@
+#include "stdafx.h"
+#include "TemplateRegistry.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <ctype.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string.h>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr size_t kAlign = 64;
+
+    size_t align_up(size_t n)
+    {
+        return (n + kAlign - 1) / kAlign * kAlign;
+    }
+
+    // Reserves space for a plane in the data block and describes it.
+    template_pack::Plane plan_plane(const cv::Mat& mat, size_t& end)
+    {
+        template_pack::Plane plane = {};
+        plane.offset = end;
+        plane.width = mat.cols;
+        plane.height = mat.rows;
+        plane.stride = static_cast<uint32_t>(align_up(mat.cols * mat.elemSize()));
+        end = align_up(end + static_cast<size_t>(plane.stride) * plane.height);
+        return plane;
+    }
+
+    void write_plane(std::vector<uint8_t>& file, const template_pack::Plane& plane, const cv::Mat& mat)
+    {
+        size_t row_bytes = mat.cols * mat.elemSize();
+        for (int y = 0; y < mat.rows; y++) {
+            memcpy(file.data() + plane.offset + static_cast<size_t>(y) * plane.stride, mat.ptr(y), row_bytes);
+        }
+    }
+
+    // bounds checked view of a plane in the mapped file
+    cv::Mat map_plane(const MappedFile& file, const template_pack::Plane& plane, int type)
+    {
+        size_t row_bytes = static_cast<size_t>(plane.width) * CV_ELEM_SIZE(type);
+        if (plane.width == 0 || plane.height == 0 || plane.stride < row_bytes || plane.offset > file.Size()
+            || static_cast<uint64_t>(plane.stride) * plane.height > file.Size() - plane.offset) {
+            throw std::runtime_error("Corrupt template pack: " + file.Path());
+        }
+        return cv::Mat(plane.height, plane.width, type, const_cast<uint8_t*>(file.Data() + plane.offset), plane.stride);
+    }
+}
+
+bool is_image_file(const std::string& path)
+{
+    auto ext = fs::u8path(path).extension().u8string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+    return ext == ".png" || ext == ".bmp" || ext == ".jpg" || ext == ".jpeg";
+}
+
+cv::Mat read_image_file(const std::string& path)
+{
+    std::ifstream in(fs::u8path(path), std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    cv::Mat image = bytes.empty() ? cv::Mat() : cv::imdecode(bytes, cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        throw std::runtime_error("Cannot read image: " + path);
+    }
+    return image;
+}
+
+size_t build_template_pack(const std::string& dir, const std::string& path)
+{
+    const fs::path root = fs::u8path(dir);
+    std::vector<std::pair<std::string, fs::path>> files;
+    for (const auto& item : fs::recursive_directory_iterator(root)) {
+        if (item.is_regular_file() && is_image_file(item.path().u8string())) {
+            auto name = item.path().lexically_relative(root).replace_extension().generic_u8string();
+            files.emplace_back(name, item.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<Template> templates;
+    for (const auto& file : files) {
+        templates.push_back(Template::FromImage(read_image_file(file.second.u8string())));
+    }
+
+    // offsets first, then one buffer for the whole file
+    std::vector<template_pack::Entry> entries(files.size());
+    size_t end = sizeof(template_pack::Header) + entries.size() * sizeof(template_pack::Entry);
+    for (size_t i = 0; i < files.size(); i++) {
+        entries[i] = {};
+        entries[i].name_offset = end;
+        entries[i].name_size = static_cast<uint32_t>(files[i].first.size());
+        end += files[i].first.size();
+    }
+    end = align_up(end);
+    for (size_t i = 0; i < templates.size(); i++) {
+        const Template& t = templates[i];
+        entries[i].channels = static_cast<uint8_t>(t.Level(0).channels());
+        entries[i].levels = static_cast<uint8_t>(t.Levels());
+        entries[i].has_mask = t.HasMask() ? 1 : 0;
+        for (int level = 0; level < t.Levels(); level++) {
+            entries[i].pixels[level] = plan_plane(t.Level(level), end);
+            if (t.HasMask()) {
+                entries[i].masks[level] = plan_plane(t.Mask(level), end);
+            }
+        }
+    }
+
+    std::vector<uint8_t> file(end);
+    template_pack::Header header = {};
+    memcpy(header.magic, template_pack::kMagic, sizeof(header.magic));
+    header.version = template_pack::kVersion;
+    header.count = static_cast<uint32_t>(entries.size());
+    header.file_size = end;
+    memcpy(file.data(), &header, sizeof(header));
+    if (!entries.empty()) {
+        memcpy(file.data() + sizeof(header), entries.data(), entries.size() * sizeof(template_pack::Entry));
+    }
+    for (size_t i = 0; i < templates.size(); i++) {
+        memcpy(file.data() + entries[i].name_offset, files[i].first.data(), files[i].first.size());
+        const Template& t = templates[i];
+        for (int level = 0; level < t.Levels(); level++) {
+            write_plane(file, entries[i].pixels[level], t.Level(level));
+            if (t.HasMask()) {
+                write_plane(file, entries[i].masks[level], t.Mask(level));
+            }
+        }
+    }
+
+    // a reader never sees a half written pack
+    fs::path target = fs::u8path(path);
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), file.size());
+        if (!out) {
+            throw std::runtime_error("Cannot write template pack: " + path);
+        }
+    }
+    fs::rename(temp, target);
+    return templates.size();
+}
+
+std::shared_ptr<const TemplatePack> TemplatePack::Open(const std::string& path)
+{
+    auto file = std::make_shared<const MappedFile>(MappedFile::Open(path));
+    template_pack::Header header = {};
+    if (file->Size() < sizeof(header)) {
+        throw std::runtime_error("Not a template pack: " + path);
+    }
+    memcpy(&header, file->Data(), sizeof(header));
+    if (memcmp(header.magic, template_pack::kMagic, sizeof(header.magic)) != 0
+        || header.version != template_pack::kVersion || header.file_size != file->Size()
+        || header.count > (file->Size() - sizeof(header)) / sizeof(template_pack::Entry)) {
+        throw std::runtime_error("Not a template pack (or another version): " + path);
+    }
+
+    auto pack = std::make_shared<TemplatePack>();
+    pack->m_path = path;
+    const auto* entries = reinterpret_cast<const template_pack::Entry*>(file->Data() + sizeof(header));
+    for (uint32_t i = 0; i < header.count; i++) {
+        const template_pack::Entry& e = entries[i];
+        if (e.name_offset > file->Size() || e.name_size > file->Size() - e.name_offset
+            || e.levels == 0 || e.levels > Template::kMaxLevels || e.channels == 0 || e.channels > 4) {
+            throw std::runtime_error("Corrupt template pack: " + path);
+        }
+        std::vector<cv::Mat> levels;
+        std::vector<cv::Mat> masks;
+        for (int level = 0; level < e.levels; level++) {
+            levels.push_back(map_plane(*file, e.pixels[level], CV_8UC(e.channels)));
+            if (e.has_mask) {
+                masks.push_back(map_plane(*file, e.masks[level], CV_8UC1));
+            }
+        }
+        std::string name(reinterpret_cast<const char*>(file->Data() + e.name_offset), e.name_size);
+        pack->m_ids[name] = pack->m_templates.size();
+        pack->m_names.push_back(std::move(name));
+        pack->m_templates.push_back(std::make_shared<const Template>(std::move(levels), std::move(masks), file));
+    }
+    return pack;
+}
+
+std::shared_ptr<const Template> TemplatePack::Get(size_t id) const
+{
+    return id < m_templates.size() ? m_templates[id] : nullptr;
+}
+
+std::shared_ptr<const Template> TemplatePack::Find(const std::string& name) const
+{
+    auto it = m_ids.find(name);
+    return it != m_ids.end() ? m_templates[it->second] : nullptr;
+}
+
+size_t TemplateRegistry::Reload(const std::string& pack_path)
+{
+    // opened outside the lock, lookups continue on the old pack meanwhile
+    auto pack = TemplatePack::Open(pack_path);
+    size_t size = pack->Size();
+    std::shared_ptr<const TemplatePack> old;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        old = std::exchange(m_pack, std::move(pack));
+    }
+    // the old mapping goes away with its last template, outside the lock
+    return size;
+}
+
+void TemplateRegistry::Add(const std::string& name, std::shared_ptr<const Template> templ)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_added[name] = std::move(templ);
+}
+
+std::shared_ptr<const Template> TemplateRegistry::Find(const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_added.find(name);
+    if (it != m_added.end()) {
+        return it->second;
+    }
+    return m_pack ? m_pack->Find(name) : nullptr;
+}
+
+std::shared_ptr<const Template> TemplateRegistry::Find(size_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pack ? m_pack->Get(id) : nullptr;
+}
+
+std::shared_ptr<const TemplatePack> TemplateRegistry::Pack() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pack;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "MappedMemory.h"
+#include "TemplateMatch.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Asset pack: decoded templates with their masks and pyramids in one file that is
+// mapped, not parsed, so opening it decodes nothing.
+//
+// Layout (native endian, offsets from the start of the file):
+//   0        Header
+//   64       Entry[count]
+//   ...      names, UTF-8 without terminators
+//   ...      pixel and mask planes, each starting on a 64 byte boundary
+namespace template_pack {
+    constexpr char kMagic[4] = { 'D', 'A', 'T', 'P' };
+    constexpr uint32_t kVersion = 1;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+        uint64_t file_size;
+        uint8_t pad[40];
+    };
+    static_assert(sizeof(Header) == 64, "template pack header is 64 bytes");
+
+    struct Plane
+    {
+        uint64_t offset;
+        uint32_t width;
+        uint32_t height;
+        uint32_t stride;
+        uint32_t reserved;
+    };
+
+    struct Entry
+    {
+        uint64_t name_offset;
+        uint32_t name_size;
+        uint8_t channels;
+        uint8_t levels;
+        uint8_t has_mask;
+        uint8_t reserved;
+        Plane pixels[Template::kMaxLevels];
+        Plane masks[Template::kMaxLevels];
+    };
+}
+
+// png, bmp or jpg by extension
+bool is_image_file(const std::string& path);
+
+// Decodes an image file as cv::IMREAD_UNCHANGED. path is UTF-8 (read through
+// imdecode, so non-ASCII paths work on Windows too). Throws std::runtime_error.
+cv::Mat read_image_file(const std::string& path);
+
+// Builds a pack from every image (png, bmp, jpg) below dir. Names are the paths
+// relative to dir, '/' separated, without extension; ids are the index in name order.
+// Written to a temporary file and renamed over path. Returns the template count.
+size_t build_template_pack(const std::string& dir, const std::string& path);
+
+// A mapped asset pack. Templates are views into the mapping and keep it alive.
+class TemplatePack
+{
+public:
+    // throws std::runtime_error if the file is missing or malformed
+    static std::shared_ptr<const TemplatePack> Open(const std::string& path);
+
+    const std::string& Path() const { return m_path; }
+    size_t Size() const { return m_templates.size(); }
+    const std::string& Name(size_t id) const { return m_names[id]; }
+
+    // null if unknown
+    std::shared_ptr<const Template> Get(size_t id) const;
+    std::shared_ptr<const Template> Find(const std::string& name) const;
+
+private:
+    std::string m_path;
+    std::vector<std::shared_ptr<const Template>> m_templates;
+    std::vector<std::string> m_names;
+    std::unordered_map<std::string, size_t> m_ids;
+};
+
+// Templates by integer id (index in the current pack) or by name. Reload swaps the
+// whole pack at once; lookups in flight keep the templates they already hold.
+// Templates added one at a time are found by name before the pack and survive reloads.
+class TemplateRegistry
+{
+public:
+    // Opens the pack and swaps it in. On failure the current pack stays. Returns the template count.
+    size_t Reload(const std::string& pack_path);
+
+    void Add(const std::string& name, std::shared_ptr<const Template> templ);
+
+    // null if unknown
+    std::shared_ptr<const Template> Find(const std::string& name) const;
+    std::shared_ptr<const Template> Find(size_t id) const;
+
+    // null if no pack is loaded
+    std::shared_ptr<const TemplatePack> Pack() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::shared_ptr<const TemplatePack> m_pack;
+    std::unordered_map<std::string, std::shared_ptr<const Template>> m_added;
+};
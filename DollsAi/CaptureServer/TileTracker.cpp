@@ -0,0 +1,287 @@
+#include "stdafx.h"
+#include "TileTracker.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace {
+    constexpr uint64_t kPrime64 = 0x9E3779B185EBCA87ULL;
+    constexpr int kKeyPairs = 16;
+
+    // per 16 byte chunk keys (position within the row segment)
+    alignas(16) const uint64_t kKeys[2 * kKeyPairs] = {
+        0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+        0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+        0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+        0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+        0xc3ebd33483acc5eaULL, 0xeb6313faffa081c5ULL, 0x49daf0b751dd0d17ULL, 0x9e68d429265516d3ULL,
+        0xfca1477d58be162bULL, 0xce31d07ad1b8f88fULL, 0x280416958f3acb45ULL, 0x7e404bbbcafbd7afULL,
+        0xb2a5f5f8c1a4a1b6ULL, 0x0c4b1ef51ad32c74ULL, 0x5f3e6a7b28e4d9c1ULL, 0x91d8c7e2f0a3b564ULL,
+        0x3a7d4e9c18b6f205ULL, 0xe5c1a8047f92d36bULL, 0x6b28f3d5c0e9a417ULL, 0xd40e97b3625a8cf1ULL,
+    };
+
+    // xxh3 style accumulation: acc += lo32(d ^ key) * hi32(d ^ key) + swapped d.
+    // Only needs a 32x32->64 multiply, which SSE2 has. Both paths give the same result.
+    void accumulate_scalar(uint64_t* acc, const uint8_t* p, size_t size)
+    {
+        size_t i = 0;
+        int k = 0;
+        for (; i + 16 <= size; i += 16, k = (k + 1) % kKeyPairs) {
+            uint64_t lo, hi;
+            memcpy(&lo, p + i, 8);
+            memcpy(&hi, p + i + 8, 8);
+            uint64_t dlo = lo ^ kKeys[2 * k];
+            uint64_t dhi = hi ^ kKeys[2 * k + 1];
+            acc[0] += (dlo & 0xffffffff) * (dlo >> 32) + hi;
+            acc[1] += (dhi & 0xffffffff) * (dhi >> 32) + lo;
+        }
+        if (i < size) {
+            uint8_t tail[16] = {};
+            memcpy(tail, p + i, size - i);
+            accumulate_scalar(acc, tail, sizeof(tail));
+        }
+    }
+
+#ifdef DOLLSAI_SIMD_X86
+    // SSE2 is the x86 baseline (x64, and MSVC's default /arch for x86), no runtime check
+    void accumulate_sse2(uint64_t* acc, const uint8_t* p, size_t size)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc));
+        size_t i = 0;
+        int k = 0;
+        for (; i + 16 <= size; i += 16, k = (k + 1) % kKeyPairs) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i dk = _mm_xor_si128(v, _mm_load_si128(reinterpret_cast<const __m128i*>(kKeys + 2 * k)));
+            __m128i prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(2, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+            a = _mm_add_epi64(a, _mm_add_epi64(prod, swapped));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc), a);
+        if (i < size) {
+            uint8_t tail[16] = {};
+            memcpy(tail, p + i, size - i);
+            accumulate_scalar(acc, tail, sizeof(tail));
+        }
+    }
+#endif
+
+    void accumulate(uint64_t* acc, const uint8_t* p, size_t size)
+    {
+#ifdef DOLLSAI_SIMD_X86
+        accumulate_sse2(acc, p, size);
+#else
+        accumulate_scalar(acc, p, size);
+#endif
+    }
+
+    // once per row segment, so swapped rows hash differently
+    void scramble(uint64_t* acc)
+    {
+        acc[0] = (acc[0] ^ (acc[0] >> 47)) * kPrime64;
+        acc[1] = (acc[1] ^ (acc[1] >> 47)) * kPrime64;
+    }
+
+    uint64_t finalize(const uint64_t* acc)
+    {
+        uint64_t h = acc[0] ^ ((acc[1] << 29) | (acc[1] >> 35));
+        h ^= h >> 33;
+        h *= kPrime64;
+        return h ^ (h >> 29);
+    }
+
+    // Rectangles in tile units.
+    using TileRect = TileTracker::Rect;
+
+    TileRect bounding(const TileRect& a, const TileRect& b)
+    {
+        int x0 = (std::min)(a.x, b.x);
+        int y0 = (std::min)(a.y, b.y);
+        int x1 = (std::max)(a.x + a.width, b.x + b.width);
+        int y1 = (std::max)(a.y + a.height, b.y + b.height);
+        return { x0, y0, x1 - x0, y1 - y0 };
+    }
+
+    long long area(const TileRect& r)
+    {
+        return static_cast<long long>(r.width) * r.height;
+    }
+
+    // Extends a rect from the previous row when a run has exactly the same span.
+    void add_run(std::vector<TileRect>& rects, std::vector<size_t>& open, std::vector<size_t>& next_open,
+        int x0, int x1, int y)
+    {
+        for (size_t index : open) {
+            TileRect& r = rects[index];
+            if (r.x == x0 && r.width == x1 - x0) {
+                r.height++;
+                next_open.push_back(index);
+                return;
+            }
+        }
+        next_open.push_back(rects.size());
+        rects.push_back({ x0, y, x1 - x0, 1 });
+    }
+
+    // Greedily merges the pair whose bounding box wastes the least area.
+    void merge_to(std::vector<TileRect>& rects, size_t max_rects)
+    {
+        while (rects.size() > max_rects && rects.size() > 1) {
+            size_t best_i = 0;
+            size_t best_j = 1;
+            long long best_cost = -1;
+            for (size_t i = 0; i < rects.size(); i++) {
+                for (size_t j = i + 1; j < rects.size(); j++) {
+                    long long cost = area(bounding(rects[i], rects[j])) - area(rects[i]) - area(rects[j]);
+                    if (best_cost < 0 || cost < best_cost) {
+                        best_cost = cost;
+                        best_i = i;
+                        best_j = j;
+                    }
+                }
+            }
+            rects[best_i] = bounding(rects[best_i], rects[best_j]);
+            rects.erase(rects.begin() + best_j);
+        }
+    }
+
+    // Above this the greedy merge is too slow, so rows are collapsed to bands first.
+    constexpr size_t kMaxGreedyRects = 64;
+}
+
+TileTracker::TileTracker(int tile_size) : m_tileSize(tile_size)
+{
+    if (tile_size < 4) {
+        throw std::invalid_argument("Tile size too small");
+    }
+}
+
+bool TileTracker::Update(const Frame& frame)
+{
+    const int w = frame.Width();
+    const int h = frame.Height();
+    const size_t row_bytes = static_cast<size_t>(w) * bytes_per_pixel(frame.Format());
+    const size_t tile_bytes = static_cast<size_t>(m_tileSize) * bytes_per_pixel(frame.Format());
+    const int cols = (w + m_tileSize - 1) / m_tileSize;
+    const int rows = (h + m_tileSize - 1) / m_tileSize;
+
+    // one pass over the frame in memory order, one running state per tile column
+    m_newHashes.resize(static_cast<size_t>(cols) * rows);
+    m_rowState.resize(2 * static_cast<size_t>(cols));
+    for (int ty = 0; ty < rows; ty++) {
+        std::fill(m_rowState.begin(), m_rowState.end(), 0);
+        int y1 = (std::min)(h, (ty + 1) * m_tileSize);
+        for (int y = ty * m_tileSize; y < y1; y++) {
+            const uint8_t* row = frame.Row(y);
+            for (int tx = 0; tx < cols; tx++) {
+                size_t offset = tx * tile_bytes;
+                uint64_t* acc = &m_rowState[2 * tx];
+                accumulate(acc, row + offset, (std::min)(tile_bytes, row_bytes - offset));
+                scramble(acc);
+            }
+        }
+        for (int tx = 0; tx < cols; tx++) {
+            m_newHashes[ty * cols + tx] = finalize(&m_rowState[2 * tx]);
+        }
+    }
+
+    bool duplicate = true;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (w != m_width || h != m_height || frame.Format() != m_format || m_lastId == 0) {
+        m_width = w;
+        m_height = h;
+        m_format = frame.Format();
+        m_cols = cols;
+        m_rows = rows;
+        m_firstId = frame.Id();
+        m_lastChanged.assign(m_newHashes.size(), frame.Id());
+        duplicate = false;
+    }
+    else {
+        for (size_t i = 0; i < m_newHashes.size(); i++) {
+            if (m_newHashes[i] != m_hashes[i]) {
+                m_lastChanged[i] = frame.Id();
+                duplicate = false;
+            }
+        }
+    }
+    m_lastId = frame.Id();
+    m_hashes.swap(m_newHashes);
+    return duplicate;
+}
+
+uint64_t TileTracker::FrameId() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastId;
+}
+
+std::vector<TileTracker::Rect> TileTracker::ChangedSince(uint64_t since, size_t max_rects, bool* full) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (full != nullptr) {
+        *full = false;
+    }
+    if (m_lastId == 0) {
+        return {};
+    }
+    if (since < m_firstId) {
+        if (full != nullptr) {
+            *full = true;
+        }
+        return { { 0, 0, m_width, m_height } };
+    }
+
+    std::vector<TileRect> rects;
+    std::vector<size_t> open;
+    std::vector<size_t> next_open;
+    for (int ty = 0; ty < m_rows; ty++) {
+        next_open.clear();
+        const uint64_t* changed = &m_lastChanged[static_cast<size_t>(ty) * m_cols];
+        for (int tx = 0; tx < m_cols; ) {
+            if (changed[tx] <= since) {
+                tx++;
+                continue;
+            }
+            int x0 = tx;
+            while (tx < m_cols && changed[tx] > since) {
+                tx++;
+            }
+            add_run(rects, open, next_open, x0, tx, ty);
+        }
+        open.swap(next_open);
+    }
+
+    if (rects.size() > (std::max)(max_rects, kMaxGreedyRects)) {
+        // collapse each tile row to one band, then stack equal bands
+        std::vector<TileRect> bands;
+        open.clear();
+        for (int ty = 0; ty < m_rows; ty++) {
+            bool any = false;
+            TileRect band = {};
+            for (const auto& r : rects) {
+                if (ty >= r.y && ty < r.y + r.height) {
+                    TileRect row = { r.x, ty, r.width, 1 };
+                    band = any ? bounding(band, row) : row;
+                    any = true;
+                }
+            }
+            next_open.clear();
+            if (any) {
+                add_run(bands, open, next_open, band.x, band.x + band.width, ty);
+            }
+            open.swap(next_open);
+        }
+        rects.swap(bands);
+    }
+    merge_to(rects, (std::max)(max_rects, size_t(1)));
+
+    for (auto& r : rects) {
+        r.x *= m_tileSize;
+        r.y *= m_tileSize;
+        r.width = (std::min)(r.width * m_tileSize, m_width - r.x);
+        r.height = (std::min)(r.height * m_tileSize, m_height - r.y);
+    }
+    return rects;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "FramePool.h"
+
+#include <mutex>
+#include <vector>
+
+// Splits frames into square tiles, hashes every tile and remembers the id of the
+// last frame that changed each tile. Update runs on the capture thread right after
+// a frame is produced; queries may come from any thread.
+class TileTracker
+{
+public:
+    struct Rect
+    {
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+    explicit TileTracker(int tile_size = 32);
+
+    int TileSize() const { return m_tileSize; }
+
+    // Returns true if no tile differs from the previous frame (a duplicate frame).
+    // A size or format change resets the history.
+    bool Update(const Frame& frame);
+
+    // Area changed by frames after `since` up to the last Update, in pixels, merged
+    // into at most max_rects rectangles. If `since` is older than the history, the
+    // whole frame is returned and *full is set.
+    std::vector<Rect> ChangedSince(uint64_t since, size_t max_rects, bool* full = nullptr) const;
+
+    // Frame id of the last Update, 0 if none.
+    uint64_t FrameId() const;
+
+private:
+    const int m_tileSize;
+
+    // capture thread only
+    std::vector<uint64_t> m_hashes;
+    std::vector<uint64_t> m_newHashes;
+    std::vector<uint64_t> m_rowState;
+
+    mutable std::mutex m_mutex;
+    int m_width = 0;
+    int m_height = 0;
+    PixelFormat m_format = PixelFormat::BGRA;
+    int m_cols = 0;
+    int m_rows = 0;
+    uint64_t m_firstId = 0;
+    uint64_t m_lastId = 0;
+    std::vector<uint64_t> m_lastChanged;
+};
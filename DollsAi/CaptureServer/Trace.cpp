@@ -0,0 +1,224 @@
+#include "stdafx.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct Event
+    {
+        const char* name;
+        int64_t start_ns;
+        int64_t duration_ns;
+        uint32_t tid;
+    };
+
+    struct Buffer
+    {
+        explicit Buffer(size_t capacity) : events(new Event[capacity]), capacity(capacity) {}
+
+        std::unique_ptr<Event[]> events;
+        const size_t capacity;
+        uint64_t written = 0;
+    };
+
+    // One thread writes at a time. Whoever swaps the buffer out waits for
+    // `writing` to clear before touching it; the seq_cst pair makes sure a writer
+    // either sees the swap or is seen writing.
+    struct Ring
+    {
+        std::atomic<Buffer*> buffer{ nullptr };
+        std::atomic<bool> writing{ false };
+        // registry mutex
+        bool owned = false;
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Ring>> rings;
+        std::map<uint32_t, const char*> names;
+        size_t capacity = 0;
+        std::chrono::steady_clock::time_point origin;
+    };
+
+    Registry& registry()
+    {
+        // never destroyed: threads may still trace while the process exits
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    std::atomic<bool> s_running{ false };
+    std::atomic<uint32_t> s_nextTid{ 1 };
+
+    Buffer* take_buffer(Ring& ring, Buffer* replacement)
+    {
+        Buffer* old = ring.buffer.exchange(replacement);
+        while (ring.writing.load()) {
+            std::this_thread::yield();
+        }
+        return old;
+    }
+
+    struct ThreadState
+    {
+        ThreadState() : tid(s_nextTid.fetch_add(1, std::memory_order_relaxed)) {}
+        ~ThreadState()
+        {
+            if (ring != nullptr) {
+                // the events stay in the ring for the next owner
+                std::lock_guard<std::mutex> lock(registry().mutex);
+                ring->owned = false;
+            }
+        }
+
+        const uint32_t tid;
+        Ring* ring = nullptr;
+    };
+
+    thread_local ThreadState t_thread;
+
+    Ring& thread_ring()
+    {
+        if (t_thread.ring != nullptr) {
+            return *t_thread.ring;
+        }
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto it = std::find_if(r.rings.begin(), r.rings.end(), [](const auto& ring) { return !ring->owned; });
+        if (it == r.rings.end()) {
+            r.rings.push_back(std::make_unique<Ring>());
+            it = r.rings.end() - 1;
+        }
+        Ring& ring = **it;
+        ring.owned = true;
+        if (ring.buffer.load() == nullptr && s_running.load()) {
+            ring.buffer.store(new Buffer(r.capacity));
+        }
+        t_thread.ring = &ring;
+        return ring;
+    }
+
+    int64_t to_ns(std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+}
+
+void trace_start(size_t events_per_thread)
+{
+    if (events_per_thread == 0) {
+        throw std::invalid_argument("Trace ring size must be positive");
+    }
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.capacity = events_per_thread;
+    for (auto& ring : r.rings) {
+        delete take_buffer(*ring, new Buffer(events_per_thread));
+    }
+    r.origin = std::chrono::steady_clock::now();
+    s_running.store(true);
+}
+
+TraceResult trace_stop(const std::string& path)
+{
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::map<uint32_t, const char*> names;
+    std::chrono::steady_clock::time_point origin;
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (!s_running.exchange(false)) {
+            throw std::runtime_error("Trace not started");
+        }
+        for (auto& ring : r.rings) {
+            buffers.emplace_back(take_buffer(*ring, nullptr));
+        }
+        names = r.names;
+        origin = r.origin;
+    }
+
+    std::vector<Event> events;
+    TraceResult result = {};
+    for (const auto& buffer : buffers) {
+        if (buffer == nullptr) {
+            continue;
+        }
+        uint64_t kept = (std::min)(buffer->written, static_cast<uint64_t>(buffer->capacity));
+        result.overwritten += buffer->written - kept;
+        for (uint64_t i = buffer->written - kept; i < buffer->written; i++) {
+            events.push_back(buffer->events[i % buffer->capacity]);
+        }
+    }
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.start_ns < b.start_ns; });
+    result.events = events.size();
+
+    std::ofstream out(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot create trace: " + path);
+    }
+    const int64_t origin_ns = to_ns(origin);
+    char line[128];
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& name : names) {
+        out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << name.first
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":" << nlohmann::json(name.second).dump() << "}}";
+        first = false;
+    }
+    for (const auto& e : events) {
+        // microseconds, ns resolution
+        snprintf(line, sizeof(line), "\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            e.tid, (e.start_ns - origin_ns) / 1000.0, e.duration_ns / 1000.0);
+        out << (first ? "" : ",\n") << "{\"ph\":\"X\",\"name\":" << nlohmann::json(e.name).dump() << "," << line;
+        first = false;
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write trace: " + path);
+    }
+    return result;
+}
+
+bool trace_running()
+{
+    return s_running.load(std::memory_order_relaxed);
+}
+
+void trace_thread_name(const char* name)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.names[t_thread.tid] = name;
+}
+
+void trace_complete(const char* name, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end)
+{
+    if (!s_running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Ring& ring = thread_ring();
+    ring.writing.store(true);
+    Buffer* buffer = ring.buffer.load();
+    if (buffer != nullptr) {
+        Event& e = buffer->events[buffer->written % buffer->capacity];
+        e.name = name;
+        e.start_ns = to_ns(start);
+        e.duration_ns = to_ns(end) - e.start_ns;
+        e.tid = t_thread.tid;
+        buffer->written++;
+    }
+    ring.writing.store(false, std::memory_order_release);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+// Timeline tracing in the Chrome trace event format (chrome://tracing, Perfetto UI).
+//
+// While a trace runs every thread appends complete ("X") events to its own ring of
+// trace_start's capacity, overwriting its oldest events when full. Appending takes
+// no lock; a thread's ring is only read once the thread is out of it, at trace_stop.
+// Events carry the thread id, so the ring of an exited thread can be handed to a
+// new one without mislabeling what is already in it.
+
+struct TraceResult
+{
+    uint64_t events;
+    // lost to ring overwrites
+    uint64_t overwritten;
+};
+
+// Starts (or restarts, dropping what was recorded) a trace with room for
+// events_per_thread events in each thread's ring.
+void trace_start(size_t events_per_thread);
+// Stops the trace and writes it to path (UTF-8) as Chrome trace JSON.
+// Throws std::runtime_error if no trace runs or the file cannot be written.
+TraceResult trace_stop(const std::string& path);
+bool trace_running();
+
+// Names the calling thread in traces. name must outlive the process (a literal).
+void trace_thread_name(const char* name);
+
+// One event from start to end on the calling thread; name must be stable (a literal
+// or a string that is never freed). No-op unless a trace runs.
+void trace_complete(const char* name, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end);
@@ -0,0 +1,433 @@
+#include "stdafx.h"
+#include "Watchers.h"
+#include "CaptureThread.h"
+#include "LatencyStats.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+    // how often the watcher thread looks for held events while no frame comes
+    constexpr auto kIdleTimeout = std::chrono::milliseconds(50);
+    // how often a Congested stream is checked again
+    constexpr auto kCongestedRetry = std::chrono::milliseconds(10);
+
+    nlohmann::json rect_json(const TileTracker::Rect& r)
+    {
+        return nlohmann::json::array({ r.x, r.y, r.width, r.height });
+    }
+
+    // changes since `since`, reusing the session's query when it covers the same span
+    const FrameChanges& changes_since(const FrameChanges& changes, uint64_t since, FrameChanges& storage)
+    {
+        if (changes.since == since || changes.tiles == nullptr) {
+            return changes;
+        }
+        storage = FrameChanges::Query(*changes.tiles, since);
+        return storage;
+    }
+
+    class ChangedWatcher : public Watcher
+    {
+    public:
+        explicit ChangedWatcher(TileTracker::Rect area) : m_area(area)
+        {
+        }
+
+        nlohmann::json Check(const Frame& frame, const FrameChanges& changes) override
+        {
+            uint64_t last = m_last;
+            m_last = frame.Id();
+            if (last == 0) {
+                // the first frame is where changes count from
+                return nullptr;
+            }
+            FrameChanges storage;
+            const FrameChanges& span = changes_since(changes, last, storage);
+            if (!span.Touches(m_area)) {
+                return nullptr;
+            }
+            auto rects = nlohmann::json::array();
+            for (const auto& r : span.rects) {
+                if (m_area.width == 0 || (r.x < m_area.x + m_area.width && m_area.x < r.x + r.width &&
+                    r.y < m_area.y + m_area.height && m_area.y < r.y + r.height)) {
+                    rects.push_back(rect_json(r));
+                }
+            }
+            return {
+                {"kind", "changed"},
+                {"full", span.full},
+                {"rects", rects},
+            };
+        }
+
+    private:
+        TileTracker::Rect m_area;
+        uint64_t m_last = 0;
+    };
+
+    class ConditionWatcher : public Watcher
+    {
+    public:
+        ConditionWatcher(FramePredicate::Ptr condition, std::string on, std::string off)
+            : m_condition(std::move(condition)), m_on(std::move(on)), m_off(std::move(off))
+        {
+        }
+
+        nlohmann::json Check(const Frame& frame, const FrameChanges& changes) override
+        {
+            FrameChanges storage;
+            // the tree's leaves expect changes since the frame they saw last
+            bool value = m_condition->Evaluate(frame, changes_since(changes, m_last, storage));
+            bool first = m_last == 0;
+            m_last = frame.Id();
+            if (value == m_value && !(first && value)) {
+                return nullptr;
+            }
+            m_value = value;
+            auto details = nlohmann::json::array();
+            if (value) {
+                m_condition->Describe(frame.Id(), details);
+            }
+            return {
+                {"kind", "condition"},
+                {"state", value ? m_on : m_off},
+                {"details", details},
+            };
+        }
+
+    private:
+        FramePredicate::Ptr m_condition;
+        std::string m_on;
+        std::string m_off;
+        uint64_t m_last = 0;
+        bool m_value = false;
+    };
+
+    class ScreenChangeWatcher : public Watcher
+    {
+    public:
+        ScreenChangeWatcher(std::shared_ptr<const ScreenClassifier> screens, TileTracker::Rect roi, int max_distance)
+            : m_screens(std::move(screens)), m_roi(roi), m_maxDistance(max_distance)
+        {
+        }
+
+        nlohmann::json Check(const Frame& frame, const FrameChanges& changes) override
+        {
+            FrameChanges storage;
+            bool first = m_last == 0;
+            bool dirty = first || changes_since(changes, m_last, storage).Touches(m_roi);
+            m_last = frame.Id();
+            if (!dirty) {
+                return nullptr;
+            }
+
+            uint64_t hash = frame.ScreenHash();
+            if (m_roi.width != 0) {
+                int x = (std::max)(m_roi.x, 0);
+                int y = (std::max)(m_roi.y, 0);
+                int width = (std::min)(m_roi.x + m_roi.width, frame.Width()) - x;
+                int height = (std::min)(m_roi.y + m_roi.height, frame.Height()) - y;
+                if (width <= 0 || height <= 0) {
+                    return nullptr;
+                }
+                hash = dhash(frame.Row(y) + x * bytes_per_pixel(frame.Format()), frame.Stride(),
+                    width, height, frame.Format());
+            }
+            auto nearest = m_screens->Nearest(hash, 1, m_maxDistance);
+            std::string label = nearest.empty() ? std::string() : nearest[0].label;
+            if (!first && label == m_label) {
+                return nullptr;
+            }
+            nlohmann::json event = {
+                {"kind", "screen"},
+                {"from", first ? nlohmann::json() : nlohmann::json(m_label)},
+                {"to", label},
+                {"distance", nearest.empty() ? nlohmann::json() : nlohmann::json(nearest[0].distance)},
+            };
+            m_label = std::move(label);
+            return event;
+        }
+
+    private:
+        std::shared_ptr<const ScreenClassifier> m_screens;
+        TileTracker::Rect m_roi;
+        int m_maxDistance;
+        uint64_t m_last = 0;
+        std::string m_label;
+    };
+}
+
+std::unique_ptr<Watcher> Watcher::Changed(TileTracker::Rect area)
+{
+    return std::make_unique<ChangedWatcher>(area);
+}
+
+std::unique_ptr<Watcher> Watcher::Condition(FramePredicate::Ptr condition, std::string on, std::string off)
+{
+    return std::make_unique<ConditionWatcher>(std::move(condition), std::move(on), std::move(off));
+}
+
+std::unique_ptr<Watcher> Watcher::ScreenChange(std::shared_ptr<const ScreenClassifier> screens,
+    TileTracker::Rect roi, int max_distance)
+{
+    return std::make_unique<ScreenChangeWatcher>(std::move(screens), roi, max_distance);
+}
+
+std::shared_ptr<EventOutbox> EventOutbox::ForStream(CommandStream& stream)
+{
+    static std::mutex mutex;
+    static std::unordered_map<const CommandStream*, std::weak_ptr<EventOutbox>> outboxes;
+
+    auto weak = stream.weak_from_this();
+    if (weak.expired()) {
+        throw std::logic_error("Events need a stream owned by a shared_ptr");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = outboxes.begin(); it != outboxes.end(); ) {
+        it = it->second.expired() ? outboxes.erase(it) : std::next(it);
+    }
+    auto outbox = outboxes[&stream].lock();
+    // a new stream at the address of a closed one gets its own outbox
+    if (outbox == nullptr || !outbox->Alive()) {
+        outbox = std::make_shared<EventOutbox>(std::move(weak));
+        outboxes[&stream] = outbox;
+    }
+    return outbox;
+}
+
+EventOutbox::EventOutbox(std::weak_ptr<CommandStream> stream) : m_stream(std::move(stream))
+{
+    m_thread = std::thread([this]() { Run(); });
+}
+
+EventOutbox::~EventOutbox()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+bool EventOutbox::Alive() const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_dead) {
+            return false;
+        }
+    }
+    auto stream = m_stream.lock();
+    return stream != nullptr && !stream->Closed();
+}
+
+void EventOutbox::Push(const std::string& key, nlohmann::json event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_dead) {
+        return;
+    }
+    for (auto& entry : m_pending) {
+        if (entry.first == key) {
+            uint64_t coalesced = entry.second.value("coalesced", uint64_t(0)) + 1 + event.value("coalesced", uint64_t(0));
+            entry.second = std::move(event);
+            entry.second["coalesced"] = coalesced;
+            return;
+        }
+    }
+    m_pending.emplace_back(key, std::move(event));
+    m_cond.notify_one();
+}
+
+void EventOutbox::Run()
+{
+    trace_thread_name("events");
+    std::vector<std::pair<std::string, nlohmann::json>> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_stop || !m_pending.empty(); });
+            if (m_stop) {
+                return;
+            }
+        }
+        auto stream = m_stream.lock();
+        if (stream == nullptr || stream->Closed()) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_dead = true;
+            m_pending.clear();
+            return;
+        }
+        if (stream->Congested()) {
+            // let the replies drain, events keep coalescing meanwhile
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait_for(lock, kCongestedRetry, [this]() { return m_stop; });
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            batch.swap(m_pending);
+        }
+        try {
+            for (auto& entry : batch) {
+                stream->Push(std::move(entry.second));
+            }
+        }
+        catch (std::exception&) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_dead = true;
+            m_pending.clear();
+            return;
+        }
+        batch.clear();
+    }
+}
+
+SessionWatchers::SessionWatchers(CaptureThread& capture, uint32_t session) : m_capture(capture), m_session(session)
+{
+}
+
+SessionWatchers::~SessionWatchers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void SessionWatchers::Add(std::shared_ptr<EventOutbox> outbox, const std::string& name, std::unique_ptr<Watcher> watcher,
+    std::chrono::milliseconds min_interval)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find_if(m_subs.begin(), m_subs.end(), [&](const std::shared_ptr<Subscription>& sub) {
+        return sub->outbox == outbox && sub->name == name;
+    });
+    auto sub = std::make_shared<Subscription>(Subscription{ std::move(outbox), name, std::move(watcher), min_interval });
+    if (it != m_subs.end()) {
+        (*it)->active = false;
+        *it = std::move(sub);
+    }
+    else {
+        m_subs.push_back(std::move(sub));
+    }
+    if (!m_thread.joinable()) {
+        m_thread = std::thread([this]() { Run(); });
+    }
+}
+
+bool SessionWatchers::Remove(const EventOutbox* outbox, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find_if(m_subs.begin(), m_subs.end(), [&](const std::shared_ptr<Subscription>& sub) {
+        return sub->outbox.get() == outbox && sub->name == name;
+    });
+    if (it == m_subs.end()) {
+        return false;
+    }
+    (*it)->active = false;
+    m_subs.erase(it);
+    return true;
+}
+
+std::vector<std::string> SessionWatchers::Names(const EventOutbox* outbox) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> names;
+    for (const auto& sub : m_subs) {
+        if (sub->outbox.get() == outbox) {
+            names.push_back(sub->name);
+        }
+    }
+    return names;
+}
+
+void SessionWatchers::Run()
+{
+    trace_thread_name("watchers");
+    const TileTracker& tiles = m_capture.Tiles();
+    uint64_t previous = 0;
+    std::vector<std::shared_ptr<Subscription>> subs;
+    std::vector<std::pair<Subscription*, nlohmann::json>> events;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                return;
+            }
+        }
+        Frame frame;
+        try {
+            // only looked at: get_frame and a Lossless source still see every frame
+            frame = m_capture.PeekFrame(previous + 1, kIdleTimeout);
+        }
+        catch (std::exception&) {
+            // the capture failed, no more frames to watch
+            return;
+        }
+
+        auto now = FrameClock::now();
+        if (frame) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                subs = m_subs;
+            }
+            // without m_mutex: subscribe / unsubscribe do not wait for the pass
+            DOLLSAI_TIME_SCOPE("watchers.pass");
+            FrameChanges changes = FrameChanges::Query(tiles, previous);
+            for (auto& sub : subs) {
+                auto event = sub->watcher->Check(frame, changes);
+                if (!event.is_null()) {
+                    event["frame_id"] = frame.Id();
+                    events.emplace_back(sub.get(), std::move(event));
+                }
+            }
+            previous = frame.Id();
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& [sub, event] : events) {
+            // not for a subscription removed or replaced during the pass
+            if (sub->active) {
+                Emit(*sub, std::move(event), now);
+            }
+        }
+        events.clear();
+        subs.clear();
+        for (auto& sub : m_subs) {
+            if (!sub->pending.is_null() && now - sub->last_push >= sub->min_interval) {
+                Emit(*sub, std::move(sub->pending), now);
+            }
+        }
+        // subscribers that went away
+        m_subs.erase(std::remove_if(m_subs.begin(), m_subs.end(), [](const std::shared_ptr<Subscription>& sub) {
+            return !sub->outbox->Alive();
+        }), m_subs.end());
+    }
+}
+
+void SessionWatchers::Emit(Subscription& sub, nlohmann::json event, FrameClock::time_point now)
+{
+    if (now - sub.last_push < sub.min_interval) {
+        if (!sub.pending.is_null()) {
+            sub.held++;
+        }
+        sub.pending = std::move(event);
+        return;
+    }
+    event["event"] = sub.name;
+    event["session"] = m_session;
+    if (sub.held != 0) {
+        event["coalesced"] = sub.held;
+    }
+    sub.held = 0;
+    sub.pending = nullptr;
+    sub.last_push = now;
+    sub.outbox->Push(std::to_string(m_session) + ":" + sub.name, std::move(event));
+}
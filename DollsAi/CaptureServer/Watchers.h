@@ -0,0 +1,120 @@
+#pragma once
+
+#include "FramePredicate.h"
+#include "Protocol.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+class CaptureThread;
+
+// Events for one stream, written by their own thread so that a slow reader never
+// holds up the frame pass. Events that wait to be written (the stream is busy or
+// Congested) are coalesced per key: the newest is kept and its "coalesced" counts
+// the ones it replaced.
+class EventOutbox
+{
+public:
+    // one per stream, shared by all its subscriptions
+    static std::shared_ptr<EventOutbox> ForStream(CommandStream& stream);
+
+    explicit EventOutbox(std::weak_ptr<CommandStream> stream);
+    ~EventOutbox();
+
+    EventOutbox(const EventOutbox&) = delete;
+    EventOutbox& operator=(const EventOutbox&) = delete;
+
+    // false once the stream is closed or gone
+    bool Alive() const;
+    void Push(const std::string& key, nlohmann::json event);
+
+private:
+    void Run();
+
+    std::weak_ptr<CommandStream> m_stream;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    // in arrival order, one per key
+    std::vector<std::pair<std::string, nlohmann::json>> m_pending;
+    bool m_stop = false;
+    bool m_dead = false;
+    std::thread m_thread;
+};
+
+// Checks something on every frame and tells what happened, if anything.
+class Watcher
+{
+public:
+    virtual ~Watcher() = default;
+
+    // changes: since the previous frame of the session (not necessarily seen by this watcher)
+    // Returns the event for this frame, null for none.
+    virtual nlohmann::json Check(const Frame& frame, const FrameChanges& changes) = 0;
+
+    // something in area (width 0 = the whole frame) changed: {"kind": "changed", "rects"}
+    static std::unique_ptr<Watcher> Changed(TileTracker::Rect area);
+    // condition turned true or false: {"kind": "condition", "state": on / off, "details"};
+    // a condition that already holds on the first frame is reported too
+    static std::unique_ptr<Watcher> Condition(FramePredicate::Ptr condition, std::string on, std::string off);
+    // the nearest reference screen changed: {"kind": "screen", "from", "to", "distance"};
+    // "" is a frame near no reference screen
+    static std::unique_ptr<Watcher> ScreenChange(std::shared_ptr<const ScreenClassifier> screens,
+        TileTracker::Rect roi, int max_distance);
+};
+
+// The subscriptions of one capture session. A thread looks at every new frame and
+// runs all watchers over it in one pass, with one change query shared by all of
+// them. Events of a subscription come at most once per min_interval; the ones in
+// between are coalesced into the next.
+class SessionWatchers
+{
+public:
+    SessionWatchers(CaptureThread& capture, uint32_t session);
+    // stops the thread, before the capture goes away
+    ~SessionWatchers();
+
+    SessionWatchers(const SessionWatchers&) = delete;
+    SessionWatchers& operator=(const SessionWatchers&) = delete;
+
+    // Replaces a subscription of the same name on the same outbox.
+    void Add(std::shared_ptr<EventOutbox> outbox, const std::string& name, std::unique_ptr<Watcher> watcher,
+        std::chrono::milliseconds min_interval);
+    // false if there was no such subscription
+    bool Remove(const EventOutbox* outbox, const std::string& name);
+    // names subscribed through outbox
+    std::vector<std::string> Names(const EventOutbox* outbox) const;
+
+private:
+    struct Subscription
+    {
+        std::shared_ptr<EventOutbox> outbox;
+        std::string name;
+        std::unique_ptr<Watcher> watcher;
+        std::chrono::milliseconds min_interval;
+        FrameClock::time_point last_push;
+        // held back by min_interval
+        nlohmann::json pending;
+        uint64_t held = 0;
+        // false once removed or replaced, under m_mutex
+        bool active = true;
+    };
+
+    void Run();
+    void Emit(Subscription& sub, nlohmann::json event, FrameClock::time_point now);
+
+    CaptureThread& m_capture;
+    const uint32_t m_session;
+
+    mutable std::mutex m_mutex;
+    // the pass checks a copy of these outside m_mutex
+    std::vector<std::shared_ptr<Subscription>> m_subs;
+    bool m_stop = false;
+    // started with the first subscription
+    std::thread m_thread;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "FramePool.h"
+#include "SyntheticSource.h"
+#include "tests/MemoryStream.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+namespace bench {
+    constexpr int kWidth = 1920;
+    constexpr int kHeight = 1080;
+    // a SyntheticSource this fast never sleeps, every WaitNextFrame makes a frame
+    constexpr double kUnpaced = 1e9;
+
+    // One synthetic frame in the given format, the input of most benchmarks.
+    inline Frame synthetic_frame(int width, int height, PixelFormat format, uint64_t index = 1)
+    {
+        CopyOptions options;
+        options.format = format;
+        SyntheticSource source(width, height, kUnpaced, options);
+        Frame frame;
+        for (uint64_t i = 0; i < index; i++) {
+            frame = source.WaitNextFrame(std::chrono::milliseconds(100));
+        }
+        if (!frame) {
+            throw std::runtime_error("SyntheticSource gave no frame");
+        }
+        return frame;
+    }
+
+    // attachments are only counted
+    class MemoryStream : public test::MemoryStream
+    {
+    public:
+        MemoryStream() : test::MemoryStream(false) {}
+    };
+}
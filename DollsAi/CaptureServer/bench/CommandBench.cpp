@@ -0,0 +1,166 @@
+#include "BenchUtil.h"
+#include "CommandServer.h"
+#include "PixelProbe.h"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <vector>
+
+// Command dispatch: process_cmd against a running synthetic session, and the whole
+// request path (decode, run, encode the reply) in each wire mode. The probe kernels
+// are also timed alone, to see what probe_pixels adds around them.
+namespace {
+    constexpr WireMode kModes[] = { WireMode::Text, WireMode::Cbor, WireMode::MsgPack };
+
+    nlohmann::json run(bench::MemoryStream& stream, const nlohmann::json& body)
+    {
+        Request request = { body };
+        CmdContext ctx = { stream, request };
+        return process_cmd(body, ctx);
+    }
+
+    // One 1080p synthetic session at 240 fps for every benchmark of the fixture,
+    // started and stopped like a client would.
+    class SessionFixture : public benchmark::Fixture
+    {
+    public:
+        void SetUp(const benchmark::State&) override
+        {
+            run(m_stream, {
+                {"cmd", "capture_start"},
+                {"source", "synthetic"},
+                {"fps", 240},
+                {"shm_name", "DollsAiBench"},
+                {"max_width", bench::kWidth},
+                {"max_height", bench::kHeight},
+            });
+            // wait for the first frame
+            run(m_stream, { {"cmd", "get_frame"}, {"min_frame_id", 1}, {"timeout_ms", 1000} });
+        }
+
+        void TearDown(const benchmark::State&) override
+        {
+            run(m_stream, { {"cmd", "capture_end"} });
+        }
+
+    protected:
+        bench::MemoryStream m_stream;
+    };
+
+    // the latest frame into the shared memory ring
+    BENCHMARK_DEFINE_F(SessionFixture, BM_DispatchGetFrame)(benchmark::State& state)
+    {
+        const nlohmann::json body = { {"cmd", "get_frame"} };
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(run(m_stream, body));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_REGISTER_F(SessionFixture, BM_DispatchGetFrame);
+
+    // tile history only, the cheapest frame command
+    BENCHMARK_DEFINE_F(SessionFixture, BM_DispatchGetChanges)(benchmark::State& state)
+    {
+        const nlohmann::json body = { {"cmd", "get_changes"}, {"since", 0} };
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(run(m_stream, body));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_REGISTER_F(SessionFixture, BM_DispatchGetChanges);
+
+    // probes spread over the 1080p frame, every 7th out of it
+    std::vector<std::array<int, 2>> probe_positions(int count)
+    {
+        std::vector<std::array<int, 2>> positions;
+        for (int i = 0; i < count; i++) {
+            int x = (10 + i * 53) % bench::kWidth;
+            int y = (20 + i * 31) % bench::kHeight;
+            positions.push_back({ i % 7 == 6 ? -x - 1 : x, y });
+        }
+        return positions;
+    }
+
+    // probes through parse_probe_set, or the same probes kept by name
+    // args: probes, 1 = kept set
+    BENCHMARK_DEFINE_F(SessionFixture, BM_DispatchProbePixels)(benchmark::State& state)
+    {
+        auto probes = nlohmann::json::array();
+        for (const auto& p : probe_positions(static_cast<int>(state.range(0)))) {
+            probes.push_back({ p[0], p[1], 0x336699, 8 });
+        }
+        run(m_stream, { {"cmd", "probe_pixels"}, {"probes", probes}, {"set", "bench"} });
+        const nlohmann::json body = state.range(1) != 0
+            ? nlohmann::json({ {"cmd", "probe_pixels"}, {"set", "bench"} })
+            : nlohmann::json({ {"cmd", "probe_pixels"}, {"probes", probes} });
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(run(m_stream, body));
+        }
+        state.SetItemsProcessed(state.iterations() * probes.size());
+    }
+    BENCHMARK_REGISTER_F(SessionFixture, BM_DispatchProbePixels)->ArgsProduct({ { 32, 500 }, { 0, 1 } });
+
+    // ProbeSet::Evaluate alone, without the command around it
+    // args: probes, simd level (0 = scalar, 1 = AVX2)
+    void BM_EvaluateProbes(benchmark::State& state)
+    {
+        SimdLevel level = state.range(1) != 0 ? SimdLevel::AVX2 : SimdLevel::Scalar;
+        if (level > simd_level()) {
+            state.SkipWithError("SIMD level not supported on this CPU");
+            return;
+        }
+        state.SetLabel(simd_level_name(level));
+        Frame frame = bench::synthetic_frame(bench::kWidth, bench::kHeight, PixelFormat::BGR);
+        ProbeSet set;
+        for (const auto& p : probe_positions(static_cast<int>(state.range(0)))) {
+            set.Add(p[0], p[1], 0x336699, 8);
+        }
+        std::vector<uint32_t> colors(set.Size());
+        std::vector<uint8_t> hits(set.Size());
+        for (auto _ : state) {
+            set.Evaluate(frame, colors.data(), hits.data(), level);
+            benchmark::DoNotOptimize(hits.data());
+        }
+        state.SetItemsProcessed(state.iterations() * set.Size());
+    }
+    BENCHMARK(BM_EvaluateProbes)->ArgsProduct({ { 32, 500 }, { 0, 1 } });
+
+    // decode, process_cmd, reply with the id: what a pipelined client costs per request
+    // arg: wire mode
+    BENCHMARK_DEFINE_F(SessionFixture, BM_RequestRoundTrip)(benchmark::State& state)
+    {
+        WireMode mode = kModes[state.range(0)];
+        state.SetLabel(wire_mode_name(mode));
+        bench::MemoryStream client;
+        client.SetMode(mode);
+        client.Write({ {"cmd", "get_changes"}, {"since", 0}, {"id", 1} });
+        const std::vector<uint8_t> encoded = client.bytes;
+
+        bench::MemoryStream server;
+        server.SetMode(mode);
+        Request request;
+        for (auto _ : state) {
+            server.Decode(encoded.data(), encoded.size(), request);
+            CmdContext ctx = { server, request };
+            auto reply = process_cmd(request.body, ctx);
+            reply["id"] = request.body["id"];
+            server.Write(std::move(reply), ctx.attachments);
+            server.Clear();
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_REGISTER_F(SessionFixture, BM_RequestRoundTrip)->DenseRange(0, 2);
+
+    // the command table and latency bookkeeping without any frame work
+    void BM_DispatchStats(benchmark::State& state)
+    {
+        bench::MemoryStream stream;
+        const nlohmann::json body = { {"cmd", "stats"} };
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(run(stream, body));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(BM_DispatchStats);
+}
@@ -0,0 +1,153 @@
+#include "BenchUtil.h"
+#include "FrameCopy.h"
+#include "PixelConvert.h"
+#include "Recording.h"
+#include "ReplaySource.h"
+#include "Resample.h"
+
+#include <benchmark/benchmark.h>
+#include <opencv2/imgproc.hpp>
+
+#include <filesystem>
+#include <memory>
+
+// Frame conversion: the BGRA -> format kernels per SIMD level, the area resampler
+// against converting then cv::resize, and whole frames from SyntheticSource and
+// ReplaySource (copy, convert, pool).
+namespace {
+    constexpr PixelFormat kFormats[] = { PixelFormat::BGRA, PixelFormat::BGR, PixelFormat::RGB, PixelFormat::Gray };
+    constexpr SimdLevel kLevels[] = { SimdLevel::Scalar, SimdLevel::SSSE3, SimdLevel::AVX2 };
+
+    void set_frame_counters(benchmark::State& state, size_t bytes_per_frame)
+    {
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes_per_frame));
+    }
+
+    // args: simd level, dst format
+    void BM_ConvertBgra(benchmark::State& state)
+    {
+        SimdLevel level = kLevels[state.range(0)];
+        PixelFormat format = kFormats[state.range(1)];
+        if (level > simd_level()) {
+            state.SkipWithError("SIMD level not supported on this CPU");
+            return;
+        }
+        state.SetLabel(std::string(simd_level_name(level)) + " " + pixel_format_name(format));
+        Frame src = bench::synthetic_frame(bench::kWidth, bench::kHeight, PixelFormat::BGRA);
+        std::vector<uint8_t> dst(static_cast<size_t>(bench::kWidth) * bench::kHeight * 4);
+        size_t dst_pitch = static_cast<size_t>(bench::kWidth) * bytes_per_pixel(format);
+        for (auto _ : state) {
+            convert_bgra(src.Data(), src.Stride(), dst.data(), dst_pitch, bench::kWidth, bench::kHeight, format, level);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        set_frame_counters(state, src.Stride() * src.Height());
+    }
+    BENCHMARK(BM_ConvertBgra)->ArgsProduct({ { 0, 1, 2 }, { 0, 1, 2, 3 } });
+
+    // args: source width (16:9, so 1080p, 1440p, 2160p), output size in percent, dst format;
+    // 50 and 25 take the box path, 67 the float taps
+    void BM_Resample(benchmark::State& state)
+    {
+        const int src_width = static_cast<int>(state.range(0));
+        const int src_height = src_width * 9 / 16;
+        const int width = src_width * static_cast<int>(state.range(1)) / 100;
+        const int height = src_height * static_cast<int>(state.range(1)) / 100;
+        PixelFormat format = kFormats[state.range(2)];
+        state.SetLabel(pixel_format_name(format));
+        Frame src = bench::synthetic_frame(src_width, src_height, PixelFormat::BGRA);
+        AreaResampler resampler(src_width, src_height, width, height);
+        size_t dst_pitch = static_cast<size_t>(width) * bytes_per_pixel(format);
+        std::vector<uint8_t> dst(dst_pitch * height);
+        for (auto _ : state) {
+            resampler.Resample(src.Data(), src.Stride(), dst.data(), dst_pitch, format);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        set_frame_counters(state, src.Stride() * src.Height());
+    }
+    BENCHMARK(BM_Resample)->ArgsProduct({ { 1920, 2560, 3840 }, { 50, 25, 67 }, { 1, 3 } });
+
+    // What BM_Resample replaces: convert the whole surface into a frame, then
+    // cv::resize(INTER_AREA) it. Same args and inputs.
+    void BM_ResizeBaseline(benchmark::State& state)
+    {
+        const int src_width = static_cast<int>(state.range(0));
+        const int src_height = src_width * 9 / 16;
+        const int width = src_width * static_cast<int>(state.range(1)) / 100;
+        const int height = src_height * static_cast<int>(state.range(1)) / 100;
+        PixelFormat format = kFormats[state.range(2)];
+        state.SetLabel(pixel_format_name(format));
+        Frame src = bench::synthetic_frame(src_width, src_height, PixelFormat::BGRA);
+        const int type = format == PixelFormat::Gray ? CV_8UC1 : CV_8UC3;
+        cv::Mat full(src_height, src_width, type);
+        cv::Mat dst;
+        for (auto _ : state) {
+            convert_bgra(src.Data(), src.Stride(), full.data, full.step, src_width, src_height, format);
+            cv::resize(full, dst, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+            benchmark::DoNotOptimize(dst.data);
+        }
+        set_frame_counters(state, src.Stride() * src.Height());
+    }
+    BENCHMARK(BM_ResizeBaseline)->ArgsProduct({ { 1920, 2560, 3840 }, { 50, 25, 67 }, { 1, 3 } });
+
+    // A whole SyntheticSource frame: surface copy into a pooled frame in the format.
+    // args: dst format, scale in percent (100 = none)
+    void BM_SyntheticFrame(benchmark::State& state)
+    {
+        CopyOptions options;
+        options.format = kFormats[state.range(0)];
+        options.scale = state.range(1) / 100.0;
+        state.SetLabel(pixel_format_name(options.format));
+        SyntheticSource source(bench::kWidth, bench::kHeight, bench::kUnpaced, options);
+        for (auto _ : state) {
+            Frame frame = source.WaitNextFrame(std::chrono::milliseconds(100));
+            benchmark::DoNotOptimize(frame.Data());
+        }
+        set_frame_counters(state, static_cast<size_t>(bench::kWidth) * bench::kHeight * 4);
+    }
+    BENCHMARK(BM_SyntheticFrame)->ArgsProduct({ { 0, 1, 3 }, { 100, 50, 40 } });
+
+    // 120 synthetic frames recorded once per format, replayed as fast as they are taken
+    class ReplayFixture : public benchmark::Fixture
+    {
+    public:
+        void SetUp(const benchmark::State& state) override
+        {
+            CopyOptions options;
+            options.format = kFormats[state.range(0)];
+            m_path = (std::filesystem::temp_directory_path() / "dollsai_bench_replay.dasr").u8string();
+            RecorderOptions recorder_options;
+            recorder_options.queue_frames = kFrames;
+            Recorder recorder(m_path, recorder_options);
+            SyntheticSource source(bench::kWidth, bench::kHeight, bench::kUnpaced, options);
+            for (size_t i = 0; i < kFrames; i++) {
+                recorder.Push(source.WaitNextFrame(std::chrono::milliseconds(100)));
+            }
+            recorder.Stop();
+        }
+
+        void TearDown(const benchmark::State&) override
+        {
+            std::filesystem::remove(std::filesystem::u8path(m_path));
+        }
+
+    protected:
+        static constexpr size_t kFrames = 120;
+        std::string m_path;
+    };
+
+    BENCHMARK_DEFINE_F(ReplayFixture, BM_ReplayRecording)(benchmark::State& state)
+    {
+        ReplayOptions options;
+        options.loop = true;
+        ReplaySource source(m_path, options);
+        size_t bytes = 0;
+        for (auto _ : state) {
+            Frame frame = source.WaitNextFrame(std::chrono::milliseconds(100));
+            bytes += frame.Stride() * frame.Height();
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(static_cast<int64_t>(bytes));
+    }
+    BENCHMARK_REGISTER_F(ReplayFixture, BM_ReplayRecording)->Arg(0)->Arg(1);
+}
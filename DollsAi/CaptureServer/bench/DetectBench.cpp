@@ -0,0 +1,110 @@
+#include "BenchUtil.h"
+#include "ObjectDetect.h"
+#include "TaskPool.h"
+#include "TemplateMatch.h"
+#include "TemplateRegistry.h"
+
+#include <benchmark/benchmark.h>
+#include <opencv2/imgproc.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Object detection: what detect_objects does to a 1080p frame against one naive
+// detectMultiScale over all of it. Needs the bundled cascades (DOLLSAI_CASCADE_DIR).
+// The frames are the screenshots in DOLLSAI_DETECT_IMAGES (cmake -D), scaled to
+// 1080p, or else one synthetic frame. That frame has nothing for a cascade to find,
+// so only real screenshots give representative numbers.
+namespace {
+    constexpr const char* kCascade = "haarcascade_frontalface_default";
+    // the centre quarter of the frame
+    const cv::Rect kRoi(bench::kWidth / 4, bench::kHeight / 4, bench::kWidth / 2, bench::kHeight / 2);
+    constexpr double kDownscale = 0.5;
+
+    enum Variant { Naive, Roi, RoiDownscale, RoiDownscaleParallel };
+
+    // null if the cascades are not there
+    std::shared_ptr<const Cascade> load_cascade()
+    {
+#ifdef DOLLSAI_CASCADE_DIR
+        CascadeRegistry registry;
+        registry.AddDir(DOLLSAI_CASCADE_DIR);
+        try {
+            return registry.Find(kCascade);
+        }
+        catch (std::exception&) {
+        }
+#endif
+        return nullptr;
+    }
+
+    // BGR 1080p images, empty if DOLLSAI_DETECT_IMAGES is not set or has none
+    std::vector<cv::Mat> load_images()
+    {
+        std::vector<cv::Mat> images;
+#ifdef DOLLSAI_DETECT_IMAGES
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::u8path(DOLLSAI_DETECT_IMAGES), error)) {
+            const std::string path = entry.path().u8string();
+            if (!entry.is_regular_file() || !is_image_file(path)) {
+                continue;
+            }
+            cv::Mat decoded = read_image_file(path);
+            cv::Mat bgr;
+            if (decoded.channels() == 1) {
+                cv::cvtColor(decoded, bgr, cv::COLOR_GRAY2BGR);
+            }
+            else if (decoded.channels() == 4) {
+                cv::cvtColor(decoded, bgr, cv::COLOR_BGRA2BGR);
+            }
+            else {
+                bgr = decoded;
+            }
+            cv::Mat image;
+            cv::resize(bgr, image, cv::Size(bench::kWidth, bench::kHeight), 0, 0, cv::INTER_AREA);
+            images.push_back(image);
+        }
+#endif
+        return images;
+    }
+
+    // arg: the Variant, each adding one step of detect_objects to the previous
+    void BM_Detect(benchmark::State& state)
+    {
+        const auto variant = static_cast<Variant>(state.range(0));
+        auto cascade = load_cascade();
+        if (cascade == nullptr) {
+            state.SkipWithError("no cascades, build with external/opencv/etc present");
+            return;
+        }
+        Frame frame = bench::synthetic_frame(bench::kWidth, bench::kHeight, PixelFormat::BGR);
+        auto images = load_images();
+        const bool synthetic = images.empty();
+        if (synthetic) {
+            images.push_back(frame_to_mat(frame));
+        }
+
+        DetectOptions options;
+        options.downscale = variant >= RoiDownscale ? kDownscale : 1.0;
+        options.pool = variant >= RoiDownscaleParallel ? &TaskPool::Default() : nullptr;
+        size_t objects = 0;
+        for (auto _ : state) {
+            objects = 0;
+            for (const auto& image : images) {
+                if (variant == Naive) {
+                    objects += cascade->DetectNaive(image, options).size();
+                }
+                else {
+                    objects += cascade->Detect(image(kRoi), options).size();
+                }
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * images.size());
+        const char* names[] = { "naive", "roi", "roi_downscale", "roi_downscale_parallel" };
+        state.SetLabel(std::string(names[variant]) + (synthetic ? " synthetic" : ""));
+        state.counters["objects"] = static_cast<double>(objects);
+    }
+    BENCHMARK(BM_Detect)->DenseRange(Naive, RoiDownscaleParallel)->UseRealTime()->Unit(benchmark::kMillisecond);
+}
@@ -0,0 +1,29 @@
+#include "GlyphReader.h"
+#include "tests/GlyphFont.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+// Number reading: read_number on a rendered number, the work of one read_number
+// command after its frame wait (segmentation, Otsu, one atlas lookup per glyph).
+namespace {
+    // args: digits, font scale (a 7 pixel high digit times this)
+    void BM_ReadNumber(benchmark::State& state)
+    {
+        const int digits = static_cast<int>(state.range(0));
+        const int scale = static_cast<int>(state.range(1));
+        std::string text;
+        for (int i = 0; i < digits; i++) {
+            text.push_back(static_cast<char>('0' + (i * 7 + 3) % 10));
+        }
+        GlyphAtlas atlas = test::font_atlas(scale);
+        auto image = test::render_text(text, scale);
+        for (auto _ : state) {
+            NumberReading reading = read_number(image.View(), atlas, GlyphOptions());
+            benchmark::DoNotOptimize(reading.value);
+        }
+        state.SetItemsProcessed(state.iterations() * digits);
+    }
+    BENCHMARK(BM_ReadNumber)->ArgsProduct({ { 4, 12 }, { 2, 4 } })->Unit(benchmark::kMicrosecond);
+}
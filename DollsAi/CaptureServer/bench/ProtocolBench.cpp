@@ -0,0 +1,145 @@
+#include "BenchUtil.h"
+#include "Protocol.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+
+// Serialization: replies and requests in each wire mode, and a pipelined burst
+// of requests decoded from one buffer as a socket client would send them.
+namespace {
+    constexpr WireMode kModes[] = { WireMode::Text, WireMode::Cbor, WireMode::MsgPack };
+
+    // what get_frame answers
+    nlohmann::json frame_reply(uint64_t id)
+    {
+        return nlohmann::json({ {"result", {
+            {"slot", id % 4},
+            {"seq", id},
+            {"frame_id", id},
+            {"duplicate", false},
+        }}, {"id", id} });
+    }
+
+    // a typical probe_pixels request: 32 probes and two predicates
+    nlohmann::json probe_request(uint64_t id)
+    {
+        auto probes = nlohmann::json::array();
+        for (int i = 0; i < 32; i++) {
+            probes.push_back({ 10 + i * 50, 20 + i * 30, 0x336699 + i, 8 });
+        }
+        return nlohmann::json({
+            {"cmd", "probe_pixels"},
+            {"id", id},
+            {"probes", probes},
+            {"predicates", {
+                {{"name", "in_battle"}, {"probes", {0, 1, 2, 3}}},
+                {{"name", "menu"}, {"op", "or"}, {"probes", {4, 5}}},
+            }},
+        });
+    }
+
+    // arg: wire mode
+    void BM_EncodeReply(benchmark::State& state)
+    {
+        WireMode mode = kModes[state.range(0)];
+        state.SetLabel(wire_mode_name(mode));
+        bench::MemoryStream stream;
+        stream.SetMode(mode);
+        uint64_t id = 1;
+        for (auto _ : state) {
+            stream.Write(frame_reply(id++));
+            stream.Clear();
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(BM_EncodeReply)->DenseRange(0, 2);
+
+    // get_frame "inline": a 1080p BGR frame behind the document, never copied
+    // arg: wire mode (binary only)
+    void BM_EncodeFrameAttachment(benchmark::State& state)
+    {
+        WireMode mode = kModes[state.range(0)];
+        state.SetLabel(wire_mode_name(mode));
+        bench::MemoryStream stream;
+        stream.SetMode(mode);
+        Frame frame = bench::synthetic_frame(bench::kWidth, bench::kHeight, PixelFormat::BGR);
+        uint64_t id = 1;
+        for (auto _ : state) {
+            std::vector<Attachment> attachments = { { frame.Data(), frame.Stride() * frame.Height(), frame } };
+            stream.Write(frame_reply(id++), attachments);
+            stream.Clear();
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(BM_EncodeFrameAttachment)->DenseRange(1, 2);
+
+    // arg: wire mode
+    void BM_DecodeRequest(benchmark::State& state)
+    {
+        WireMode mode = kModes[state.range(0)];
+        state.SetLabel(wire_mode_name(mode));
+        bench::MemoryStream stream;
+        stream.SetMode(mode);
+        // requests are framed like replies, so Write produces a valid request
+        stream.Write(probe_request(1));
+        Request request;
+        for (auto _ : state) {
+            size_t used = stream.Decode(stream.bytes.data(), stream.bytes.size(), request);
+            benchmark::DoNotOptimize(used);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.bytes.size()));
+    }
+    BENCHMARK(BM_DecodeRequest)->DenseRange(0, 2);
+
+    // A burst of pipelined requests in one read buffer, decoded front to back
+    // the way SocketServer does after a large recv.
+    // args: wire mode, requests in the buffer
+    void BM_DecodePipelined(benchmark::State& state)
+    {
+        WireMode mode = kModes[state.range(0)];
+        state.SetLabel(wire_mode_name(mode));
+        bench::MemoryStream stream;
+        stream.SetMode(mode);
+        for (int64_t i = 0; i < state.range(1); i++) {
+            stream.Write(probe_request(i));
+        }
+        Request request;
+        for (auto _ : state) {
+            size_t offset = 0;
+            while (size_t used = stream.Decode(stream.bytes.data() + offset, stream.bytes.size() - offset, request)) {
+                offset += used;
+            }
+            benchmark::DoNotOptimize(offset);
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(1));
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.bytes.size()));
+    }
+    BENCHMARK(BM_DecodePipelined)->ArgsProduct({ { 0, 1 }, { 16, 256 } });
+
+    // One large text request arriving in 64 KB reads, Decode called after each read
+    // like SocketServer does: the terminator search must not start over every time.
+    // arg: request size in KB
+    void BM_DecodeTextInPieces(benchmark::State& state)
+    {
+        bench::MemoryStream stream;
+        // [1000,1000,3368601,8], is 23 bytes
+        auto probes = nlohmann::json::array();
+        for (int64_t i = 0; i < state.range(0) * 1024 / 23; i++) {
+            probes.push_back({ 1000, 1000, 0x336699, 8 });
+        }
+        stream.Write({ {"cmd", "probe_pixels"}, {"probes", probes} });
+        const size_t piece = 64 * 1024;
+        Request request;
+        for (auto _ : state) {
+            size_t used = 0;
+            for (size_t end = (std::min)(piece, stream.bytes.size()); used == 0; end = (std::min)(end + piece, stream.bytes.size())) {
+                used = stream.Decode(stream.bytes.data(), end, request);
+            }
+            benchmark::DoNotOptimize(used);
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.bytes.size()));
+    }
+    BENCHMARK(BM_DecodeTextInPieces)->Arg(256)->Arg(4096);
+}
@@ -0,0 +1,65 @@
+#include "BenchUtil.h"
+#include "ScreenClassifier.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+// Screen classification: dHash of a 1080p frame, and Nearest against 10k reference
+// hashes, which should stay well under a millisecond.
+namespace {
+    constexpr size_t kReferences = 10000;
+
+    // hash with bits random bits of base flipped
+    uint64_t near_hash(std::mt19937_64& rng, uint64_t base, int bits)
+    {
+        for (int i = 0; i < bits; i++) {
+            base ^= uint64_t(1) << (rng() % 64);
+        }
+        return base;
+    }
+
+    // arg: dst format
+    void BM_Dhash(benchmark::State& state)
+    {
+        PixelFormat format = static_cast<PixelFormat>(state.range(0));
+        state.SetLabel(pixel_format_name(format));
+        Frame frame = bench::synthetic_frame(bench::kWidth, bench::kHeight, format);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(dhash(frame.Data(), frame.Stride(), frame.Width(), frame.Height(), format));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(BM_Dhash)->Arg(static_cast<int>(PixelFormat::BGR))->Arg(static_cast<int>(PixelFormat::Gray));
+
+    // 10k references: 200 screens with 50 captures each, a few bits apart, and
+    // queries that are captures of a known screen.
+    // args: max_results, max_distance
+    void BM_ScreenNearest(benchmark::State& state)
+    {
+        std::mt19937_64 rng(3);
+        std::vector<uint64_t> screens;
+        for (int i = 0; i < 200; i++) {
+            screens.push_back(rng());
+        }
+        ScreenClassifier classifier;
+        for (size_t i = 0; i < kReferences; i++) {
+            size_t screen = i % screens.size();
+            classifier.Add(near_hash(rng, screens[screen], static_cast<int>(rng() % 8)), "screen" + std::to_string(screen));
+        }
+        std::vector<uint64_t> queries;
+        for (int i = 0; i < 256; i++) {
+            queries.push_back(near_hash(rng, screens[rng() % screens.size()], static_cast<int>(rng() % 8)));
+        }
+
+        const size_t max_results = static_cast<size_t>(state.range(0));
+        const int max_distance = static_cast<int>(state.range(1));
+        size_t q = 0;
+        for (auto _ : state) {
+            auto matches = classifier.Nearest(queries[q++ % queries.size()], max_results, max_distance);
+            benchmark::DoNotOptimize(matches.data());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(BM_ScreenNearest)->ArgsProduct({ { 1, 5 }, { 12, 64 } })->Unit(benchmark::kMicrosecond);
+}
@@ -0,0 +1,151 @@
+#include "BenchUtil.h"
+#include "CommandServer.h"
+
+#include <benchmark/benchmark.h>
+
+// The whole server path over a real socket: run_server --listen on a unix socket,
+// a client sending one request at a time and waiting for its reply, in each wire
+// mode. Unlike BM_RequestRoundTrip this includes the socket loop, the worker
+// handoff and the kernel copies, what a client on the same machine sees.
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+namespace {
+    constexpr WireMode kModes[] = { WireMode::Text, WireMode::Cbor, WireMode::MsgPack };
+
+    // run_server serves until the process exits, one for every benchmark
+    const std::string& server_path()
+    {
+        static std::string path;
+        static std::once_flag started;
+        std::call_once(started, []() {
+            path = (std::filesystem::temp_directory_path() / ("dollsai_bench_" + std::to_string(getpid()) + ".sock")).u8string();
+            std::thread([]() {
+                std::string address = "unix:" + path;
+                char name[] = "capture_bench";
+                char listen[] = "--listen";
+                char* argv[] = { name, listen, &address[0] };
+                run_server(3, argv);
+            }).detach();
+        });
+        return path;
+    }
+
+    // -1 if the server does not come up within a second
+    int connect_server()
+    {
+        const std::string& path = server_path();
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        for (int attempt = 0; attempt < 100; attempt++) {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+                return fd;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    }
+
+    // Encodes requests and decodes replies in the stream's mode, over the socket.
+    class Client
+    {
+    public:
+        explicit Client(int fd) : m_fd(fd) {}
+        ~Client() { close(m_fd); }
+
+        bench::MemoryStream& Stream() { return m_stream; }
+        // bytes read from the socket so far
+        size_t Received() const { return m_received; }
+
+        bool Send(const std::vector<uint8_t>& bytes)
+        {
+            return send(m_fd, bytes.data(), bytes.size(), 0) == static_cast<ssize_t>(bytes.size());
+        }
+
+        // blocks for the next message, false if the connection closed
+        bool Receive(Request& reply)
+        {
+            while (true) {
+                if (!m_buffer.empty()) {
+                    size_t used = m_stream.Decode(m_buffer.data(), m_buffer.size(), reply);
+                    if (used > 0) {
+                        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + used);
+                        return true;
+                    }
+                }
+                uint8_t chunk[65536];
+                ssize_t got = recv(m_fd, chunk, sizeof(chunk), 0);
+                if (got <= 0) {
+                    return false;
+                }
+                m_buffer.insert(m_buffer.end(), chunk, chunk + got);
+                m_received += static_cast<size_t>(got);
+            }
+        }
+
+        // one request in the current mode and its reply
+        bool Call(const nlohmann::json& body, Request& reply)
+        {
+            m_stream.Write(body);
+            bool sent = Send(m_stream.bytes);
+            m_stream.Clear();
+            return sent && Receive(reply);
+        }
+
+    private:
+        int m_fd;
+        bench::MemoryStream m_stream;
+        std::vector<uint8_t> m_buffer;
+        size_t m_received = 0;
+    };
+
+    // stats: no frame work, a reply of a few hundred bytes of counters and histograms
+    // arg: wire mode
+    void BM_ServerRoundTrip(benchmark::State& state)
+    {
+        WireMode mode = kModes[state.range(0)];
+        state.SetLabel(wire_mode_name(mode));
+        int fd = connect_server();
+        if (fd == -1) {
+            state.SkipWithError("run_server did not listen");
+            return;
+        }
+        Client client(fd);
+        Request reply;
+        if (!client.Call({ {"cmd", "set_protocol"}, {"mode", wire_mode_name(mode)} }, reply)) {
+            state.SkipWithError("set_protocol failed");
+            return;
+        }
+        client.Stream().SetMode(mode);
+
+        // encoded once, only the socket and the server are timed
+        client.Stream().Write({ {"cmd", "stats"}, {"id", 1} });
+        const std::vector<uint8_t> request = client.Stream().bytes;
+        client.Stream().Clear();
+        const size_t received = client.Received();
+        for (auto _ : state) {
+            if (!client.Send(request) || !client.Receive(reply)) {
+                state.SkipWithError("connection closed");
+                break;
+            }
+            benchmark::DoNotOptimize(reply.body);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.counters["request_bytes"] = static_cast<double>(request.size());
+        state.counters["reply_bytes"] = benchmark::Counter(static_cast<double>(client.Received() - received),
+            benchmark::Counter::kAvgIterations);
+    }
+    BENCHMARK(BM_ServerRoundTrip)->DenseRange(0, 2)->UseRealTime()->Unit(benchmark::kMicrosecond);
+}
+#endif
@@ -0,0 +1,85 @@
+#include "BenchUtil.h"
+#include "TaskPool.h"
+#include "TemplateMatch.h"
+#include "tests/TemplateCorpus.h"
+
+#include <benchmark/benchmark.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include <memory>
+
+// Template matching on the 1080p corpus image: find_template with 200 templates,
+// split over the pool the way the find_template command does, at 1 to 8 threads;
+// and for fewer templates, the pyramid search against a full resolution
+// cv::matchTemplate, which finds the same matches (TemplateMatchTest).
+namespace {
+    constexpr size_t kTemplates = 200;
+    // a full resolution search takes long, the comparisons run fewer templates
+    constexpr size_t kCompared = 20;
+
+    // arg: threads running the templates, including the caller; 1 = no pool
+    void BM_FindTemplates(benchmark::State& state)
+    {
+        const unsigned threads = static_cast<unsigned>(state.range(0));
+        auto corpus = test::template_corpus(kTemplates);
+
+        // TaskPool(0) means one worker per hardware thread, so 1 runs without one
+        std::unique_ptr<TaskPool> pool;
+        MatchOptions options;
+        if (threads > 1) {
+            pool = std::make_unique<TaskPool>(threads - 1);
+            options.pool = pool.get();
+        }
+        for (auto _ : state) {
+            if (pool != nullptr) {
+                auto results = parallel_map<std::vector<MatchResult>>(*pool, corpus.templates.size(), [&](size_t i) {
+                    return find_template(corpus.image, *corpus.templates[i], options);
+                });
+                benchmark::DoNotOptimize(results.data());
+            }
+            else {
+                for (const auto& templ : corpus.templates) {
+                    auto matches = find_template(corpus.image, *templ, options);
+                    benchmark::DoNotOptimize(matches.data());
+                }
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * corpus.templates.size());
+    }
+    BENCHMARK(BM_FindTemplates)->RangeMultiplier(2)->Range(1, 8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+    // arg: MatchOptions::levels, 1 = full resolution only, -1 = the whole pyramid
+    void BM_FindTemplateLevels(benchmark::State& state)
+    {
+        auto corpus = test::template_corpus(kCompared);
+        MatchOptions options;
+        options.levels = static_cast<int>(state.range(0));
+        for (auto _ : state) {
+            for (const auto& templ : corpus.templates) {
+                auto matches = find_template(corpus.image, *templ, options);
+                benchmark::DoNotOptimize(matches.data());
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * corpus.templates.size());
+    }
+    BENCHMARK(BM_FindTemplateLevels)->Arg(1)->Arg(-1)->Unit(benchmark::kMillisecond);
+
+    // the baseline: one cv::matchTemplate over the whole image and its best score
+    void BM_MatchTemplateBaseline(benchmark::State& state)
+    {
+        auto corpus = test::template_corpus(kCompared);
+        cv::Mat scores;
+        for (auto _ : state) {
+            for (const auto& templ : corpus.templates) {
+                cv::matchTemplate(corpus.image, templ->Level(0), scores, cv::TM_CCOEFF_NORMED);
+                double best = 0;
+                cv::Point at;
+                cv::minMaxLoc(scores, nullptr, &best, nullptr, &at);
+                benchmark::DoNotOptimize(at);
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * corpus.templates.size());
+    }
+    BENCHMARK(BM_MatchTemplateBaseline)->Unit(benchmark::kMillisecond);
+}
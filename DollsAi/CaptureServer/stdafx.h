@@ -1,5 +1,9 @@
 #pragma once
 
+#ifdef _WIN32
+// before anything includes windows.h (and with it the old winsock.h)
+#include <winsock2.h>
+
 // D3D
 #include <d3d11_4.h>
 #include <dxgi1_6.h>
@@ -20,8 +24,10 @@
 #include <windows.ui.composition.interop.h>
 #include <DispatcherQueue.h>
 
-// External libraries
 #include "strconv.h"
+#endif
+
+// External libraries
 #include <nlohmann/json.hpp>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgcodecs.hpp>
@@ -0,0 +1,96 @@
+#include "CaptureThread.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <future>
+#include <thread>
+
+namespace {
+    constexpr auto kWait = std::chrono::seconds(2);
+}
+
+// A Lossless source waits until its frame is taken; looking at it does not count.
+TEST(CaptureThread, PeekDoesNotTake)
+{
+    CaptureThread capture(std::make_unique<test::ScriptedSource>(std::vector<uint8_t>{ 10, 20, 30 }, true));
+    Frame frame = capture.PeekFrame(1, kWait);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame.Id(), 1u);
+    EXPECT_EQ(frame.Row(0)[0], 10);
+    EXPECT_FALSE(capture.PeekFrame(2, std::chrono::milliseconds(100)));
+
+    EXPECT_EQ(capture.WaitFrame(1, kWait).Id(), 1u);
+    frame = capture.PeekFrame(2, kWait);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame.Row(0)[0], 20);
+    EXPECT_EQ(capture.WaitFrame(2, kWait).Id(), 2u);
+    EXPECT_EQ(capture.WaitFrame(3, kWait).Id(), 3u);
+
+    auto stats = capture.GetStats();
+    EXPECT_EQ(stats.frames, 3u);
+    EXPECT_EQ(stats.dropped, 0u);
+}
+
+// Frames only looked at are dropped when the next one replaces them.
+TEST(CaptureThread, PeekedFramesCountAsDropped)
+{
+    CaptureThread capture(std::make_unique<test::ScriptedSource>(std::vector<uint8_t>{ 1, 2, 3, 4 }));
+    ASSERT_EQ(capture.PeekFrame(4, kWait).Id(), 4u);
+    EXPECT_EQ(capture.GetStats().dropped, 3u);
+    EXPECT_EQ(capture.WaitFrame(4, kWait).Id(), 4u);
+    EXPECT_EQ(capture.GetStats().dropped, 3u);
+}
+
+TEST(CaptureThread, StopEndsWaits)
+{
+    CaptureThread capture(std::make_unique<test::ScriptedSource>(std::vector<uint8_t>{ 5 }));
+    ASSERT_TRUE(capture.PeekFrame(1, kWait));
+    auto start = FrameClock::now();
+    auto peek = std::async(std::launch::async, [&]() { return capture.PeekFrame(2, std::chrono::seconds(10)); });
+    auto wait = std::async(std::launch::async, [&]() { return capture.WaitFrame(2, std::chrono::seconds(10)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    capture.Stop();
+    EXPECT_FALSE(peek.get());
+    EXPECT_FALSE(wait.get());
+    EXPECT_LT(FrameClock::now() - start, std::chrono::seconds(2));
+    // the newest frame is still there, and a second Stop does nothing
+    EXPECT_EQ(capture.WaitFrame(1, std::chrono::milliseconds(0)).Id(), 1u);
+    capture.Stop();
+}
+
+// A source faster than its consumer has frames replaced before they are taken: each
+// frame is either taken or counted as dropped.
+TEST(CaptureThread, FastSourceDrops)
+{
+    const std::vector<uint8_t> script(30, 1);
+    CaptureThread capture(std::make_unique<test::ScriptedSource>(script, false, 500));
+    uint64_t taken = 0;
+    for (uint64_t id = 1; id <= script.size(); ) {
+        Frame frame = capture.WaitFrame(id, kWait);
+        ASSERT_TRUE(frame);
+        taken++;
+        id = frame.Id() + 1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    auto stats = capture.GetStats();
+    EXPECT_EQ(stats.frames, script.size());
+    EXPECT_GT(stats.dropped, 0u);
+    EXPECT_EQ(taken + stats.dropped, script.size());
+}
+
+// At the same rates a Lossless source waits for the consumer and drops nothing.
+TEST(CaptureThread, LosslessSourceDoesNotDrop)
+{
+    const std::vector<uint8_t> script(30, 1);
+    CaptureThread capture(std::make_unique<test::ScriptedSource>(script, true, 500));
+    for (uint64_t id = 1; id <= script.size(); id++) {
+        Frame frame = capture.WaitFrame(id, kWait);
+        ASSERT_TRUE(frame);
+        ASSERT_EQ(frame.Id(), id);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    auto stats = capture.GetStats();
+    EXPECT_EQ(stats.frames, script.size());
+    EXPECT_EQ(stats.dropped, 0u);
+}
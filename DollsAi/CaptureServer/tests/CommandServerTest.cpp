@@ -0,0 +1,202 @@
+#include "CommandServer.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <future>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+    nlohmann::json run(test::MemoryStream& stream, const nlohmann::json& body,
+        std::shared_lock<std::shared_mutex>* state_lock = nullptr)
+    {
+        Request request = { body };
+        CmdContext ctx = { stream, request };
+        ctx.state_lock = state_lock;
+        return process_cmd(body, ctx);
+    }
+
+    // capture_start {"source": "scripted", "values": [...], "lossless": bool}, see test::ScriptedSource
+    uint32_t start_scripted(test::MemoryStream& stream, const std::vector<uint8_t>& values, bool lossless)
+    {
+        register_source("scripted", [](const nlohmann::json& args, const CopyOptions&) -> std::unique_ptr<FrameSource> {
+            return std::make_unique<test::ScriptedSource>(args.at("values").get<std::vector<uint8_t>>(), args.at("lossless").get<bool>());
+        });
+        auto reply = run(stream, {
+            {"cmd", "capture_start"},
+            {"source", "scripted"},
+            {"values", values},
+            {"lossless", lossless},
+            {"format", "gray"},
+            {"shm_name", test::unique_name("DollsAiTest")},
+            {"max_width", test::ScriptedSource::kWidth},
+            {"max_height", test::ScriptedSource::kHeight},
+        });
+        return reply.at("result").at("session").get<uint32_t>();
+    }
+
+    // every pixel of the gray frame is value
+    nlohmann::json pixel_is(int value)
+    {
+        return { {"probes", { { 0, 0, value * 0x010101, 0 } }} };
+    }
+
+    // a synthetic session of its own size and format; the reply's session id
+    uint32_t start_synthetic(test::MemoryStream& stream, int width, int height, const std::string& format)
+    {
+        auto reply = run(stream, {
+            {"cmd", "capture_start"},
+            {"source", "synthetic"},
+            {"width", width},
+            {"height", height},
+            {"format", format},
+            {"fps", 120},
+            {"shm_name", test::unique_name("DollsAiTest")},
+            {"max_width", width},
+            {"max_height", height},
+        });
+        return reply.at("result").at("session").get<uint32_t>();
+    }
+
+    // get_frame "inline" for session: the frame's description
+    nlohmann::json frame_of(test::MemoryStream& stream, const nlohmann::json& session)
+    {
+        nlohmann::json body = { {"cmd", "get_frame"}, {"inline", true}, {"min_frame_id", 1}, {"timeout_ms", 2000} };
+        if (!session.is_null()) {
+            body["session"] = session;
+        }
+        return run(stream, body).at("result");
+    }
+
+    class CommandServerTest : public ::testing::Test
+    {
+    protected:
+        void SetUp() override
+        {
+            m_stream.SetMode(WireMode::Cbor);
+        }
+
+        void TearDown() override
+        {
+            run(m_stream, { {"cmd", "capture_end"} });
+        }
+
+        test::MemoryStream m_stream;
+    };
+}
+
+// Every frame command goes to the session named by "session", and only to it.
+TEST_F(CommandServerTest, RoutesBySession)
+{
+    uint32_t a = start_synthetic(m_stream, 320, 240, "bgr");
+    uint32_t b = start_synthetic(m_stream, 160, 96, "gray");
+    ASSERT_NE(a, b);
+
+    auto sessions = run(m_stream, { {"cmd", "capture_list"} }).at("result");
+    ASSERT_EQ(sessions.size(), 2u);
+    EXPECT_NE(sessions[0]["shm_name"], sessions[1]["shm_name"]);
+
+    for (int i = 0; i < 3; i++) {
+        auto frame_a = frame_of(m_stream, a);
+        EXPECT_EQ(frame_a["width"], 320);
+        EXPECT_EQ(frame_a["height"], 240);
+        EXPECT_EQ(frame_a["format"], "bgr");
+        auto frame_b = frame_of(m_stream, b);
+        EXPECT_EQ(frame_b["width"], 160);
+        EXPECT_EQ(frame_b["height"], 96);
+        EXPECT_EQ(frame_b["format"], "gray");
+    }
+
+    // with two sessions running the session cannot be guessed
+    EXPECT_THROW(frame_of(m_stream, nullptr), std::runtime_error);
+    EXPECT_THROW(frame_of(m_stream, b + 100), std::runtime_error);
+}
+
+// Stopping one session leaves the other running, and then it is the default.
+TEST_F(CommandServerTest, StopOneSession)
+{
+    uint32_t a = start_synthetic(m_stream, 320, 240, "bgr");
+    uint32_t b = start_synthetic(m_stream, 160, 96, "bgra");
+
+    run(m_stream, { {"cmd", "capture_end"}, {"session", a} });
+    EXPECT_THROW(frame_of(m_stream, a), std::runtime_error);
+    EXPECT_THROW(run(m_stream, { {"cmd", "capture_end"}, {"session", a} }), std::runtime_error);
+
+    auto frame = frame_of(m_stream, b);
+    EXPECT_EQ(frame["width"], 160);
+    frame = frame_of(m_stream, nullptr);
+    EXPECT_EQ(frame["width"], 160);
+    EXPECT_EQ(frame["format"], "bgra");
+}
+
+// The last scripted frame stays the newest one, so the condition is seen on it.
+TEST_F(CommandServerTest, WaitUntilHolds)
+{
+    start_scripted(m_stream, { 0, 0, 0, 200 }, false);
+    auto reply = run(m_stream, { {"cmd", "wait_until"}, {"until", pixel_is(200)}, {"min_frame_id", 1}, {"timeout_ms", 2000} });
+    auto result = reply.at("result");
+    EXPECT_EQ(result["frame_id"], 4);
+    EXPECT_GE(result["frames"], 1);
+    EXPECT_FALSE(result["details"].empty());
+
+    // does not hold on anything: null after the timeout
+    reply = run(m_stream, { {"cmd", "wait_until"}, {"until", pixel_is(7)}, {"min_frame_id", 1}, {"timeout_ms", 50} });
+    EXPECT_TRUE(reply.is_null());
+}
+
+// wait_until only looks at frames: a Lossless replay does not move on for it, and
+// get_frame still gets every frame in order afterwards.
+TEST_F(CommandServerTest, WaitUntilDoesNotTakeFrames)
+{
+    start_scripted(m_stream, { 0, 100, 200 }, true);
+    auto reply = run(m_stream, { {"cmd", "wait_until"}, {"until", pixel_is(200)}, {"min_frame_id", 1}, {"timeout_ms", 200} });
+    EXPECT_TRUE(reply.is_null());
+    for (uint64_t id = 1; id <= 3; id++) {
+        reply = run(m_stream, { {"cmd", "get_frame"}, {"inline", true}, {"min_frame_id", id}, {"timeout_ms", 2000} });
+        EXPECT_EQ(reply.at("result")["frame_id"], id);
+    }
+}
+
+// A waiting wait_until has let go of the state lock, and capture_end ends it.
+TEST_F(CommandServerTest, WaitUntilReleasesStateLock)
+{
+    start_scripted(m_stream, { 0 }, false);
+    std::shared_mutex state;
+    auto start = FrameClock::now();
+    // locked before the wait starts, so it is wait_until that lets go of it
+    std::shared_lock<std::shared_mutex> shared(state);
+    auto wait = std::async(std::launch::async, [&, lock = std::move(shared)]() mutable {
+        test::MemoryStream stream;
+        return run(stream, { {"cmd", "wait_until"}, {"until", pixel_is(9)}, {"min_frame_id", 1}, {"timeout_ms", 10000} }, &lock);
+    });
+
+    bool locked = false;
+    while (!locked && FrameClock::now() - start < std::chrono::seconds(2)) {
+        locked = state.try_lock();
+        if (!locked) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    ASSERT_TRUE(locked);
+    EXPECT_EQ(wait.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+    run(m_stream, { {"cmd", "capture_end"} });
+    state.unlock();
+    EXPECT_TRUE(wait.get().is_null());
+    EXPECT_LT(FrameClock::now() - start, std::chrono::seconds(5));
+}
+
+// Watchers only look at frames too: with a subscription on a Lossless replay,
+// get_frame still gets every frame in order.
+TEST_F(CommandServerTest, WatchersDoNotTakeFrames)
+{
+    start_scripted(m_stream, { 0, 100, 200 }, true);
+    auto events = std::make_shared<test::MemoryStream>();
+    run(*events, { {"cmd", "subscribe"}, {"name", "bright"}, {"kind", "condition"}, {"until", pixel_is(200)} });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (uint64_t id = 1; id <= 3; id++) {
+        auto reply = run(m_stream, { {"cmd", "get_frame"}, {"inline", true}, {"min_frame_id", id}, {"timeout_ms", 2000} });
+        EXPECT_EQ(reply.at("result")["frame_id"], id);
+    }
+}
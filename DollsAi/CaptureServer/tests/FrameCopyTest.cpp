@@ -0,0 +1,78 @@
+#include "FrameCopy.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+    constexpr int kWidth = 203;
+    constexpr int kHeight = 117;
+    // wider than 4 * kWidth, as a mapped texture's RowPitch may be
+    constexpr size_t kPitch = 4 * kWidth + 52;
+
+    // every kind of placement, including the frame edges
+    std::vector<Roi> edge_rois()
+    {
+        return {
+            { "inside", 40, 30, 64, 20 },
+            { "one_pixel", 0, 0, 1, 1 },
+            { "top_left", -7, -5, 30, 12 },
+            { "bottom_right", kWidth - 10, kHeight - 4, 25, 9 },
+            { "right_edge", kWidth - 33, 50, 33, 8 },
+            { "wider_than_frame", -3, 60, kWidth + 10, 3 },
+            { "outside", kWidth + 5, kHeight + 5, 8, 8 },
+            { "above", 10, -20, 8, 6 },
+        };
+    }
+}
+
+// The ROI path reads only the ROIs, yet gives the same bytes as cropping the
+// whole-frame copy; the parts of an ROI outside the frame are zero.
+TEST(FrameCopy, RoisMatchCroppedFullCopy)
+{
+    auto surface = test::random_bytes(kPitch * kHeight, 11);
+    auto pool = FramePool::Create();
+    auto layout = std::make_shared<const RoiLayout>(edge_rois());
+    for (auto format : { PixelFormat::BGRA, PixelFormat::BGR, PixelFormat::RGB, PixelFormat::Gray }) {
+        CopyOptions full_options;
+        full_options.format = format;
+        Frame full = SurfaceCopier(full_options).Copy(*pool, surface.data(), kPitch, kWidth, kHeight);
+
+        CopyOptions roi_options;
+        roi_options.format = format;
+        roi_options.rois = layout;
+        Frame packed = SurfaceCopier(roi_options).Copy(*pool, surface.data(), kPitch, kWidth, kHeight);
+        ASSERT_EQ(packed.Width(), layout->Width());
+        ASSERT_EQ(packed.Height(), layout->Height());
+        ASSERT_EQ(packed.Format(), format);
+
+        const size_t bpp = bytes_per_pixel(format);
+        const auto& rois = layout->Rois();
+        for (size_t i = 0; i < rois.size(); i++) {
+            const Roi& roi = rois[i];
+            for (int y = 0; y < roi.height; y++) {
+                const uint8_t* row = packed.Row(layout->OffsetY(i) + y);
+                for (int x = 0; x < layout->Width(); x++) {
+                    int sx = roi.x + x;
+                    int sy = roi.y + y;
+                    bool visible = x < roi.width && sx >= 0 && sx < kWidth && sy >= 0 && sy < kHeight;
+                    for (size_t c = 0; c < bpp; c++) {
+                        uint8_t expected = visible ? full.Row(sy)[sx * bpp + c] : 0;
+                        ASSERT_EQ(row[x * bpp + c], expected)
+                            << roi.name << " format " << static_cast<int>(format) << " x " << x << " y " << y;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(FrameCopy, RoiLayoutRejects)
+{
+    EXPECT_THROW(RoiLayout({}), std::invalid_argument);
+    EXPECT_THROW(RoiLayout({ { "a", 0, 0, 0, 4 } }), std::invalid_argument);
+    EXPECT_THROW(RoiLayout({ { "a", 0, 0, 4, 4 }, { "a", 8, 8, 4, 4 } }), std::invalid_argument);
+}
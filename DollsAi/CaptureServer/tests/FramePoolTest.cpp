@@ -0,0 +1,136 @@
+#include "FramePool.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts every heap allocation of the test binary, so a test can check that a
+// stretch of code makes none.
+#if defined(__GNUC__) && !defined(__clang__)
+// the replaced operator delete frees what the replaced operator new returned
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+namespace {
+    std::atomic<size_t> s_allocations{ 0 };
+
+    void* allocate(size_t size, size_t align)
+    {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        if (size == 0) {
+            size = 1;
+        }
+#ifdef _WIN32
+        void* p = _aligned_malloc(size, align);
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, (std::max)(align, sizeof(void*)), size) != 0) {
+            p = nullptr;
+        }
+#endif
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void deallocate(void* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+}
+
+void* operator new(size_t size) { return allocate(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t align) { return allocate(size, static_cast<size_t>(align)); }
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+
+namespace {
+    constexpr int kWidth = 1920;
+    constexpr int kHeight = 1080;
+    // frames in flight at once, like a capture thread, a client and the ring
+    constexpr size_t kInFlight = 4;
+}
+
+// After one round has seen every size, acquiring and releasing frames only
+// recycles buffers: no miss and no heap allocation.
+TEST(FramePool, SteadyStateDoesNotAllocate)
+{
+    auto pool = FramePool::Create(kInFlight);
+    std::array<Frame, kInFlight> frames;
+    for (auto& frame : frames) {
+        frame = pool->Acquire(kWidth, kHeight, PixelFormat::BGRA);
+    }
+    for (auto& frame : frames) {
+        frame.Reset();
+    }
+    auto warm = pool->GetStats();
+    EXPECT_EQ(warm.misses, kInFlight);
+    EXPECT_EQ(warm.bytes_in_flight, 0u);
+
+    const size_t before = s_allocations.load();
+    for (int round = 0; round < 100; round++) {
+        for (auto& frame : frames) {
+            frame = pool->Acquire(kWidth, kHeight, PixelFormat::BGRA);
+            frame.Row(kHeight - 1)[0] = static_cast<uint8_t>(round);
+        }
+        // copies share the buffer and take no allocation either
+        Frame copy = frames[0];
+        for (auto& frame : frames) {
+            frame.Reset();
+        }
+    }
+    const size_t allocations = s_allocations.load() - before;
+
+    auto stats = pool->GetStats();
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(stats.misses, warm.misses);
+    EXPECT_EQ(stats.hits, warm.hits + 100 * kInFlight);
+    EXPECT_EQ(stats.bytes_in_flight, 0u);
+    EXPECT_EQ(stats.bytes_idle, warm.bytes_idle);
+}
+
+// A smaller frame of the same size class takes a recycled buffer too.
+TEST(FramePool, SizeClassReuse)
+{
+    auto pool = FramePool::Create();
+    pool->Acquire(kWidth, kHeight, PixelFormat::BGRA);
+    Frame frame = pool->Acquire(kWidth - 16, kHeight, PixelFormat::BGRA);
+    EXPECT_EQ(pool->GetStats().misses, 1u);
+    EXPECT_EQ(pool->GetStats().hits, 1u);
+    EXPECT_EQ(frame.Stride() % FramePool::kAlign, 0u);
+}
+
+// Beyond max_idle, released buffers are freed, and Trim frees the rest.
+TEST(FramePool, MaxIdle)
+{
+    auto pool = FramePool::Create(2);
+    {
+        std::array<Frame, 3> frames;
+        for (auto& frame : frames) {
+            frame = pool->Acquire(640, 480, PixelFormat::BGR);
+        }
+    }
+    auto stats = pool->GetStats();
+    EXPECT_EQ(stats.misses, 3u);
+    EXPECT_EQ(stats.bytes_in_flight, 0u);
+    const size_t idle = stats.bytes_idle;
+    EXPECT_GT(idle, 0u);
+    pool->Acquire(640, 480, PixelFormat::BGR);
+    pool->Acquire(640, 480, PixelFormat::BGR);
+    EXPECT_EQ(pool->GetStats().hits, 2u);
+
+    pool->Trim();
+    EXPECT_EQ(pool->GetStats().bytes_idle, 0u);
+    pool->Acquire(640, 480, PixelFormat::BGR);
+    EXPECT_EQ(pool->GetStats().misses, 4u);
+}
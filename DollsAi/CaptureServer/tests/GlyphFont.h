@@ -0,0 +1,82 @@
+#pragma once
+
+#include "GlyphReader.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace test {
+    // Dark 5x7 digits, '-' and '.' on a light background, for what GlyphReaderTest
+    // reads and GlyphBench times.
+    struct TextImage
+    {
+        std::vector<uint8_t> pixels;
+        int width;
+        int height;
+
+        ImageView View() const { return { pixels.data(), static_cast<size_t>(width), width, height, PixelFormat::Gray }; }
+    };
+
+    // rows top down, bit 4 is the leftmost column
+    inline const uint8_t* font_rows(char c)
+    {
+        static const uint8_t kDigits[10][7] = {
+            { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },
+            { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },
+            { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },
+            { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },
+            { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },
+            { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },
+            { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },
+            { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+            { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },
+            { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },
+        };
+        static const uint8_t kMinus[7] = { 0, 0, 0, 0x1f, 0, 0, 0 };
+        static const uint8_t kDot[7] = { 0, 0, 0, 0, 0, 0x0c, 0x0c };
+        if (c >= '0' && c <= '9') {
+            return kDigits[c - '0'];
+        }
+        if (c == '-') {
+            return kMinus;
+        }
+        if (c == '.') {
+            return kDot;
+        }
+        throw std::invalid_argument(std::string("No glyph for ") + c);
+    }
+
+    // each font pixel scale x scale, one font column between glyphs, a margin around
+    inline TextImage render_text(const std::string& text, int scale)
+    {
+        constexpr int kMargin = 3;
+        constexpr uint8_t kInk = 30;
+        constexpr uint8_t kPaper = 220;
+        TextImage image;
+        image.width = 2 * kMargin + static_cast<int>(text.size()) * 6 * scale;
+        image.height = 2 * kMargin + 7 * scale;
+        image.pixels.assign(static_cast<size_t>(image.width) * image.height, kPaper);
+        for (size_t i = 0; i < text.size(); i++) {
+            const uint8_t* rows = font_rows(text[i]);
+            for (int y = 0; y < 7 * scale; y++) {
+                for (int x = 0; x < 5 * scale; x++) {
+                    if (rows[y / scale] & (0x10 >> (x / scale))) {
+                        int px = kMargin + static_cast<int>(i) * 6 * scale + x;
+                        image.pixels[static_cast<size_t>(kMargin + y) * image.width + px] = kInk;
+                    }
+                }
+            }
+        }
+        return image;
+    }
+
+    // every glyph of the font once, in the given size
+    inline GlyphAtlas font_atlas(int scale)
+    {
+        const std::string chars = "0123456789-.";
+        GlyphAtlas atlas;
+        atlas.AddSamples(render_text(chars, scale).View(), chars, GlyphOptions());
+        return atlas;
+    }
+}
@@ -0,0 +1,69 @@
+#include "GlyphReader.h"
+#include "GlyphFont.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+namespace {
+    struct Expected
+    {
+        const char* text;
+        double value;
+    };
+
+    constexpr Expected kNumbers[] = {
+        { "0", 0 },
+        { "7", 7 },
+        { "42", 42 },
+        { "1234567890", 1234567890 },
+        { "-15", -15 },
+        { "3.25", 3.25 },
+        { "-0.5", -0.5 },
+        { "99999", 99999 },
+        { "10.01", 10.01 },
+    };
+}
+
+// Numbers rendered in the font the atlas was made from read back exactly.
+TEST(GlyphReader, ReadsRenderedNumbers)
+{
+    GlyphAtlas atlas = test::font_atlas(3);
+    ASSERT_EQ(atlas.Size(), 12u);
+    for (const auto& expected : kNumbers) {
+        auto image = test::render_text(expected.text, 3);
+        NumberReading reading = read_number(image.View(), atlas, GlyphOptions());
+        EXPECT_EQ(reading.text, expected.text);
+        ASSERT_TRUE(reading.has_value) << expected.text;
+        EXPECT_DOUBLE_EQ(reading.value, expected.value);
+        EXPECT_DOUBLE_EQ(reading.confidence, 1.0) << expected.text;
+    }
+}
+
+// Glyphs are normalized to their cell, so a larger rendering reads the same.
+TEST(GlyphReader, ReadsOtherSizes)
+{
+    GlyphAtlas atlas = test::font_atlas(2);
+    for (int scale : { 3, 4, 6 }) {
+        for (const auto& expected : kNumbers) {
+            auto image = test::render_text(expected.text, scale);
+            NumberReading reading = read_number(image.View(), atlas, GlyphOptions());
+            EXPECT_EQ(reading.text, expected.text) << "scale " << scale;
+            EXPECT_DOUBLE_EQ(reading.value, expected.value) << "scale " << scale;
+        }
+    }
+}
+
+// An empty region has no value; a sample with the wrong glyph count is refused.
+TEST(GlyphReader, NoTextAndBadSamples)
+{
+    GlyphAtlas atlas = test::font_atlas(3);
+    auto blank = test::render_text("", 3);
+    NumberReading reading = read_number(blank.View(), atlas, GlyphOptions());
+    EXPECT_EQ(reading.text, "");
+    EXPECT_FALSE(reading.has_value);
+
+    GlyphAtlas other;
+    EXPECT_THROW(other.AddSamples(test::render_text("123", 3).View(), "12", GlyphOptions()), std::invalid_argument);
+    EXPECT_THROW(read_number(blank.View(), other, GlyphOptions()), std::invalid_argument);
+}
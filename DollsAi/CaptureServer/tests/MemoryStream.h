@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Protocol.h"
+
+#include <vector>
+
+namespace test {
+    // Keeps what is written, and decodes in the stream's current mode. Shared by the
+    // tests and the benchmarks; the latter only count attachments, so that copying
+    // them is not part of what they measure.
+    class MemoryStream : public CommandStream
+    {
+    public:
+        using CommandStream::Decode;
+
+        explicit MemoryStream(bool keep_attachments = true) : m_keepAttachments(keep_attachments)
+        {
+        }
+
+        // Every Write after this is in mode. The reply that switches is dropped.
+        void SetMode(WireMode mode)
+        {
+            WriteSwitching(nlohmann::json::object(), mode, false);
+            Clear();
+        }
+
+        void Clear()
+        {
+            bytes.clear();
+            attachment_bytes = 0;
+        }
+
+        // every message, attachments included if kept
+        std::vector<uint8_t> bytes;
+        size_t attachment_bytes = 0;
+
+    protected:
+        void Send(std::vector<uint8_t> head, const std::vector<Attachment>& attachments) override
+        {
+            bytes.insert(bytes.end(), head.begin(), head.end());
+            for (const auto& a : attachments) {
+                attachment_bytes += a.size;
+                if (m_keepAttachments) {
+                    bytes.insert(bytes.end(), a.data, a.data + a.size);
+                }
+            }
+        }
+
+    private:
+        const bool m_keepAttachments;
+    };
+}
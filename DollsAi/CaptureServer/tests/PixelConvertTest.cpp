@@ -0,0 +1,98 @@
+#include "PixelConvert.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    constexpr PixelFormat kFormats[] = { PixelFormat::BGRA, PixelFormat::BGR, PixelFormat::RGB, PixelFormat::Gray };
+
+    std::vector<SimdLevel> supported_levels()
+    {
+        std::vector<SimdLevel> levels = { SimdLevel::Scalar };
+        for (auto level : { SimdLevel::SSSE3, SimdLevel::AVX2 }) {
+            if (level <= simd_level()) {
+                levels.push_back(level);
+            }
+        }
+        return levels;
+    }
+
+    // dst of width x height in format, rows packed, converted with the given kernels
+    std::vector<uint8_t> convert(const std::vector<uint8_t>& src, int width, int height, PixelFormat format, SimdLevel level)
+    {
+        const size_t dst_pitch = static_cast<size_t>(width) * bytes_per_pixel(format);
+        std::vector<uint8_t> dst(dst_pitch * height + 64);
+        convert_bgra(src.data(), 4 * static_cast<size_t>(width), dst.data(), dst_pitch, width, height, format, level);
+        dst.resize(dst_pitch * height);
+        return dst;
+    }
+}
+
+TEST(PixelConvert, ScalarPixels)
+{
+    const uint8_t bgra[8] = { 10, 20, 30, 40, 255, 255, 255, 0 };
+    uint8_t dst[8] = {};
+
+    convert_bgra_row(bgra, dst, 2, PixelFormat::BGR);
+    EXPECT_EQ(std::vector<uint8_t>(dst, dst + 6), std::vector<uint8_t>({ 10, 20, 30, 255, 255, 255 }));
+    convert_bgra_row(bgra, dst, 2, PixelFormat::RGB);
+    EXPECT_EQ(std::vector<uint8_t>(dst, dst + 6), std::vector<uint8_t>({ 30, 20, 10, 255, 255, 255 }));
+    // 0.114 * 10 + 0.587 * 20 + 0.299 * 30 = 21.85
+    convert_bgra_row(bgra, dst, 2, PixelFormat::Gray);
+    EXPECT_EQ(dst[0], 22);
+    EXPECT_EQ(dst[1], 255);
+}
+
+// Every kernel set the CPU has must give exactly the scalar bytes, for widths around
+// the 16 pixel blocks (tails) and for pitches wider than the row.
+TEST(PixelConvert, SimdMatchesScalar)
+{
+    for (int width : { 1, 7, 15, 16, 17, 31, 33, 64, 100, 1927 }) {
+        const int height = 3;
+        // kernels may read up to FramePool::kAlign bytes past the last pixel
+        auto src = test::random_bytes(4 * static_cast<size_t>(width) * height + FramePool::kAlign, width);
+        for (auto format : kFormats) {
+            auto expected = convert(src, width, height, format, SimdLevel::Scalar);
+            for (auto level : supported_levels()) {
+                EXPECT_EQ(convert(src, width, height, format, level), expected)
+                    << simd_level_name(level) << " " << pixel_format_name(format) << " width " << width;
+            }
+        }
+    }
+}
+
+TEST(PixelConvert, PaddedPitch)
+{
+    const int width = 37;
+    const int height = 4;
+    const size_t src_pitch = 4 * width + 20;
+    auto src = test::random_bytes(src_pitch * height + FramePool::kAlign, 7);
+    for (auto format : kFormats) {
+        const size_t row_bytes = static_cast<size_t>(width) * bytes_per_pixel(format);
+        const size_t dst_pitch = row_bytes + 9;
+        for (auto level : supported_levels()) {
+            std::vector<uint8_t> dst(dst_pitch * height + 64, 0xcc);
+            convert_bgra(src.data(), src_pitch, dst.data(), dst_pitch, width, height, format, level);
+            for (int y = 0; y < height; y++) {
+                std::vector<uint8_t> row(row_bytes + 64);
+                convert_bgra(src.data() + y * src_pitch, src_pitch, row.data(), row_bytes, width, 1, format, SimdLevel::Scalar);
+                row.resize(row_bytes);
+                EXPECT_TRUE(std::equal(row.begin(), row.end(), dst.begin() + y * dst_pitch))
+                    << simd_level_name(level) << " " << pixel_format_name(format) << " row " << y;
+                // the padding between rows is not written
+                EXPECT_EQ(dst[y * dst_pitch + row_bytes], 0xcc);
+            }
+        }
+    }
+}
+
+TEST(PixelConvert, FormatNames)
+{
+    for (auto format : kFormats) {
+        EXPECT_EQ(parse_pixel_format(pixel_format_name(format)), format);
+    }
+    EXPECT_THROW(parse_pixel_format("yuv"), std::runtime_error);
+}
@@ -0,0 +1,98 @@
+#include "PixelProbe.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace {
+    constexpr int kWidth = 203;
+    constexpr int kHeight = 117;
+    constexpr PixelFormat kFormats[] = { PixelFormat::BGRA, PixelFormat::BGR, PixelFormat::RGB, PixelFormat::Gray };
+
+    // count probes, some outside the frame, some on its last pixels, most of the rest
+    // near the color under them so that both hits and misses occur
+    ProbeSet random_probes(const Frame& frame, size_t count, uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        ProbeSet set;
+        for (size_t i = 0; i < count; i++) {
+            int x = static_cast<int>(rng() % (kWidth + 40)) - 20;
+            int y = static_cast<int>(rng() % (kHeight + 40)) - 20;
+            if (i % 16 == 5) {
+                x = kWidth - 1;
+                y = kHeight - 1;
+            }
+            uint32_t rgb = rng() & 0xffffff;
+            bool inside = x >= 0 && x < kWidth && y >= 0 && y < kHeight;
+            if (inside && rng() % 4 != 0) {
+                const uint8_t* p = frame.Row(y) + static_cast<size_t>(x) * bytes_per_pixel(frame.Format());
+                switch (frame.Format()) {
+                case PixelFormat::RGB:
+                    rgb = p[0] << 16 | p[1] << 8 | p[2];
+                    break;
+                case PixelFormat::Gray:
+                    rgb = p[0] * 0x010101u;
+                    break;
+                default:
+                    rgb = p[2] << 16 | p[1] << 8 | p[0];
+                    break;
+                }
+                // off by up to 12 in one channel
+                rgb ^= (rng() % 13) << (8 * (rng() % 3));
+            }
+            set.Add(x, y, rgb, static_cast<int>(rng() % 16));
+        }
+        return set;
+    }
+}
+
+// The AVX2 gather gives exactly the scalar colors and hits, for every format, probes
+// outside the frame or on its last pixel, and counts with a partial last block of 8.
+TEST(PixelProbe, Avx2MatchesScalar)
+{
+    if (simd_level() < SimdLevel::AVX2) {
+        GTEST_SKIP() << "no AVX2 on this CPU";
+    }
+    auto pool = FramePool::Create();
+    for (auto format : kFormats) {
+        Frame frame = test::random_frame(*pool, kWidth, kHeight, format, 3);
+        for (size_t count : { 1, 7, 8, 9, 300, 333 }) {
+            ProbeSet set = random_probes(frame, count, static_cast<uint32_t>(count));
+            std::vector<uint32_t> scalar_colors(count);
+            std::vector<uint8_t> scalar_hits(count);
+            set.Evaluate(frame, scalar_colors.data(), scalar_hits.data(), SimdLevel::Scalar);
+            std::vector<uint32_t> colors(count);
+            std::vector<uint8_t> hits(count);
+            set.Evaluate(frame, colors.data(), hits.data(), SimdLevel::AVX2);
+            EXPECT_EQ(colors, scalar_colors) << "format " << static_cast<int>(format) << " count " << count;
+            EXPECT_EQ(hits, scalar_hits) << "format " << static_cast<int>(format) << " count " << count;
+
+            // hits only, as the predicates use them
+            std::vector<uint8_t> hits_only(count);
+            set.Evaluate(frame, nullptr, hits_only.data(), SimdLevel::AVX2);
+            EXPECT_EQ(hits_only, scalar_hits);
+        }
+    }
+}
+
+// The scalar reference itself: colors as 0xRRGGBB in every format, nothing outside the frame.
+TEST(PixelProbe, ScalarColors)
+{
+    auto pool = FramePool::Create();
+    Frame frame = pool->Acquire(2, 1, PixelFormat::BGR);
+    const uint8_t bgr[6] = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 };
+    memcpy(frame.Row(0), bgr, sizeof(bgr));
+    ProbeSet set;
+    set.Add(0, 0, 0x302010, 0);
+    // blue off by 8, then by 7
+    set.Add(1, 0, 0x605048, 7);
+    set.Add(1, 0, 0x605047, 7);
+    set.Add(2, 0, 0, 255);
+    set.Add(0, -1, 0, 255);
+    uint32_t colors[5];
+    uint8_t hits[5];
+    set.Evaluate(frame, colors, hits, SimdLevel::Scalar);
+    EXPECT_EQ(std::vector<uint32_t>(colors, colors + 5), std::vector<uint32_t>({ 0x302010, 0x605040, 0x605040, 0, 0 }));
+    EXPECT_EQ(std::vector<uint8_t>(hits, hits + 5), std::vector<uint8_t>({ 1, 0, 1, 0, 0 }));
+}
@@ -0,0 +1,159 @@
+#include "Protocol.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+namespace {
+    std::vector<uint8_t> bytes_of(const std::string& text)
+    {
+        return std::vector<uint8_t>(text.begin(), text.end());
+    }
+
+    uint32_t load_le32(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+}
+
+TEST(Protocol, TextFraming)
+{
+    test::MemoryStream stream;
+    auto data = bytes_of("{\"cmd\": \"a\"}\n\n{\"cmd\":\n\n\"b\"}\n\n{\"cmd\": ");
+    Request request;
+
+    size_t used = stream.Decode(data.data(), data.size(), request);
+    ASSERT_EQ(used, 14u);
+    EXPECT_EQ(request.body["cmd"], "a");
+
+    // an empty line ends the message even inside the JSON: it does not parse
+    size_t offset = used;
+    used = stream.Decode(data.data() + offset, data.size() - offset, request);
+    ASSERT_EQ(used, 9u);
+    EXPECT_TRUE(request.body.is_discarded());
+
+    // "b"}\n\n is the rest of that one, then an incomplete message
+    offset += used;
+    used = stream.Decode(data.data() + offset, data.size() - offset, request);
+    ASSERT_EQ(used, 6u);
+    offset += used;
+    EXPECT_EQ(stream.Decode(data.data() + offset, data.size() - offset, request), 0u);
+}
+
+// Bytes arriving one at a time, the way SocketServer calls Decode after each read.
+TEST(Protocol, TextIncremental)
+{
+    test::MemoryStream stream;
+    auto data = bytes_of("{\"cmd\": \"a\", \"text\": \"x\\ny\"}\n\n{\"cmd\": \"b\"}\n\n");
+    Request request;
+    size_t begin = 0;
+    std::vector<std::string> commands;
+    for (size_t end = begin + 1; end <= data.size(); end++) {
+        size_t used = stream.Decode(data.data() + begin, end - begin, request);
+        if (used != 0) {
+            EXPECT_EQ(used, end - begin);
+            commands.push_back(request.body["cmd"]);
+            begin = end;
+        }
+    }
+    EXPECT_EQ(commands, std::vector<std::string>({ "a", "b" }));
+}
+
+// A text message with no end in sight is not buffered forever.
+TEST(Protocol, TextTooLarge)
+{
+    test::MemoryStream stream;
+    std::vector<uint8_t> data(64 * 1024 * 1024, 'x');
+    Request request;
+    EXPECT_EQ(stream.Decode(data.data(), data.size(), request), 0u);
+    data.push_back('\n');
+    EXPECT_THROW(stream.Decode(data.data(), data.size(), request), std::runtime_error);
+}
+
+TEST(Protocol, TextWrite)
+{
+    test::MemoryStream stream;
+    stream.Write({ {"result", 1} });
+    stream.Push({ {"event", "x"} });
+    EXPECT_EQ(std::string(stream.bytes.begin(), stream.bytes.end()), "{\"result\":1}\n\n{\"event\":\"x\"}\n\n");
+    // raw bytes need a binary mode
+    uint8_t pixels[4] = {};
+    EXPECT_THROW(stream.Write({ {"result", 1} }, { { pixels, 4, Frame() } }), std::logic_error);
+}
+
+// The reply to set_protocol goes out in the old mode, everything after it in the new one.
+TEST(Protocol, ModeSwitchAfterReply)
+{
+    test::MemoryStream stream;
+    stream.Push({ {"event", "x"} });
+    stream.WriteSwitching({ {"result", "cbor"} }, WireMode::Cbor, false);
+    EXPECT_EQ(stream.Mode(), WireMode::Cbor);
+    EXPECT_EQ(std::string(stream.bytes.begin(), stream.bytes.end()), "{\"event\":\"x\"}\n\n{\"result\":\"cbor\"}\n\n");
+
+    stream.bytes.clear();
+    stream.Write({ {"result", 1} });
+    Request request;
+    ASSERT_EQ(stream.Decode(stream.bytes.data(), stream.bytes.size(), request), stream.bytes.size());
+    EXPECT_EQ(request.body, nlohmann::json({ {"result", 1} }));
+}
+
+TEST(Protocol, BinaryRoundTrip)
+{
+    for (auto mode : { WireMode::Cbor, WireMode::MsgPack }) {
+        test::MemoryStream stream;
+        stream.SetMode(mode);
+        auto a = test::random_bytes(100, 1);
+        auto b = test::random_bytes(7, 2);
+        nlohmann::json body = { {"result", {{"frame_id", 3}}}, {"id", "x"} };
+        stream.Write(body, { { a.data(), a.size(), Frame() }, { b.data(), b.size(), Frame() } });
+        stream.Write({ {"result", nullptr} });
+
+        // header: document size, then the attachment total
+        ASSERT_GE(stream.bytes.size(), 8u);
+        const uint32_t doc_size = load_le32(stream.bytes.data());
+        EXPECT_EQ(load_le32(stream.bytes.data() + 4), 107u);
+
+        Request request;
+        size_t used = stream.Decode(stream.bytes.data(), stream.bytes.size(), request);
+        ASSERT_EQ(used, 8 + doc_size + 107u) << wire_mode_name(mode);
+        body["attachments"] = { 100, 7 };
+        EXPECT_EQ(request.body, body);
+        std::vector<uint8_t> attachment = a;
+        attachment.insert(attachment.end(), b.begin(), b.end());
+        EXPECT_EQ(request.attachment, attachment);
+
+        // every prefix of the second message is incomplete
+        const size_t rest = stream.bytes.size() - used;
+        for (size_t size = 0; size < rest; size++) {
+            EXPECT_EQ(stream.Decode(stream.bytes.data() + used, size, request), 0u);
+        }
+        EXPECT_EQ(stream.Decode(stream.bytes.data() + used, rest, request), rest);
+        EXPECT_TRUE(request.body["result"].is_null());
+        EXPECT_TRUE(request.attachment.empty());
+    }
+}
+
+TEST(Protocol, BinaryBrokenInput)
+{
+    test::MemoryStream stream;
+    stream.SetMode(WireMode::Cbor);
+    Request request;
+
+    // a size no real message has: the stream is out of sync
+    uint8_t header[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+    EXPECT_THROW(stream.Decode(header, sizeof(header), request), std::runtime_error);
+
+    // a complete message whose document is not CBOR is consumed and discarded
+    uint8_t garbage[10] = { 2, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    EXPECT_EQ(stream.Decode(garbage, sizeof(garbage), request), sizeof(garbage));
+    EXPECT_TRUE(request.body.is_discarded());
+}
+
+TEST(Protocol, ModeNames)
+{
+    for (auto mode : { WireMode::Text, WireMode::Cbor, WireMode::MsgPack }) {
+        EXPECT_EQ(parse_wire_mode(wire_mode_name(mode)), mode);
+    }
+    EXPECT_THROW(parse_wire_mode("xml"), std::runtime_error);
+}
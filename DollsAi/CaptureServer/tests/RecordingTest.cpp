@@ -0,0 +1,187 @@
+#include "Recording.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // a recording file removed at the end of the test
+    struct TempFile
+    {
+        TempFile() : path((fs::temp_directory_path() / (test::unique_name("dollsai_test") + ".dasr")).u8string()) {}
+        ~TempFile()
+        {
+            std::error_code ec;
+            fs::remove(fs::u8path(path), ec);
+        }
+
+        std::string path;
+    };
+
+    // Frames 1..count: random pixels, then a few tiles changed per frame; every
+    // fifth frame repeats the one before it (flagged duplicate, like TileTracker does).
+    std::vector<Frame> frame_sequence(FramePool& pool, int width, int height, PixelFormat format, size_t count)
+    {
+        std::vector<Frame> frames;
+        Frame previous = test::random_frame(pool, width, height, format, 1);
+        const int bpp = bytes_per_pixel(format);
+        for (size_t i = 0; i < count; i++) {
+            Frame frame = pool.Acquire(width, height, format);
+            for (int y = 0; y < height; y++) {
+                memcpy(frame.Row(y), previous.Row(y), static_cast<size_t>(width) * bpp);
+            }
+            if (i % 5 == 4) {
+                frame.SetDuplicate(true);
+            }
+            else {
+                auto noise = test::random_bytes(8 * bpp, static_cast<uint32_t>(i) + 100);
+                int x = static_cast<int>(i * 37 % (width - 8));
+                int y = static_cast<int>(i * 11 % height);
+                memcpy(frame.Row(y) + x * bpp, noise.data(), noise.size());
+            }
+            frame.SetId(i + 1);
+            frame.SetTimestamp(FrameClock::now());
+            frames.push_back(frame);
+            previous = frame;
+        }
+        return frames;
+    }
+
+    void record(const std::string& path, const std::vector<Frame>& frames, uint32_t keyframe_interval)
+    {
+        RecorderOptions options;
+        options.queue_frames = frames.size();
+        options.keyframe_interval = keyframe_interval;
+        Recorder recorder(path, options);
+        for (const auto& frame : frames) {
+            ASSERT_TRUE(recorder.Push(frame));
+        }
+        recorder.Stop();
+        auto stats = recorder.GetStats();
+        EXPECT_EQ(stats.frames, frames.size());
+        EXPECT_EQ(stats.dropped, 0u);
+        EXPECT_TRUE(stats.error.empty()) << stats.error;
+    }
+}
+
+TEST(Recording, ZeroRunRoundTrip)
+{
+    // literal bytes with zero runs of every length around kMinZeroRun
+    std::vector<uint8_t> input;
+    auto literal = test::random_bytes(4000, 9);
+    size_t pos = 0;
+    for (size_t run = 0; run < 40; run++) {
+        input.insert(input.end(), literal.begin() + pos, literal.begin() + pos + run + 1);
+        pos += run + 1;
+        input.insert(input.end(), run % 20, 0);
+    }
+    input.insert(input.end(), 1000, 0);
+
+    // appended in uneven pieces
+    std::vector<uint8_t> encoded;
+    recording::ZeroRunEncoder encoder(encoded);
+    for (size_t i = 0; i < input.size(); i += 13) {
+        encoder.Append(input.data() + i, (std::min)(size_t(13), input.size() - i));
+    }
+    encoder.Finish();
+    EXPECT_LT(encoded.size(), input.size());
+
+    std::vector<uint8_t> decoded(input.size());
+    size_t consumed = 0;
+    ASSERT_TRUE(recording::zero_run_decode(encoded.data(), encoded.size(), decoded.data(), decoded.size(), &consumed));
+    EXPECT_EQ(consumed, encoded.size());
+    EXPECT_EQ(decoded, input);
+
+    // short input is an error, not a crash
+    EXPECT_FALSE(recording::zero_run_decode(encoded.data(), encoded.size() / 2, decoded.data(), decoded.size(), &consumed));
+}
+
+TEST(Recording, RoundTrip)
+{
+    auto pool = FramePool::Create();
+    for (auto format : { PixelFormat::BGRA, PixelFormat::BGR, PixelFormat::Gray }) {
+        TempFile file;
+        // not multiples of the tile size, so the last tiles are clipped
+        auto frames = frame_sequence(*pool, 100, 70, format, 30);
+        record(file.path, frames, 8);
+
+        RecordingReader reader(file.path);
+        ASSERT_EQ(reader.Size(), frames.size());
+        // in order: one delta per frame
+        for (size_t i = 0; i < frames.size(); i++) {
+            Frame frame = reader.Read(i, *pool);
+            EXPECT_EQ(frame.Id(), frames[i].Id());
+            EXPECT_TRUE(test::same_pixels(frame, frames[i])) << pixel_format_name(format) << " frame " << i;
+            EXPECT_EQ((reader.Entry(i).flags & recording::kKeyframe) != 0, i % 8 == 0) << i;
+        }
+        // any order: decoded forward from the keyframe before it
+        for (size_t i : { 29, 3, 17, 16, 0, 9, 9, 24 }) {
+            EXPECT_TRUE(test::same_pixels(reader.Read(i, *pool), frames[i])) << pixel_format_name(format) << " frame " << i;
+        }
+        EXPECT_EQ(reader.Find(17), 16u);
+        EXPECT_EQ(reader.Find(1000), frames.size());
+        EXPECT_THROW(reader.Read(frames.size(), *pool), std::out_of_range);
+    }
+}
+
+// A size change starts a new keyframe; both sizes read back.
+TEST(Recording, SizeChange)
+{
+    auto pool = FramePool::Create();
+    TempFile file;
+    auto frames = frame_sequence(*pool, 64, 48, PixelFormat::BGR, 6);
+    auto larger = frame_sequence(*pool, 90, 50, PixelFormat::BGR, 6);
+    for (size_t i = 0; i < larger.size(); i++) {
+        larger[i].SetId(frames.size() + i + 1);
+        larger[i].SetDuplicate(false);
+        frames.push_back(larger[i]);
+    }
+    record(file.path, frames, 300);
+
+    RecordingReader reader(file.path);
+    ASSERT_EQ(reader.Size(), frames.size());
+    EXPECT_TRUE(reader.Entry(6).flags & recording::kKeyframe);
+    for (size_t i : { 11, 2, 6, 5 }) {
+        EXPECT_TRUE(test::same_pixels(reader.Read(i, *pool), frames[i])) << "frame " << i;
+    }
+}
+
+// Without the index and trailer (a killed writer) the chunks are walked instead.
+TEST(Recording, ReadsWithoutTrailer)
+{
+    auto pool = FramePool::Create();
+    TempFile file;
+    auto frames = frame_sequence(*pool, 80, 40, PixelFormat::BGRA, 12);
+    record(file.path, frames, 5);
+
+    recording::Trailer trailer = {};
+    {
+        std::ifstream in(fs::u8path(file.path), std::ios::binary);
+        in.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end);
+        in.read(reinterpret_cast<char*>(&trailer), sizeof(trailer));
+        ASSERT_TRUE(in);
+    }
+    ASSERT_EQ(trailer.count, frames.size());
+    fs::resize_file(fs::u8path(file.path), trailer.index_offset);
+
+    RecordingReader reader(file.path);
+    ASSERT_EQ(reader.Size(), frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        EXPECT_TRUE(test::same_pixels(reader.Read(i, *pool), frames[i])) << "frame " << i;
+    }
+}
+
+TEST(Recording, NotARecording)
+{
+    TempFile file;
+    {
+        std::ofstream out(fs::u8path(file.path), std::ios::binary);
+        out << "certainly not a recording, but longer than the 64 byte file header of one";
+    }
+    EXPECT_THROW(RecordingReader reader(file.path), std::runtime_error);
+}
@@ -0,0 +1,86 @@
+#include "Recording.h"
+#include "ReplaySource.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <future>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // a short recording, removed at the end of the test
+    struct TempRecording
+    {
+        explicit TempRecording(size_t count)
+            : path((fs::temp_directory_path() / (test::unique_name("dollsai_test") + ".dasr")).u8string())
+        {
+            auto pool = FramePool::Create();
+            RecorderOptions options;
+            options.queue_frames = count;
+            Recorder recorder(path, options);
+            for (size_t i = 0; i < count; i++) {
+                Frame frame = test::random_frame(*pool, 64, 32, PixelFormat::BGR, static_cast<uint32_t>(i));
+                frame.SetId(i + 1);
+                // a second apart: a paced replay waits a long time for the next frame
+                frame.SetTimestamp(FrameClock::time_point(std::chrono::seconds(i + 1)));
+                recorder.Push(frame);
+            }
+            recorder.Stop();
+        }
+        ~TempRecording()
+        {
+            std::error_code ec;
+            fs::remove(fs::u8path(path), ec);
+        }
+
+        std::string path;
+    };
+
+    // WaitNextFrame with a long timeout on another thread, interrupted while it waits
+    FrameClock::duration interrupted_wait(ReplaySource& source)
+    {
+        auto start = FrameClock::now();
+        auto wait = std::async(std::launch::async, [&]() {
+            return source.WaitNextFrame(std::chrono::seconds(10));
+        });
+        EXPECT_EQ(wait.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+        source.Interrupt();
+        EXPECT_FALSE(wait.get());
+        return FrameClock::now() - start;
+    }
+}
+
+TEST(ReplaySource, PlaysInOrder)
+{
+    TempRecording file(3);
+    ReplaySource source(file.path, ReplayOptions());
+    for (uint64_t id = 1; id <= 3; id++) {
+        Frame frame = source.WaitNextFrame(std::chrono::milliseconds(100));
+        ASSERT_TRUE(frame);
+        EXPECT_EQ(frame.Id(), id);
+    }
+    EXPECT_FALSE(source.WaitNextFrame(std::chrono::milliseconds(1)));
+}
+
+// Interrupt ends the idle wait after the last frame without a timeout.
+TEST(ReplaySource, InterruptAtEnd)
+{
+    TempRecording file(1);
+    ReplaySource source(file.path, ReplayOptions());
+    ASSERT_TRUE(source.WaitNextFrame(std::chrono::milliseconds(100)));
+    EXPECT_LT(interrupted_wait(source), std::chrono::seconds(2));
+}
+
+// ... and the wait for a paced frame that is not due yet.
+TEST(ReplaySource, InterruptPaced)
+{
+    TempRecording file(3);
+    ReplayOptions options;
+    // the second frame is due 5 s after the first
+    options.speed = 0.2;
+    ReplaySource source(file.path, options);
+    ASSERT_TRUE(source.WaitNextFrame(std::chrono::milliseconds(100)));
+    EXPECT_LT(interrupted_wait(source), std::chrono::seconds(2));
+}
@@ -0,0 +1,121 @@
+#include "Resample.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+
+namespace {
+    // Straight area average in double: output pixel (x, y) covers source
+    // [x * sx, (x + 1) * sx) x [y * sy, (y + 1) * sy), weighted by overlap. BGRA out.
+    std::vector<double> reference_area(const std::vector<uint8_t>& src, int src_width, int src_height,
+        int dst_width, int dst_height)
+    {
+        const double sx = static_cast<double>(src_width) / dst_width;
+        const double sy = static_cast<double>(src_height) / dst_height;
+        std::vector<double> dst(4 * static_cast<size_t>(dst_width) * dst_height);
+        for (int y = 0; y < dst_height; y++) {
+            for (int x = 0; x < dst_width; x++) {
+                double sum[4] = {};
+                double total = 0;
+                for (int v = static_cast<int>(floor(y * sy)); v < (std::min)(src_height, static_cast<int>(ceil((y + 1) * sy))); v++) {
+                    double wy = (std::min)((y + 1) * sy, v + 1.0) - (std::max)(y * sy, static_cast<double>(v));
+                    for (int u = static_cast<int>(floor(x * sx)); u < (std::min)(src_width, static_cast<int>(ceil((x + 1) * sx))); u++) {
+                        double wx = (std::min)((x + 1) * sx, u + 1.0) - (std::max)(x * sx, static_cast<double>(u));
+                        const uint8_t* p = &src[4 * (static_cast<size_t>(v) * src_width + u)];
+                        for (int c = 0; c < 4; c++) {
+                            sum[c] += p[c] * wx * wy;
+                        }
+                        total += wx * wy;
+                    }
+                }
+                for (int c = 0; c < 4; c++) {
+                    dst[4 * (static_cast<size_t>(y) * dst_width + x) + c] = sum[c] / total;
+                }
+            }
+        }
+        return dst;
+    }
+
+    std::vector<uint8_t> resample(const std::vector<uint8_t>& src, int src_width, int src_height,
+        int dst_width, int dst_height, PixelFormat format = PixelFormat::BGRA)
+    {
+        AreaResampler resampler(src_width, src_height, dst_width, dst_height);
+        const size_t dst_pitch = static_cast<size_t>(dst_width) * bytes_per_pixel(format);
+        std::vector<uint8_t> dst(dst_pitch * dst_height + FramePool::kAlign);
+        resampler.Resample(src.data(), 4 * static_cast<size_t>(src_width), dst.data(), dst_pitch, format);
+        dst.resize(dst_pitch * dst_height);
+        return dst;
+    }
+
+    // largest difference to the reference, in levels
+    double max_error(const std::vector<uint8_t>& actual, const std::vector<double>& expected)
+    {
+        double worst = 0;
+        for (size_t i = 0; i < actual.size(); i++) {
+            worst = (std::max)(worst, fabs(actual[i] - expected[i]));
+        }
+        return worst;
+    }
+}
+
+// Integer factors take the box path (SSE2 for 2 and 4): the exact rounded mean.
+TEST(Resample, BoxIsExactMean)
+{
+    for (int k : { 2, 3, 4, 5 }) {
+        // odd output widths exercise the scalar tails of the SSE2 kernels
+        const int dst_width = 13;
+        const int dst_height = 5;
+        auto src = test::random_bytes(4 * static_cast<size_t>(dst_width) * k * dst_height * k + FramePool::kAlign, k);
+        auto actual = resample(src, dst_width * k, dst_height * k, dst_width, dst_height);
+        auto expected = reference_area(src, dst_width * k, dst_height * k, dst_width, dst_height);
+        for (size_t i = 0; i < actual.size(); i++) {
+            // (sum + n / 2) / n rounds half up
+            ASSERT_EQ(actual[i], static_cast<uint8_t>(floor(expected[i] + 0.5))) << "factor " << k << " byte " << i;
+        }
+    }
+}
+
+// Any other ratio takes the float taps, within rounding of the exact average.
+TEST(Resample, AreaWithinRounding)
+{
+    struct Case
+    {
+        int src_width, src_height, dst_width, dst_height;
+    };
+    for (auto c : { Case{ 100, 60, 40, 24 }, Case{ 37, 23, 15, 9 }, Case{ 64, 64, 48, 20 }, Case{ 8, 8, 16, 16 } }) {
+        auto src = test::random_bytes(4 * static_cast<size_t>(c.src_width) * c.src_height + FramePool::kAlign, c.src_width);
+        auto actual = resample(src, c.src_width, c.src_height, c.dst_width, c.dst_height);
+        auto expected = reference_area(src, c.src_width, c.src_height, c.dst_width, c.dst_height);
+        EXPECT_LE(max_error(actual, expected), 0.51) << c.src_width << "x" << c.src_height
+            << " -> " << c.dst_width << "x" << c.dst_height;
+    }
+}
+
+// The destination format is applied to the resampled BGRA, as convert_bgra_row would.
+TEST(Resample, ConvertsFormat)
+{
+    const int src_width = 48;
+    const int src_height = 30;
+    auto src = test::random_bytes(4 * static_cast<size_t>(src_width) * src_height + FramePool::kAlign, 3);
+    for (auto size : { std::make_pair(24, 15), std::make_pair(20, 11) }) {
+        auto bgra = resample(src, src_width, src_height, size.first, size.second);
+        bgra.resize(bgra.size() + FramePool::kAlign);
+        for (auto format : { PixelFormat::BGR, PixelFormat::RGB, PixelFormat::Gray }) {
+            auto actual = resample(src, src_width, src_height, size.first, size.second, format);
+            std::vector<uint8_t> expected(actual.size() + FramePool::kAlign);
+            convert_bgra(bgra.data(), 4 * static_cast<size_t>(size.first), expected.data(),
+                static_cast<size_t>(size.first) * bytes_per_pixel(format), size.first, size.second, format, SimdLevel::Scalar);
+            expected.resize(actual.size());
+            EXPECT_EQ(actual, expected) << pixel_format_name(format);
+        }
+    }
+}
+
+TEST(Resample, RejectsEmptySizes)
+{
+    EXPECT_THROW(AreaResampler(0, 10, 5, 5), std::invalid_argument);
+    EXPECT_THROW(AreaResampler(10, 10, 5, 0), std::invalid_argument);
+}
@@ -0,0 +1,114 @@
+#include "ScreenClassifier.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+
+namespace {
+    // hash with bits random bits of base flipped
+    uint64_t near_hash(std::mt19937_64& rng, uint64_t base, int bits)
+    {
+        for (int i = 0; i < bits; i++) {
+            base ^= uint64_t(1) << (rng() % 64);
+        }
+        return base;
+    }
+
+    // Every reference compared, the answer Nearest must give.
+    std::vector<ScreenClassifier::Match> brute_force(const std::vector<std::pair<uint64_t, std::string>>& refs,
+        uint64_t hash, size_t max_results, int max_distance)
+    {
+        std::map<std::string, int> best;
+        for (const auto& ref : refs) {
+            int d = hamming_distance(hash, ref.first);
+            if (d <= max_distance) {
+                auto it = best.find(ref.second);
+                if (it == best.end() || d < it->second) {
+                    best[ref.second] = d;
+                }
+            }
+        }
+        std::vector<ScreenClassifier::Match> result;
+        for (const auto& b : best) {
+            result.push_back({ b.first, b.second });
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return a.distance != b.distance ? a.distance < b.distance : a.label < b.label;
+        });
+        if (result.size() > max_results) {
+            result.resize(max_results);
+        }
+        return result;
+    }
+}
+
+TEST(ScreenClassifier, HammingDistance)
+{
+    EXPECT_EQ(hamming_distance(0, 0), 0);
+    EXPECT_EQ(hamming_distance(0, ~uint64_t(0)), 64);
+    EXPECT_EQ(hamming_distance(0x0f, 0xf0), 8);
+}
+
+TEST(ScreenClassifier, Empty)
+{
+    ScreenClassifier classifier;
+    EXPECT_TRUE(classifier.Nearest(0, 5, 64).empty());
+    classifier.Add(0, "a");
+    EXPECT_TRUE(classifier.Nearest(0, 0, 64).empty());
+}
+
+// The BK-tree pruning, and the radius shrinking to the worst kept distance once
+// max_results labels are known, give exactly what comparing everything gives.
+TEST(ScreenClassifier, MatchesBruteForce)
+{
+    std::mt19937_64 rng(5);
+    // clusters of near hashes (a few screens, many captures each) spread over labels,
+    // so distances from a query range from 0 to far
+    std::vector<uint64_t> centers;
+    for (int i = 0; i < 40; i++) {
+        centers.push_back(rng());
+    }
+    std::vector<std::pair<uint64_t, std::string>> refs;
+    ScreenClassifier classifier;
+    for (int i = 0; i < 3000; i++) {
+        uint64_t hash = near_hash(rng, centers[rng() % centers.size()], static_cast<int>(rng() % 12));
+        std::string label = "screen" + std::to_string(rng() % 150);
+        refs.emplace_back(hash, label);
+        classifier.Add(hash, label);
+    }
+    ASSERT_EQ(classifier.Size(), refs.size());
+
+    for (int q = 0; q < 300; q++) {
+        // mostly near a cluster, sometimes anywhere
+        uint64_t query = q % 5 == 0 ? rng() : near_hash(rng, centers[rng() % centers.size()], static_cast<int>(rng() % 16));
+        for (size_t max_results : { 1, 3, 10, 200 }) {
+            for (int max_distance : { 0, 4, 12, 64 }) {
+                auto expected = brute_force(refs, query, max_results, max_distance);
+                auto actual = classifier.Nearest(query, max_results, max_distance);
+                ASSERT_EQ(actual.size(), expected.size()) << "query " << q << " max_results " << max_results << " max_distance " << max_distance;
+                for (size_t i = 0; i < expected.size(); i++) {
+                    EXPECT_EQ(actual[i].label, expected[i].label) << "query " << q << " result " << i;
+                    EXPECT_EQ(actual[i].distance, expected[i].distance) << "query " << q << " result " << i;
+                }
+            }
+        }
+    }
+}
+
+// Equal hashes go down the distance 0 edge; all of them stay findable.
+TEST(ScreenClassifier, DuplicateHashes)
+{
+    ScreenClassifier classifier;
+    classifier.Add(0x1234, "a");
+    classifier.Add(0x1234, "b");
+    classifier.Add(0x1234, "a");
+    classifier.Add(0x1235, "c");
+    auto matches = classifier.Nearest(0x1234, 5, 1);
+    ASSERT_EQ(matches.size(), 3u);
+    EXPECT_EQ(matches[0].label, "a");
+    EXPECT_EQ(matches[1].label, "b");
+    EXPECT_EQ(matches[2].label, "c");
+    EXPECT_EQ(matches[2].distance, 1);
+}
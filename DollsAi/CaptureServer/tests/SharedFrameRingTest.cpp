@@ -0,0 +1,207 @@
+#include "SharedFrameRing.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // every byte of the frame is id & 0xff, so a torn copy shows
+    Frame filled_frame(FramePool& pool, int width, int height, uint64_t id)
+    {
+        Frame frame = pool.Acquire(width, height, PixelFormat::Gray);
+        for (int y = 0; y < height; y++) {
+            memset(frame.Row(y), static_cast<int>(id & 0xff), width);
+        }
+        frame.SetId(id);
+        return frame;
+    }
+}
+
+TEST(SharedFrameRing, PublishAndRead)
+{
+    auto pool = FramePool::Create();
+    SharedFrameRing ring(test::unique_name("DollsAiTest"), 4, 64 * 64 * 4);
+    SharedFrameReader reader(ring.Name());
+
+    SharedFrameReader::View view;
+    EXPECT_FALSE(reader.TryReadNext(view));
+
+    Frame frame = test::random_frame(*pool, 50, 30, PixelFormat::BGR, 1);
+    frame.SetId(42);
+    auto published = ring.Publish(frame);
+    EXPECT_EQ(published.seq, 1u);
+    EXPECT_EQ(published.slot, 0u);
+
+    ASSERT_TRUE(reader.TryReadNext(view));
+    EXPECT_EQ(view.seq, 1u);
+    EXPECT_EQ(view.frame_id, 42u);
+    EXPECT_EQ(view.width, 50);
+    EXPECT_EQ(view.height, 30);
+    EXPECT_EQ(view.stride, frame.Stride());
+    EXPECT_EQ(view.format, PixelFormat::BGR);
+    EXPECT_EQ(memcmp(view.data, frame.Data(), frame.Stride() * frame.Height()), 0);
+    EXPECT_TRUE(reader.Validate(view));
+    EXPECT_FALSE(reader.TryReadNext(view));
+    EXPECT_EQ(reader.Skipped(), 0u);
+}
+
+TEST(SharedFrameRing, FrameTooLarge)
+{
+    auto pool = FramePool::Create();
+    SharedFrameRing ring(test::unique_name("DollsAiTest"), 2, 1024);
+    EXPECT_THROW(ring.Publish(filled_frame(*pool, 64, 64, 1)), std::runtime_error);
+}
+
+// A live ring is never taken over, in this process or another one.
+TEST(SharedFrameRing, NameInUse)
+{
+    auto pool = FramePool::Create();
+    const std::string name = test::unique_name("DollsAiTest");
+    auto ring = std::make_unique<SharedFrameRing>(name, 2, 1024);
+    EXPECT_THROW(SharedFrameRing(name, 2, 1024), std::runtime_error);
+
+    // the first ring still has its name and its readers
+    ring->Publish(filled_frame(*pool, 16, 16, 1));
+    SharedFrameReader reader(name);
+    SharedFrameReader::View view;
+    ASSERT_TRUE(reader.TryReadNext(view));
+    EXPECT_EQ(view.frame_id, 1u);
+
+    ring.reset();
+    EXPECT_THROW(SharedFrameReader{ name }, std::runtime_error);
+    EXPECT_NO_THROW(SharedFrameRing(name, 2, 1024));
+}
+
+#ifndef _WIN32
+// A region whose owner_pid is no longer running is what a crashed server leaves.
+TEST(SharedFrameRing, ReplacesStaleRing)
+{
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        _exit(0);
+    }
+    ASSERT_EQ(waitpid(child, nullptr, 0), child);
+
+    const std::string name = test::unique_name("DollsAiTest");
+    const std::string path = "/" + name;
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, 4096), 0);
+    void* p = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(p, MAP_FAILED);
+    auto stale = new (p) SharedRingHeader();
+    stale->owner_pid = static_cast<uint32_t>(child);
+    munmap(p, 4096);
+
+    auto pool = FramePool::Create();
+    SharedFrameRing ring(name, 2, 1024);
+    ring.Publish(filled_frame(*pool, 16, 16, 7));
+    SharedFrameReader reader(name);
+    SharedFrameReader::View view;
+    ASSERT_TRUE(reader.TryReadNext(view));
+    EXPECT_EQ(view.frame_id, 7u);
+}
+#endif
+
+// A reader lapped by the producer jumps to the oldest slot still intact and counts the rest.
+TEST(SharedFrameRing, LappedReaderSkips)
+{
+    auto pool = FramePool::Create();
+    // 16 x 16 gray frames, rows padded to FramePool::kAlign
+    SharedFrameRing ring(test::unique_name("DollsAiTest"), 2, FramePool::kAlign * 16);
+    SharedFrameReader next_reader(ring.Name());
+    SharedFrameReader latest_reader(ring.Name());
+    for (uint64_t id = 1; id <= 5; id++) {
+        ring.Publish(filled_frame(*pool, 16, 16, id));
+    }
+
+    SharedFrameReader::View view;
+    ASSERT_TRUE(next_reader.TryReadNext(view));
+    EXPECT_EQ(view.frame_id, 4u);
+    EXPECT_EQ(next_reader.Skipped(), 3u);
+    ASSERT_TRUE(next_reader.TryReadNext(view));
+    EXPECT_EQ(view.frame_id, 5u);
+    EXPECT_FALSE(next_reader.TryReadNext(view));
+
+    ASSERT_TRUE(latest_reader.TryReadLatest(view));
+    EXPECT_EQ(view.frame_id, 5u);
+    EXPECT_EQ(latest_reader.Skipped(), 4u);
+    EXPECT_EQ(latest_reader.Cursor(), 5u);
+}
+
+// Validate turns false as soon as the slot is reused, however the pixels look.
+TEST(SharedFrameRing, ValidateDetectsOverwrite)
+{
+    auto pool = FramePool::Create();
+    SharedFrameRing ring(test::unique_name("DollsAiTest"), 2, FramePool::kAlign * 16);
+    SharedFrameReader reader(ring.Name());
+    ring.Publish(filled_frame(*pool, 16, 16, 1));
+
+    SharedFrameReader::View view;
+    ASSERT_TRUE(reader.TryReadNext(view));
+    ring.Publish(filled_frame(*pool, 16, 16, 2));
+    EXPECT_TRUE(reader.Validate(view));
+    // publish 3 goes to slot 0 again
+    ring.Publish(filled_frame(*pool, 16, 16, 3));
+    EXPECT_FALSE(reader.Validate(view));
+}
+
+// A reader racing the producer: every copy that Validate accepts is one whole frame.
+TEST(SharedFrameRing, NoTornReads)
+{
+    constexpr int kSide = 64;
+    constexpr uint64_t kFrames = 20000;
+    auto pool = FramePool::Create();
+    SharedFrameRing ring(test::unique_name("DollsAiTest"), 2, kSide * kSide * 2);
+    SharedFrameReader reader(ring.Name());
+    const size_t stride = pool->Acquire(kSide, kSide, PixelFormat::Gray).Stride();
+
+    std::atomic<bool> done = false;
+    std::thread producer([&]() {
+        for (uint64_t id = 1; id <= kFrames; id++) {
+            ring.Publish(filled_frame(*pool, kSide, kSide, id));
+        }
+        done = true;
+    });
+
+    uint64_t accepted = 0;
+    uint64_t torn = 0;
+    std::vector<uint8_t> copy(kSide * kSide);
+    SharedFrameReader::View view;
+    while (!done) {
+        if (!reader.TryReadLatest(view)) {
+            continue;
+        }
+        // the size is known, a torn header must not make the copy run off the slot
+        for (int y = 0; y < kSide; y++) {
+            memcpy(copy.data() + y * kSide, view.data + y * stride, kSide);
+        }
+        if (!reader.Validate(view)) {
+            continue;
+        }
+        accepted++;
+        for (uint8_t b : copy) {
+            if (b != static_cast<uint8_t>(view.frame_id & 0xff)) {
+                torn++;
+                break;
+            }
+        }
+    }
+    producer.join();
+    EXPECT_GT(accepted, 0u);
+    EXPECT_EQ(torn, 0u);
+}
@@ -0,0 +1,122 @@
+#include "SocketServer.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+    int connect_unix(const std::string& path)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // A server on its own thread whose handler keeps every request unanswered,
+    // like a worker pool that has not got to them yet.
+    class HeldRequests
+    {
+    public:
+        HeldRequests()
+            : m_path((fs::temp_directory_path() / (test::unique_name("dollsai_test") + ".sock")).u8string()),
+            m_server("unix:" + m_path, [this](const std::shared_ptr<SocketClient>& client, Request& request) {
+                client->AddPending();
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_held.emplace_back(client, request.body);
+                m_cond.notify_all();
+            }),
+            m_loop([this]() { m_server.Run(); })
+        {
+        }
+        ~HeldRequests()
+        {
+            m_server.Stop();
+            m_loop.join();
+        }
+
+        const std::string& Path() const { return m_path; }
+
+        // requests handed to the handler, after waiting up to a second for count
+        size_t WaitFor(size_t count)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait_for(lock, std::chrono::seconds(1), [&]() { return m_held.size() >= count; });
+            return m_held.size();
+        }
+
+        // replies to request i
+        void Answer(size_t i)
+        {
+            std::shared_ptr<SocketClient> client;
+            nlohmann::json body;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                client = m_held[i].first;
+                body = m_held[i].second;
+            }
+            client->Write({ {"result", nullptr}, {"id", body["id"]} });
+            client->RemovePending();
+        }
+
+    private:
+        std::string m_path;
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::vector<std::pair<std::shared_ptr<SocketClient>, nlohmann::json>> m_held;
+        SocketServer m_server;
+        std::thread m_loop;
+    };
+}
+
+// A client with kMaxPending unanswered requests is not read from until one is answered,
+// even when more requests already arrived in the same read.
+TEST(SocketServer, PendingLimit)
+{
+    HeldRequests server;
+    int fd = connect_unix(server.Path());
+    ASSERT_NE(fd, -1);
+    const size_t total = SocketClient::kMaxPending * 2 + 10;
+    std::string requests;
+    for (size_t i = 0; i < total; i++) {
+        requests += "{\"cmd\": \"x\", \"id\": " + std::to_string(i) + "}\n\n";
+    }
+    ASSERT_EQ(send(fd, requests.data(), requests.size(), 0), static_cast<ssize_t>(requests.size()));
+
+    EXPECT_EQ(server.WaitFor(SocketClient::kMaxPending), SocketClient::kMaxPending);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(server.WaitFor(0), SocketClient::kMaxPending);
+
+    // each answer lets exactly one more in
+    for (size_t i = 0; i < 5; i++) {
+        server.Answer(i);
+    }
+    EXPECT_EQ(server.WaitFor(SocketClient::kMaxPending + 5), SocketClient::kMaxPending + 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(server.WaitFor(0), SocketClient::kMaxPending + 5);
+
+    for (size_t i = 5; i < total; i++) {
+        ASSERT_GT(server.WaitFor(i + 1), i);
+        server.Answer(i);
+    }
+    EXPECT_EQ(server.WaitFor(total), total);
+    close(fd);
+}
+#endif
@@ -0,0 +1,80 @@
+#include "TaskPool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+TEST(TaskPool, EveryIndexOnce)
+{
+    TaskPool pool(3);
+    EXPECT_EQ(pool.Concurrency(), 4u);
+    for (size_t count : { 0, 1, 2, 5, 16, 1000 }) {
+        std::vector<std::atomic<int>> calls(count);
+        pool.ParallelFor(count, [&](size_t i) { calls[i]++; });
+        for (size_t i = 0; i < count; i++) {
+            ASSERT_EQ(calls[i].load(), 1) << "count " << count << " index " << i;
+        }
+    }
+}
+
+TEST(TaskPool, ParallelMapKeepsOrder)
+{
+    TaskPool pool(2);
+    auto squares = parallel_map<size_t>(pool, 100, [](size_t i) { return i * i; });
+    ASSERT_EQ(squares.size(), 100u);
+    for (size_t i = 0; i < squares.size(); i++) {
+        EXPECT_EQ(squares[i], i * i);
+    }
+}
+
+// With several failing calls the lowest index wins, whichever thread got there first,
+// and the pool keeps working afterwards.
+TEST(TaskPool, RethrowsLowestIndex)
+{
+    TaskPool pool(3);
+    for (int round = 0; round < 20; round++) {
+        try {
+            pool.ParallelFor(64, [](size_t i) {
+                if (i == 7 || i == 40 || i == 63) {
+                    throw std::runtime_error(std::to_string(i));
+                }
+            });
+            FAIL() << "no exception";
+        }
+        catch (std::runtime_error& e) {
+            EXPECT_STREQ(e.what(), "7");
+        }
+    }
+    std::atomic<size_t> sum = 0;
+    pool.ParallelFor(10, [&](size_t i) { sum += i; });
+    EXPECT_EQ(sum.load(), 45u);
+}
+
+// A task may run a ParallelFor of its own; the waiting threads run the inner tasks,
+// so nesting deeper than the thread count does not deadlock.
+TEST(TaskPool, Nested)
+{
+    TaskPool pool(2);
+    std::atomic<size_t> leaves = 0;
+    pool.ParallelFor(8, [&](size_t) {
+        pool.ParallelFor(8, [&](size_t) {
+            pool.ParallelFor(4, [&](size_t) { leaves++; });
+        });
+    });
+    EXPECT_EQ(leaves.load(), 8u * 8 * 4);
+}
+
+TEST(TaskPool, NestedException)
+{
+    TaskPool pool(2);
+    EXPECT_THROW(pool.ParallelFor(4, [&](size_t i) {
+        pool.ParallelFor(4, [&](size_t j) {
+            if (i == 2 && j == 3) {
+                throw std::invalid_argument("inner");
+            }
+        });
+    }), std::invalid_argument);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "TemplateMatch.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace test {
+    // What TemplateBench searches and TemplateMatchTest checks recall on: a 1080p BGR
+    // image of smooth random blobs, and templates of 24 to 64 pixels cut out of it.
+    // Each template's true match is where it was cut out.
+    struct TemplateCorpus
+    {
+        cv::Mat image;
+        std::vector<std::shared_ptr<const Template>> templates;
+        std::vector<cv::Point> positions;
+    };
+
+    // the same image and the same first templates for every count
+    inline TemplateCorpus template_corpus(size_t count)
+    {
+        constexpr int kWidth = 1920;
+        constexpr int kHeight = 1080;
+        // random colors every 8 pixels, interpolated between: detail that survives
+        // the coarse levels, unlike pixel noise, and repeats nowhere, unlike a gradient
+        constexpr int kGrid = 8;
+        std::mt19937 rng(7);
+        cv::Mat coarse(kHeight / kGrid, kWidth / kGrid, CV_8UC3);
+        for (int y = 0; y < coarse.rows; y++) {
+            uint8_t* row = coarse.ptr<uint8_t>(y);
+            for (int i = 0; i < coarse.cols * 3; i++) {
+                row[i] = static_cast<uint8_t>(rng());
+            }
+        }
+        TemplateCorpus corpus;
+        cv::resize(coarse, corpus.image, cv::Size(kWidth, kHeight), 0, 0, cv::INTER_LINEAR);
+        for (size_t i = 0; i < count; i++) {
+            int w = 24 + static_cast<int>(rng() % 41);
+            int h = 24 + static_cast<int>(rng() % 41);
+            int x = static_cast<int>(rng() % (kWidth - w));
+            int y = static_cast<int>(rng() % (kHeight - h));
+            corpus.templates.push_back(std::make_shared<const Template>(corpus.image(cv::Rect(x, y, w, h)).clone()));
+            corpus.positions.emplace_back(x, y);
+        }
+        return corpus;
+    }
+}
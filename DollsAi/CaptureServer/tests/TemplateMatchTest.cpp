@@ -0,0 +1,65 @@
+#include "TemplateMatch.h"
+#include "TaskPool.h"
+#include "TemplateCorpus.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+namespace {
+    // a full resolution search takes long, the first templates of the bench corpus
+    constexpr size_t kTemplates = 40;
+
+    // a match within a pixel of where the template was cut out
+    bool found(const std::vector<MatchResult>& matches, cv::Point position)
+    {
+        for (const auto& match : matches) {
+            if (std::abs(match.x - position.x) <= 1 && std::abs(match.y - position.y) <= 1) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// The coarse-to-fine search finds every template the full resolution search finds,
+// on the corpus TemplateBench times.
+TEST(TemplateMatch, PyramidRecallEqualsFullResolution)
+{
+    auto corpus = test::template_corpus(kTemplates);
+    MatchOptions full;
+    full.levels = 1;
+    MatchOptions pyramid;
+    size_t found_full = 0;
+    size_t found_pyramid = 0;
+    for (size_t i = 0; i < corpus.templates.size(); i++) {
+        const Template& templ = *corpus.templates[i];
+        bool by_full = found(find_template(corpus.image, templ, full), corpus.positions[i]);
+        bool by_pyramid = found(find_template(corpus.image, templ, pyramid), corpus.positions[i]);
+        EXPECT_EQ(by_pyramid, by_full) << "template " << i << " " << templ.Width() << "x" << templ.Height()
+            << " at " << corpus.positions[i].x << "," << corpus.positions[i].y << " levels " << templ.Levels();
+        found_full += by_full;
+        found_pyramid += by_pyramid;
+    }
+    EXPECT_EQ(found_full, corpus.templates.size());
+    EXPECT_EQ(found_pyramid, found_full);
+}
+
+// Splitting the search over a pool changes nothing in the results.
+TEST(TemplateMatch, PoolGivesSameMatches)
+{
+    auto corpus = test::template_corpus(8);
+    TaskPool pool(3);
+    MatchOptions pooled;
+    pooled.pool = &pool;
+    for (size_t i = 0; i < corpus.templates.size(); i++) {
+        auto alone = find_template(corpus.image, *corpus.templates[i], MatchOptions());
+        auto split = find_template(corpus.image, *corpus.templates[i], pooled);
+        ASSERT_EQ(split.size(), alone.size()) << "template " << i;
+        for (size_t j = 0; j < alone.size(); j++) {
+            EXPECT_EQ(split[j].x, alone[j].x);
+            EXPECT_EQ(split[j].y, alone[j].y);
+            EXPECT_DOUBLE_EQ(split[j].score, alone[j].score);
+        }
+    }
+}
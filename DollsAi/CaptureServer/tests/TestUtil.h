@@ -0,0 +1,125 @@
+#pragma once
+
+#include "FramePool.h"
+#include "FrameSource.h"
+#include "MemoryStream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string.h>
+#include <vector>
+
+namespace test {
+    // pseudo random bytes, the same for the same seed
+    inline std::vector<uint8_t> random_bytes(size_t size, uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::vector<uint8_t> bytes(size);
+        for (auto& b : bytes) {
+            b = static_cast<uint8_t>(rng());
+        }
+        return bytes;
+    }
+
+    // shared memory name no other test run uses
+    inline std::string unique_name(const std::string& prefix)
+    {
+        return prefix + "_" + std::to_string(std::random_device()());
+    }
+
+    inline Frame random_frame(FramePool& pool, int width, int height, PixelFormat format, uint32_t seed)
+    {
+        Frame frame = pool.Acquire(width, height, format);
+        const size_t row_bytes = static_cast<size_t>(width) * bytes_per_pixel(format);
+        auto bytes = random_bytes(row_bytes * height, seed);
+        for (int y = 0; y < height; y++) {
+            memcpy(frame.Row(y), bytes.data() + y * row_bytes, row_bytes);
+        }
+        return frame;
+    }
+
+    // same size, format and pixels; the stride (padding) may differ
+    inline bool same_pixels(const Frame& a, const Frame& b)
+    {
+        if (a.Width() != b.Width() || a.Height() != b.Height() || a.Format() != b.Format()) {
+            return false;
+        }
+        const size_t row_bytes = static_cast<size_t>(a.Width()) * bytes_per_pixel(a.Format());
+        for (int y = 0; y < a.Height(); y++) {
+            if (memcmp(a.Row(y), b.Row(y), row_bytes) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Gray frames in which every pixel is the next value of a script, one per
+    // WaitNextFrame, then none until interrupted. With fps > 0 the frames come at that
+    // rate, like a capture would; with 0 as fast as they are taken.
+    class ScriptedSource : public FrameSource
+    {
+    public:
+        static constexpr int kWidth = 64;
+        static constexpr int kHeight = 32;
+
+        explicit ScriptedSource(std::vector<uint8_t> script, bool lossless = false, double fps = 0)
+            : m_script(std::move(script)), m_lossless(lossless),
+            m_interval(fps > 0 ? std::chrono::duration_cast<FrameClock::duration>(std::chrono::duration<double>(1.0 / fps))
+                : FrameClock::duration::zero())
+        {
+        }
+
+        Frame WaitNextFrame(std::chrono::milliseconds timeout) override
+        {
+            if (m_next == m_script.size()) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait_for(lock, timeout, [this]() { return m_interrupted; });
+                return Frame();
+            }
+            if (m_interval != FrameClock::duration::zero()) {
+                // a late frame does not make the next ones come sooner
+                m_due = (std::max)(m_due, FrameClock::now());
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_cond.wait_until(lock, m_due, [this]() { return m_interrupted; })) {
+                    return Frame();
+                }
+                m_due += m_interval;
+            }
+            Frame frame = m_pool->Acquire(kWidth, kHeight, PixelFormat::Gray);
+            for (int y = 0; y < kHeight; y++) {
+                memset(frame.Row(y), m_script[m_next], kWidth);
+            }
+            frame.SetId(++m_next);
+            frame.SetTimestamp(FrameClock::now());
+            return frame;
+        }
+
+        FramePool::Stats GetPoolStats() const override { return m_pool->GetStats(); }
+
+        void Interrupt() override
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_interrupted = true;
+            }
+            m_cond.notify_all();
+        }
+
+        bool Lossless() const override { return m_lossless; }
+
+    private:
+        std::vector<uint8_t> m_script;
+        const bool m_lossless;
+        const FrameClock::duration m_interval;
+        // when the next frame is made, with an interval
+        FrameClock::time_point m_due;
+        size_t m_next = 0;
+        std::shared_ptr<FramePool> m_pool = FramePool::Create();
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        bool m_interrupted = false;
+    };
+}
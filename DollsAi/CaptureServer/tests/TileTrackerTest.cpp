@@ -0,0 +1,144 @@
+#include "TileTracker.h"
+#include "TestUtil.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+namespace {
+    constexpr int kWidth = 200;
+    constexpr int kHeight = 100;
+
+    // a copy of frame with a new id
+    Frame next_frame(FramePool& pool, const Frame& frame, uint64_t id)
+    {
+        Frame copy = pool.Acquire(frame.Width(), frame.Height(), frame.Format());
+        for (int y = 0; y < frame.Height(); y++) {
+            memcpy(copy.Row(y), frame.Row(y), static_cast<size_t>(frame.Width()) * bytes_per_pixel(frame.Format()));
+        }
+        copy.SetId(id);
+        return copy;
+    }
+
+    void touch(Frame& frame, int x, int y)
+    {
+        frame.Row(y)[x * bytes_per_pixel(frame.Format())] ^= 0xff;
+    }
+
+    bool covers(const TileTracker::Rect& r, int x, int y)
+    {
+        return x >= r.x && x < r.x + r.width && y >= r.y && y < r.y + r.height;
+    }
+}
+
+TEST(TileTracker, DuplicateFrames)
+{
+    auto pool = FramePool::Create();
+    TileTracker tiles(32);
+    Frame frame = test::random_frame(*pool, kWidth, kHeight, PixelFormat::BGR, 1);
+    frame.SetId(1);
+    // the first frame has nothing to be a duplicate of
+    EXPECT_FALSE(tiles.Update(frame));
+    EXPECT_TRUE(tiles.Update(next_frame(*pool, frame, 2)));
+    EXPECT_EQ(tiles.FrameId(), 2u);
+    EXPECT_TRUE(tiles.ChangedSince(1, 16).empty());
+}
+
+TEST(TileTracker, ChangedTilesOnly)
+{
+    auto pool = FramePool::Create();
+    TileTracker tiles(32);
+    Frame frame = test::random_frame(*pool, kWidth, kHeight, PixelFormat::BGRA, 2);
+    frame.SetId(1);
+    tiles.Update(frame);
+
+    // one pixel in tile (1, 0), one in the clipped last column and row (6, 3)
+    Frame second = next_frame(*pool, frame, 2);
+    touch(second, 40, 5);
+    touch(second, 199, 99);
+    EXPECT_FALSE(tiles.Update(second));
+    Frame third = next_frame(*pool, second, 3);
+    touch(third, 100, 50);
+    tiles.Update(third);
+
+    bool full = true;
+    auto rects = tiles.ChangedSince(1, 16, &full);
+    EXPECT_FALSE(full);
+    ASSERT_EQ(rects.size(), 3u);
+    int covered = 0;
+    for (const auto& r : rects) {
+        covered += covers(r, 40, 5) + covers(r, 199, 99) + covers(r, 100, 50);
+        // every rect is one tile, clipped to the frame
+        EXPECT_EQ(r.x % 32, 0);
+        EXPECT_EQ(r.y % 32, 0);
+        EXPECT_LE(r.x + r.width, kWidth);
+        EXPECT_LE(r.y + r.height, kHeight);
+    }
+    EXPECT_EQ(covered, 3);
+    EXPECT_EQ(tiles.ChangedSince(1, 16)[0].width, 32);
+
+    // only what changed after frame 2
+    rects = tiles.ChangedSince(2, 16);
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_TRUE(covers(rects[0], 100, 50));
+    EXPECT_TRUE(tiles.ChangedSince(3, 16).empty());
+}
+
+TEST(TileTracker, MergesToMaxRects)
+{
+    auto pool = FramePool::Create();
+    TileTracker tiles(8);
+    Frame frame = test::random_frame(*pool, 128, 128, PixelFormat::Gray, 3);
+    frame.SetId(1);
+    tiles.Update(frame);
+    Frame second = next_frame(*pool, frame, 2);
+    // a checkerboard of changed tiles, far more runs than allowed
+    for (int ty = 0; ty < 16; ty++) {
+        for (int tx = ty % 2; tx < 16; tx += 2) {
+            touch(second, tx * 8, ty * 8);
+        }
+    }
+    tiles.Update(second);
+    auto rects = tiles.ChangedSince(1, 4);
+    EXPECT_LE(rects.size(), 4u);
+    for (int ty = 0; ty < 16; ty++) {
+        for (int tx = ty % 2; tx < 16; tx += 2) {
+            bool hit = false;
+            for (const auto& r : rects) {
+                hit = hit || covers(r, tx * 8, ty * 8);
+            }
+            EXPECT_TRUE(hit) << "tile " << tx << "," << ty;
+        }
+    }
+}
+
+// History older than the tracker's (or before a size change) is the whole frame.
+TEST(TileTracker, FullAfterReset)
+{
+    auto pool = FramePool::Create();
+    TileTracker tiles(32);
+    EXPECT_TRUE(tiles.ChangedSince(0, 16).empty());
+
+    Frame frame = test::random_frame(*pool, kWidth, kHeight, PixelFormat::BGR, 4);
+    frame.SetId(5);
+    tiles.Update(frame);
+    bool full = false;
+    auto rects = tiles.ChangedSince(2, 16, &full);
+    EXPECT_TRUE(full);
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].width, kWidth);
+    EXPECT_EQ(rects[0].height, kHeight);
+
+    Frame smaller = test::random_frame(*pool, 64, 64, PixelFormat::BGR, 5);
+    smaller.SetId(6);
+    EXPECT_FALSE(tiles.Update(smaller));
+    rects = tiles.ChangedSince(5, 16, &full);
+    EXPECT_TRUE(full);
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].width, 64);
+}
+
+TEST(TileTracker, RejectsTinyTiles)
+{
+    EXPECT_THROW(TileTracker(2), std::invalid_argument);
+}